@@ -0,0 +1,210 @@
+#include "stdafx.h"
+#include "BrickFaces.h"
+#include <algorithm>
+#include <chrono>
+
+static_assert(BrickWidth == 4 && BrickHeight == 4 && BrickDepth == 4, "The face planes are shifted assuming 4x4x4 bricks.");
+static_assert(FaceLists::MaxEntriesPerBrick < (1u << cFaceCountBits), "List lengths must fit below cFaceCountBits.");
+static_assert(BrickCount * FaceLists::EntriesPerBlock <= FaceLists::MaxEntries, "A block per brick must fit above cFaceCountBits.");
+
+static const UINT WordsPerBlock = FaceLists::EntriesPerBlock / 2;
+
+// Voxels on each outer layer of a brick's occupancy mask.
+static const UINT64 LayerX0 = 0x1111111111111111ull;
+static const UINT64 LayerX3 = 0x8888888888888888ull;
+static const UINT64 LayerY0 = 0x000f000f000f000full;
+static const UINT64 LayerY3 = 0xf000f000f000f000ull;
+
+void FaceLists::Clear()
+{
+	std::fill(mTable.begin(), mTable.end(), 0);
+	mWords.clear();
+	for (std::vector<UINT>& freeBlocks : mFreeBlocks)
+	{
+		freeBlocks.clear();
+	}
+	mTotalCount = 0;
+	mListCount = 0;
+	mOverflowed = false;
+}
+
+void FaceLists::Write(UINT brick, const UINT16* entries, UINT count)
+{
+	UINT& entry = mTable[brick];
+	const UINT oldCount = entry & ((1u << cFaceCountBits) - 1);
+	const UINT oldBlocks = (oldCount + EntriesPerBlock - 1) / EntriesPerBlock;
+	const UINT blocks = (count + EntriesPerBlock - 1) / EntriesPerBlock;
+	UINT first = entry >> cFaceCountBits;
+
+	if (blocks != oldBlocks)
+	{
+		if (oldBlocks != 0)
+		{
+			mFreeBlocks[oldBlocks].push_back(first);
+		}
+
+		first = 0;
+		if (blocks != 0)
+		{
+			std::vector<UINT>& freeBlocks = mFreeBlocks[blocks];
+			if (!freeBlocks.empty())
+			{
+				first = freeBlocks.back();
+				freeBlocks.pop_back();
+			}
+			else if (WordCount() * 2 < MaxEntries)
+			{
+				first = WordCount() * 2;
+				mWords.resize(mWords.size() + blocks * WordsPerBlock);
+			}
+			else
+			{
+				// The list could not be addressed from the table.
+				mOverflowed = true;
+				count = 0;
+			}
+		}
+	}
+
+	UINT* words = mWords.empty() ? nullptr : &mWords[first / 2];
+	for (UINT n = 0; n < count; n += 2)
+	{
+		words[n / 2] = entries[n] | (n + 1 < count ? UINT(entries[n + 1]) << 16 : 0);
+	}
+
+	entry = (first << cFaceCountBits) | count;
+	mTotalCount += count;
+	mTotalCount -= oldCount;
+	mListCount += (count != 0 ? 1 : 0);
+	mListCount -= (oldCount != 0 ? 1 : 0);
+}
+
+const UINT* FaceLists::GetList(UINT brick, UINT& wordCount) const
+{
+	const UINT count = GetCount(brick);
+	if (count == 0)
+	{
+		wordCount = 0;
+		return nullptr;
+	}
+
+	wordCount = (count + 1) / 2;
+	return &mWords[(mTable[brick] >> cFaceCountBits) / 2];
+}
+
+void BrickFaces::Build(const BrickOccupancy& occupancy)
+{
+	mLists.Clear();
+	for (UINT brick = 0; brick < BrickCount; brick++)
+	{
+		BuildPlanes(occupancy, brick);
+		WriteList(brick);
+	}
+}
+
+void BrickFaces::UpdateBricks(const BrickOccupancy& occupancy, const std::vector<UINT>& bricks, std::vector<UINT>& changed)
+{
+	const UINT slice = cWidthInBricks*cHeightInBricks;
+	std::vector<UINT> visit;
+	visit.reserve(bricks.size() * 7);
+
+	for (UINT brick : bricks)
+	{
+		XMUINT3 b = GetBrickCoords(brick);
+		visit.push_back(brick);
+		if (b.x > 0) visit.push_back(brick - 1);
+		if (b.x + 1 < cWidthInBricks) visit.push_back(brick + 1);
+		if (b.y > 0) visit.push_back(brick - cWidthInBricks);
+		if (b.y + 1 < cHeightInBricks) visit.push_back(brick + cWidthInBricks);
+		if (b.z > 0) visit.push_back(brick - slice);
+		if (b.z + 1 < cDepthInBricks) visit.push_back(brick + slice);
+	}
+
+	std::sort(visit.begin(), visit.end());
+	visit.erase(std::unique(visit.begin(), visit.end()), visit.end());
+
+	for (UINT brick : visit)
+	{
+		if (BuildPlanes(occupancy, brick))
+		{
+			WriteList(brick);
+			changed.push_back(brick);
+		}
+	}
+}
+
+bool BrickFaces::BuildPlanes(const BrickOccupancy& occupancy, UINT brick)
+{
+	const UINT slice = cWidthInBricks*cHeightInBricks;
+	const std::vector<UINT64>& masks = occupancy.mMasks;
+	const XMUINT3 b = GetBrickCoords(brick);
+	const UINT64 m = masks[brick];
+
+	// Occupancy of the neighbouring bricks; outside the volume is air.
+	const UINT64 nx = b.x > 0 ? masks[brick - 1] : 0;
+	const UINT64 px = b.x + 1 < cWidthInBricks ? masks[brick + 1] : 0;
+	const UINT64 ny = b.y > 0 ? masks[brick - cWidthInBricks] : 0;
+	const UINT64 py = b.y + 1 < cHeightInBricks ? masks[brick + cWidthInBricks] : 0;
+	const UINT64 nz = b.z > 0 ? masks[brick - slice] : 0;
+	const UINT64 pz = b.z + 1 < cDepthInBricks ? masks[brick + slice] : 0;
+
+	// Shift each voxel's neighbour into its bit, taking the outer layer from the
+	// neighbouring brick, and keep the occupied voxels whose neighbour is air.
+	UINT64 planes[FaceCount];
+	planes[FaceNegZ] = m & ~((m << 16) | (nz >> 48));
+	planes[FacePosZ] = m & ~((m >> 16) | (pz << 48));
+	planes[FacePosY] = m & ~(((m >> 4) & ~LayerY3) | ((py << 12) & LayerY3));
+	planes[FaceNegY] = m & ~(((m << 4) & ~LayerY0) | ((ny >> 12) & LayerY0));
+	planes[FaceNegX] = m & ~(((m << 1) & ~LayerX0) | ((nx >> 3) & LayerX0));
+	planes[FacePosX] = m & ~(((m >> 1) & ~LayerX3) | ((px << 3) & LayerX3));
+
+	UINT64* stored = &mPlanes[brick * FaceCount];
+	if (memcmp(stored, planes, sizeof(planes)) == 0)
+	{
+		return false;
+	}
+
+	memcpy(stored, planes, sizeof(planes));
+	return true;
+}
+
+void BrickFaces::WriteList(UINT brick)
+{
+	UINT16 faces[FaceLists::MaxEntriesPerBrick];
+	UINT count = 0;
+
+	const UINT64* planes = &mPlanes[brick * FaceCount];
+	for (UINT face = 0; face < FaceCount; face++)
+	{
+		for (UINT64 bits = planes[face]; bits != 0; bits &= bits - 1)
+		{
+			faces[count++] = static_cast<UINT16>(GetLowestBit(bits) | (face << 6));
+		}
+	}
+
+	mLists.Write(brick, faces, count);
+}
+
+UINT BrickFaces::GetVoxelFaces(UINT brick, UINT voxel) const
+{
+	const UINT64* planes = &mPlanes[brick * FaceCount];
+	UINT mask = 0;
+	for (UINT face = 0; face < FaceCount; face++)
+	{
+		mask |= UINT((planes[face] >> voxel) & 1) << face;
+	}
+
+	return mask;
+}
+
+double BrickFaces::Benchmark(const BrickOccupancy& occupancy, UINT iterations)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+	for (UINT i = 0; i < iterations; i++)
+	{
+		Build(occupancy);
+	}
+	std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+	return (double(BrickCount) * iterations) / elapsed.count();
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include "VoxelTypes.h"
+#include "BrickOccupancy.h"
+
+// Faces in the order of the vertex table in shaders.hlsl.
+enum VoxelFace
+{
+	FaceNegZ,
+	FacePosZ,
+	FacePosY,
+	FaceNegY,
+	FaceNegX,
+	FacePosX,
+	FaceCount
+};
+
+// Lists of 16 bit entries per brick, packed two to a word. Lists live in blocks
+// of EntriesPerBlock entries and are moved, like the blocks of a BrickPool, when
+// they need a different number of blocks.
+//
+// The GPU copy is mTable followed by mWords. A table entry holds the brick's
+// first entry (counted from the start of mWords) above cFaceCountBits and its
+// entry count below, so lists can only start within the first MaxEntries. A
+// list that would start beyond them is dropped and Fits() turns false, and the
+// lists must then not be uploaded.
+class FaceLists
+{
+public:
+	static const UINT EntriesPerBlock = 32;
+	static const UINT MaxEntriesPerBrick = VoxelsPerBrick * FaceCount;
+	static const UINT MaxEntries = 1u << (32 - cFaceCountBits);
+
+	FaceLists() :
+		mTable(BrickCount, 0),
+		mTotalCount(0),
+		mListCount(0),
+		mOverflowed(false)
+	{}
+
+	// Every list empty, with no blocks.
+	void Clear();
+
+	void Write(UINT brick, const UINT16* entries, UINT count);
+
+	UINT GetCount(UINT brick) const { return mTable[brick] & ((1u << cFaceCountBits) - 1); }
+	UINT64 GetTotalCount() const { return mTotalCount; }
+
+	// The number of bricks with a non-empty list.
+	UINT GetListCount() const { return mListCount; }
+
+	// The brick's list and the number of words it covers, or nullptr when it is empty.
+	const UINT* GetList(UINT brick, UINT& wordCount) const;
+
+	UINT WordCount() const { return static_cast<UINT>(mWords.size()); }
+
+	// False once a list has been dropped for want of an addressable first entry.
+	bool Fits() const { return !mOverflowed; }
+
+	std::vector<UINT>	mTable;
+	std::vector<UINT>	mWords;
+
+private:
+	std::vector<UINT>	mFreeBlocks[MaxEntriesPerBrick / EntriesPerBlock + 1];	// By size in blocks.
+	UINT64				mTotalCount;
+	UINT				mListCount;
+	bool				mOverflowed;
+};
+
+// The exposed faces of every occupied voxel: those whose neighbour across the
+// face is air, looking into the neighbouring bricks at brick boundaries and
+// treating everything outside the volume as air. The six bit masks of a voxel
+// are kept as planes of 64 bit words, one per face per brick, laid out like the
+// occupancy masks they are derived from, so building them is a handful of
+// shifts per brick.
+//
+// Each brick's exposed faces are also compacted into mLists for the vertex
+// shader, which draws one instance per entry instead of six per voxel. An entry
+// holds the voxel in its low 6 bits and the face above.
+class BrickFaces
+{
+public:
+	BrickFaces() :
+		mPlanes(BrickCount * FaceCount, 0)
+	{}
+
+	void Build(const BrickOccupancy& occupancy);
+
+	// Updates the faces after the occupancy of the given bricks changed. Their
+	// neighbours are revisited too, since their boundary faces may have been
+	// covered or uncovered. Every brick whose faces changed is appended to changed.
+	void UpdateBricks(const BrickOccupancy& occupancy, const std::vector<UINT>& bricks, std::vector<UINT>& changed);
+
+	// The six bit exposed face mask of a voxel, bit n for face n.
+	UINT GetVoxelFaces(UINT brick, UINT voxel) const;
+
+	UINT GetFaceCount(UINT brick) const { return mLists.GetCount(brick); }
+	UINT64 GetTotalFaceCount() const { return mLists.GetTotalCount(); }
+
+	// Bricks per second for a full rebuild from the masks.
+	double Benchmark(const BrickOccupancy& occupancy, UINT iterations);
+
+	std::vector<UINT64>	mPlanes;	// FaceCount per brick.
+	FaceLists			mLists;
+
+private:
+	// Recomputes the planes of a brick and returns true if they changed.
+	bool BuildPlanes(const BrickOccupancy& occupancy, UINT brick);
+	void WriteList(UINT brick);
+};
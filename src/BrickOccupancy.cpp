@@ -0,0 +1,139 @@
+#include "stdafx.h"
+#include "BrickOccupancy.h"
+#include <immintrin.h>
+#include <chrono>
+
+static_assert(VoxelsPerBrick == 64, "Occupancy masks hold one bit per voxel in a 64 bit word.");
+static_assert(sizeof(Voxel) == sizeof(UINT), "The mask builder loads voxels as packed 32 bit materials.");
+
+// Builds the mask for one brick by comparing materials against zero several at a
+// time and gathering the sign bits of the comparison.
+static inline UINT64 BuildMaskSse2(const Voxel* voxels)
+{
+	const UINT* materials = reinterpret_cast<const UINT*>(voxels);
+	UINT64 empty = 0;
+
+	const __m128i zero = _mm_setzero_si128();
+	for (UINT n = 0; n < VoxelsPerBrick; n += 4)
+	{
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(materials + n));
+		UINT bits = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(v, zero)));
+		empty |= UINT64(bits) << n;
+	}
+
+	return ~empty;
+}
+
+static inline AVX2_FUNCTION UINT64 BuildMaskAvx2(const Voxel* voxels)
+{
+	const UINT* materials = reinterpret_cast<const UINT*>(voxels);
+	UINT64 empty = 0;
+
+	const __m256i zero = _mm256_setzero_si256();
+	for (UINT n = 0; n < VoxelsPerBrick; n += 8)
+	{
+		__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(materials + n));
+		UINT bits = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(v, zero)));
+		empty |= UINT64(bits) << n;
+	}
+
+	return ~empty;
+}
+
+static inline UINT64 BuildMaskScalar(const Voxel* voxels)
+{
+	UINT64 mask = 0;
+	for (UINT n = 0; n < VoxelsPerBrick; n++)
+	{
+		if (voxels[n].mMaterial != 0)
+		{
+			mask |= 1ull << n;
+		}
+	}
+	return mask;
+}
+
+// The whole volume in one call, so that the AVX2 mask builder inlines.
+static AVX2_FUNCTION void BuildMasksAvx2(const Voxel* voxels, UINT64* masks)
+{
+	for (UINT brick = 0; brick < BrickCount; brick++)
+	{
+		masks[brick] = BuildMaskAvx2(voxels + brick * VoxelsPerBrick);
+	}
+}
+
+UINT64 BrickOccupancy::BuildMask(const Voxel* voxels) const
+{
+	switch (GetSimdLevel(mSimd))
+	{
+		case SimdAvx2:	return BuildMaskAvx2(voxels);
+		case SimdSse2:	return BuildMaskSse2(voxels);
+		default:		return BuildMaskScalar(voxels);
+	}
+}
+
+void BrickOccupancy::Build(const Voxel* voxels)
+{
+	switch (GetSimdLevel(mSimd))
+	{
+		case SimdAvx2:
+			BuildMasksAvx2(voxels, &mMasks[0]);
+			break;
+		case SimdSse2:
+			for (UINT brick = 0; brick < BrickCount; brick++)
+			{
+				mMasks[brick] = BuildMaskSse2(voxels + brick * VoxelsPerBrick);
+			}
+			break;
+		default:
+			BuildScalar(voxels);
+			break;
+	}
+}
+
+void BrickOccupancy::BuildScalar(const Voxel* voxels)
+{
+	for (UINT brick = 0; brick < BrickCount; brick++)
+	{
+		mMasks[brick] = BuildMaskScalar(voxels + brick * VoxelsPerBrick);
+	}
+}
+
+void BrickOccupancy::UpdateBrick(const Voxel* voxels, UINT brick)
+{
+	mMasks[brick] = BuildMask(voxels + brick * VoxelsPerBrick);
+}
+
+void BrickOccupancy::UpdateBrick(const BrickPool& bricks, UINT brick)
+{
+	if (bricks.IsUniform(brick))
+	{
+		mMasks[brick] = (bricks.mTable[brick] & ~UniformBrickFlag) ? ~0ull : 0;
+	}
+	else
+	{
+		Voxel voxels[VoxelsPerBrick];
+		bricks.ReadBrick(brick, voxels);
+		mMasks[brick] = BuildMask(voxels);
+	}
+}
+
+void BrickOccupancy::Build(const BrickPool& bricks)
+{
+	for (UINT brick = 0; brick < BrickCount; brick++)
+	{
+		UpdateBrick(bricks, brick);
+	}
+}
+
+double BrickOccupancy::Benchmark(const Voxel* voxels, UINT iterations)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+	for (UINT i = 0; i < iterations; i++)
+	{
+		Build(voxels);
+	}
+	std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+	return (double(BrickCount) * iterations) / elapsed.count();
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "VoxelTypes.h"
+#include "BrickPool.h"
+#include "Simd.h"
+
+// One bit per voxel for every brick, set when the voxel holds a material. Bit n
+// corresponds to voxel n within the brick, so a brick is solid when its mask is
+// all ones and empty when it is zero. compute.hlsl reads the masks as uint2.
+class BrickOccupancy
+{
+public:
+	BrickOccupancy() :
+		mSimd(GetCpuSimdLevel()),
+		mMasks(BrickCount, 0)
+	{}
+
+	void Build(const Voxel* voxels);
+	void BuildScalar(const Voxel* voxels);
+	void UpdateBrick(const Voxel* voxels, UINT brick);
+
+	// Uniform bricks in the pool map straight to an all or nothing mask.
+	void Build(const BrickPool& bricks);
+	void UpdateBrick(const BrickPool& bricks, UINT brick);
+
+	void SetVoxel(UINT index, bool occupied)
+	{
+		UINT64 bit = 1ull << (index % VoxelsPerBrick);
+		UINT64& mask = mMasks[index / VoxelsPerBrick];
+		mask = occupied ? (mask | bit) : (mask & ~bit);
+	}
+
+	bool IsBrickSolid(UINT brick) const { return mMasks[brick] == ~0ull; }
+	bool IsBrickEmpty(UINT brick) const { return mMasks[brick] == 0; }
+
+	// Bricks per second for a full rebuild at mSimd.
+	double Benchmark(const Voxel* voxels, UINT iterations);
+
+	SimdLevel			mSimd;		// The widest mask builder to use; clamped to what the CPU supports.
+	std::vector<UINT64>	mMasks;
+
+private:
+	UINT64 BuildMask(const Voxel* voxels) const;
+};
@@ -0,0 +1,469 @@
+#include "stdafx.h"
+#include "BrickPool.h"
+#include <algorithm>
+#include <chrono>
+
+static_assert(sizeof(Voxel) == sizeof(UINT), "The GPU pool packs table entries and voxels as uints.");
+static_assert(VoxelsPerBrick == 64, "Palette indices are packed assuming 64 voxels per brick.");
+
+// Largest block a brick can need, used for scratch space.
+static const UINT MaxBlockWords = VoxelsPerBrick;
+
+UINT BrickPool::PaletteCapacity(BrickFormat format)
+{
+	// An 8 bit block with a full 256 entry palette would be larger than a raw
+	// one, so it is only used for up to 32 materials.
+	switch (format)
+	{
+		case BrickFormatPalette1:	return 2;
+		case BrickFormatPalette2:	return 4;
+		case BrickFormatPalette4:	return 16;
+		case BrickFormatPalette8:	return 32;
+		default:					return 0;
+	}
+}
+
+UINT BrickPool::BlockWords(BrickFormat format)
+{
+	return PaletteCapacity(format) + VoxelsPerBrick * BitsPerVoxel(format) / 32;
+}
+
+void BrickPool::Clear()
+{
+	mTable.assign(BrickCount, UniformBrickFlag);
+	mWords.clear();
+	for (UINT format = 0; format < BrickFormatCount; format++)
+	{
+		mFreeBlocks[format].clear();
+		mFormatCounts[format] = 0;
+	}
+	mMixedBricks = 0;
+}
+
+bool BrickPool::IsUniform(const Voxel* voxels, UINT& material)
+{
+	material = voxels[0].mMaterial;
+	if (material & UniformBrickFlag)
+	{
+		return false;
+	}
+
+	for (UINT n = 1; n < VoxelsPerBrick; n++)
+	{
+		if (voxels[n].mMaterial != material)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+BrickFormat BrickPool::EncodeBlock(const Voxel* voxels, UINT* block)
+{
+	// Gather the palette in order of first use, giving up once it outgrows the
+	// largest palette format.
+	const UINT maxPalette = PaletteCapacity(BrickFormatPalette8);
+	UINT palette[32];
+	UINT8 indices[VoxelsPerBrick];
+	UINT paletteCount = 0;
+	UINT index = 0;
+
+	for (UINT n = 0; n < VoxelsPerBrick; n++)
+	{
+		// Neighbouring voxels usually match, so only search on a change.
+		const UINT material = voxels[n].mMaterial;
+		if (n == 0 || palette[index] != material)
+		{
+			index = 0;
+			while (index < paletteCount && palette[index] != material)
+			{
+				index++;
+			}
+		}
+
+		if (index == paletteCount)
+		{
+			if (paletteCount == maxPalette)
+			{
+				memcpy(block, voxels, VoxelsPerBrick * sizeof(UINT));
+				return BrickFormatRaw;
+			}
+			palette[paletteCount++] = material;
+		}
+		indices[n] = static_cast<UINT8>(index);
+	}
+
+	BrickFormat format = BrickFormatPalette1;
+	while (PaletteCapacity(format) < paletteCount)
+	{
+		format = static_cast<BrickFormat>(format + 1);
+	}
+
+	const UINT capacity = PaletteCapacity(format);
+	const UINT bits = BitsPerVoxel(format);
+	memcpy(block, palette, paletteCount * sizeof(UINT));
+	memset(block + paletteCount, 0, (BlockWords(format) - paletteCount) * sizeof(UINT));
+
+	UINT* packed = block + capacity;
+	for (UINT n = 0; n < VoxelsPerBrick; n++)
+	{
+		const UINT bit = n * bits;
+		packed[bit >> 5] |= UINT(indices[n]) << (bit & 31);
+	}
+
+	return format;
+}
+
+template<UINT Bits>
+static inline void DecodePalette(const UINT* block, Voxel* out)
+{
+	const UINT capacity = Bits == 8 ? 32 : 1 << Bits;
+	const UINT perWord = 32 / Bits;
+	const UINT mask = (1u << Bits) - 1;
+	const UINT* packed = block + capacity;
+
+	for (UINT w = 0; w < VoxelsPerBrick / perWord; w++)
+	{
+		UINT word = packed[w];
+		for (UINT i = 0; i < perWord; i++)
+		{
+			out[w * perWord + i].mMaterial = block[word & mask];
+			word >>= Bits;
+		}
+	}
+}
+
+void BrickPool::DecodeBlock(BrickFormat format, const UINT* block, Voxel* out)
+{
+	switch (format)
+	{
+		case BrickFormatPalette1:	DecodePalette<1>(block, out); break;
+		case BrickFormatPalette2:	DecodePalette<2>(block, out); break;
+		case BrickFormatPalette4:	DecodePalette<4>(block, out); break;
+		case BrickFormatPalette8:	DecodePalette<8>(block, out); break;
+		default:					memcpy(out, block, VoxelsPerBrick * sizeof(UINT)); break;
+	}
+}
+
+UINT BrickPool::AllocateBlock(BrickFormat format)
+{
+	std::vector<UINT>& freeBlocks = mFreeBlocks[format];
+	if (!freeBlocks.empty())
+	{
+		UINT offset = freeBlocks.back();
+		freeBlocks.pop_back();
+		return offset;
+	}
+
+	UINT offset = WordCount();
+	mWords.resize(mWords.size() + BlockWords(format));
+	return offset;
+}
+
+void BrickPool::FreeBlock(UINT entry)
+{
+	const BrickFormat format = static_cast<BrickFormat>(entry >> cBrickFormatShift);
+	mFreeBlocks[format].push_back(entry & cBrickOffsetMask);
+	mFormatCounts[format]--;
+	mMixedBricks--;
+}
+
+void BrickPool::WriteBrick(UINT brick, const Voxel* voxels)
+{
+	UINT material;
+	if (IsUniform(voxels, material))
+	{
+		WriteBlock(brick, UniformBrickFlag | material, nullptr);
+		return;
+	}
+
+	UINT block[MaxBlockWords];
+	const BrickFormat format = EncodeBlock(voxels, block);
+	WriteBlock(brick, UINT(format) << cBrickFormatShift, block);
+}
+
+void BrickPool::WriteBlock(UINT brick, UINT encoded, const UINT* block)
+{
+	UINT& entry = mTable[brick];
+
+	if (encoded & UniformBrickFlag)
+	{
+		if (!(entry & UniformBrickFlag))
+		{
+			FreeBlock(entry);
+		}
+		entry = encoded;
+		return;
+	}
+
+	// Keep the existing block if the format is unchanged; otherwise move.
+	const BrickFormat format = static_cast<BrickFormat>(encoded >> cBrickFormatShift);
+	if ((entry & UniformBrickFlag) || BrickFormat(entry >> cBrickFormatShift) != format)
+	{
+		if (!(entry & UniformBrickFlag))
+		{
+			FreeBlock(entry);
+		}
+		entry = (UINT(format) << cBrickFormatShift) | AllocateBlock(format);
+		mFormatCounts[format]++;
+		mMixedBricks++;
+	}
+
+	memcpy(&mWords[entry & cBrickOffsetMask], block, BlockWords(format) * sizeof(UINT));
+}
+
+void BrickPool::CopyBricks(const UINT* bricks, UINT count, std::vector<UINT>& entries, std::vector<UINT>& words) const
+{
+	for (UINT n = 0; n < count; n++)
+	{
+		const UINT entry = mTable[bricks[n]];
+		if (entry & UniformBrickFlag)
+		{
+			entries.push_back(entry);
+			continue;
+		}
+
+		const UINT wordCount = BlockWords(static_cast<BrickFormat>(entry >> cBrickFormatShift));
+		const UINT* block = &mWords[entry & cBrickOffsetMask];
+		entries.push_back((entry & ~cBrickOffsetMask) | static_cast<UINT>(words.size()));
+		words.insert(words.end(), block, block + wordCount);
+	}
+}
+
+void BrickPool::RestoreBricks(const UINT* bricks, UINT count, const UINT* entries, const UINT* words)
+{
+	for (UINT n = 0; n < count; n++)
+	{
+		const UINT entry = entries[n];
+		WriteBlock(bricks[n], entry, (entry & UniformBrickFlag) ? nullptr : words + (entry & cBrickOffsetMask));
+	}
+}
+
+const UINT* BrickPool::GetBlock(UINT brick, UINT& wordCount) const
+{
+	const UINT entry = mTable[brick];
+	if (entry & UniformBrickFlag)
+	{
+		wordCount = 0;
+		return nullptr;
+	}
+
+	wordCount = BlockWords(static_cast<BrickFormat>(entry >> cBrickFormatShift));
+	return &mWords[entry & cBrickOffsetMask];
+}
+
+void BrickPool::ReadBrick(UINT brick, Voxel* out) const
+{
+	const UINT entry = mTable[brick];
+	if (entry & UniformBrickFlag)
+	{
+		for (UINT n = 0; n < VoxelsPerBrick; n++)
+		{
+			out[n].mMaterial = entry & ~UniformBrickFlag;
+		}
+	}
+	else
+	{
+		DecodeBlock(static_cast<BrickFormat>(entry >> cBrickFormatShift), &mWords[entry & cBrickOffsetMask], out);
+	}
+}
+
+UINT BrickPool::GetMaterial(UINT index) const
+{
+	const UINT entry = mTable[index / VoxelsPerBrick];
+	if (entry & UniformBrickFlag)
+	{
+		return entry & ~UniformBrickFlag;
+	}
+
+	const BrickFormat format = static_cast<BrickFormat>(entry >> cBrickFormatShift);
+	const UINT* block = &mWords[entry & cBrickOffsetMask];
+	const UINT voxel = index % VoxelsPerBrick;
+	if (format == BrickFormatRaw)
+	{
+		return block[voxel];
+	}
+
+	const UINT bits = BitsPerVoxel(format);
+	const UINT bit = voxel * bits;
+	const UINT paletteIndex = (block[PaletteCapacity(format) + (bit >> 5)] >> (bit & 31)) & ((1u << bits) - 1);
+	return block[paletteIndex];
+}
+
+void BrickPool::Build(const Voxel* voxels)
+{
+	Clear();
+	for (UINT brick = 0; brick < BrickCount; brick++)
+	{
+		WriteBrick(brick, voxels + brick * VoxelsPerBrick);
+	}
+}
+
+void BrickPool::Compact(std::vector<UINT>& table, std::vector<UINT>& words) const
+{
+	table.resize(BrickCount);
+	words.clear();
+	words.reserve(mWords.size());
+
+	for (UINT brick = 0; brick < BrickCount; brick++)
+	{
+		const UINT entry = mTable[brick];
+		if (entry & UniformBrickFlag)
+		{
+			table[brick] = entry;
+			continue;
+		}
+
+		UINT wordCount;
+		const UINT* block = GetBlock(brick, wordCount);
+		table[brick] = (entry & ~cBrickOffsetMask) | static_cast<UINT>(words.size());
+		words.insert(words.end(), block, block + wordCount);
+	}
+}
+
+bool BrickPool::IsValidBlock(BrickFormat format, const UINT* block)
+{
+	if (format != BrickFormatPalette8)
+	{
+		return true;
+	}
+
+	// Each word packs four indices, none of which may reach the 32nd entry.
+	const UINT* packed = block + PaletteCapacity(BrickFormatPalette8);
+	for (UINT w = 0; w < VoxelsPerBrick / 4; w++)
+	{
+		if (packed[w] & 0xe0e0e0e0)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+bool BrickPool::IsValidTable(const UINT* table, const UINT* words, UINT wordCount)
+{
+	std::vector<std::pair<UINT, UINT>> blocks;	// The first and one past the last word of each block.
+	for (UINT brick = 0; brick < BrickCount; brick++)
+	{
+		const UINT entry = table[brick];
+		if (entry & UniformBrickFlag)
+		{
+			continue;
+		}
+
+		const UINT format = entry >> cBrickFormatShift;
+		const UINT offset = entry & cBrickOffsetMask;
+		if (format >= BrickFormatCount || offset + BlockWords(static_cast<BrickFormat>(format)) > wordCount ||
+			!IsValidBlock(static_cast<BrickFormat>(format), words + offset))
+		{
+			return false;
+		}
+		blocks.push_back(std::make_pair(offset, offset + BlockWords(static_cast<BrickFormat>(format))));
+	}
+
+	// Bricks sharing words would overwrite each other once the pool is edited.
+	std::sort(blocks.begin(), blocks.end());
+	for (size_t n = 1; n < blocks.size(); n++)
+	{
+		if (blocks[n].first < blocks[n - 1].second)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+bool BrickPool::Load(const UINT* table, const UINT* words, UINT wordCount)
+{
+	Clear();
+	if (!IsValidTable(table, words, wordCount))
+	{
+		return false;
+	}
+
+	for (UINT brick = 0; brick < BrickCount; brick++)
+	{
+		if (!(table[brick] & UniformBrickFlag))
+		{
+			mFormatCounts[table[brick] >> cBrickFormatShift]++;
+			mMixedBricks++;
+		}
+	}
+
+	mTable.assign(table, table + BrickCount);
+	mWords.assign(words, words + wordCount);
+	return true;
+}
+
+void BrickPool::Decode(Voxel* voxels) const
+{
+	for (UINT brick = 0; brick < BrickCount; brick++)
+	{
+		ReadBrick(brick, voxels + brick * VoxelsPerBrick);
+	}
+}
+
+size_t BrickPool::ResidentBytes() const
+{
+	size_t bytes = (mTable.size() + mWords.size()) * sizeof(UINT);
+	for (UINT format = 0; format < BrickFormatCount; format++)
+	{
+		bytes += mFreeBlocks[format].size() * sizeof(UINT);
+	}
+
+	return bytes;
+}
+
+double BrickPool::BenchmarkEncode(UINT iterations) const
+{
+	// Decode the mixed bricks up front so only encoding is timed.
+	std::vector<Voxel> voxels;
+	for (UINT brick = 0; brick < BrickCount; brick++)
+	{
+		if (!IsUniform(brick))
+		{
+			voxels.resize(voxels.size() + VoxelsPerBrick);
+			ReadBrick(brick, &voxels[voxels.size() - VoxelsPerBrick]);
+		}
+	}
+
+	const UINT count = static_cast<UINT>(voxels.size() / VoxelsPerBrick);
+	UINT block[MaxBlockWords];
+	UINT formats = 0;
+
+	auto start = std::chrono::high_resolution_clock::now();
+	for (UINT i = 0; i < iterations; i++)
+	{
+		for (UINT b = 0; b < count; b++)
+		{
+			formats += EncodeBlock(&voxels[b * VoxelsPerBrick], block);
+		}
+	}
+	std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+	// Keep the encodes from being optimised away.
+	return formats == ~0u ? 0.0 : (double(count) * iterations) / elapsed.count();
+}
+
+double BrickPool::BenchmarkDecode(UINT iterations) const
+{
+	Voxel voxels[VoxelsPerBrick];
+	UINT material = 0;
+
+	auto start = std::chrono::high_resolution_clock::now();
+	for (UINT i = 0; i < iterations; i++)
+	{
+		for (UINT brick = 0; brick < BrickCount; brick++)
+		{
+			if (!IsUniform(brick))
+			{
+				ReadBrick(brick, voxels);
+				material += voxels[brick % VoxelsPerBrick].mMaterial;
+			}
+		}
+	}
+	std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+	return material == ~0u ? 0.0 : (double(MixedBrickCount()) * iterations) / elapsed.count();
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include "VoxelTypes.h"
+
+// Sparse, palette compressed voxel storage. Every brick has one entry in mTable.
+// A brick whose voxels all hold the same material (air, or a uniform fill) keeps
+// that material in the entry with UniformBrickFlag set, unless the material
+// itself has that bit set; such a brick is stored as a block like any other. Any other brick keeps a
+// block in mWords, and its entry holds the block's offset in the low bits and
+// its format above cBrickFormatShift:
+//
+//	BrickFormatPalette1/2/4/8	A palette of PaletteCapacity() materials, then
+//								one 1, 2, 4 or 8 bit palette index per voxel,
+//								packed from the low bit of each word up.
+//	BrickFormatRaw				VoxelsPerBrick materials, for bricks with more
+//								distinct materials than an 8 bit block holds.
+//
+// WriteBrick picks the smallest format that fits and moves the block when the
+// format changes; freed blocks are reused by bricks of the same format.
+//
+// The GPU copy has the same layout, packed as uints: the BrickCount table entries
+// followed by mWords. shaders.hlsl reads it through LoadVoxel.
+enum BrickFormat
+{
+	BrickFormatRaw,
+	BrickFormatPalette1,
+	BrickFormatPalette2,
+	BrickFormatPalette4,
+	BrickFormatPalette8,
+	BrickFormatCount
+};
+
+class BrickPool
+{
+public:
+	BrickPool()
+	{
+		Clear();
+	}
+
+	// Every brick uniform air, with no blocks.
+	void Clear();
+
+	void Build(const Voxel* voxels);
+	void Decode(Voxel* voxels) const;
+
+	// Writes the table and blocks with the blocks packed in brick order and no
+	// free space between them, as a saved tile holds them.
+	void Compact(std::vector<UINT>& table, std::vector<UINT>& words) const;
+
+	// Replaces the pool with a table and packed blocks. Returns false, leaving the
+	// pool cleared, when the table fails IsValidTable().
+	bool Load(const UINT* table, const UINT* words, UINT wordCount);
+
+	// True when every entry is uniform or has a valid format and a block that
+	// lies within wordCount words and passes IsValidBlock(), and no two blocks
+	// overlap.
+	static bool IsValidTable(const UINT* table, const UINT* words, UINT wordCount);
+
+	// False for an 8 bit block with an index past its palette, which would read
+	// outside the block. Indices of the smaller formats always fit.
+	static bool IsValidBlock(BrickFormat format, const UINT* block);
+
+	// Stores a brick's voxels, collapsing it to a table entry when uniform.
+	void WriteBrick(UINT brick, const Voxel* voxels);
+
+	// Stores a brick that is already encoded: a table entry and, unless the entry
+	// is uniform, the block of its format. The entry's offset bits are ignored.
+	void WriteBlock(UINT brick, UINT encoded, const UINT* block);
+
+	// Appends the encoded bricks to entries and their blocks to words, with each
+	// entry's offset relative to the start of words.
+	void CopyBricks(const UINT* bricks, UINT count, std::vector<UINT>& entries, std::vector<UINT>& words) const;
+
+	// Writes back bricks copied by CopyBricks.
+	void RestoreBricks(const UINT* bricks, UINT count, const UINT* entries, const UINT* words);
+	void ReadBrick(UINT brick, Voxel* out) const;
+
+	bool IsUniform(UINT brick) const { return (mTable[brick] & UniformBrickFlag) != 0; }
+
+	// The brick's block and its size in words, or nullptr for a uniform brick.
+	const UINT* GetBlock(UINT brick, UINT& wordCount) const;
+
+	// Material of a voxel, by its index in the dense brick-major layout.
+	UINT GetMaterial(UINT index) const;
+
+	// Words allocated to blocks, including any on the free lists.
+	UINT WordCount() const { return static_cast<UINT>(mWords.size()); }
+	UINT MixedBrickCount() const { return mMixedBricks; }
+	UINT BrickCountInFormat(BrickFormat format) const { return mFormatCounts[format]; }
+	size_t ResidentBytes() const;
+
+	// Bricks per second for encoding and decoding the current mixed bricks.
+	double BenchmarkEncode(UINT iterations) const;
+	double BenchmarkDecode(UINT iterations) const;
+
+	// True when every voxel holds one material that fits in a uniform entry.
+	static bool IsUniform(const Voxel* voxels, UINT& material);
+	static UINT BitsPerVoxel(BrickFormat format) { return format == BrickFormatRaw ? 32 : 1 << (format - 1); }
+	static UINT PaletteCapacity(BrickFormat format);
+	static UINT BlockWords(BrickFormat format);
+
+	// Chooses a format and writes the block for a brick that is not uniform.
+	static BrickFormat EncodeBlock(const Voxel* voxels, UINT* block);
+	static void DecodeBlock(BrickFormat format, const UINT* block, Voxel* out);
+
+	std::vector<UINT>	mTable;
+	std::vector<UINT>	mWords;
+
+private:
+	UINT AllocateBlock(BrickFormat format);
+	void FreeBlock(UINT entry);
+
+	std::vector<UINT>	mFreeBlocks[BrickFormatCount];
+	UINT				mFormatCounts[BrickFormatCount];
+	UINT				mMixedBricks;
+};
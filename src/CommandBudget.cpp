@@ -0,0 +1,72 @@
+#include "stdafx.h"
+#include "CommandBudget.h"
+
+void CommandBudget::Reset()
+{
+	mHistoryCount = 0;
+	mNext = 0;
+	mFallbackFrames = 0;
+	mStats = {};
+}
+
+UINT CommandBudget::GetMaxCommandCount() const
+{
+	if (mHistoryCount == 0 || mFallbackFrames > 0)
+	{
+		return mBound;
+	}
+
+	UINT peak = 0;
+	for (UINT n = 0; n < mHistoryCount; n++)
+	{
+		peak = mHistory[n] > peak ? mHistory[n] : peak;
+	}
+
+	// Round up so small changes in the count leave the budget as it is.
+	UINT64 budget = static_cast<UINT64>(ceil(peak * (1.0 + mHeadroom)));
+	budget = (budget / Granularity + 1) * Granularity;
+	return budget < mBound ? static_cast<UINT>(budget) : mBound;
+}
+
+void CommandBudget::Record(UINT count, UINT budget)
+{
+	mHistory[mNext] = count;
+	mNext = (mNext + 1) % HistoryLength;
+	mHistoryCount += mHistoryCount < HistoryLength ? 1 : 0;
+
+	// One record is made per frame, so the fallback runs down a frame at a time.
+	if (count > budget)
+	{
+		mFallbackFrames = FallbackLength;
+	}
+	else if (mFallbackFrames > 0)
+	{
+		mFallbackFrames--;
+	}
+
+	mStats.mFrames++;
+	mStats.mLastCount = count;
+	mStats.mPeakCount = count > mStats.mPeakCount ? count : mStats.mPeakCount;
+	mStats.mOverflows += count > budget ? 1 : 0;
+	mStats.mTotalCount += count;
+	mStats.mTotalBudget += budget;
+}
+
+CommandBudget::BudgetStats CommandBudget::Simulate(const UINT* counts, UINT frames, UINT latency, UINT bound, float headroom)
+{
+	CommandBudget budget(headroom);
+	budget.SetBound(bound);
+
+	// The budget each frame was drawn with, until its count comes back.
+	std::vector<UINT> budgets(frames);
+	for (UINT frame = 0; frame < frames; frame++)
+	{
+		if (frame >= latency)
+		{
+			budget.Record(counts[frame - latency], budgets[frame - latency]);
+		}
+		budgets[frame] = budget.GetMaxCommandCount();
+	}
+
+	return budget.GetStats();
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "VoxelTypes.h"
+
+// Chooses the MaxCommandCount passed to ExecuteIndirect for a stream of culled
+// commands. The cull shader appends the visible commands to the front of the
+// stream and leaves their exact count in the UAV counter, but the CPU only sees
+// that count a few frames later through a readback, so the budget is the
+// largest count over the recent frames plus some headroom, rounded up to
+// Granularity.
+//
+// The budget never exceeds the bound, the number of commands that could survive
+// culling at all (bricks with something to draw), so a budget at the bound is
+// always exact-safe, and it is used until a count has been read back. A frame
+// whose count came back above the budget it was drawn with has lost commands for
+// that frame; it is counted as an overflow. The visible set is then changing
+// faster than the readback can follow, as in a quick turn, and the frames drawn
+// before its count came back have most likely overflowed too, so the budget goes
+// straight to the bound for the next FallbackLength frames rather than waiting
+// for the history to catch up.
+class CommandBudget
+{
+public:
+	static const UINT Granularity = 256;
+	static const UINT HistoryLength = 32;
+	static const UINT FallbackLength = 16;
+
+	// Counts over the frames recorded since the last Reset().
+	struct BudgetStats
+	{
+		UINT	mFrames;
+		UINT	mLastCount;			// Visible commands in the last frame read back.
+		UINT	mPeakCount;
+		UINT	mOverflows;			// Frames drawn with a budget below their count.
+		UINT64	mTotalCount;
+		UINT64	mTotalBudget;		// Sum of the budgets the frames were drawn with.
+	};
+
+	CommandBudget(float headroom = 0.25f) :
+		mHeadroom(headroom),
+		mBound(BrickCount)
+	{
+		Reset();
+	}
+
+	// Forgets the history, so the budget is the bound until it refills.
+	void Reset();
+
+	// Sets the most commands the stream can hold this frame.
+	void SetBound(UINT bound) { mBound = bound < BrickCount ? bound : BrickCount; }
+
+	UINT GetMaxCommandCount() const;
+
+	// Records the count read back for a frame that was drawn with the given budget.
+	void Record(UINT count, UINT budget);
+
+	const BudgetStats& GetStats() const { return mStats; }
+
+	// Replays per-frame visible counts as the sample would see them, each read back
+	// latency frames after it was drawn, under a fixed bound. Returns the stats of
+	// the replay; frames whose counts had not come back yet are not included.
+	static BudgetStats Simulate(const UINT* counts, UINT frames, UINT latency, UINT bound, float headroom = 0.25f);
+
+	float	mHeadroom;		// Fraction added to the peak count.
+
+private:
+	UINT		mBound;
+	UINT		mHistory[HistoryLength];
+	UINT		mHistoryCount;	// Frames recorded since the last Reset(), up to HistoryLength.
+	UINT		mNext;
+	UINT		mFallbackFrames;	// Frames left to draw at the bound after an overflow.
+	BudgetStats	mStats;
+};
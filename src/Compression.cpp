@@ -0,0 +1,267 @@
+#include "stdafx.h"
+#include "Compression.h"
+
+static const UINT MinMatch = 4;
+static const UINT MaxOffset = 65535;
+static const UINT HashBits = 12;
+
+// As in LZ4, the last five bytes are always literals and no match starts in the
+// last twelve, so a decoder may copy in whole words near the end of a block.
+static const UINT LastLiterals = 5;
+static const UINT MatchSearchLimit = 12;
+
+static inline UINT Read32(const UINT8* p)
+{
+	UINT value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+static inline UINT64 Read64(const UINT8* p)
+{
+	UINT64 value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+static inline UINT HashSequence(UINT sequence)
+{
+	return (sequence * 2654435761u) >> (32 - HashBits);
+}
+
+static inline UINT8* WriteLength(UINT8* op, UINT length)
+{
+	while (length >= 255)
+	{
+		*op++ = 255;
+		length -= 255;
+	}
+	*op++ = static_cast<UINT8>(length);
+	return op;
+}
+
+// Writes literals followed by a match, or the literals alone when length is zero.
+static UINT8* WriteSequence(UINT8* op, const UINT8* literals, UINT literalCount, UINT offset, UINT length)
+{
+	UINT8* token = op++;
+	*token = static_cast<UINT8>((literalCount < 15 ? literalCount : 15) << 4);
+	if (literalCount >= 15)
+	{
+		op = WriteLength(op, literalCount - 15);
+	}
+	memcpy(op, literals, literalCount);
+	op += literalCount;
+
+	if (length == 0)
+	{
+		return op;
+	}
+
+	*op++ = static_cast<UINT8>(offset);
+	*op++ = static_cast<UINT8>(offset >> 8);
+
+	const UINT extra = length - MinMatch;
+	*token |= static_cast<UINT8>(extra < 15 ? extra : 15);
+	if (extra >= 15)
+	{
+		op = WriteLength(op, extra - 15);
+	}
+	return op;
+}
+
+// Counts the matching bytes at a and b, comparing eight at a time, up to limit.
+static inline UINT MatchLength(const UINT8* a, const UINT8* b, UINT limit)
+{
+	UINT length = 0;
+	while (length + 8 <= limit)
+	{
+		const UINT64 diff = Read64(a + length) ^ Read64(b + length);
+		if (diff)
+		{
+			return length + GetLowestBit(diff) / 8;
+		}
+		length += 8;
+	}
+
+	while (length < limit && a[length] == b[length])
+	{
+		length++;
+	}
+	return length;
+}
+
+UINT LzCompressBound(UINT size)
+{
+	return size + size / 255 + 16;
+}
+
+UINT LzCompress(const void* src, UINT size, UINT8* dst)
+{
+	const UINT8* in = static_cast<const UINT8*>(src);
+	UINT8* op = dst;
+	UINT anchor = 0;
+
+	if (size > MatchSearchLimit)
+	{
+		// Positions of the last sequence seen with each hash. Every entry points at
+		// real input, so a stale one only costs a failed comparison.
+		UINT table[1 << HashBits] = {};
+
+		const UINT searchEnd = size - MatchSearchLimit;
+		const UINT matchEnd = size - LastLiterals;
+		UINT ip = 1;
+
+		while (ip < searchEnd)
+		{
+			const UINT sequence = Read32(in + ip);
+			const UINT hash = HashSequence(sequence);
+			UINT match = table[hash];
+			table[hash] = ip;
+
+			if (ip - match > MaxOffset || Read32(in + match) != sequence)
+			{
+				// Step further the longer nothing has matched, so incompressible
+				// stretches are skipped quickly.
+				ip += 1 + ((ip - anchor) >> 6);
+				continue;
+			}
+
+			// Extend the match back over any literals that also match.
+			while (ip > anchor && match > 0 && in[ip - 1] == in[match - 1])
+			{
+				ip--;
+				match--;
+			}
+
+			const UINT length = MinMatch + MatchLength(in + ip + MinMatch, in + match + MinMatch, matchEnd - ip - MinMatch);
+			op = WriteSequence(op, in + anchor, ip - anchor, ip - match, length);
+			ip += length;
+			anchor = ip;
+		}
+	}
+
+	op = WriteSequence(op, in + anchor, size - anchor, 0, 0);
+	return static_cast<UINT>(op - dst);
+}
+
+static inline bool ReadLength(const UINT8*& ip, const UINT8* end, UINT& length)
+{
+	UINT8 byte;
+	do
+	{
+		if (ip == end || length > 0x40000000)
+		{
+			return false;
+		}
+		byte = *ip++;
+		length += byte;
+	} while (byte == 255);
+
+	return true;
+}
+
+// Copies a match that may overlap its own output. Writes up to seven bytes past
+// the match, never past outEnd; those bytes are overwritten by what follows.
+static inline void CopyMatch(UINT8* op, UINT offset, UINT length, const UINT8* outEnd)
+{
+	const UINT8* match = op - offset;
+	const UINT8* copyEnd = op + length;
+
+	if (offset < 8)
+	{
+		// Repeat the pattern a byte at a time until it spans eight bytes. After that
+		// the output repeats every period bytes, and a copy from a whole period
+		// back reads only bytes already written.
+		const UINT period = offset * ((8 + offset - 1) / offset);
+		const UINT head = period < length ? period : length;
+		for (UINT n = 0; n < head; n++)
+		{
+			op[n] = match[n];
+		}
+		op += head;
+		match = op - period;
+	}
+
+	while (op < copyEnd && outEnd - op >= 8)
+	{
+		memcpy(op, match, 8);
+		op += 8;
+		match += 8;
+	}
+	while (op < copyEnd)
+	{
+		*op++ = *match++;
+	}
+}
+
+bool LzDecompress(const UINT8* src, UINT srcSize, void* dst, UINT dstSize)
+{
+	const UINT8* ip = src;
+	const UINT8* const end = src + srcSize;
+	UINT8* const base = static_cast<UINT8*>(dst);
+	UINT8* const outEnd = base + dstSize;
+	UINT8* op = base;
+
+	for (;;)
+	{
+		if (ip == end)
+		{
+			return false;
+		}
+		const UINT token = *ip++;
+
+		UINT literals = token >> 4;
+		if (literals == 15 && !ReadLength(ip, end, literals))
+		{
+			return false;
+		}
+		if (literals > static_cast<UINT>(end - ip) || literals > static_cast<UINT>(outEnd - op))
+		{
+			return false;
+		}
+
+		// Short runs, the common case, are copied as one fixed size block when
+		// both buffers have room for it.
+		if (literals <= 16 && end - ip >= 16 && outEnd - op >= 16)
+		{
+			memcpy(op, ip, 16);
+		}
+		else
+		{
+			memcpy(op, ip, literals);
+		}
+		ip += literals;
+		op += literals;
+
+		// Only the last sequence has no match.
+		if (ip == end)
+		{
+			return op == outEnd;
+		}
+
+		if (end - ip < 2)
+		{
+			return false;
+		}
+		const UINT offset = ip[0] | (UINT(ip[1]) << 8);
+		ip += 2;
+		if (offset == 0 || offset > static_cast<UINT>(op - base))
+		{
+			return false;
+		}
+
+		UINT length = token & 15;
+		if (length == 15 && !ReadLength(ip, end, length))
+		{
+			return false;
+		}
+		length += MinMatch;
+		if (length > static_cast<UINT>(outEnd - op))
+		{
+			return false;
+		}
+
+		CopyMatch(op, offset, length, outEnd);
+		op += length;
+	}
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "VoxelTypes.h"
+
+// A byte oriented LZ codec writing the LZ4 block format, so a block can be read
+// by any LZ4 decoder. The data is a run of sequences, each a token byte holding
+// the literal count in its high nibble and the match length less four in its low
+// nibble, then the literal count's overflow bytes, the literals, a two byte
+// little endian match offset and the match length's overflow bytes. A nibble of
+// 15 continues in bytes of 255 up to a final smaller byte. The last sequence is
+// literals alone and always ends the block.
+//
+// The compressor finds matches through a hash of the next four bytes, so it is
+// fast rather than tight. The decompressor checks every length and offset
+// against both buffers, so damaged input fails instead of reading or writing
+// out of bounds.
+
+// Largest compressed size of size bytes of input.
+UINT LzCompressBound(UINT size);
+
+// Compresses size bytes into dst, which must hold LzCompressBound(size) bytes.
+// Returns the compressed size.
+UINT LzCompress(const void* src, UINT size, UINT8* dst);
+
+// Decompresses a block into exactly dstSize bytes. Returns false when the block
+// is damaged or does not decompress to dstSize bytes.
+bool LzDecompress(const UINT8* src, UINT srcSize, void* dst, UINT dstSize);
@@ -0,0 +1,554 @@
+#include "stdafx.h"
+#include "Culling.h"
+#include "VoxelMips.h"
+#include <immintrin.h>
+#include <chrono>
+#include <algorithm>
+
+// Brick coordinates are unpacked from the index with shifts in the SIMD path.
+static_assert((cWidthInBricks & (cWidthInBricks - 1)) == 0 && (cHeightInBricks & (cHeightInBricks - 1)) == 0,
+	"The SIMD culler assumes power of two brick dimensions.");
+
+static_assert(cWidthInBricks % cCullGroupWidth == 0 && cHeightInBricks % cCullGroupWidth == 0 && cDepthInBricks % cCullGroupWidth == 0,
+	"Cull groups must tile the volume.");
+
+static constexpr UINT Log2(UINT v)
+{
+	return v <= 1 ? 0 : 1 + Log2(v / 2);
+}
+
+static const UINT WidthShift = Log2(cWidthInBricks);
+static const UINT SliceShift = WidthShift + Log2(cHeightInBricks);
+
+// Constants shared with cull.hlsl.
+static const float BrickSize[3] = { cBrickWidth * cVoxelHalfWidth * 2.0f, cBrickHeight * cVoxelHalfWidth * 2.0f, cBrickDepth * cVoxelHalfWidth * 2.0f };
+static const float WEpsilon = 0.000001f;
+static const float NearClip = 0.9999f;
+
+// Group tests only settle a group when every plane is cleared by this fraction of
+// the clip space magnitudes, leaving rounding differences to the brick test.
+static const float GroupMargin = 0.0001f;
+
+void FrustumCuller::SetProjection(const XMFLOAT4X4& projection)
+{
+	memcpy(mRows, projection.m, sizeof(mRows));
+
+	// The shader grows the brick bounds by 20% before taking the radius.
+	float bx = BrickSize[0] * 2.4f / 2.0f;
+	float by = BrickSize[1] * 2.4f / 2.0f;
+	float bz = BrickSize[2] * 2.4f / 2.0f;
+	mRadius = sqrtf(bx * bx + by * by + bz * bz);
+}
+
+void FrustumCuller::SetLod(const VoxelMips* mips, float lodDistance)
+{
+	mMips = mips;
+	mLodDistance = lodDistance;
+}
+
+bool FrustumCuller::IsBrickVisible(UINT brick, bool& isFar) const
+{
+	XMUINT3 b = GetBrickCoords(brick);
+	float c[3] =
+	{
+		static_cast<float>(b.x) * BrickSize[0] + BrickSize[0] / 2.0f,
+		static_cast<float>(b.y) * BrickSize[1] + BrickSize[1] / 2.0f,
+		static_cast<float>(b.z) * BrickSize[2] + BrickSize[2] / 2.0f
+	};
+
+	float p[4];
+	for (UINT n = 0; n < 4; n++)
+	{
+		p[n] = c[0] * mRows[n][0] + c[1] * mRows[n][1] + c[2] * mRows[n][2] + mRows[n][3];
+	}
+
+	float w = p[3] + WEpsilon;
+	float x = p[0] / w;
+	float y = p[1] / w;
+	float z = p[2] / w;
+	float r = mRadius / w;
+
+	if (x > (1.0f + r) || x < (-1.0f - r) || y > (1.0f + r) || y < (-1.0f - r) || z < -r || z > NearClip)
+	{
+		return false;
+	}
+
+	isFar = p[3] > mLodDistance;
+	return true;
+}
+
+// Range of dot(plane, (c, 1)) over the box of centres c in [lo, hi].
+static inline void PlaneRange(const float plane[4], const float lo[3], const float hi[3], float& low, float& high)
+{
+	low = plane[3];
+	high = plane[3];
+	for (UINT a = 0; a < 3; a++)
+	{
+		float l = plane[a] * lo[a];
+		float h = plane[a] * hi[a];
+		low += l < h ? l : h;
+		high += l < h ? h : l;
+	}
+}
+
+FrustumCuller::GroupVisibility FrustumCuller::ClassifyGroup(UINT group) const
+{
+	const UINT gx = group % cCullGroupsX;
+	const UINT gy = (group / cCullGroupsX) % cCullGroupsY;
+	const UINT gz = group / (cCullGroupsX * cCullGroupsY);
+
+	// Box spanned by the centres of the group's bricks.
+	const float span = static_cast<float>(CullGroupWidth - 1);
+	float lo[3] =
+	{
+		static_cast<float>(gx * CullGroupWidth) * BrickSize[0] + BrickSize[0] / 2.0f,
+		static_cast<float>(gy * CullGroupWidth) * BrickSize[1] + BrickSize[1] / 2.0f,
+		static_cast<float>(gz * CullGroupWidth) * BrickSize[2] + BrickSize[2] / 2.0f
+	};
+	float hi[3] = { lo[0] + span * BrickSize[0], lo[1] + span * BrickSize[1], lo[2] + span * BrickSize[2] };
+
+	// Clip space ranges, and the margin they set.
+	float low[4], high[4];
+	float scale = mRadius;
+	for (UINT n = 0; n < 4; n++)
+	{
+		PlaneRange(mRows[n], lo, hi, low[n], high[n]);
+		float m = fabsf(low[n]) > fabsf(high[n]) ? fabsf(low[n]) : fabsf(high[n]);
+		scale = scale > m ? scale : m;
+	}
+	const float margin = GroupMargin * scale;
+
+	// Multiplying the brick test through by w flips it where w is negative, so
+	// the group must lie wholly on one side of w = 0.
+	float w[4] = { mRows[3][0], mRows[3][1], mRows[3][2], mRows[3][3] + WEpsilon };
+	float wLow, wHigh;
+	PlaneRange(w, lo, hi, wLow, wHigh);
+
+	float sign;
+	if (wLow > margin)
+	{
+		sign = 1.0f;
+	}
+	else if (wHigh < -margin)
+	{
+		sign = -1.0f;
+	}
+	else
+	{
+		return GroupPartial;
+	}
+
+	// A brick is rejected when sign * dot(plane, (c, 1)) > 0 for any of these.
+	float planes[6][4];
+	for (UINT a = 0; a < 4; a++)
+	{
+		planes[0][a] = mRows[0][a] - w[a];
+		planes[1][a] = -mRows[0][a] - w[a];
+		planes[2][a] = mRows[1][a] - w[a];
+		planes[3][a] = -mRows[1][a] - w[a];
+		planes[4][a] = -mRows[2][a];
+		planes[5][a] = mRows[2][a] - NearClip * w[a];
+	}
+	for (UINT n = 0; n < 4; n++)
+	{
+		planes[n][3] -= mRadius;
+	}
+	planes[4][3] -= mRadius;
+
+	bool partial = false;
+	for (UINT n = 0; n < 6; n++)
+	{
+		float l, h;
+		PlaneRange(planes[n], lo, hi, l, h);
+		if (sign < 0.0f)
+		{
+			float t = -h;
+			h = -l;
+			l = t;
+		}
+
+		if (l > margin)
+		{
+			return GroupCulled;
+		}
+		partial |= h >= -margin;
+	}
+
+	if (partial)
+	{
+		return GroupPartial;
+	}
+
+	// Bricks are far when w - mLodDistance > 0, which never holds behind the camera.
+	float farPlane[4] = { mRows[3][0], mRows[3][1], mRows[3][2], mRows[3][3] - mLodDistance };
+
+	float l, h;
+	PlaneRange(farPlane, lo, hi, l, h);
+	if (l > margin)
+	{
+		return GroupVisibleFar;
+	}
+	return h < -margin ? GroupVisible : GroupPartial;
+}
+
+float FrustumCuller::GetCentreW(UINT brick) const
+{
+	XMUINT3 b = GetBrickCoords(brick);
+	float c[3] =
+	{
+		static_cast<float>(b.x) * BrickSize[0] + BrickSize[0] / 2.0f,
+		static_cast<float>(b.y) * BrickSize[1] + BrickSize[1] / 2.0f,
+		static_cast<float>(b.z) * BrickSize[2] + BrickSize[2] / 2.0f
+	};
+
+	return c[0] * mRows[3][0] + c[1] * mRows[3][1] + c[2] * mRows[3][2] + mRows[3][3];
+}
+
+UINT FrustumCuller::GetDistanceBucket(UINT brick) const
+{
+	float w = GetCentreW(brick);
+	if (w <= 0.0f)
+	{
+		return 0;
+	}
+
+	UINT bucket = static_cast<UINT>(w / cDistanceBucketDepth);
+	return bucket < DistanceBucketCount ? bucket : DistanceBucketCount - 1;
+}
+
+void FrustumCuller::SortByDistance(const DrawVoxelCommand* commands, UINT count, DrawVoxelCommand* out, UINT* bucketCounts) const
+{
+	// Like the shader, count in one pass and place in a second, rather than keep
+	// every command's bucket.
+	UINT offsets[DistanceBucketCount] = {};
+	for (UINT n = 0; n < count; n++)
+	{
+		offsets[GetDistanceBucket(commands[n].Data & BrickIndexMask)]++;
+	}
+
+	if (bucketCounts)
+	{
+		memcpy(bucketCounts, offsets, sizeof(offsets));
+	}
+
+	// Turn the counts into the first slot of each bucket, as the shader's second pass does.
+	UINT first = 0;
+	for (UINT bucket = 0; bucket < DistanceBucketCount; bucket++)
+	{
+		UINT size = offsets[bucket];
+		offsets[bucket] = first;
+		first += size;
+	}
+
+	for (UINT n = 0; n < count; n++)
+	{
+		out[offsets[GetDistanceBucket(commands[n].Data & BrickIndexMask)]++] = commands[n];
+	}
+}
+
+void FrustumCuller::Emit(DrawVoxelCommand command, bool isFar, DrawVoxelCommand* out, UINT& count) const
+{
+	if (isFar)
+	{
+		const bool coarse = GetCentreW(command.Data) > 2.0f * mLodDistance;
+		command.DrawArguments.InstanceCount = mMips->GetInstanceCount(command.Data, coarse ? 2 : 1);
+		command.Data |= coarse ? FarBrickFlag | CoarseBrickFlag : FarBrickFlag;
+		if (command.DrawArguments.InstanceCount == 0)
+		{
+			return;
+		}
+	}
+	out[count++] = command;
+}
+
+UINT FrustumCuller::RunScalar(const DrawVoxelCommand* commands, UINT count, DrawVoxelCommand* out) const
+{
+	UINT visible = 0;
+	for (UINT n = 0; n < count; n++)
+	{
+		bool isFar;
+		if (commands[n].DrawArguments.InstanceCount != 0 && IsBrickVisible(commands[n].Data, isFar))
+		{
+			Emit(commands[n], isFar, out, visible);
+		}
+	}
+
+	return visible;
+}
+
+UINT FrustumCuller::RunSse2(const DrawVoxelCommand* commands, UINT count, DrawVoxelCommand* out) const
+{
+	UINT visible = 0;
+	UINT n = 0;
+
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 minusOne = _mm_set1_ps(-1.0f);
+	const __m128 radius = _mm_set1_ps(mRadius);
+
+	for (; n + 4 <= count; n += 4)
+	{
+		const DrawVoxelCommand* batch = commands + n;
+		__m128i index = _mm_setr_epi32(batch[0].Data, batch[1].Data, batch[2].Data, batch[3].Data);
+		__m128i instances = _mm_setr_epi32(batch[0].DrawArguments.InstanceCount, batch[1].DrawArguments.InstanceCount,
+			batch[2].DrawArguments.InstanceCount, batch[3].DrawArguments.InstanceCount);
+
+		__m128 c[3];
+		c[0] = _mm_cvtepi32_ps(_mm_and_si128(index, _mm_set1_epi32(cWidthInBricks - 1)));
+		c[1] = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(index, WidthShift), _mm_set1_epi32(cHeightInBricks - 1)));
+		c[2] = _mm_cvtepi32_ps(_mm_srli_epi32(index, SliceShift));
+		for (UINT a = 0; a < 3; a++)
+		{
+			c[a] = _mm_add_ps(_mm_mul_ps(c[a], _mm_set1_ps(BrickSize[a])), _mm_set1_ps(BrickSize[a] / 2.0f));
+		}
+
+		__m128 p[4];
+		for (UINT row = 0; row < 4; row++)
+		{
+			p[row] = _mm_mul_ps(c[0], _mm_set1_ps(mRows[row][0]));
+			p[row] = _mm_add_ps(p[row], _mm_mul_ps(c[1], _mm_set1_ps(mRows[row][1])));
+			p[row] = _mm_add_ps(p[row], _mm_mul_ps(c[2], _mm_set1_ps(mRows[row][2])));
+			p[row] = _mm_add_ps(p[row], _mm_set1_ps(mRows[row][3]));
+		}
+
+		__m128 w = _mm_add_ps(p[3], _mm_set1_ps(WEpsilon));
+		__m128 x = _mm_div_ps(p[0], w);
+		__m128 y = _mm_div_ps(p[1], w);
+		__m128 z = _mm_div_ps(p[2], w);
+		__m128 r = _mm_div_ps(radius, w);
+		__m128 upper = _mm_add_ps(one, r);
+		__m128 lower = _mm_sub_ps(minusOne, r);
+
+		__m128 outside = _mm_or_ps(_mm_cmpgt_ps(x, upper), _mm_cmplt_ps(x, lower));
+		outside = _mm_or_ps(outside, _mm_or_ps(_mm_cmpgt_ps(y, upper), _mm_cmplt_ps(y, lower)));
+		outside = _mm_or_ps(outside, _mm_or_ps(_mm_cmplt_ps(z, _mm_sub_ps(_mm_setzero_ps(), r)), _mm_cmpgt_ps(z, _mm_set1_ps(NearClip))));
+		outside = _mm_or_ps(outside, _mm_castsi128_ps(_mm_cmpeq_epi32(instances, _mm_setzero_si128())));
+
+		int visibleMask = ~_mm_movemask_ps(outside) & 0xf;
+		if (visibleMask == 0)
+		{
+			continue;
+		}
+
+		int farMask = _mm_movemask_ps(_mm_cmpgt_ps(p[3], _mm_set1_ps(mLodDistance)));
+		for (UINT lane = 0; lane < 4; lane++)
+		{
+			if (visibleMask & (1 << lane))
+			{
+				Emit(batch[lane], (farMask & (1 << lane)) != 0, out, visible);
+			}
+		}
+	}
+
+	// The tail that does not fill a batch.
+	return visible + RunScalar(commands + n, count - n, out + visible);
+}
+
+// As RunSse2, eight bricks at a time, gathering the fields of each batch.
+AVX2_FUNCTION UINT FrustumCuller::RunAvx2(const DrawVoxelCommand* commands, UINT count, DrawVoxelCommand* out) const
+{
+	UINT visible = 0;
+	UINT n = 0;
+
+	const UINT stride = sizeof(DrawVoxelCommand) / sizeof(UINT);
+	const __m256i dataOffsets = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(stride));
+	const __m256i instanceOffsets = _mm256_add_epi32(dataOffsets,
+		_mm256_set1_epi32((offsetof(DrawVoxelCommand, DrawArguments) + offsetof(DrawVoxelArguments, InstanceCount)) / sizeof(UINT)));
+	const __m256 one = _mm256_set1_ps(1.0f);
+	const __m256 minusOne = _mm256_set1_ps(-1.0f);
+	const __m256 radius = _mm256_set1_ps(mRadius);
+
+	for (; n + 8 <= count; n += 8)
+	{
+		const int* base = reinterpret_cast<const int*>(commands + n);
+		__m256i index = _mm256_i32gather_epi32(base, dataOffsets, 4);
+		__m256i instances = _mm256_i32gather_epi32(base, instanceOffsets, 4);
+
+		// Brick centres in SoA form.
+		__m256 c[3];
+		c[0] = _mm256_cvtepi32_ps(_mm256_and_si256(index, _mm256_set1_epi32(cWidthInBricks - 1)));
+		c[1] = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(index, WidthShift), _mm256_set1_epi32(cHeightInBricks - 1)));
+		c[2] = _mm256_cvtepi32_ps(_mm256_srli_epi32(index, SliceShift));
+		for (UINT a = 0; a < 3; a++)
+		{
+			c[a] = _mm256_add_ps(_mm256_mul_ps(c[a], _mm256_set1_ps(BrickSize[a])), _mm256_set1_ps(BrickSize[a] / 2.0f));
+		}
+
+		__m256 p[4];
+		for (UINT row = 0; row < 4; row++)
+		{
+			p[row] = _mm256_mul_ps(c[0], _mm256_set1_ps(mRows[row][0]));
+			p[row] = _mm256_add_ps(p[row], _mm256_mul_ps(c[1], _mm256_set1_ps(mRows[row][1])));
+			p[row] = _mm256_add_ps(p[row], _mm256_mul_ps(c[2], _mm256_set1_ps(mRows[row][2])));
+			p[row] = _mm256_add_ps(p[row], _mm256_set1_ps(mRows[row][3]));
+		}
+
+		__m256 w = _mm256_add_ps(p[3], _mm256_set1_ps(WEpsilon));
+		__m256 x = _mm256_div_ps(p[0], w);
+		__m256 y = _mm256_div_ps(p[1], w);
+		__m256 z = _mm256_div_ps(p[2], w);
+		__m256 r = _mm256_div_ps(radius, w);
+		__m256 upper = _mm256_add_ps(one, r);
+		__m256 lower = _mm256_sub_ps(minusOne, r);
+
+		// Test for rejection as the shader does, so a NaN from a zero w keeps the brick.
+		__m256 outside = _mm256_or_ps(_mm256_cmp_ps(x, upper, _CMP_GT_OQ), _mm256_cmp_ps(x, lower, _CMP_LT_OQ));
+		outside = _mm256_or_ps(outside, _mm256_or_ps(_mm256_cmp_ps(y, upper, _CMP_GT_OQ), _mm256_cmp_ps(y, lower, _CMP_LT_OQ)));
+		outside = _mm256_or_ps(outside, _mm256_or_ps(_mm256_cmp_ps(z, _mm256_sub_ps(_mm256_setzero_ps(), r), _CMP_LT_OQ), _mm256_cmp_ps(z, _mm256_set1_ps(NearClip), _CMP_GT_OQ)));
+		outside = _mm256_or_ps(outside, _mm256_castsi256_ps(_mm256_cmpeq_epi32(instances, _mm256_setzero_si256())));
+
+		int visibleMask = ~_mm256_movemask_ps(outside) & 0xff;
+		if (visibleMask == 0)
+		{
+			continue;
+		}
+
+		int farMask = _mm256_movemask_ps(_mm256_cmp_ps(p[3], _mm256_set1_ps(mLodDistance), _CMP_GT_OQ));
+		for (UINT lane = 0; lane < 8; lane++)
+		{
+			if (visibleMask & (1 << lane))
+			{
+				Emit(commands[n + lane], (farMask & (1 << lane)) != 0, out, visible);
+			}
+		}
+	}
+
+	// The tail that does not fill a batch.
+	return visible + RunScalar(commands + n, count - n, out + visible);
+}
+
+UINT FrustumCuller::Run(const DrawVoxelCommand* commands, UINT count, DrawVoxelCommand* out) const
+{
+	switch (GetSimdLevel(mSimd))
+	{
+		case SimdAvx2:	return RunAvx2(commands, count, out);
+		case SimdSse2:	return RunSse2(commands, count, out);
+		default:		return RunScalar(commands, count, out);
+	}
+}
+
+void FrustumCuller::Run(const std::vector<DrawVoxelCommand>& commands, std::vector<DrawVoxelCommand>& out) const
+{
+	out.resize(commands.size());
+	if (!commands.empty())
+	{
+		out.resize(Run(&commands[0], static_cast<UINT>(commands.size()), &out[0]));
+	}
+}
+
+UINT FrustumCuller::Run(const CullHierarchy& hierarchy, DrawVoxelCommand* out, CullStats* stats) const
+{
+	CullStats counts = {};
+	UINT visible = 0;
+
+	for (UINT group = 0; group < CullGroupCount; group++)
+	{
+		const UINT first = hierarchy.mGroupStart[group];
+		const UINT count = hierarchy.mGroupStart[group + 1] - first;
+		if (count == 0)
+		{
+			continue;
+		}
+
+		counts.mGroupTests++;
+		const DrawVoxelCommand* commands = &hierarchy.mCommands[first];
+		switch (ClassifyGroup(group))
+		{
+			case GroupCulled:
+				break;
+
+			case GroupVisible:
+				memcpy(out + visible, commands, count * sizeof(DrawVoxelCommand));
+				visible += count;
+				break;
+
+			case GroupVisibleFar:
+				for (UINT n = 0; n < count; n++)
+				{
+					Emit(commands[n], true, out, visible);
+				}
+				break;
+
+			case GroupPartial:
+				visible += Run(commands, count, out + visible);
+				counts.mBrickTests += count;
+				break;
+		}
+	}
+
+	if (stats)
+	{
+		*stats = counts;
+	}
+	return visible;
+}
+
+void FrustumCuller::Run(const CullHierarchy& hierarchy, std::vector<DrawVoxelCommand>& out, CullStats* stats) const
+{
+	out.resize(hierarchy.GetCommandCount());
+	if (!out.empty())
+	{
+		out.resize(Run(hierarchy, &out[0], stats));
+	}
+	else if (stats)
+	{
+		*stats = CullStats();
+	}
+}
+
+void CullHierarchy::Build(const std::vector<DrawVoxelCommand>& commands)
+{
+	// Counting sort on the group, which keeps brick order within each group.
+	std::fill(mGroupStart.begin(), mGroupStart.end(), 0);
+	for (const DrawVoxelCommand& command : commands)
+	{
+		if (command.DrawArguments.InstanceCount != 0)
+		{
+			mGroupStart[GetCullGroup(command.Data) + 1]++;
+		}
+	}
+
+	for (UINT group = 0; group < CullGroupCount; group++)
+	{
+		mGroupStart[group + 1] += mGroupStart[group];
+	}
+
+	mCommands.resize(mGroupStart[CullGroupCount]);
+	std::vector<UINT> next(mGroupStart.begin(), mGroupStart.end() - 1);
+	for (const DrawVoxelCommand& command : commands)
+	{
+		if (command.DrawArguments.InstanceCount != 0)
+		{
+			mCommands[next[GetCullGroup(command.Data)]++] = command;
+		}
+	}
+}
+
+double FrustumCuller::Benchmark(const CullHierarchy& hierarchy, UINT iterations) const
+{
+	std::vector<DrawVoxelCommand> out;
+	out.reserve(hierarchy.GetCommandCount());
+
+	auto start = std::chrono::high_resolution_clock::now();
+	for (UINT i = 0; i < iterations; i++)
+	{
+		Run(hierarchy, out);
+	}
+	std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+	return (double(hierarchy.GetCommandCount()) * iterations) / elapsed.count();
+}
+
+double FrustumCuller::Benchmark(const std::vector<DrawVoxelCommand>& commands, UINT iterations) const
+{
+	std::vector<DrawVoxelCommand> out;
+	out.reserve(commands.size());
+
+	auto start = std::chrono::high_resolution_clock::now();
+	for (UINT i = 0; i < iterations; i++)
+	{
+		Run(commands, out);
+	}
+	std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+	return (double(commands.size()) * iterations) / elapsed.count();
+}
@@ -0,0 +1,146 @@
+#pragma once
+
+#include "VoxelTypes.h"
+#include "Simd.h"
+#include <cfloat>
+
+class CullHierarchy;
+class VoxelMips;
+
+// CPU implementation of the frustum test in cull.hlsl. Each brick centre is
+// transformed by the view-projection and compared against the clip volume grown
+// by the brick's bounding radius. Bricks whose centre lies beyond the LOD distance
+// in w are flagged with FarBrickFlag and draw the faces of their level 1 cells
+// from the VoxelMips records instead of their own; beyond twice that distance
+// CoarseBrickFlag is added and they draw their level 2 voxel. Bricks with nothing
+// to draw at their level are dropped. Run() produces the same
+// commands that CSMain emits, in input order rather than the shader's distance
+// order (SortByDistance() applies that), so it doubles as a reference for the
+// shader and as a fallback when the compute queue is busy.
+//
+// Above SimdScalar, bricks are transformed in SoA batches (4 wide with SSE2, 8
+// wide with AVX2) using the same operations in the same order as the scalar
+// test, so every path accepts exactly the same bricks.
+//
+// The shader first tests each CullGroupWidth^3 group of bricks as a whole:
+// ClassifyGroup() bounds the group's brick centres and evaluates the brick test
+// in its w-multiplied, linear form at the extremes of that box. Groups that are
+// clearly outside, or clearly inside, every plane are settled by that one test;
+// only groups within a small margin of a plane fall back to the brick test, so
+// the hierarchical path accepts the same bricks as the flat one.
+class FrustumCuller
+{
+public:
+	static const UINT FarBrickFlag = cFarBrickFlag;			// Set in Data for bricks drawn from their LOD record.
+	static const UINT CoarseBrickFlag = cCoarseBrickFlag;	// Also set for bricks drawn at level 2.
+	static const UINT BrickIndexMask = ~(FarBrickFlag | CoarseBrickFlag);
+
+	enum GroupVisibility
+	{
+		GroupCulled,			// Every brick is outside the frustum.
+		GroupPartial,			// Needs the brick test.
+		GroupVisible,			// Every brick is inside and none is past the LOD distance.
+		GroupVisibleFar			// Every brick is inside and past the LOD distance.
+	};
+
+	// Tests made by one culling pass.
+	struct CullStats
+	{
+		UINT mGroupTests;
+		UINT mBrickTests;
+	};
+
+	FrustumCuller() :
+		mSimd(GetCpuSimdLevel()),
+		mRadius(0.0f),
+		mLodDistance(FLT_MAX),
+		mMips(nullptr)
+	{
+		SetProjection(XMFLOAT4X4(1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1));
+	}
+
+	// Takes the matrix as it is passed to cull.hlsl in CSCullConstants, i.e.
+	// the transposed view-projection.
+	void SetProjection(const XMFLOAT4X4& projection);
+
+	// Draws bricks past lodDistance in w from the records of mips. The default,
+	// FLT_MAX, draws every brick at full detail and needs no mips.
+	void SetLod(const VoxelMips* mips, float lodDistance);
+
+	// Writes the commands that survive culling to out (which must hold count
+	// entries) and returns how many there are. Commands with no instances are
+	// skipped, as the shader skips the slots the enclosure pass zeroed.
+	UINT Run(const DrawVoxelCommand* commands, UINT count, DrawVoxelCommand* out) const;
+	void Run(const std::vector<DrawVoxelCommand>& commands, std::vector<DrawVoxelCommand>& out) const;
+
+	// As Run(), but tests the groups of the hierarchy first and only runs the
+	// brick test on the commands of partially visible groups. out must hold
+	// every command in the hierarchy. Commands come out in group order.
+	UINT Run(const CullHierarchy& hierarchy, DrawVoxelCommand* out, CullStats* stats = nullptr) const;
+	void Run(const CullHierarchy& hierarchy, std::vector<DrawVoxelCommand>& out, CullStats* stats = nullptr) const;
+
+	// The shader's test for a single brick. Returns false when the brick is
+	// outside the frustum; otherwise isFar is set when it is past the LOD distance.
+	bool IsBrickVisible(UINT brick, bool& isFar) const;
+
+	// The shader's test for a whole group, indexed like bricks but in units of
+	// CullGroupWidth bricks.
+	GroupVisibility ClassifyGroup(UINT group) const;
+
+	// The distance bucket cull.hlsl puts a brick in: the view depth of its centre
+	// in units of cDistanceBucketDepth, clamped to the buckets.
+	UINT GetDistanceBucket(UINT brick) const;
+
+	// The shader's ordering of the commands it emits: a counting sort by distance
+	// bucket, nearest first. Within a bucket the shader's order depends on thread
+	// timing; here commands keep their input order. Writes count commands to out,
+	// which must not overlap commands, and the size of each bucket to bucketCounts
+	// when it is given.
+	void SortByDistance(const DrawVoxelCommand* commands, UINT count, DrawVoxelCommand* out, UINT* bucketCounts = nullptr) const;
+
+	// Commands processed per second over the given number of passes.
+	double Benchmark(const std::vector<DrawVoxelCommand>& commands, UINT iterations) const;
+	double Benchmark(const CullHierarchy& hierarchy, UINT iterations) const;
+
+	SimdLevel	mSimd;		// The widest kernel to use; clamped to what the CPU supports.
+
+private:
+	UINT RunScalar(const DrawVoxelCommand* commands, UINT count, DrawVoxelCommand* out) const;
+	UINT RunSse2(const DrawVoxelCommand* commands, UINT count, DrawVoxelCommand* out) const;
+	UINT RunAvx2(const DrawVoxelCommand* commands, UINT count, DrawVoxelCommand* out) const;
+
+	// Clip space w of the brick's centre.
+	float GetCentreW(UINT brick) const;
+
+	// Appends command to out, switching bricks past the LOD distance to their LOD record.
+	void Emit(DrawVoxelCommand command, bool isFar, DrawVoxelCommand* out, UINT& count) const;
+
+	float				mRows[4][4];	// Rows of the matrix as passed; HLSL reads them as columns, so clip[n] = dot(mRows[n], centre).
+	float				mRadius;		// Bounding radius of a brick before the divide by w.
+	float				mLodDistance;
+	const VoxelMips*	mMips;
+};
+
+// Commands sorted by the cull group their brick belongs to, so that the
+// commands of each group can be accepted, rejected or tested as a run.
+class CullHierarchy
+{
+public:
+	CullHierarchy() :
+		mGroupStart(CullGroupCount + 1, 0)
+	{}
+
+	// Commands without instances are left out, as they are never drawn.
+	void Build(const std::vector<DrawVoxelCommand>& commands);
+
+	UINT GetCommandCount() const { return static_cast<UINT>(mCommands.size()); }
+
+	std::vector<DrawVoxelCommand>	mCommands;		// Grouped commands, in brick order within each group.
+	std::vector<UINT>				mGroupStart;	// First command of each group; the last entry is the total.
+};
+
+static inline UINT GetCullGroup(UINT brick)
+{
+	XMUINT3 b = GetBrickCoords(brick);
+	return ((b.z / CullGroupWidth) * cCullGroupsY + (b.y / CullGroupWidth)) * cCullGroupsX + (b.x / CullGroupWidth);
+}
@@ -16,6 +16,13 @@
 const UINT D3D12ExecuteIndirect::CommandSizePerFrame = BrickCount * sizeof(IndirectCommand);
 const UINT D3D12ExecuteIndirect::CommandBufferCounterOffset = AlignForUavCounter(D3D12ExecuteIndirect::CommandSizePerFrame);
 const float D3D12ExecuteIndirect::VoxelHalfWidth = cVoxelHalfWidth;
+const float D3D12ExecuteIndirect::EditRadius = sqrtf(0.5f);
+const UINT D3D12ExecuteIndirect::MaxEditScale = 16;
+const UINT D3D12ExecuteIndirect::WorldSeed = 1;
+const UINT D3D12ExecuteIndirect::OcclusionWidth = 320;
+const float D3D12ExecuteIndirect::LodVoxelPixels = 4.0f;
+const LPCWSTR D3D12ExecuteIndirect::WorldFileName = L"world.vxt";
+const LPCWSTR D3D12ExecuteIndirect::JournalFileName = L"world.vxj";
 
 D3D12ExecuteIndirect::D3D12ExecuteIndirect(UINT width, UINT height, std::wstring name) :
 	DXSample(width, height, name),
@@ -27,13 +34,31 @@ D3D12ExecuteIndirect::D3D12ExecuteIndirect(UINT width, UINT height, std::wstring
 	m_cullingScissorRect(),
 	m_rtvDescriptorSize(0),
 	m_cbvSrvUavDescriptorSize(0),
+	m_voxelWordCapacity(0),
+	m_faceWordCapacity(0),
+	m_greedyMeshing(false),
+	m_meshingChanged(false),
+	m_lodEnabled(true),
+	m_pLodDataBegin(nullptr),
 	m_csRootConstants(),
-	m_Yaw(0)
+	m_Yaw(0),
+	m_worldType(WorldSample),
+	m_RegenerateWorld(false),
+	m_loadWorld(false),
+	m_cpuCulling(false),
+	m_enclosedCommandsDirty(true),
+	m_occlusionRasterizer(OcclusionWidth, (OcclusionWidth * height + width - 1) / width),
+	m_occlusionCulling(false),
+	m_drawnBudgets(),
+	m_titleFrames(0),
+	m_dirtyBricks(true, BrickCount / 4),
+	m_dirtyUploads(false, DirtyBricks::UploadListLength)
 {
 	ZeroMemory(m_fenceValues, sizeof(m_fenceValues));
-	m_constantBufferData.resize(VoxelCount);
+	ZeroMemory(m_pCpuCullCommandsBegin, sizeof(m_pCpuCullCommandsBegin));
 
 	m_csRootConstants.commandCount = BrickCount;
+	m_csRootConstants.brickListCount = 0;
 
 	m_viewport.Width = static_cast<float>(width);
 	m_viewport.Height = static_cast<float>(height);
@@ -43,7 +68,10 @@ D3D12ExecuteIndirect::D3D12ExecuteIndirect(UINT width, UINT height, std::wstring
 	m_scissorRect.bottom = static_cast<LONG>(height);
 
 	m_Position = XMFLOAT3(-0.1f * cWidth/2 , -0.1f * cHeight/2, -0.1f * cDepth/2);
-	m_VoxOp = None;
+	m_undoEdit = false;
+	m_redoEdit = false;
+	m_editShape = EditSphere;
+	m_editSize = EditRadius;
 }
 
 void D3D12ExecuteIndirect::OnInit()
@@ -211,6 +239,14 @@ void D3D12ExecuteIndirect::LoadAssets()
 		CD3DX12_DESCRIPTOR_RANGE1 voxelranges[1];
 		voxelranges[0].Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 1, 0, 0, D3D12_DESCRIPTOR_RANGE_FLAG_DATA_STATIC);
 		rootParameters[Cbv].InitAsDescriptorTable(1, &voxelranges[0], D3D12_SHADER_VISIBILITY_VERTEX); //D3D12_ROOT_DESCRIPTOR_FLAG_DATA_STATIC, D3D12_SHADER_VISIBILITY_VERTEX);
+
+		CD3DX12_DESCRIPTOR_RANGE1 faceranges[1];
+		faceranges[0].Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 1, 1, 0, D3D12_DESCRIPTOR_RANGE_FLAG_DATA_STATIC);
+		rootParameters[Faces].InitAsDescriptorTable(1, &faceranges[0], D3D12_SHADER_VISIBILITY_VERTEX);
+
+		CD3DX12_DESCRIPTOR_RANGE1 lodranges[1];
+		lodranges[0].Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 1, 2, 0, D3D12_DESCRIPTOR_RANGE_FLAG_DATA_STATIC);
+		rootParameters[Lods].InitAsDescriptorTable(1, &lodranges[0], D3D12_SHADER_VISIBILITY_VERTEX);
 		
 		rootParameters[View].InitAsConstants(ViewInUInt32s, 1); 
 
@@ -241,7 +277,7 @@ void D3D12ExecuteIndirect::LoadAssets()
 		// Create compute signature.
 		{
 			CD3DX12_DESCRIPTOR_RANGE1 ranges[2];
-			ranges[0].Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 2, 0, 0, D3D12_DESCRIPTOR_RANGE_FLAG_DATA_STATIC);
+			ranges[0].Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 5, 0, 0, D3D12_DESCRIPTOR_RANGE_FLAG_DATA_STATIC);
 			ranges[1].Init(D3D12_DESCRIPTOR_RANGE_TYPE_UAV, 1, 0, 0, D3D12_DESCRIPTOR_RANGE_FLAG_DATA_VOLATILE);
 
 			CD3DX12_ROOT_PARAMETER1 computeRootParameters[ComputeRootParametersCount];
@@ -260,11 +296,11 @@ void D3D12ExecuteIndirect::LoadAssets()
 			CD3DX12_ROOT_PARAMETER1 cullRootParameters[CullRootParametersCount];
 
 			CD3DX12_DESCRIPTOR_RANGE1 srvranges[1];
-			srvranges[0].Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 2, 0, 0, D3D12_DESCRIPTOR_RANGE_FLAG_DATA_STATIC);
+			srvranges[0].Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 3, 0, 0, D3D12_DESCRIPTOR_RANGE_FLAG_DATA_STATIC);
 			cullRootParameters[SrvTable].InitAsDescriptorTable(1, srvranges);
 
 			CD3DX12_DESCRIPTOR_RANGE1 uavranges[1];
-			uavranges[0].Init(D3D12_DESCRIPTOR_RANGE_TYPE_UAV, 1, 0, 0, D3D12_DESCRIPTOR_RANGE_FLAG_DATA_VOLATILE);
+			uavranges[0].Init(D3D12_DESCRIPTOR_RANGE_TYPE_UAV, 2, 0, 0, D3D12_DESCRIPTOR_RANGE_FLAG_DATA_VOLATILE);
 			cullRootParameters[UavTable].InitAsDescriptorTable(1, uavranges);
 
 			cullRootParameters[CullRootConstants].InitAsConstants(CullConstantsInU32, 0);
@@ -465,95 +501,122 @@ void D3D12ExecuteIndirect::LoadAssets()
 		m_device->CreateShaderResourceView(m_texture.Get(), &srvDesc, cbvSrvHandle); 
 	}
 
-	// Create the constant buffers.
+	// Load the saved world, or generate one, replay the edits made since and create
+	// the buffer the voxels are uploaded to.
 	{
+		if (!LoadWorld())
+		{
+			CreateWorldGenerator(m_worldType, WorldSeed)->Generate(m_voxelPool, ThreadPool::Default());
+			OpenJournal();
+		}
+		CreateVoxelBuffer();
+	}
 
-		const UINT constantBufferDataSize = VoxelCount * FrameCount * sizeof(SceneConstantBuffer);
+	// Create the brick occupancy masks that the enclosure pass tests instead of scanning voxels.
+	{
+		const UINT brickMaskDataSize = BrickCount * FrameCount * sizeof(UINT64);
 
 		ThrowIfFailed(m_device->CreateCommittedResource(
 			&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD),
 			D3D12_HEAP_FLAG_NONE,
-			&CD3DX12_RESOURCE_DESC::Buffer(constantBufferDataSize),
+			&CD3DX12_RESOURCE_DESC::Buffer(brickMaskDataSize),
 			D3D12_RESOURCE_STATE_GENERIC_READ,
 			nullptr,
-			IID_PPV_ARGS(&m_constantBuffer)));
+			IID_PPV_ARGS(&m_brickMaskBuffer)));
 
-		NAME_D3D12_OBJECT(m_constantBuffer);
+		NAME_D3D12_OBJECT(m_brickMaskBuffer);
+
+		m_brickOccupancy.Build(m_voxelPool);
+		m_brickFaces.Build(m_brickOccupancy);
+		m_voxelMips.Build(m_voxelPool, ThreadPool::Default());
 
-		for (int bz = 0; bz < cDepthInBricks; bz++)
 		{
-			for (int by = 0; by < cHeightInBricks; by++)
-			{
-				for (int bx = 0; bx < cWidthInBricks; bx++)
-				{
-					for (int vz = 0; vz < cBrickDepth; vz++)
-					{
-						for (int vy = 0; vy < cBrickHeight; vy++)
-						{
-							for (int vx = 0; vx < cBrickWidth; vx++)
-							{
-								UINT brick = bz * (cWidthInBricks*cHeightInBricks) + by * cWidthInBricks + bx;
-								UINT voxel = vz * (cBrickWidth*cBrickHeight) + vy * cBrickWidth + vx;
-								UINT n = brick * VoxelsPerBrick + voxel;
-
-								UINT x = bx * cBrickWidth + vx;
-								UINT y = by * cBrickHeight + vy;
-								UINT z = bz * cBrickDepth + vz;
-
-								auto v0 = (cos((float)x / Width * 3.141f * 4.0f + 1.0f));
-								auto v1 = (sin((float)z / Depth * 3.141f * 4.0f + 1.0f));
-
-								auto v3 = (v0*v1) / 2.0f + 0.5f;
-								auto surface = v3*(Height / 1 - 1);
-								if (y < surface  && y > (surface-6) )
-								{
-									int tx = 13;  //rand() % 16;
-									int ty = 4 * 16; // rand() % 16;
-									tx += 6 * 256;
-									ty += 3 * (256 * 16);
-									m_constantBufferData[n].color = rand() % 65536; // tx + ty; //XMFLOAT2((float)tx / 16.0f, (float)ty / 16.0f);// , GetRandomFloat(0.0f, 1.0f), 1.0f);
-								}
-								else if (y < (surface- 2))
-								{
-									int tx = 2;  //rand() % 16;
-									int ty = 0; // rand() % 16;
-									m_constantBufferData[n].color = rand() % 65536; // tx + ty * 16; // XMFLOAT2((float)tx / 16.0f, (float)ty / 16.0f); // , GetRandomFloat(0.0f, 1.0f), 1.0f);
-								} 
-								else
-								{
-									m_constantBufferData[n].color = 0; // XMFLOAT2(0, 0);
-								}
-							}
-						}
-					}
-				}
-			}
+			CD3DX12_RANGE readRange(0, 0);		// We do not intend to read from this resource on the CPU.
+			ThrowIfFailed(m_brickMaskBuffer->Map(0, &readRange, reinterpret_cast<void**>(&m_pBrickMaskDataBegin)));
 		}
 
+		// The LOD records the cull and vertex shaders read for distant bricks, one slot per frame.
+		const UINT lodDataSize = BrickCount * VoxelMips::LodRecordWords * FrameCount * sizeof(UINT);
+
+		ThrowIfFailed(m_device->CreateCommittedResource(
+			&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD),
+			D3D12_HEAP_FLAG_NONE,
+			&CD3DX12_RESOURCE_DESC::Buffer(lodDataSize),
+			D3D12_RESOURCE_STATE_GENERIC_READ,
+			nullptr,
+			IID_PPV_ARGS(&m_lodBuffer)));
+
+		NAME_D3D12_OBJECT(m_lodBuffer);
+
 		{
 			CD3DX12_RANGE readRange(0, 0);		// We do not intend to read from this resource on the CPU.
-			ThrowIfFailed(m_constantBuffer->Map(0, &readRange, reinterpret_cast<void**>(&m_pCbvDataBegin)));
-			const size_t size = VoxelCount * sizeof(SceneConstantBuffer);
-			memcpy(m_pCbvDataBegin, &m_constantBufferData[0], size);
+			ThrowIfFailed(m_lodBuffer->Map(0, &readRange, reinterpret_cast<void**>(&m_pLodDataBegin)));
 		}
 
-		// Create shader resource views (SRV) of the constant buffers for the
-		// compute shader to read from.
+		CreateFaceBuffer();
+
+		// Fill the first slot; the other is filled when the first edit moves to it.
+		UploadVoxels(0);
+
 		D3D12_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
 		srvDesc.Format = DXGI_FORMAT_UNKNOWN;
 		srvDesc.ViewDimension = D3D12_SRV_DIMENSION_BUFFER;
 		srvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
-		srvDesc.Buffer.NumElements = VoxelCount;
-		srvDesc.Buffer.StructureByteStride = sizeof(SceneConstantBuffer);
+		srvDesc.Buffer.NumElements = BrickCount;
+		srvDesc.Buffer.StructureByteStride = sizeof(UINT64);
 		srvDesc.Buffer.Flags = D3D12_BUFFER_SRV_FLAG_NONE;
-		srvDesc.Buffer.FirstElement = 0;
 
-		CD3DX12_CPU_DESCRIPTOR_HANDLE cbvSrvHandle(m_cbvSrvUavHeap->GetCPUDescriptorHandleForHeapStart(), CbvSrvOffset + NumTexture, m_cbvSrvUavDescriptorSize);
+		CD3DX12_CPU_DESCRIPTOR_HANDLE brickMaskHandle(m_cbvSrvUavHeap->GetCPUDescriptorHandleForHeapStart(), BrickMaskOffset + NumTexture, m_cbvSrvUavDescriptorSize);
 		for (int i = 0; i < FrameCount; i++)
 		{
-			srvDesc.Buffer.FirstElement = i * VoxelCount;
-			m_device->CreateShaderResourceView(m_constantBuffer.Get(), &srvDesc, cbvSrvHandle);
-			cbvSrvHandle.Offset(CbvSrvUavDescriptorCountPerFrame, m_cbvSrvUavDescriptorSize);
+			srvDesc.Buffer.FirstElement = i * BrickCount;
+			m_device->CreateShaderResourceView(m_brickMaskBuffer.Get(), &srvDesc, brickMaskHandle);
+			brickMaskHandle.Offset(CbvSrvUavDescriptorCountPerFrame, m_cbvSrvUavDescriptorSize);
+		}
+
+		srvDesc.Buffer.NumElements = BrickCount * VoxelMips::LodRecordWords;
+		srvDesc.Buffer.StructureByteStride = sizeof(UINT);
+
+		CD3DX12_CPU_DESCRIPTOR_HANDLE lodHandle(m_cbvSrvUavHeap->GetCPUDescriptorHandleForHeapStart(), LodBufferOffset + NumTexture, m_cbvSrvUavDescriptorSize);
+		for (int i = 0; i < FrameCount; i++)
+		{
+			srvDesc.Buffer.FirstElement = i * BrickCount * VoxelMips::LodRecordWords;
+			m_device->CreateShaderResourceView(m_lodBuffer.Get(), &srvDesc, lodHandle);
+			lodHandle.Offset(CbvSrvUavDescriptorCountPerFrame, m_cbvSrvUavDescriptorSize);
+		}
+	}
+
+	// Create the lists of dirty bricks that limit the enclosure pass after an edit.
+	{
+		const UINT dirtyBrickListSize = BrickCount * FrameCount * sizeof(UINT);
+
+		ThrowIfFailed(m_device->CreateCommittedResource(
+			&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD),
+			D3D12_HEAP_FLAG_NONE,
+			&CD3DX12_RESOURCE_DESC::Buffer(dirtyBrickListSize),
+			D3D12_RESOURCE_STATE_GENERIC_READ,
+			nullptr,
+			IID_PPV_ARGS(&m_dirtyBrickListBuffer)));
+
+		NAME_D3D12_OBJECT(m_dirtyBrickListBuffer);
+
+		CD3DX12_RANGE readRange(0, 0);		// We do not intend to read from this resource on the CPU.
+		ThrowIfFailed(m_dirtyBrickListBuffer->Map(0, &readRange, reinterpret_cast<void**>(&m_pDirtyBrickListBegin)));
+
+		D3D12_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+		srvDesc.Format = DXGI_FORMAT_UNKNOWN;
+		srvDesc.ViewDimension = D3D12_SRV_DIMENSION_BUFFER;
+		srvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+		srvDesc.Buffer.NumElements = BrickCount;
+		srvDesc.Buffer.StructureByteStride = sizeof(UINT);
+		srvDesc.Buffer.Flags = D3D12_BUFFER_SRV_FLAG_NONE;
+
+		CD3DX12_CPU_DESCRIPTOR_HANDLE dirtyBrickListHandle(m_cbvSrvUavHeap->GetCPUDescriptorHandleForHeapStart(), DirtyBrickListOffset + NumTexture, m_cbvSrvUavDescriptorSize);
+		for (int i = 0; i < FrameCount; i++)
+		{
+			srvDesc.Buffer.FirstElement = i * BrickCount;
+			m_device->CreateShaderResourceView(m_dirtyBrickListBuffer.Get(), &srvDesc, dirtyBrickListHandle);
+			dirtyBrickListHandle.Offset(CbvSrvUavDescriptorCountPerFrame, m_cbvSrvUavDescriptorSize);
 		}
 	}
 
@@ -695,12 +758,12 @@ void D3D12ExecuteIndirect::LoadAssets()
 				processedCommandsCountHandle.Offset(CbvSrvUavDescriptorCountPerFrame, m_cbvSrvUavDescriptorSize);
 			}
 
-			// Allocate a buffer that can be used to reset the UAV counters and initialize
-			// it to 0.
+			// Allocate a buffer that can be used to reset the UAV counters and the
+			// distance buckets and initialize it to 0.
 			ThrowIfFailed(m_device->CreateCommittedResource(
 				&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD),
 				D3D12_HEAP_FLAG_NONE,
-				&CD3DX12_RESOURCE_DESC::Buffer(sizeof(UINT)),
+				&CD3DX12_RESOURCE_DESC::Buffer(DistanceBucketCount * 2 * sizeof(UINT)),
 				D3D12_RESOURCE_STATE_GENERIC_READ,
 				nullptr,
 				IID_PPV_ARGS(&m_processedCommandBufferCounterReset)));
@@ -708,8 +771,19 @@ void D3D12ExecuteIndirect::LoadAssets()
 			UINT8* pMappedCounterReset = nullptr;
 			CD3DX12_RANGE readRange(0, 0);		// We do not intend to read from this resource on the CPU.
 			ThrowIfFailed(m_processedCommandBufferCounterReset->Map(0, &readRange, reinterpret_cast<void**>(&pMappedCounterReset)));
-			ZeroMemory(pMappedCounterReset, sizeof(UINT));
+			ZeroMemory(pMappedCounterReset, DistanceBucketCount * 2 * sizeof(UINT));
 			m_processedCommandBufferCounterReset->Unmap(0, nullptr);
+
+			// Allocate a buffer each frame's visible command count is copied back to.
+			ThrowIfFailed(m_device->CreateCommittedResource(
+				&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_READBACK),
+				D3D12_HEAP_FLAG_NONE,
+				&CD3DX12_RESOURCE_DESC::Buffer(FrameCount * sizeof(UINT)),
+				D3D12_RESOURCE_STATE_COPY_DEST,
+				nullptr,
+				IID_PPV_ARGS(&m_commandCountReadback)));
+
+			NAME_D3D12_OBJECT(m_commandCountReadback);
 		}
 
 		{
@@ -748,6 +822,56 @@ void D3D12ExecuteIndirect::LoadAssets()
 				processedCommandsHandle.Offset(CbvSrvUavDescriptorCountPerFrame, m_cbvSrvUavDescriptorSize);
 			}
 		}
+
+		{
+			// Create the buffers the cull shader counts the commands of each distance
+			// bucket in, followed by a cursor per bucket.
+			CD3DX12_CPU_DESCRIPTOR_HANDLE distanceBucketsHandle(m_cbvSrvUavHeap->GetCPUDescriptorHandleForHeapStart(), DistanceBucketsOffset + NumTexture, m_cbvSrvUavDescriptorSize);
+			for (UINT frame = 0; frame < FrameCount; frame++)
+			{
+				ThrowIfFailed(m_device->CreateCommittedResource(
+					&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT),
+					D3D12_HEAP_FLAG_NONE,
+					&CD3DX12_RESOURCE_DESC::Buffer(DistanceBucketCount * 2 * sizeof(UINT), D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS),
+					D3D12_RESOURCE_STATE_COPY_DEST,
+					nullptr,
+					IID_PPV_ARGS(&m_distanceBucketBuffers[frame])));
+
+				NAME_D3D12_OBJECT_INDEXED(m_distanceBucketBuffers, frame);
+
+				D3D12_UNORDERED_ACCESS_VIEW_DESC uavDesc = {};
+				uavDesc.Format = DXGI_FORMAT_UNKNOWN;
+				uavDesc.ViewDimension = D3D12_UAV_DIMENSION_BUFFER;
+				uavDesc.Buffer.FirstElement = 0;
+				uavDesc.Buffer.NumElements = DistanceBucketCount * 2;
+				uavDesc.Buffer.StructureByteStride = sizeof(UINT);
+				uavDesc.Buffer.CounterOffsetInBytes = 0;
+				uavDesc.Buffer.Flags = D3D12_BUFFER_UAV_FLAG_NONE;
+
+				m_device->CreateUnorderedAccessView(m_distanceBucketBuffers[frame].Get(), nullptr, &uavDesc, distanceBucketsHandle);
+				distanceBucketsHandle.Offset(CbvSrvUavDescriptorCountPerFrame, m_cbvSrvUavDescriptorSize);
+			}
+		}
+
+		{
+			// Create the upload buffers the CPU culling fallback writes its commands
+			// and count to, laid out like the culled command buffers.
+			for (UINT frame = 0; frame < FrameCount; frame++)
+			{
+				ThrowIfFailed(m_device->CreateCommittedResource(
+					&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD),
+					D3D12_HEAP_FLAG_NONE,
+					&CD3DX12_RESOURCE_DESC::Buffer(CommandBufferCounterOffset + sizeof(UINT)),
+					D3D12_RESOURCE_STATE_GENERIC_READ,
+					nullptr,
+					IID_PPV_ARGS(&m_cpuCullCommandBuffers[frame])));
+
+				NAME_D3D12_OBJECT_INDEXED(m_cpuCullCommandBuffers, frame);
+
+				CD3DX12_RANGE readRange(0, 0);		// We do not intend to read from this resource on the CPU.
+				ThrowIfFailed(m_cpuCullCommandBuffers[frame]->Map(0, &readRange, reinterpret_cast<void**>(&m_pCpuCullCommandsBegin[frame])));
+			}
+		}
 	}
 
 	// Close the command list and execute it to begin the vertex buffer copy into
@@ -819,43 +943,812 @@ XMFLOAT3 D3D12ExecuteIndirect::GetVoxelPositionFromIndex(UINT index) const
 					   (brick.z * cBrickDepth + voxel.z) * Scale );
 }
 
-// Update frame-based values.
-void D3D12ExecuteIndirect::OnUpdate()
+// Time the CPU voxel passes against the current volume and report to the debugger.
+void D3D12ExecuteIndirect::RunBenchmarks()
+{
+	char buffer[256];
+	const UINT iterations = 8;
+
+	sprintf_s(buffer, "Voxels: %u of %u bricks mixed, %.1f MB resident against %.1f MB dense\n",
+		m_voxelPool.MixedBrickCount(), BrickCount, m_voxelPool.ResidentBytes() / 1048576.0, VoxelCount * sizeof(Voxel) / 1048576.0);
+	OutputDebugStringA(buffer);
+
+	sprintf_s(buffer, "Voxels: mixed brick formats 1 bit %u, 2 bit %u, 4 bit %u, 8 bit %u, raw %u; encode %.1f Mbricks/sec, decode %.1f Mbricks/sec\n",
+		m_voxelPool.BrickCountInFormat(BrickFormatPalette1), m_voxelPool.BrickCountInFormat(BrickFormatPalette2),
+		m_voxelPool.BrickCountInFormat(BrickFormatPalette4), m_voxelPool.BrickCountInFormat(BrickFormatPalette8),
+		m_voxelPool.BrickCountInFormat(BrickFormatRaw),
+		m_voxelPool.BenchmarkEncode(iterations) / 1.0e6, m_voxelPool.BenchmarkDecode(iterations) / 1.0e6);
+	OutputDebugStringA(buffer);
+
+	// The voxel scanning passes work on a dense copy.
+	std::vector<Voxel> voxels(VoxelCount);
+	m_voxelPool.Decode(&voxels[0]);
+
+	std::vector<DrawVoxelCommand> commands;
+	m_enclosurePass.Run(&voxels[0], commands, ThreadPool::Default());
+	double bricksPerSecond = m_enclosurePass.Benchmark(&voxels[0], ThreadPool::Default(), iterations);
+
+	sprintf_s(buffer, "Enclosure: %u threads, %u of %u bricks visible, %.1f Mbricks/sec\n",
+		ThreadPool::Default().mThreadCount, static_cast<UINT>(commands.size()), BrickCount, bricksPerSecond / 1.0e6);
+	OutputDebugStringA(buffer);
+
+	FrustumCuller culler;
+	culler.SetProjection(m_View.projection);
+	culler.SetLod(&m_voxelMips, GetLodDistance());
+	std::vector<DrawVoxelCommand> culled;
+	culler.Run(commands, culled);
+	UINT farBricks = 0;
+	for (const DrawVoxelCommand& command : culled)
+	{
+		farBricks += (command.Data & FrustumCuller::FarBrickFlag) ? 1 : 0;
+	}
+
+	culler.mSimd = SimdScalar;
+	double scalarCullsPerSecond = culler.Benchmark(commands, iterations * 4);
+	culler.mSimd = GetCpuSimdLevel();
+	double cullsPerSecond = culler.Benchmark(commands, iterations * 4);
+
+	sprintf_s(buffer, "Frustum: %u of %u bricks visible (%u far), scalar %.1f Mbricks/sec, %s %.1f Mbricks/sec\n",
+		static_cast<UINT>(culled.size()), static_cast<UINT>(commands.size()), farBricks, scalarCullsPerSecond / 1.0e6, GetSimdLevelName(culler.mSimd), cullsPerSecond / 1.0e6);
+	OutputDebugStringA(buffer);
+
+	// Rebuild the mip levels of a copy, and compare the instances the visible
+	// bricks draw from the current camera with and without their LOD records.
+	VoxelMips mips;
+	mips.mSimd = SimdScalar;
+	double scalarMipVoxelsPerSecond = mips.Benchmark(m_voxelPool, ThreadPool::Default(), iterations);
+	mips.mSimd = GetCpuSimdLevel();
+	double mipVoxelsPerSecond = mips.Benchmark(m_voxelPool, ThreadPool::Default(), iterations);
+
+	std::vector<DrawVoxelCommand> drawn(commands);
+	for (DrawVoxelCommand& command : drawn)
+	{
+		command.DrawArguments.InstanceCount = GetDrawLists().GetCount(command.Data);
+	}
+
+	UINT64 lodInstances[2] = {};
+	for (UINT lod = 0; lod < 2; lod++)
+	{
+		culler.SetLod(&m_voxelMips, lod ? GetLodDistance() : FLT_MAX);
+		culler.Run(drawn, culled);
+		for (const DrawVoxelCommand& command : culled)
+		{
+			lodInstances[lod] += command.DrawArguments.InstanceCount;
+		}
+	}
+	culler.SetLod(&m_voxelMips, GetLodDistance());
+
+	sprintf_s(buffer, "LOD: level 1 %u of %u bricks occupied, level 2 %u of %u; %llu visible instances at full detail, %llu with LOD past %.1f (%.1f%%); mip build scalar %.1f Mvoxels/sec, %s %.1f Mvoxels/sec\n",
+		m_voxelMips.GetOccupiedBrickCount(1), m_voxelMips.GetBrickCount(1), m_voxelMips.GetOccupiedBrickCount(2), m_voxelMips.GetBrickCount(2),
+		lodInstances[0], lodInstances[1], GetLodDistance(), 100.0 * double(lodInstances[1]) / double(lodInstances[0] ? lodInstances[0] : 1),
+		scalarMipVoxelsPerSecond / 1.0e6, GetSimdLevelName(mips.mSimd), mipVoxelsPerSecond / 1.0e6);
+	OutputDebugStringA(buffer);
+
+	// Compare the tests the flat and hierarchical passes make from the current
+	// camera and from a few fixed ones: over the volume's centre looking along
+	// each axis, and from a corner looking across it.
+	CullHierarchy hierarchy;
+	hierarchy.Build(commands);
+
+	const XMFLOAT3 centre(-0.1f * cWidth / 2, -0.1f * cHeight / 2, -0.1f * cDepth / 2);
+	const XMFLOAT3 cameraPositions[] = { m_Position, centre, centre, XMFLOAT3(-0.5f, -0.1f * cHeight, -0.5f) };
+	const float cameraYaws[] = { m_Yaw, 0.0f, XM_PIDIV2, -XM_PIDIV4 };
+
+	for (UINT camera = 0; camera < _countof(cameraPositions); camera++)
+	{
+		culler.SetProjection(GetViewProjection(cameraPositions[camera], cameraYaws[camera]));
+
+		FrustumCuller::CullStats stats;
+		std::vector<DrawVoxelCommand> hierarchyCulled;
+		culler.Run(hierarchy, hierarchyCulled, &stats);
+
+		double flatPerSecond = culler.Benchmark(commands, iterations * 4);
+		double hierarchyPerSecond = culler.Benchmark(hierarchy, iterations * 4);
+
+		sprintf_s(buffer, "Hierarchy camera %u: %u visible, flat %u tests %.1f Mbricks/sec, hierarchical %u group + %u brick tests %.1f Mbricks/sec\n",
+			camera, static_cast<UINT>(hierarchyCulled.size()), static_cast<UINT>(commands.size()), flatPerSecond / 1.0e6,
+			stats.mGroupTests, stats.mBrickTests, hierarchyPerSecond / 1.0e6);
+		OutputDebugStringA(buffer);
+	}
+
+	// Replay the visible counts of a camera turning on the spot through the command
+	// budget, at a slow turn and at a full turn a second, to see how far
+	// MaxCommandCount comes down and how often a turn outruns the readback.
+	const UINT turnFrames[] = { 600, 60 };
+	for (UINT turn = 0; turn < _countof(turnFrames); turn++)
+	{
+		std::vector<UINT> counts(turnFrames[turn]);
+		std::vector<DrawVoxelCommand> turnCulled;
+		for (UINT frame = 0; frame < turnFrames[turn]; frame++)
+		{
+			culler.SetProjection(GetViewProjection(m_Position, m_Yaw + XM_2PI * frame / turnFrames[turn]));
+			culler.Run(hierarchy, turnCulled);
+			counts[frame] = static_cast<UINT>(turnCulled.size());
+		}
+
+		CommandBudget::BudgetStats stats = CommandBudget::Simulate(&counts[0], turnFrames[turn], FrameCount, hierarchy.GetCommandCount());
+		sprintf_s(buffer, "Command budget, turn over %u frames: %.0f visible and %.0f max commands on average (of %u), peak %u, %u overflows\n",
+			turnFrames[turn], double(stats.mTotalCount) / (stats.mFrames ? stats.mFrames : 1), double(stats.mTotalBudget) / (stats.mFrames ? stats.mFrames : 1),
+			BrickCount, stats.mPeakCount, stats.mOverflows);
+		OutputDebugStringA(buffer);
+	}
+
+	// Without a CPU depth buffer to hand the pyramid stays clear, so this measures
+	// the cost of the test rather than how much it rejects.
+	DepthPyramid pyramid;
+	pyramid.Resize(static_cast<UINT>(m_viewport.Width), static_cast<UINT>(m_viewport.Height));
+	double texelsPerSecond = pyramid.Benchmark(iterations);
+
+	OcclusionCuller occlusion;
+	occlusion.SetProjection(m_View.projection, pyramid.GetWidth(), pyramid.GetHeight());
+	double occlusionTestsPerSecond = occlusion.Benchmark(pyramid, culled, iterations * 4);
+
+	sprintf_s(buffer, "Hi-Z: %ux%u pyramid with %u levels, build %.0f Mtexels/sec, brick test %.1f Mbricks/sec\n",
+		pyramid.GetWidth(), pyramid.GetHeight(), pyramid.GetLevelCount(), texelsPerSecond / 1.0e6, occlusionTestsPerSecond / 1.0e6);
+	OutputDebugStringA(buffer);
+
+	OcclusionRasterizer rasterizer(OcclusionWidth, (OcclusionWidth * static_cast<UINT>(m_viewport.Height) + static_cast<UINT>(m_viewport.Width) - 1) / static_cast<UINT>(m_viewport.Width));
+	double rasterizedPerSecond = rasterizer.Benchmark(m_View.projection, m_brickOccupancy, culled, ThreadPool::Default(), iterations);
+
+	sprintf_s(buffer, "Occlusion rasterizer: %ux%u, %u occluders, %u of %u bricks occluded, %.1f Mbricks/sec\n",
+		rasterizer.GetPyramid().GetWidth(), rasterizer.GetPyramid().GetHeight(), rasterizer.mStats.mOccluders,
+		rasterizer.mStats.mOccluded, rasterizer.mStats.mTested, rasterizedPerSecond / 1.0e6);
+	OutputDebugStringA(buffer);
+
+	// Overdraw from a software depth test at the occlusion buffer's size, with the
+	// culled commands in input order and in the distance order cull.hlsl emits.
+	UINT bucketCounts[DistanceBucketCount] = {};
+	std::vector<DrawVoxelCommand> sorted(culled.size());
+	culler.SetProjection(m_View.projection);
+	if (!culled.empty())
+	{
+		culler.SortByDistance(&culled[0], static_cast<UINT>(culled.size()), &sorted[0], bucketCounts);
+	}
+
+	OcclusionCuller overdraw;
+	overdraw.SetProjection(m_View.projection, rasterizer.GetPyramid().GetWidth(), rasterizer.GetPyramid().GetHeight());
+	UINT usedBuckets = 0;
+	for (UINT count : bucketCounts)
+	{
+		usedBuckets += count ? 1 : 0;
+	}
+
+	sprintf_s(buffer, "Distance buckets: %u commands in %u of %u buckets, overdraw %.2f in input order, %.2f nearest first\n",
+		static_cast<UINT>(culled.size()), usedBuckets, DistanceBucketCount,
+		overdraw.EstimateOverdraw(culled.data(), static_cast<UINT>(culled.size())),
+		overdraw.EstimateOverdraw(sorted.data(), static_cast<UINT>(sorted.size())));
+	OutputDebugStringA(buffer);
+
+	// Faces the vertex shader runs for over every brick the enclosure pass keeps,
+	// six per voxel before the face lists and one per exposed face after.
+	std::vector<DrawVoxelCommand> enclosed;
+	m_enclosurePass.Run(m_brickOccupancy, enclosed, ThreadPool::Default());
+
+	UINT64 allFaces = 0;
+	UINT64 exposedFaces = 0;
+	for (const DrawVoxelCommand& command : enclosed)
+	{
+		allFaces += command.DrawArguments.InstanceCount;
+		exposedFaces += m_brickFaces.GetFaceCount(command.Data);
+	}
+
+	BrickFaces faces;
+	double faceBricksPerSecond = faces.Benchmark(m_brickOccupancy, iterations);
+
+	sprintf_s(buffer, "Faces: %llu instances before, %llu exposed faces after (%.1f%%), %llu in the volume, mask and list build %.1f Mbricks/sec\n",
+		allFaces, exposedFaces, 100.0 * double(exposedFaces) / double(allFaces ? allFaces : 1), m_brickFaces.GetTotalFaceCount(), faceBricksPerSecond / 1.0e6);
+	OutputDebugStringA(buffer);
+
+	GreedyMesher mesher;
+	double meshedBricksPerSecond = mesher.Benchmark(m_brickFaces, m_voxelPool, iterations);
+
+	sprintf_s(buffer, "Greedy mesher: %llu faces merged into %llu quads (%.1f%%), %.1f Mbricks/sec\n",
+		m_brickFaces.GetTotalFaceCount(), mesher.mQuads.GetTotalCount(),
+		100.0 * double(mesher.mQuads.GetTotalCount()) / double(m_brickFaces.GetTotalFaceCount() ? m_brickFaces.GetTotalFaceCount() : 1), meshedBricksPerSecond / 1.0e6);
+	OutputDebugStringA(buffer);
+
+	BrickOccupancy occupancy;
+	double masksPerSecond = occupancy.Benchmark(&voxels[0], iterations);
+	double maskedBricksPerSecond = m_enclosurePass.Benchmark(&voxels[0], occupancy, ThreadPool::Default(), iterations);
+
+	sprintf_s(buffer, "Occupancy: %s mask build %.1f Mbricks/sec, build + enclosure %.1f Mbricks/sec\n",
+		GetSimdLevelName(occupancy.mSimd), masksPerSecond / 1.0e6, maskedBricksPerSecond / 1.0e6);
+	OutputDebugStringA(buffer);
+
+	// Edit a scratch copy so the benchmark leaves the world untouched. Large
+	// brushes are dominated by the inside tests, so they are also run scalar.
+	BrickPool scratch(m_voxelPool);
+	VoxelEditor editor(scratch);
+	const float largeBrushSize = 2.0f;
+	for (UINT shape = 0; shape < EditShapeCount; shape++)
+	{
+		const EditShape editShape = static_cast<EditShape>(shape);
+		double editsPerSecond = editor.Benchmark(editShape, EditRadius, 4096);
+		editor.mUseSimd = false;
+		double scalarLargeEditsPerSecond = editor.Benchmark(editShape, largeBrushSize, 64);
+		editor.mUseSimd = true;
+		double simdLargeEditsPerSecond = editor.Benchmark(editShape, largeBrushSize, 64);
+
+		sprintf_s(buffer, "Edits, %s: size %.2f %.0f edits/sec, size %.1f %.0f edits/sec scalar, %.0f edits/sec SIMD\n",
+			GetEditShapeName(editShape), EditRadius, editsPerSecond, largeBrushSize, scalarLargeEditsPerSecond, simdLargeEditsPerSecond);
+		OutputDebugStringA(buffer);
+	}
+
+	// Strokes of overlapping edits, applied one at a time and merged in batches.
+	const UINT editBatchSize = 32;
+	double singleOpsPerSecond = EditHistory::Benchmark(m_voxelPool, EditRadius, 4096, 1);
+	double batchedOpsPerSecond = EditHistory::Benchmark(m_voxelPool, EditRadius, 4096, editBatchSize);
+
+	sprintf_s(buffer, "Edit batches: %.0f ops/sec one at a time, %.0f ops/sec in batches of %u\n",
+		singleOpsPerSecond, batchedOpsPerSecond, editBatchSize);
+	OutputDebugStringA(buffer);
+
+	TerrainGenerator terrain;
+	ThreadPool singleThread(1);
+	terrain.mSimd = SimdScalar;
+	double scalarVoxelsPerSecond = terrain.Benchmark(singleThread, 2);
+	terrain.mSimd = GetCpuSimdLevel();
+	double serialVoxelsPerSecond = terrain.Benchmark(singleThread, 2);
+	double voxelsPerSecond = terrain.Benchmark(ThreadPool::Default(), 2);
+
+	sprintf_s(buffer, "Terrain: scalar %.1f Mvoxels/sec, %s %.1f Mvoxels/sec (max height error %g), %u threads %.1f Mvoxels/sec\n",
+		scalarVoxelsPerSecond / 1.0e6, GetSimdLevelName(terrain.mSimd), serialVoxelsPerSecond / 1.0e6, terrain.MaxHeightError(),
+		ThreadPool::Default().mThreadCount, voxelsPerSecond / 1.0e6);
+	OutputDebugStringA(buffer);
+
+	for (UINT type = 0; type < WorldTypeCount; type++)
+	{
+		std::unique_ptr<VoxelGenerator> generator = CreateWorldGenerator(static_cast<WorldType>(type), WorldSeed);
+		double worldVoxelsPerSecond = generator->Benchmark(ThreadPool::Default(), 2);
+
+		sprintf_s(buffer, "World %s: %.1f Mvoxels/sec\n", GetWorldTypeName(static_cast<WorldType>(type)), worldVoxelsPerSecond / 1.0e6);
+		OutputDebugStringA(buffer);
+	}
+
+	// Tiles of the current world streamed in around a camera crossing the world,
+	// each generated with its faces and mips on a loader thread.
+	const UINT loaderCount = ThreadPool::Default().mThreadCount > 1 ? ThreadPool::Default().mThreadCount - 1 : 1;
+	const UINT ringWidth = 2 * TileRingRadius + 1;
+	double tilesPerSecond = TileResidency::Benchmark(TileResidency::CreateGeneratorLoader(m_worldType, WorldSeed), TileRingRadius, loaderCount, 4);
+
+	sprintf_s(buffer, "Streaming: %ux%u tile ring in %u slots, %u loaders, %.2f tiles/sec (%.1f Mvoxels/sec)\n",
+		ringWidth, ringWidth, TileSlotCount, loaderCount, tilesPerSecond, tilesPerSecond * VoxelCount / 1.0e6);
+	OutputDebugStringA(buffer);
+
+	// The current volume saved as a tile file, then checked and copied back out of
+	// memory as LoadWorld() does from the mapped file.
+	std::vector<UINT8> image;
+	TileCoord origin = { 0, 0 };
+	SerializeTile(origin, m_voxelPool, m_brickOccupancy, image);
+	double bytesPerSecond = TileFileView::Benchmark(image, 20);
+
+	sprintf_s(buffer, "Tile files: %.2f MB per tile, loaded at %.0f MB/sec\n", image.size() / 1.0e6, bytesPerSecond / 1.0e6);
+	OutputDebugStringA(buffer);
+
+	// The same volume archived as a region file, its cull groups compressed apart.
+	std::vector<UINT8> region;
+	SerializeRegion(origin, m_voxelPool, region);
+	double decompressedPerSecond = RegionFileView::Benchmark(region, 20);
+
+	sprintf_s(buffer, "Region files: %.2f MB per tile (%.1f%% of a tile file), decompressed at %.2f GB/sec\n",
+		region.size() / 1.0e6, 100.0 * region.size() / image.size(), decompressedPerSecond / 1.0e9);
+	OutputDebugStringA(buffer);
+
+	// A save of many edited bricks: the frame only pays for the commit; the writer
+	// thread writes and flushes the log.
+	SaveJournal::BenchmarkResult journal = SaveJournal::Benchmark(m_voxelPool, GetAssetFullPath(L"benchmark.vxj"), 4096);
+
+	sprintf_s(buffer, "Save journal: %u bricks committed in %.1f us on the frame, %.2f MB written and flushed in %.2f ms in the background\n",
+		journal.mBricks, journal.mCommitSeconds * 1.0e6, journal.mBytes / 1.0e6, journal.mWriteSeconds * 1.0e3);
+	OutputDebugStringA(buffer);
+}
+
+// Create the upload buffer for the voxel pool and its per-frame SRVs, sized with
+// headroom over the pool's current blocks. Each slot holds the brick table
+// followed by the blocks. Any existing buffer must no longer be in use.
+void D3D12ExecuteIndirect::CreateVoxelBuffer()
+{
+	m_voxelWordCapacity = m_voxelPool.WordCount() + m_voxelPool.WordCount() / 4 + 256 * VoxelsPerBrick;
+	const UINT slotSize = BrickCount + m_voxelWordCapacity;
+	const UINT constantBufferDataSize = slotSize * FrameCount * sizeof(UINT);
+
+	m_constantBuffer.Reset();
+	ThrowIfFailed(m_device->CreateCommittedResource(
+		&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD),
+		D3D12_HEAP_FLAG_NONE,
+		&CD3DX12_RESOURCE_DESC::Buffer(constantBufferDataSize),
+		D3D12_RESOURCE_STATE_GENERIC_READ,
+		nullptr,
+		IID_PPV_ARGS(&m_constantBuffer)));
+
+	NAME_D3D12_OBJECT(m_constantBuffer);
+
+	{
+		CD3DX12_RANGE readRange(0, 0);		// We do not intend to read from this resource on the CPU.
+		ThrowIfFailed(m_constantBuffer->Map(0, &readRange, reinterpret_cast<void**>(&m_pCbvDataBegin)));
+	}
+
+	// Create shader resource views (SRV) of the voxel pool for the
+	// vertex shader to read from.
+	D3D12_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+	srvDesc.Format = DXGI_FORMAT_UNKNOWN;
+	srvDesc.ViewDimension = D3D12_SRV_DIMENSION_BUFFER;
+	srvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+	srvDesc.Buffer.NumElements = slotSize;
+	srvDesc.Buffer.StructureByteStride = sizeof(UINT);
+	srvDesc.Buffer.Flags = D3D12_BUFFER_SRV_FLAG_NONE;
+
+	CD3DX12_CPU_DESCRIPTOR_HANDLE cbvSrvHandle(m_cbvSrvUavHeap->GetCPUDescriptorHandleForHeapStart(), CbvSrvOffset + NumTexture, m_cbvSrvUavDescriptorSize);
+	for (int i = 0; i < FrameCount; i++)
+	{
+		srvDesc.Buffer.FirstElement = i * slotSize;
+		m_device->CreateShaderResourceView(m_constantBuffer.Get(), &srvDesc, cbvSrvHandle);
+		cbvSrvHandle.Offset(CbvSrvUavDescriptorCountPerFrame, m_cbvSrvUavDescriptorSize);
+	}
+
+	// Neither slot holds anything yet.
+	m_dirtyUploads.MarkAll();
+}
+
+// Create the upload buffer for the face lists and its per-frame SRVs, sized with
+// headroom like the voxel buffer. Each slot holds the face table followed by the
+// lists. Any existing buffer must no longer be in use.
+void D3D12ExecuteIndirect::CreateFaceBuffer()
+{
+	m_faceWordCapacity = GetDrawLists().WordCount() + GetDrawLists().WordCount() / 4 + 256 * FaceLists::EntriesPerBlock;
+	const UINT slotSize = BrickCount + m_faceWordCapacity;
+
+	m_faceBuffer.Reset();
+	ThrowIfFailed(m_device->CreateCommittedResource(
+		&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD),
+		D3D12_HEAP_FLAG_NONE,
+		&CD3DX12_RESOURCE_DESC::Buffer(slotSize * FrameCount * sizeof(UINT)),
+		D3D12_RESOURCE_STATE_GENERIC_READ,
+		nullptr,
+		IID_PPV_ARGS(&m_faceBuffer)));
+
+	NAME_D3D12_OBJECT(m_faceBuffer);
+
+	{
+		CD3DX12_RANGE readRange(0, 0);		// We do not intend to read from this resource on the CPU.
+		ThrowIfFailed(m_faceBuffer->Map(0, &readRange, reinterpret_cast<void**>(&m_pFaceDataBegin)));
+	}
+
+	// The vertex shader reads the lists and the enclosure pass the counts.
+	D3D12_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+	srvDesc.Format = DXGI_FORMAT_UNKNOWN;
+	srvDesc.ViewDimension = D3D12_SRV_DIMENSION_BUFFER;
+	srvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+	srvDesc.Buffer.NumElements = slotSize;
+	srvDesc.Buffer.StructureByteStride = sizeof(UINT);
+	srvDesc.Buffer.Flags = D3D12_BUFFER_SRV_FLAG_NONE;
+
+	CD3DX12_CPU_DESCRIPTOR_HANDLE faceHandle(m_cbvSrvUavHeap->GetCPUDescriptorHandleForHeapStart(), FaceBufferOffset + NumTexture, m_cbvSrvUavDescriptorSize);
+	for (int i = 0; i < FrameCount; i++)
+	{
+		srvDesc.Buffer.FirstElement = i * slotSize;
+		m_device->CreateShaderResourceView(m_faceBuffer.Get(), &srvDesc, faceHandle);
+		faceHandle.Offset(CbvSrvUavDescriptorCountPerFrame, m_cbvSrvUavDescriptorSize);
+	}
+
+	// Neither slot holds anything yet.
+	m_dirtyUploads.MarkAll();
+}
+
+// The lists of faces or quads the vertex shader draws.
+const FaceLists& D3D12ExecuteIndirect::GetDrawLists() const
+{
+	return m_greedyMeshing ? m_greedyMesher.mQuads : m_brickFaces.mLists;
+}
+
+// Bring a voxel buffer slot up to date with the CPU copy. Only the bricks edited
+// since the slot was last written are copied: their table entries in coalesced
+// runs, plus the blocks of those that are mixed. If so much of the volume
+// changed that m_dirtyUploads asks for the whole slot, the table and blocks are
+// copied wholesale.
+void D3D12ExecuteIndirect::UploadVoxels(UINT slot)
+{
+	// Edits can add and grow blocks; once they outgrow the buffer, wait for the
+	// GPU to finish with it and start again in a larger one.
+	if (m_voxelPool.WordCount() > m_voxelWordCapacity)
+	{
+		WaitForGpu();
+		CreateVoxelBuffer();
+	}
+
+	// Lists dropped because their first entry overflowed the table would draw
+	// as holes, so refuse them outright.
+	const FaceLists& lists = GetDrawLists();
+	if (!lists.Fits())
+	{
+		OutputDebugStringA("Face lists overflow the entries the face table can address\n");
+		throw std::exception();
+	}
+
+	if (lists.WordCount() > m_faceWordCapacity)
+	{
+		WaitForGpu();
+		CreateFaceBuffer();
+	}
+
+	const UINT slotSize = BrickCount + m_voxelWordCapacity;
+	UINT* table = reinterpret_cast<UINT*>(m_pCbvDataBegin) + slot * slotSize;
+	UINT* words = table + BrickCount;
+	UINT8* masks = m_pBrickMaskDataBegin + (BrickCount * slot * sizeof(UINT64));
+	UINT* faceTable = reinterpret_cast<UINT*>(m_pFaceDataBegin) + slot * (BrickCount + m_faceWordCapacity);
+	UINT* faceWords = faceTable + BrickCount;
+	UINT* lods = reinterpret_cast<UINT*>(m_pLodDataBegin) + slot * BrickCount * VoxelMips::LodRecordWords;
+
+	const UINT mergeGap = 2;
+	const bool full = m_dirtyUploads.IsFull(slot);
+	m_dirtyUploads.TakeRanges(slot, mergeGap, m_uploadRanges);
+
+	if (full && !m_voxelPool.mWords.empty())
+	{
+		memcpy(words, &m_voxelPool.mWords[0], m_voxelPool.mWords.size() * sizeof(UINT));
+	}
+
+	if (full && !lists.mWords.empty())
+	{
+		memcpy(faceWords, &lists.mWords[0], lists.mWords.size() * sizeof(UINT));
+	}
+
+	for (const BrickRange& range : m_uploadRanges)
+	{
+		memcpy(table + range.mFirst, &m_voxelPool.mTable[range.mFirst], range.mCount * sizeof(UINT));
+		memcpy(masks + range.mFirst * sizeof(UINT64), &m_brickOccupancy.mMasks[range.mFirst], range.mCount * sizeof(UINT64));
+		memcpy(faceTable + range.mFirst, &lists.mTable[range.mFirst], range.mCount * sizeof(UINT));
+		memcpy(lods + range.mFirst * VoxelMips::LodRecordWords, m_voxelMips.GetRecord(range.mFirst), range.mCount * VoxelMips::LodRecordWords * sizeof(UINT));
+
+		for (UINT brick = range.mFirst; !full && brick < range.mFirst + range.mCount; brick++)
+		{
+			UINT wordCount;
+			const UINT* block = m_voxelPool.GetBlock(brick, wordCount);
+			if (block)
+			{
+				memcpy(words + (m_voxelPool.mTable[brick] & cBrickOffsetMask), block, wordCount * sizeof(UINT));
+			}
+
+			const UINT* list = lists.GetList(brick, wordCount);
+			if (list)
+			{
+				memcpy(faceWords + (lists.mTable[brick] >> cFaceCountBits) / 2, list, wordCount * sizeof(UINT));
+			}
+		}
+	}
+}
+
+// Replace the whole volume with a new world of type m_worldType. The journal's
+// edits belong to the old world, so the new one is saved in their place.
+void D3D12ExecuteIndirect::GenerateWorld()
+{
+	CreateWorldGenerator(m_worldType, WorldSeed)->Generate(m_voxelPool, ThreadPool::Default());
+	m_brickOccupancy.Build(m_voxelPool);
+	SaveWorld();
+	ReplaceWorld();
+}
+
+// Map the saved world and copy it into the volume and its occupancy masks, then
+// replay the edits made since. The mapping only saves reading the file into a
+// buffer first; the volume is edited in place, so it keeps a copy of its own.
+// Returns false, leaving both untouched, when there is no valid saved world.
+bool D3D12ExecuteIndirect::LoadWorld()
+{
+	// Let the journal finish writing before anything is read back. A checkpoint it
+	// still holds replaces the tile file, which cannot happen while it is mapped.
+	const bool journalOpen = m_saveJournal.IsOpen();
+	m_saveJournal.Close();
+
+	MappedTileFile file;
+	const bool loaded = file.Open(GetAssetFullPath(WorldFileName)) && file.GetView().Load(m_voxelPool, m_brickOccupancy);
+	file.Close();
+
+	// The volume is kept when the load fails, so the journal carries on logging
+	// its edits; replaying the log onto it only repeats edits it already holds.
+	if (loaded || journalOpen)
+	{
+		OpenJournal();
+	}
+	return loaded;
+}
+
+// Open the journal, replaying its edits onto the volume.
+void D3D12ExecuteIndirect::OpenJournal()
+{
+	UINT replayedBricks = 0;
+	if (!m_saveJournal.Open(GetAssetFullPath(JournalFileName), m_voxelPool, replayedBricks))
+	{
+		OutputDebugStringA("Opening the save journal failed; edits will not be saved\n");
+	}
+	if (replayedBricks > 0)
+	{
+		m_brickOccupancy.Build(m_voxelPool);
+	}
+}
+
+// Save the volume, edits included, for LoadWorld() to pick up. The journal writes
+// it from a copy in the background and then starts over. Without a journal the
+// volume is saved here instead, and a new journal is started on top of it.
+void D3D12ExecuteIndirect::SaveWorld()
+{
+	if (m_saveJournal.IsOpen())
+	{
+		m_saveJournal.Checkpoint(m_voxelPool, GetAssetFullPath(WorldFileName));
+		return;
+	}
+
+	TileCoord origin = { 0, 0 };
+	if (!WriteTileFile(GetAssetFullPath(WorldFileName), origin, m_voxelPool, m_brickOccupancy))
+	{
+		OutputDebugStringA("Saving the world failed\n");
+		return;
+	}
+
+	// The old log's edits are in the tile file now.
+	DeleteFileW(GetAssetFullPath(JournalFileName).c_str());
+	OpenJournal();
+}
+
+// Rebuild everything derived from the volume and its occupancy masks after the
+// whole volume was replaced. Every brick changes, so both slots are queued for a
+// full upload and enclosure pass.
+void D3D12ExecuteIndirect::ReplaceWorld()
+{
+	m_editHistory.Clear();
+	m_brickFaces.Build(m_brickOccupancy);
+	if (m_greedyMeshing)
+	{
+		m_greedyMesher.Build(m_brickFaces, m_voxelPool);
+	}
+	m_voxelMips.Build(m_voxelPool, ThreadPool::Default());
+	m_dirtyBricks.MarkAll();
+	m_dirtyUploads.MarkAll();
+	m_enclosedCommandsDirty = true;
+	ResetCommandBudget();
+
+	m_bufIndex = (m_bufIndex + 1) % FrameCount;
+	UploadVoxels(m_bufIndex);
+	m_RunCompute = true;
+}
+
+// Queue an edit with the current brush just in front of the camera. Edits queued
+// between frames are applied together by OnUpdate().
+void D3D12ExecuteIndirect::QueueEdit(VoxOp op)
+{
+	XMFLOAT3 centre(-m_Position.x, -m_Position.y, -(m_Position.z - 2*VoxelHalfWidth));
+	m_editHistory.Queue(VoxelEditor::MakeBrush(m_editShape, centre, m_editSize, (op == Mine) ? 0 : 7));
+}
+
+// Bring everything derived from the volume up to date after bricks were edited,
+// and queue the changed bricks for the next upload and enclosure pass.
+void D3D12ExecuteIndirect::OnBricksEdited(const std::vector<UINT>& bricks)
+{
+	for (UINT brick : bricks)
+	{
+		m_brickOccupancy.UpdateBrick(m_voxelPool, brick);
+		m_dirtyBricks.MarkBrick(brick);
+		m_dirtyUploads.MarkBrick(brick);
+		m_saveJournal.MarkBrick(brick);
+	}
+	m_saveJournal.Commit(m_voxelPool);
+
+	// Edits also uncover or cover faces in the neighbouring bricks.
+	m_changedFaceBricks.clear();
+	m_brickFaces.UpdateBricks(m_brickOccupancy, bricks, m_changedFaceBricks);
+	for (UINT brick : m_changedFaceBricks)
+	{
+		m_dirtyBricks.MarkBrick(brick);
+		m_dirtyUploads.MarkBrick(brick);
+	}
+
+	// Material changes need a remesh even where no face was covered or uncovered.
+	if (m_greedyMeshing)
+	{
+		m_changedFaceBricks.insert(m_changedFaceBricks.end(), bricks.begin(), bricks.end());
+		m_greedyMesher.UpdateBricks(m_brickFaces, m_voxelPool, m_changedFaceBricks);
+	}
+
+	// The mip levels follow, and with them the LOD records of the edited bricks
+	// and their neighbours. The shaders read the records directly, so they only
+	// need uploading.
+	m_changedLodBricks.clear();
+	m_voxelMips.UpdateBricks(m_voxelPool, bricks, m_changedLodBricks);
+	for (UINT brick : m_changedLodBricks)
+	{
+		m_dirtyUploads.MarkBrick(brick);
+	}
+	m_enclosedCommandsDirty |= !bricks.empty();
+}
+
+// Record the visible command count of the frame that last used this frame index,
+// which has completed by the time OnUpdate() runs, and show the counts in the
+// window title now and then.
+void D3D12ExecuteIndirect::ReadCommandCount()
+{
+	if (m_drawnBudgets[m_frameIndex] != 0)
+	{
+		UINT* counts = nullptr;
+		CD3DX12_RANGE readRange(m_frameIndex * sizeof(UINT), (m_frameIndex + 1) * sizeof(UINT));
+		ThrowIfFailed(m_commandCountReadback->Map(0, &readRange, reinterpret_cast<void**>(&counts)));
+		UINT count = counts[m_frameIndex];
+		CD3DX12_RANGE writeRange(0, 0);
+		m_commandCountReadback->Unmap(0, &writeRange);
+
+		m_commandBudget.Record(count, m_drawnBudgets[m_frameIndex]);
+		m_drawnBudgets[m_frameIndex] = 0;
+	}
+
+	if (++m_titleFrames >= 30)
+	{
+		const CommandBudget::BudgetStats& stats = m_commandBudget.GetStats();
+		WCHAR text[128];
+		swprintf_s(text, L"%u visible bricks, %u max commands, %u overflows",
+			stats.mLastCount, m_commandBudget.GetMaxCommandCount(), stats.mOverflows);
+		SetCustomWindowText(text);
+		m_titleFrames = 0;
+	}
+}
+
+// Forget the counts of frames drawn before the visible set changed wholesale.
+void D3D12ExecuteIndirect::ResetCommandBudget()
+{
+	m_commandBudget.Reset();
+	for (UINT frame = 0; frame < FrameCount; frame++)
+	{
+		m_drawnBudgets[frame] = 0;
+	}
+}
+
+// Run the enclosure and frustum passes on the CPU, writing the surviving commands
+// and their count to this frame's upload buffer in place of the cull shader's
+// output. The enclosure pass and the grouping of its commands only rerun after
+// the volume changes.
+void D3D12ExecuteIndirect::CullOnCpu()
+{
+	if (m_enclosedCommandsDirty)
+	{
+		m_enclosurePass.Run(m_brickOccupancy, m_enclosedCommands, ThreadPool::Default());
+
+		// Draw one instance per exposed face or quad, as compute.hlsl does.
+		const FaceLists& lists = GetDrawLists();
+		for (DrawVoxelCommand& command : m_enclosedCommands)
+		{
+			command.DrawArguments.InstanceCount = lists.GetCount(command.Data);
+		}
+
+		m_cullHierarchy.Build(m_enclosedCommands);
+		m_enclosedCommandsDirty = false;
+	}
+
+	DrawVoxelCommand* commands = reinterpret_cast<DrawVoxelCommand*>(m_pCpuCullCommandsBegin[m_frameIndex]);
+	m_frustumCuller.SetProjection(m_View.projection);
+	m_frustumCuller.SetLod(&m_voxelMips, GetLodDistance());
+
+	m_frustumCuller.Run(m_cullHierarchy, m_frustumCulled);
+	UINT count = static_cast<UINT>(m_frustumCulled.size());
+	if (m_occlusionCulling && count != 0)
+	{
+		// The rasterizer keeps the order of the commands, so it can write over its input.
+		count = m_occlusionRasterizer.Run(m_View.projection, m_brickOccupancy, m_frustumCulled.data(), count,
+			m_frustumCulled.data(), ThreadPool::Default());
+	}
+
+	// Nearest first, as cull.hlsl orders them.
+	m_frustumCuller.SortByDistance(m_frustumCulled.data(), count, commands);
+
+	memcpy(m_pCpuCullCommandsBegin[m_frameIndex] + CommandBufferCounterOffset, &count, sizeof(UINT));
+}
+
+// The w beyond which bricks draw their level 1 cells: where a voxel covers
+// LodVoxelPixels of the screen's height, so a level 1 voxel covers twice that.
+// Level 2 takes over at twice the distance, where its voxels cover as much.
+float D3D12ExecuteIndirect::GetLodDistance() const
+{
+	if (!m_lodEnabled)
+	{
+		return FLT_MAX;
+	}
+
+	// Clip space y per unit of height at w = 1, scaled to pixels.
+	const float* row = m_View.projection.m[1];
+	float pixelsPerUnit = sqrtf(row[0] * row[0] + row[1] * row[1] + row[2] * row[2]) * m_viewport.Height / 2.0f;
+	return VoxelSize * pixelsPerUnit / LodVoxelPixels;
+}
+
+// The transposed view-projection for a camera, as the shaders take it.
+XMFLOAT4X4 D3D12ExecuteIndirect::GetViewProjection(const XMFLOAT3& position, float yaw) const
 {
 	auto Proj = XMMatrixPerspectiveFovLH(XM_PIDIV4, m_aspectRatio, 0.01f, cDepth * 0.1f);
-	auto Rot = XMMatrixRotationRollPitchYaw(0, m_Yaw, 0);
-	auto Trans = XMMatrixTranslation(m_Position.x, m_Position.y, m_Position.z);
+	auto Rot = XMMatrixRotationRollPitchYaw(0, yaw, 0);
+	auto Trans = XMMatrixTranslation(position.x, position.y, position.z);
 	auto ViewPos = XMMatrixMultiply(Trans, Rot);
 	auto ViewProj = XMMatrixMultiply(ViewPos, Proj);
-	XMStoreFloat4x4(&m_View.projection, XMMatrixTranspose(ViewProj));
 
-	if (m_VoxOp != None)
+	XMFLOAT4X4 projection;
+	XMStoreFloat4x4(&projection, XMMatrixTranspose(ViewProj));
+	return projection;
+}
+
+// Update frame-based values.
+void D3D12ExecuteIndirect::OnUpdate()
+{
+	m_View.projection = GetViewProjection(m_Position, m_Yaw);
+	ReadCommandCount();
+
+	if (m_RegenerateWorld)
 	{
-		for (UINT n = 0; n < VoxelCount; n++)
+		GenerateWorld();
+		m_RegenerateWorld = false;
+	}
+
+	// A failed checkpoint stops the journal, as its log no longer matches the
+	// saved world. Save the world here instead, which starts the log over.
+	if (m_saveJournal.HasFailed())
+	{
+		OutputDebugStringA("Saving the world in the background failed; saving it now\n");
+		m_saveJournal.Close();
+		SaveWorld();
+	}
+
+	if (m_loadWorld)
+	{
+		if (LoadWorld())
 		{
-			XMFLOAT3 voxpos = GetPositionFromIndex(n);
-			XMFLOAT3 dist(voxpos.x + m_Position.x,
-				          voxpos.y + m_Position.y,
-				          voxpos.z + (m_Position.z - 2*VoxelHalfWidth));
+			ReplaceWorld();
+		}
+		m_loadWorld = false;
+	}
 
-			if ((dist.x*dist.x + dist.y*dist.y + dist.z*dist.z) < 0.5f ) 
-			{
-				if (m_VoxOp == Mine)
-				{
-					m_constantBufferData[n].color = 0; 
-				}
-				else
-				{
-					m_constantBufferData[n].color = 7; 
-				}
-			}
+	if (m_meshingChanged)
+	{
+		// Every brick's list changes, so both slots need a full upload and pass.
+		if (m_greedyMeshing)
+		{
+			m_greedyMesher.Build(m_brickFaces, m_voxelPool);
 		}
+		m_dirtyBricks.MarkAll();
+		m_dirtyUploads.MarkAll();
+		m_enclosedCommandsDirty = true;
+
+		m_bufIndex = (m_bufIndex + 1) % FrameCount;
+		UploadVoxels(m_bufIndex);
+		m_RunCompute = true;
+		m_meshingChanged = false;
+	}
+
+	// Undo and redo, then every edit queued since the last frame as one batch. The
+	// buffers are brought up to date once for all of them.
+	bool edited = false;
+	if (m_undoEdit && m_editHistory.Undo(m_voxelPool))
+	{
+		OnBricksEdited(m_editHistory.mModifiedBricks);
+		edited = true;
+	}
+	if (m_redoEdit && m_editHistory.Redo(m_voxelPool))
+	{
+		OnBricksEdited(m_editHistory.mModifiedBricks);
+		edited = true;
+	}
+	m_undoEdit = false;
+	m_redoEdit = false;
 
+	if (m_editHistory.HasQueued() && m_editHistory.Apply(m_voxelPool) > 0)
+	{
+		OnBricksEdited(m_editHistory.mModifiedBricks);
+		edited = true;
+	}
+
+	if (edited)
+	{
 		m_bufIndex =  (m_bufIndex + 1) % FrameCount;
-		UINT8* destination = m_pCbvDataBegin + (VoxelCount * m_bufIndex * sizeof(SceneConstantBuffer));
-		memcpy(destination, &m_constantBufferData[0], VoxelCount * sizeof(SceneConstantBuffer));
+		UploadVoxels(m_bufIndex);
 		m_RunCompute = true;
-		m_VoxOp = None;
+	}
+
+	// The previous use of this frame's command buffer has finished by now.
+	if (m_cpuCulling)
+	{
+		CullOnCpu();
 	}
 }
 
@@ -878,11 +1771,17 @@ void D3D12ExecuteIndirect::OnRender()
 			computeCmds++;
 		}
 
-		ppCommandLists[computeCmds] = m_cullCommandList.Get();
-		computeCmds++;
+		if (!m_cpuCulling)
+		{
+			ppCommandLists[computeCmds] = m_cullCommandList.Get();
+			computeCmds++;
+		}
 
 		PIXBeginEvent(m_commandQueue.Get(), 0, L"Compute");
-		m_computeCommandQueue->ExecuteCommandLists(computeCmds, ppCommandLists);
+		if (computeCmds > 0)
+		{
+			m_computeCommandQueue->ExecuteCommandLists(computeCmds, ppCommandLists);
+		}
 		m_computeCommandQueue->Signal(m_computeFence.Get(), m_fenceValues[m_frameIndex]);
 
 		// Execute the rendering work only when the compute work is complete.
@@ -912,6 +1811,9 @@ void D3D12ExecuteIndirect::OnDestroy()
 	// cleaned up by the destructor.
 	WaitForGpu();
 
+	// Finish writing the edits still queued.
+	m_saveJournal.Close();
+
 	CloseHandle(m_fenceEvent);
 }
 
@@ -941,10 +1843,52 @@ void D3D12ExecuteIndirect::OnKeyDown(UINT8 key)
 			m_Position.y += delta;
 			break;
 		case VK_SPACE:
-			m_VoxOp = Mine;
+			QueueEdit(Mine);
 			break;
 		case VK_INSERT:
-			m_VoxOp = Place;
+			QueueEdit(Place);
+			break;
+		case 'Z':
+			m_undoEdit = true;
+			break;
+		case 'Y':
+			m_redoEdit = true;
+			break;
+		case 'E':
+			m_editShape = static_cast<EditShape>((m_editShape + 1) % EditShapeCount);
+			break;
+		case VK_OEM_4:
+			m_editSize = (m_editSize > EditRadius) ? m_editSize * 0.5f : m_editSize;
+			break;
+		case VK_OEM_6:
+			m_editSize = (m_editSize < EditRadius * MaxEditScale) ? m_editSize * 2.0f : m_editSize;
+			break;
+		case 'B':
+			RunBenchmarks();
+			break;
+		case 'G':
+			m_worldType = static_cast<WorldType>((m_worldType + 1) % WorldTypeCount);
+			m_RegenerateWorld = true;
+			break;
+		case 'C':
+			m_cpuCulling = !m_cpuCulling;
+			ResetCommandBudget();
+			break;
+		case 'O':
+			m_occlusionCulling = !m_occlusionCulling;
+			break;
+		case 'M':
+			m_greedyMeshing = !m_greedyMeshing;
+			m_meshingChanged = true;
+			break;
+		case 'L':
+			m_lodEnabled = !m_lodEnabled;
+			break;
+		case VK_F5:
+			SaveWorld();
+			break;
+		case VK_F9:
+			m_loadWorld = true;
 			break;
 	}
 }
@@ -981,20 +1925,29 @@ void D3D12ExecuteIndirect::PopulateCommandLists()
 			SrvUavTable,
 			CD3DX12_GPU_DESCRIPTOR_HANDLE(cbvSrvUavHandle, CbvSrvOffset + NumTexture + frameDescriptorOffset, m_cbvSrvUavDescriptorSize));
 
-		//m_csRootConstants.cullOffset = m_Position.z;
-		m_computeCommandList->SetComputeRoot32BitConstants(RootConstants, ComputeInUInt32s, reinterpret_cast<void*>(&m_csRootConstants), 0);
+		// Only revisit the bricks edited since this slot was last processed, unless
+		// the slot has never been processed or the edits cover too much of the volume.
+		bool fullPass = m_dirtyBricks.IsFull(m_bufIndex);
+		UINT brickListCount = m_dirtyBricks.Take(m_bufIndex, m_pDirtyBrickListBegin + m_bufIndex * BrickCount);
 
-		// Reset the UAV counter for this frame.
-		m_computeCommandList->CopyBufferRegion(m_processedCommandBuffers[m_bufIndex].Get(), CommandBufferCounterOffset, m_processedCommandBufferCounterReset.Get(), 0, sizeof(UINT));
+		m_csRootConstants.commandCount = static_cast<float>(fullPass ? BrickCount : brickListCount);
+		m_csRootConstants.brickListCount = brickListCount;
+		m_computeCommandList->SetComputeRoot32BitConstants(RootConstants, ComputeInUInt32s, reinterpret_cast<void*>(&m_csRootConstants), 0);
 
 		D3D12_RESOURCE_BARRIER barrier = CD3DX12_RESOURCE_BARRIER::Transition(m_processedCommandBuffers[m_bufIndex].Get(), D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
 		m_computeCommandList->ResourceBarrier(1, &barrier);
 
-		m_computeCommandList->Dispatch(static_cast<UINT>(ceil(BrickCount / float(ComputeThreadBlockSize))), 1, 1);
+		m_computeCommandList->Dispatch(static_cast<UINT>(ceil(m_csRootConstants.commandCount / float(ComputeThreadBlockSize))), 1, 1);
 	}
 
 	ThrowIfFailed(m_computeCommandList->Close());
 	
+	if (m_cpuCulling)
+	{
+		// CullOnCpu() has already written this frame's commands.
+		ThrowIfFailed(m_cullCommandList->Close());
+	}
+	else
 	{
 		UINT uavFrameDescriptorOffset = m_frameIndex * CbvSrvUavDescriptorCountPerFrame;
 		UINT srvFrameDescriptorOffset = m_bufIndex * CbvSrvUavDescriptorCountPerFrame;
@@ -1015,15 +1968,35 @@ void D3D12ExecuteIndirect::PopulateCommandLists()
 			CD3DX12_GPU_DESCRIPTOR_HANDLE(cbvSrvUavHandle, CullCommandsOffset + NumTexture + uavFrameDescriptorOffset, m_cbvSrvUavDescriptorSize));
 
 		memcpy( &m_cullConstants.projection, m_View.projection.m, sizeof( float[4][4] ) );
+		m_cullConstants.bucketPass = 0;
+		m_cullConstants.lodDistance = GetLodDistance();
 		m_cullCommandList->SetComputeRoot32BitConstants(CullRootConstants, CullConstantsInU32, reinterpret_cast<void*>(&m_cullConstants), 0);
 
-		// Reset the UAV counter for this frame.
+		// Reset the UAV counter and the distance buckets for this frame.
+		ID3D12Resource* distanceBuckets = m_distanceBucketBuffers[m_frameIndex].Get();
 		m_cullCommandList->CopyBufferRegion(m_cullCommandBuffers[m_frameIndex].Get(), CommandBufferCounterOffset, m_processedCommandBufferCounterReset.Get(), 0, sizeof(UINT));
+		m_cullCommandList->CopyBufferRegion(distanceBuckets, 0, m_processedCommandBufferCounterReset.Get(), 0, DistanceBucketCount * 2 * sizeof(UINT));
+
+		D3D12_RESOURCE_BARRIER barriers[2] =
+		{
+			CD3DX12_RESOURCE_BARRIER::Transition(m_cullCommandBuffers[m_frameIndex].Get(), D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_UNORDERED_ACCESS),
+			CD3DX12_RESOURCE_BARRIER::Transition(distanceBuckets, D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_UNORDERED_ACCESS)
+		};
+		m_cullCommandList->ResourceBarrier(_countof(barriers), barriers);
 
-		D3D12_RESOURCE_BARRIER barrier = CD3DX12_RESOURCE_BARRIER::Transition(m_cullCommandBuffers[m_frameIndex].Get(), D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
-		m_cullCommandList->ResourceBarrier(1, &barrier);
+		// One thread group per cull group of bricks; the first pass sizes the
+		// distance buckets and the second writes the commands into them.
+		m_cullCommandList->Dispatch(CullGroupCount, 1, 1);
 
-		m_cullCommandList->Dispatch(static_cast<UINT>(ceil(BrickCount / float(ComputeThreadBlockSize))), 1, 1);
+		D3D12_RESOURCE_BARRIER uavBarrier = CD3DX12_RESOURCE_BARRIER::UAV(distanceBuckets);
+		m_cullCommandList->ResourceBarrier(1, &uavBarrier);
+
+		m_cullConstants.bucketPass = 1;
+		m_cullCommandList->SetComputeRoot32BitConstant(CullRootConstants, m_cullConstants.bucketPass, offsetof(CSCullConstants, bucketPass) / sizeof(UINT));
+		m_cullCommandList->Dispatch(CullGroupCount, 1, 1);
+
+		D3D12_RESOURCE_BARRIER resetBarrier = CD3DX12_RESOURCE_BARRIER::Transition(distanceBuckets, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COPY_DEST);
+		m_cullCommandList->ResourceBarrier(1, &resetBarrier);
 		ThrowIfFailed(m_cullCommandList->Close());
 	}
 
@@ -1042,6 +2015,8 @@ void D3D12ExecuteIndirect::PopulateCommandLists()
 		CD3DX12_GPU_DESCRIPTOR_HANDLE cbvdt(cbvSrvUavHandle, CbvSrvOffset + NumTexture + frameDescriptorOffset, m_cbvSrvUavDescriptorSize);
 
 		m_commandList->SetGraphicsRootDescriptorTable(Cbv,  cbvdt );
+		m_commandList->SetGraphicsRootDescriptorTable(Faces, CD3DX12_GPU_DESCRIPTOR_HANDLE(cbvSrvUavHandle, FaceBufferOffset + NumTexture + frameDescriptorOffset, m_cbvSrvUavDescriptorSize));
+		m_commandList->SetGraphicsRootDescriptorTable(Lods, CD3DX12_GPU_DESCRIPTOR_HANDLE(cbvSrvUavHandle, LodBufferOffset + NumTexture + frameDescriptorOffset, m_cbvSrvUavDescriptorSize));
 
 		m_commandList->RSSetViewports(1, &m_viewport);
 		m_commandList->RSSetScissorRects(1, &m_scissorRect);
@@ -1060,11 +2035,15 @@ void D3D12ExecuteIndirect::PopulateCommandLists()
 			barrierIndex++;
 		}   
 
-		barriers[barrierIndex] = CD3DX12_RESOURCE_BARRIER::Transition(
-			m_cullCommandBuffers[m_frameIndex].Get(),
-			D3D12_RESOURCE_STATE_UNORDERED_ACCESS,
-			D3D12_RESOURCE_STATE_INDIRECT_ARGUMENT);
-		barrierIndex++;
+		// The CPU culling buffers stay in the upload heap's generic read state.
+		if (!m_cpuCulling)
+		{
+			barriers[barrierIndex] = CD3DX12_RESOURCE_BARRIER::Transition(
+				m_cullCommandBuffers[m_frameIndex].Get(),
+				D3D12_RESOURCE_STATE_UNORDERED_ACCESS,
+				D3D12_RESOURCE_STATE_INDIRECT_ARGUMENT);
+			barrierIndex++;
+		}
 
 		barriers[barrierIndex] = CD3DX12_RESOURCE_BARRIER::Transition(
 			m_renderTargets[m_frameIndex].Get(),
@@ -1086,6 +2065,19 @@ void D3D12ExecuteIndirect::PopulateCommandLists()
 
 		m_commandList->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLESTRIP);
 
+		// ExecuteIndirect's overhead grows with MaxCommandCount, so keep it close to
+		// the visible count: exact when the CPU culled, otherwise the budget from the
+		// counts of earlier frames. Only bricks with exposed faces can be drawn at all,
+		// which bounds the budget.
+		ID3D12Resource* commandBuffer = m_cpuCulling ? m_cpuCullCommandBuffers[m_frameIndex].Get() : m_cullCommandBuffers[m_frameIndex].Get();
+		m_commandBudget.SetBound(m_brickFaces.mLists.GetListCount());
+		UINT maxCommandCount = m_commandBudget.GetMaxCommandCount();
+		if (m_cpuCulling)
+		{
+			memcpy(&maxCommandCount, m_pCpuCullCommandsBegin[m_frameIndex] + CommandBufferCounterOffset, sizeof(UINT));
+		}
+		m_drawnBudgets[m_frameIndex] = maxCommandCount > 0 ? maxCommandCount : 1;
+
 		{
 			PIXBeginEvent(m_commandList.Get(), 0, L"Draw visible voxels");
 			for (int i = 0; i < TileX; i++) {
@@ -1094,20 +2086,15 @@ void D3D12ExecuteIndirect::PopulateCommandLists()
 
 					m_View.tileoffset = XMFLOAT4( i*VoxelHalfWidth*2.0f*Width, 0, j*VoxelHalfWidth*2.0f*Depth, 0);
 					m_commandList->SetGraphicsRoot32BitConstants(View, ViewInUInt32s, reinterpret_cast<void*>(&m_View), 0);
-					
-					// Hmmm ... so what does ExecuteIndirect use this TriangleCount for ? I assume it has to allocate / reserve
-					// some buffer internally; making it smaller improves perf so might there be some "ideal" vendor specific
-					// command length?
-					// http://developer.download.nvidia.com/gameworks/events/GDC2016/AdvancedRenderingwithDirectX11andDirectX12.pdf
-					// strongly recommend Making MaxCommandCount close to actual count, which implies there is some overhead prop
-					// to max command count on nvidia.
 
+					// http://developer.download.nvidia.com/gameworks/events/GDC2016/AdvancedRenderingwithDirectX11andDirectX12.pdf
+					// strongly recommends making MaxCommandCount close to the actual count.
 					m_commandList->ExecuteIndirect(
 						m_commandSignature.Get(),
-						BrickCount, // er ... make it a bit smaller? and crashier?
-						m_cullCommandBuffers[m_frameIndex].Get(),
+						maxCommandCount,
+						commandBuffer,
 						0,
-						m_cullCommandBuffers[m_frameIndex].Get(),
+						commandBuffer,
 						CommandBufferCounterOffset);
 				}
 			}
@@ -1115,6 +2102,15 @@ void D3D12ExecuteIndirect::PopulateCommandLists()
 
 		PIXEndEvent(m_commandList.Get());
 
+		// Copy the visible command count back; ReadCommandCount() picks it up once
+		// this frame has completed.
+		if (!m_cpuCulling)
+		{
+			D3D12_RESOURCE_BARRIER copyBarrier = CD3DX12_RESOURCE_BARRIER::Transition(commandBuffer, D3D12_RESOURCE_STATE_INDIRECT_ARGUMENT, D3D12_RESOURCE_STATE_COPY_SOURCE);
+			m_commandList->ResourceBarrier(1, &copyBarrier);
+		}
+		m_commandList->CopyBufferRegion(m_commandCountReadback.Get(), m_frameIndex * sizeof(UINT), commandBuffer, CommandBufferCounterOffset, sizeof(UINT));
+
 		// Indicate that the command buffer may be used by the compute shader
 		// and that the back buffer will now be used to present.
 
@@ -1127,9 +2123,12 @@ void D3D12ExecuteIndirect::PopulateCommandLists()
 			barrierIndex++;
 		}
 
-		barriers[barrierIndex].Transition.StateBefore = D3D12_RESOURCE_STATE_INDIRECT_ARGUMENT;
-		barriers[barrierIndex].Transition.StateAfter = D3D12_RESOURCE_STATE_COPY_DEST;
-		barrierIndex++;
+		if (!m_cpuCulling)
+		{
+			barriers[barrierIndex].Transition.StateBefore = D3D12_RESOURCE_STATE_COPY_SOURCE;
+			barriers[barrierIndex].Transition.StateAfter = D3D12_RESOURCE_STATE_COPY_DEST;
+			barrierIndex++;
+		}
 
 		barriers[barrierIndex].Transition.StateBefore = D3D12_RESOURCE_STATE_RENDER_TARGET;
 		barriers[barrierIndex].Transition.StateAfter = D3D12_RESOURCE_STATE_PRESENT;
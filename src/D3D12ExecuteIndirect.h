@@ -12,6 +12,23 @@
 #pragma once
 
 #include "Definitions.h"
+#include "BrickPool.h"
+#include "BrickOccupancy.h"
+#include "BrickFaces.h"
+#include "GreedyMesher.h"
+#include "VoxelMips.h"
+#include "Culling.h"
+#include "CommandBudget.h"
+#include "Occlusion.h"
+#include "DirtyBricks.h"
+#include "Enclosure.h"
+#include "VoxelEdit.h"
+#include "EditHistory.h"
+#include "Worlds.h"
+#include "TileResidency.h"
+#include "TileFile.h"
+#include "RegionFile.h"
+#include "SaveJournal.h"
 
 using namespace DirectX;
 using Microsoft::WRL::ComPtr;
@@ -31,6 +48,13 @@ private:
 	static const UINT CommandSizePerFrame;			     // The size of the indirect commands to draw all of the triangles in a single frame.
 	static const UINT CommandBufferCounterOffset;		// The offset of the UAV counter in the processed command buffer.
 	static const float VoxelHalfWidth;					// The x and y offsets used by the triangle vertices.
+	static const float EditRadius;						// Smallest brush size; the radius of the default sphere.
+	static const UINT MaxEditScale;						// Largest brush size, in multiples of EditRadius.
+	static const UINT WorldSeed;						// Seed for every world type's generator.
+	static const UINT OcclusionWidth;					// Width of the CPU occlusion buffer; its height follows the aspect ratio.
+	static const float LodVoxelPixels;					// Pixels of screen height a voxel covers where bricks switch to level 1.
+	static const LPCWSTR WorldFileName;					// Tile file the world is saved to and loaded from, beside the executable.
+	static const LPCWSTR JournalFileName;				// Log of the edits made since the world was last saved, beside the executable.
 
 	struct ViewConstantBuffer
 	{
@@ -41,16 +65,11 @@ private:
 
 	static const UINT32 ViewInUInt32s = sizeof(ViewConstantBuffer) / sizeof(UINT32);
 
-	// Constant buffer definition.
-	struct SceneConstantBuffer
-	{
-		UINT color;
-	};
-
 	// Root constants for the compute shader.
 	struct CSRootConstants
 	{
 		float commandCount;
+		UINT  brickListCount;	// Non-zero when only the listed dirty bricks are processed.
 	};
 
 	static const UINT32 ComputeInUInt32s = sizeof(CSRootConstants) / sizeof(UINT32);
@@ -75,7 +94,6 @@ private:
 
 	enum VoxOp
 	{
-		None,
 		Mine,
 		Place
 	};
@@ -85,6 +103,8 @@ private:
 	{
 		View,
 		Cbv,
+		Faces,
+		Lods,
 		Texture,
 		GraphicsRootParametersCount
 	};
@@ -110,15 +130,58 @@ private:
 	{
 		CbvSrvOffset = 0,										// SRV that points to the constant buffers used by the rendering thread.
 		CommandsOffset = CbvSrvOffset + 1,									// SRV that points to all of the indirect commands.
-		ProcessedCommandsOffset = CommandsOffset + 1,						// UAV that records the commands we actually want to execute.
+		BrickMaskOffset = CommandsOffset + 1,								// SRV that points to the per-brick occupancy masks.
+		DirtyBrickListOffset = BrickMaskOffset + 1,							// SRV that lists the bricks the enclosure pass should revisit.
+		FaceBufferOffset = DirtyBrickListOffset + 1,						// SRV that points to the face table and lists of exposed voxel faces.
+		ProcessedCommandsOffset = FaceBufferOffset + 1,						// UAV that records the commands we actually want to execute.
 		ProcessedCommandsCountOffset = ProcessedCommandsOffset + 1,
-		CullCommandsOffset = ProcessedCommandsCountOffset + 1,
-		CbvSrvUavDescriptorCountPerFrame = CullCommandsOffset + 1		// 2 SRVs + 1 UAV for the compute shader.
+		LodBufferOffset = ProcessedCommandsCountOffset + 1,					// SRV that points to the per-brick LOD records.
+		CullCommandsOffset = LodBufferOffset + 1,
+		DistanceBucketsOffset = CullCommandsOffset + 1,						// UAV that sizes and fills the distance buckets of the culled commands.
+		CbvSrvUavDescriptorCountPerFrame = DistanceBucketsOffset + 1		// 5 SRVs + 1 UAV for the compute shader.
 	};
 
-	// Each triangle gets its own constant buffer per frame.
-	std::vector<SceneConstantBuffer> m_constantBufferData;
+	// CPU copy of the voxels, stored sparsely. m_constantBuffer holds one slot per
+	// frame in the same layout, with room for m_voxelWordCapacity words of blocks.
+	BrickPool m_voxelPool;
 	UINT8* m_pCbvDataBegin;
+	UINT m_voxelWordCapacity;
+
+	// Edits to m_voxelPool since the world was last saved, logged in the background.
+	SaveJournal m_saveJournal;
+
+	// Edits queued since the last frame, and the steps they were applied in.
+	EditHistory m_editHistory;
+
+	// Occupancy masks kept in step with m_voxelPool; one slot per frame lives in m_brickMaskBuffer.
+	BrickOccupancy m_brickOccupancy;
+	UINT8* m_pBrickMaskDataBegin;
+
+	// Exposed voxel faces kept in step with m_brickOccupancy. m_faceBuffer holds one
+	// slot per frame of the lists the vertex shader draws from, the faces or, with
+	// m_greedyMeshing set, the merged quads, with room for m_faceWordCapacity words.
+	BrickFaces m_brickFaces;
+	GreedyMesher m_greedyMesher;	// Only kept up to date while m_greedyMeshing is set.
+	bool m_greedyMeshing;
+	bool m_meshingChanged;			// Set when the buffer must switch lists.
+	std::vector<UINT> m_changedFaceBricks;
+	UINT8* m_pFaceDataBegin;
+	UINT m_faceWordCapacity;
+
+	// Mip levels of the volume and the LOD records distant bricks draw from, kept
+	// in step with m_voxelPool; one slot of records per frame lives in m_lodBuffer.
+	VoxelMips m_voxelMips;
+	bool m_lodEnabled;
+	std::vector<UINT> m_changedLodBricks;
+	UINT8* m_pLodDataBegin;
+
+	// Bricks each voxel buffer slot still has to run through the enclosure pass.
+	DirtyBricks m_dirtyBricks;
+	UINT* m_pDirtyBrickListBegin;
+
+	// Bricks each voxel buffer slot is missing from the CPU copy.
+	DirtyBricks m_dirtyUploads;
+	std::vector<BrickRange> m_uploadRanges;
 
 	ViewConstantBuffer m_View;
 
@@ -154,7 +217,34 @@ private:
 	XMFLOAT3 m_Position;
 	float    m_Yaw;
 	bool     m_RunCompute;
-	VoxOp	 m_VoxOp;
+	bool     m_undoEdit;		// Set to take back the last step of m_editHistory.
+	bool     m_redoEdit;		// Set to make again the last step undone.
+	EditShape m_editShape;		// Brush dug or placed by an edit, cycled with E.
+	float    m_editSize;		// Brush size, halved and doubled with [ and ].
+	WorldType m_worldType;
+	bool     m_RegenerateWorld;	// Set to replace the volume with a fresh m_worldType world.
+	bool     m_loadWorld;		// Set to replace the volume with the saved world.
+
+	EnclosurePass m_enclosurePass;	// CPU reference for compute.hlsl.
+
+	// CPU culling fallback. When m_cpuCulling is set the enclosure and frustum
+	// passes run on the CPU and write straight into an upload buffer per frame,
+	// and the cull shader is not dispatched.
+	FrustumCuller m_frustumCuller;	// CPU reference for cull.hlsl.
+	bool m_cpuCulling;
+	bool m_enclosedCommandsDirty;	// Set when m_enclosedCommands no longer matches the volume.
+	std::vector<DrawVoxelCommand> m_enclosedCommands;
+	CullHierarchy m_cullHierarchy;		// m_enclosedCommands sorted into cull groups.
+	OcclusionRasterizer m_occlusionRasterizer;	// Rejects bricks hidden behind nearer solid bricks.
+	bool m_occlusionCulling;		// Off by default, and only used by the CPU path; cull.hlsl has no occlusion stage.
+	std::vector<DrawVoxelCommand> m_frustumCulled;	// Culled commands before they are sorted by distance.
+	UINT8* m_pCpuCullCommandsBegin[FrameCount];
+
+	// ExecuteIndirect is sized from the visible command counts copied back from
+	// each frame's command buffer once the frame has completed.
+	CommandBudget m_commandBudget;
+	UINT m_drawnBudgets[FrameCount];	// The MaxCommandCount each frame was drawn with; 0 once its count is read.
+	UINT m_titleFrames;					// Frames since the window title last showed the counts.
 
 	// Synchronization objects.
 	ComPtr<ID3D12Fence> m_fence;
@@ -170,11 +260,18 @@ private:
 	ComPtr<ID3D12GraphicsCommandList> m_computeCommandList;
 	ComPtr<ID3D12GraphicsCommandList> m_cullCommandList;
 	ComPtr<ID3D12Resource> m_constantBuffer;
+	ComPtr<ID3D12Resource> m_brickMaskBuffer;
+	ComPtr<ID3D12Resource> m_faceBuffer;
+	ComPtr<ID3D12Resource> m_lodBuffer;
+	ComPtr<ID3D12Resource> m_dirtyBrickListBuffer;
 	ComPtr<ID3D12Resource> m_depthStencil;
 	ComPtr<ID3D12Resource> m_commandBuffer;
 	ComPtr<ID3D12Resource> m_processedCommandBuffers[FrameCount];
 	ComPtr<ID3D12Resource> m_processedCommandBufferCounterReset;
 	ComPtr<ID3D12Resource> m_cullCommandBuffers[FrameCount];
+	ComPtr<ID3D12Resource> m_distanceBucketBuffers[FrameCount];
+	ComPtr<ID3D12Resource> m_cpuCullCommandBuffers[FrameCount];
+	ComPtr<ID3D12Resource> m_commandCountReadback;	// One visible command count per frame.
 	ComPtr<ID3D12Resource> m_texture;
 	
 	void LoadPipeline();
@@ -186,6 +283,23 @@ private:
 	XMFLOAT3 GetPositionFromIndex(UINT index) const ;
 	XMFLOAT3 GetBrickPositionFromIndex(UINT index) const;
 	XMFLOAT3 GetVoxelPositionFromIndex(UINT index) const;
+	void RunBenchmarks();
+	void CreateVoxelBuffer();
+	void CreateFaceBuffer();
+	const FaceLists& GetDrawLists() const;
+	void UploadVoxels(UINT slot);
+	void GenerateWorld();
+	bool LoadWorld();
+	void OpenJournal();
+	void SaveWorld();
+	void ReplaceWorld();
+	void QueueEdit(VoxOp op);
+	void OnBricksEdited(const std::vector<UINT>& bricks);
+	void CullOnCpu();
+	void ReadCommandCount();
+	void ResetCommandBudget();
+	float GetLodDistance() const;
+	XMFLOAT4X4 GetViewProjection(const XMFLOAT3& position, float yaw) const;
 
 	// We pack the UAV counter into the same buffer as the commands rather than create
 	// a separate 64K resource/heap for it. The counter must be aligned on 4K boundaries,
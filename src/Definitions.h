@@ -1,19 +1,22 @@
 #pragma once
 
 #include "DXSample.h"
-#include "defines.h"
-
-using namespace DirectX;
+#include "VoxelTypes.h"
 
 // CBV/SRV/UAV desciptor heap offsets.
 enum TileHeapOffsets
 {
 	VoxelBufferOffset					= 0,								// SRV that points to the voxels for the current tile
 	DrawCommandsOffset					= VoxelBufferOffset + 1,			// SRV that points to the raw draw commands.
-	ProcessedDrawCommandsOffset			= DrawCommandsOffset + 1,			// UAV that records the commands used to draw the non-enclosed bricks
+	BrickMaskBufferOffset				= DrawCommandsOffset + 1,			// SRV that points to the per-brick occupancy masks
+	DirtyBrickListOffset				= BrickMaskBufferOffset + 1,		// SRV that lists the bricks to revisit after an edit
+	FaceBufferOffset					= DirtyBrickListOffset + 1,			// SRV that points to the face table and lists of exposed voxel faces
+	ProcessedDrawCommandsOffset			= FaceBufferOffset + 1,				// UAV that records the commands used to draw the non-enclosed bricks
 	CounterOffset						= ProcessedDrawCommandsOffset + 1,	// CBV holding the count of the non-enclosed bricks
-	CulledDrawCommandsOffset			= CounterOffset + 1,				// UAV that records the frustum visib,le bricks
- 	DescriptorCountPerFrame				= CulledDrawCommandsOffset + 1		// total
+	LodBufferOffset						= CounterOffset + 1,				// SRV that points to the per-brick LOD records
+	CulledDrawCommandsOffset			= LodBufferOffset + 1,				// UAV that records the frustum visib,le bricks
+	DistanceBucketsOffset				= CulledDrawCommandsOffset + 1,		// UAV that sizes and fills the distance buckets of the visible bricks
+ 	DescriptorCountPerFrame				= DistanceBucketsOffset + 1			// total
 };
 
 // Compute root signature parameter offsets.
@@ -36,53 +39,33 @@ enum CullRootParameters
 struct ComputeRootConstants
 {
 	float CommandCount;
+	UINT  BrickListCount;		// Non-zero when only the listed dirty bricks are processed.
 };
 
 static const UINT ComputeRootConstantsInU32s = sizeof(ComputeRootConstants) / sizeof(UINT32);
 
-#pragma pack(push, 4)
-struct DrawVoxelCommand
-{
-	UINT					  Data;
-	D3D12_DRAW_ARGUMENTS	  DrawArguments;
-};
-#pragma pack(pop)
-
-#pragma pack(push,4)
-struct Voxel
-{
-	UINT mMaterial;
-};
-#pragma pack(pop)
+// The command signature reads DrawVoxelCommand's arguments as a draw.
+static_assert(sizeof(DrawVoxelArguments) == sizeof(D3D12_DRAW_ARGUMENTS), "DrawVoxelArguments must match D3D12_DRAW_ARGUMENTS.");
+static_assert(offsetof(DrawVoxelArguments, InstanceCount) == offsetof(D3D12_DRAW_ARGUMENTS, InstanceCount), "DrawVoxelArguments must match D3D12_DRAW_ARGUMENTS.");
+static_assert(offsetof(DrawVoxelArguments, StartInstanceLocation) == offsetof(D3D12_DRAW_ARGUMENTS, StartInstanceLocation), "DrawVoxelArguments must match D3D12_DRAW_ARGUMENTS.");
 
 struct ViewParams
 {
 	XMFLOAT4X4 mProjection;
 	UINT       mFrame;
+	float      mLodDistance;	// Clip space w past which bricks draw from their LOD records.
 };
 
 #pragma pack(push, 4)
 struct CSCullConstants
 {
 	XMFLOAT4X4 projection;
+	UINT       bucketPass;	// 0 counts the commands in each distance bucket, 1 writes them out.
+	float      lodDistance;	// Clip space w past which bricks draw their level 1 cells, and level 2 past twice that.
 };
 #pragma pack(pop)
 const UINT CullConstantsInU32 = sizeof(CSCullConstants) / sizeof(UINT);
 
-static const UINT FrameCount = 2;
-static const UINT Depth = cDepth;
-static const UINT Height = cHeight;
-static const UINT Width = cWidth;
-static const UINT BrickWidth = cBrickWidth;
-static const UINT BrickHeight = cBrickHeight;
-static const UINT BrickDepth = cBrickDepth;
-static const UINT VoxelsPerBrick = BrickWidth*BrickDepth *BrickHeight;
-static const UINT TileX = 1;
-static const UINT TileY = 1;
-static const UINT TileZ = 1;
-static const UINT BrickCount = cDepthInBricks*cHeightInBricks*cWidthInBricks;
-static const UINT VoxelCount = BrickCount * VoxelsPerBrick;
-static const UINT BrickResourceCount = BrickCount * FrameCount;
 static const UINT CommandSizePerTile = BrickCount * sizeof(DrawVoxelCommand);
 static const UINT NumTexture = 1;
 static const UINT TileDescriptorStart = NumTexture;
@@ -96,4 +79,4 @@ static inline UINT AlignForUavCounter(UINT bufferSize)
 {
 	const UINT alignment = D3D12_UAV_COUNTER_PLACEMENT_ALIGNMENT;
 	return (bufferSize + (alignment - 1)) & ~(alignment - 1);
-}
\ No newline at end of file
+}
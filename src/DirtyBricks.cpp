@@ -0,0 +1,105 @@
+#include "stdafx.h"
+#include "DirtyBricks.h"
+#include <algorithm>
+
+static_assert(FrameCount <= 8, "Dirty brick slots are tracked as bits in a byte.");
+
+void DirtyBricks::Queue(UINT brick)
+{
+	for (UINT slot = 0; slot < FrameCount; slot++)
+	{
+		if (mFull[slot] || (mSlotFlags[brick] & (1 << slot)))
+		{
+			continue;
+		}
+
+		if (mBricks[slot].size() >= mMaxListLength)
+		{
+			// Too many to be worth listing; drop the list and do the whole volume.
+			for (UINT queued : mBricks[slot])
+			{
+				mSlotFlags[queued] &= ~(1 << slot);
+			}
+			mBricks[slot].clear();
+			mFull[slot] = true;
+			continue;
+		}
+
+		mSlotFlags[brick] |= (1 << slot);
+		mBricks[slot].push_back(brick);
+	}
+}
+
+void DirtyBricks::MarkBrick(UINT brick)
+{
+	Queue(brick);
+	if (!mMarkNeighbours)
+	{
+		return;
+	}
+
+	XMUINT3 b = GetBrickCoords(brick);
+	if (b.x > 0)					Queue(GetBrickIndex(b.x - 1, b.y, b.z));
+	if (b.x < cWidthInBricks - 1)	Queue(GetBrickIndex(b.x + 1, b.y, b.z));
+	if (b.y > 0)					Queue(GetBrickIndex(b.x, b.y - 1, b.z));
+	if (b.y < cHeightInBricks - 1)	Queue(GetBrickIndex(b.x, b.y + 1, b.z));
+	if (b.z > 0)					Queue(GetBrickIndex(b.x, b.y, b.z - 1));
+	if (b.z < cDepthInBricks - 1)	Queue(GetBrickIndex(b.x, b.y, b.z + 1));
+}
+
+void DirtyBricks::MarkAll()
+{
+	for (UINT slot = 0; slot < FrameCount; slot++)
+	{
+		mBricks[slot].clear();
+		mFull[slot] = true;
+	}
+	std::fill(mSlotFlags.begin(), mSlotFlags.end(), UINT8(0));
+}
+
+UINT DirtyBricks::Take(UINT slot, UINT* out)
+{
+	UINT count = 0;
+	if (!mFull[slot])
+	{
+		for (UINT brick : mBricks[slot])
+		{
+			out[count++] = brick;
+			mSlotFlags[brick] &= ~(1 << slot);
+		}
+	}
+
+	mBricks[slot].clear();
+	mFull[slot] = false;
+	return count;
+}
+
+void DirtyBricks::TakeRanges(UINT slot, UINT mergeGap, std::vector<BrickRange>& ranges)
+{
+	ranges.clear();
+	if (mFull[slot])
+	{
+		ranges.push_back({ 0, BrickCount });
+	}
+	else
+	{
+		std::vector<UINT>& bricks = mBricks[slot];
+		std::sort(bricks.begin(), bricks.end());
+
+		for (UINT brick : bricks)
+		{
+			if (!ranges.empty() && brick <= ranges.back().mFirst + ranges.back().mCount + mergeGap)
+			{
+				ranges.back().mCount = brick - ranges.back().mFirst + 1;
+			}
+			else
+			{
+				ranges.push_back({ brick, 1 });
+			}
+			mSlotFlags[brick] &= ~(1 << slot);
+		}
+	}
+
+	mBricks[slot].clear();
+	mFull[slot] = false;
+}
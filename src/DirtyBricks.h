@@ -0,0 +1,58 @@
+#pragma once
+
+#include "VoxelTypes.h"
+
+// A run of consecutive bricks.
+struct BrickRange
+{
+	UINT mFirst;
+	UINT mCount;
+};
+
+// Tracks the bricks that each buffer slot has not yet caught up with. Slots are
+// brought up to date independently (the sample alternates between them on each
+// edit), so every slot keeps its own queue. When a queue grows past
+// maxListLength the slot is flagged for a full refresh instead.
+//
+// The enclosure pass queues neighbours too, since editing a brick can change
+// whether any of its six neighbours is enclosed.
+class DirtyBricks
+{
+public:
+	// The list length past which the sample's uploads copy whole slots.
+	static const UINT UploadListLength = BrickCount / 8;
+
+	DirtyBricks(bool markNeighbours, UINT maxListLength) :
+		mSlotFlags(BrickCount, 0),
+		mMarkNeighbours(markNeighbours),
+		mMaxListLength(maxListLength)
+	{
+		MarkAll();
+	}
+
+	void MarkBrick(UINT brick);
+	void MarkAll();
+
+	// True when the whole volume must be refreshed for this slot.
+	bool IsFull(UINT slot) const { return mFull[slot]; }
+
+	// Writes the queued bricks for the slot to out (which must hold BrickCount
+	// entries), clears the slot and returns the count. Returns 0 when the slot
+	// needs a full refresh.
+	UINT Take(UINT slot, UINT* out);
+
+	// As Take, but sorts the queued bricks into runs. Runs separated by no more
+	// than mergeGap clean bricks are joined, trading a little extra copying for
+	// fewer copies. A slot that needs a full refresh yields one range covering
+	// every brick.
+	void TakeRanges(UINT slot, UINT mergeGap, std::vector<BrickRange>& ranges);
+
+private:
+	void Queue(UINT brick);
+
+	std::vector<UINT8>	mSlotFlags;		// Bit n set when the brick is queued for slot n.
+	std::vector<UINT>	mBricks[FrameCount];
+	bool				mFull[FrameCount];
+	bool				mMarkNeighbours;
+	UINT				mMaxListLength;
+};
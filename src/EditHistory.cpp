@@ -0,0 +1,163 @@
+#include "stdafx.h"
+#include "EditHistory.h"
+#include <algorithm>
+#include <chrono>
+
+UINT EditHistory::Apply(BrickPool& bricks)
+{
+	mModifiedBricks.clear();
+	if (mQueued.empty())
+	{
+		return 0;
+	}
+
+	// Copy every brick the ops can reach, since which of them change is only known
+	// afterwards; the copies of those left alone are dropped below.
+	EditStep step;
+	const UINT opCount = static_cast<UINT>(mQueued.size());
+	VoxelEditor::GetBricks(mQueued.data(), opCount, mTouched);
+	std::vector<UINT> touchedEntries;
+	std::vector<UINT> touchedWords;
+	bricks.CopyBricks(mTouched.data(), static_cast<UINT>(mTouched.size()), touchedEntries, touchedWords);
+
+	VoxelEditor editor(bricks);
+	const UINT changed = editor.Apply(mQueued.data(), opCount);
+	mModifiedBricks.swap(editor.mModifiedBricks);
+
+	step.mOps.swap(mQueued);
+	mQueued.clear();
+	if (mModifiedBricks.empty())
+	{
+		return 0;
+	}
+
+	// Both lists are in brick order, so the modified bricks' copies are found in
+	// one pass.
+	UINT t = 0;
+	for (UINT brick : mModifiedBricks)
+	{
+		while (mTouched[t] != brick)
+		{
+			t++;
+		}
+
+		const UINT entry = touchedEntries[t];
+		if (entry & UniformBrickFlag)
+		{
+			step.mBeforeEntries.push_back(entry);
+			continue;
+		}
+
+		const UINT offset = entry & cBrickOffsetMask;
+		const UINT wordCount = BrickPool::BlockWords(static_cast<BrickFormat>(entry >> cBrickFormatShift));
+		step.mBeforeEntries.push_back((entry & ~cBrickOffsetMask) | static_cast<UINT>(step.mBeforeWords.size()));
+		step.mBeforeWords.insert(step.mBeforeWords.end(), touchedWords.begin() + offset, touchedWords.begin() + offset + wordCount);
+	}
+	step.mBricks = mModifiedBricks;
+	bricks.CopyBricks(step.mBricks.data(), static_cast<UINT>(step.mBricks.size()), step.mAfterEntries, step.mAfterWords);
+
+	// A new step replaces any that were undone.
+	mSteps.erase(mSteps.begin() + mApplied, mSteps.end());
+	mSteps.push_back(std::move(step));
+	if (mSteps.size() > mMaxSteps)
+	{
+		mDroppedOps.insert(mDroppedOps.end(), mSteps.front().mOps.begin(), mSteps.front().mOps.end());
+		mSteps.pop_front();
+	}
+	mApplied = static_cast<UINT>(mSteps.size());
+
+	return changed;
+}
+
+bool EditHistory::Undo(BrickPool& bricks)
+{
+	mModifiedBricks.clear();
+	if (!CanUndo())
+	{
+		return false;
+	}
+
+	const EditStep& step = mSteps[--mApplied];
+	bricks.RestoreBricks(step.mBricks.data(), static_cast<UINT>(step.mBricks.size()), step.mBeforeEntries.data(), step.mBeforeWords.data());
+	mModifiedBricks = step.mBricks;
+	return true;
+}
+
+bool EditHistory::Redo(BrickPool& bricks)
+{
+	mModifiedBricks.clear();
+	if (!CanRedo())
+	{
+		return false;
+	}
+
+	const EditStep& step = mSteps[mApplied++];
+	bricks.RestoreBricks(step.mBricks.data(), static_cast<UINT>(step.mBricks.size()), step.mAfterEntries.data(), step.mAfterWords.data());
+	mModifiedBricks = step.mBricks;
+	return true;
+}
+
+void EditHistory::Clear()
+{
+	mQueued.clear();
+	mDroppedOps.clear();
+	mSteps.clear();
+	mApplied = 0;
+	mModifiedBricks.clear();
+}
+
+void EditHistory::GetOps(std::vector<EditOp>& ops) const
+{
+	ops = mDroppedOps;
+	for (UINT s = 0; s < mApplied; s++)
+	{
+		ops.insert(ops.end(), mSteps[s].mOps.begin(), mSteps[s].mOps.end());
+	}
+}
+
+UINT EditHistory::Replay(BrickPool& bricks, const std::vector<EditOp>& ops, UINT batchSize, std::vector<UINT>& modifiedBricks)
+{
+	modifiedBricks.clear();
+	VoxelEditor editor(bricks);
+	UINT changed = 0;
+
+	const UINT opCount = static_cast<UINT>(ops.size());
+	const UINT step = batchSize > 0 ? batchSize : 1;
+	for (UINT first = 0; first < opCount; first += step)
+	{
+		const UINT count = opCount - first < step ? opCount - first : step;
+		changed += editor.Apply(&ops[first], count);
+		modifiedBricks.insert(modifiedBricks.end(), editor.mModifiedBricks.begin(), editor.mModifiedBricks.end());
+	}
+
+	if (opCount > step)
+	{
+		std::sort(modifiedBricks.begin(), modifiedBricks.end());
+		modifiedBricks.erase(std::unique(modifiedBricks.begin(), modifiedBricks.end()), modifiedBricks.end());
+	}
+	return changed;
+}
+
+double EditHistory::Benchmark(const BrickPool& bricks, float radius, UINT opCount, UINT batchSize)
+{
+	// Strokes of spheres half a radius apart, as a held dig or place key makes,
+	// each stroke starting somewhere new.
+	std::vector<EditOp> ops;
+	const UINT strokeLength = 32;
+	for (UINT i = 0; i < opCount; i++)
+	{
+		const UINT stroke = i / strokeLength;
+		const float along = (i % strokeLength) * radius * 0.5f;
+		XMFLOAT3 centre(((stroke * 37) % Width) * VoxelSize + along, ((stroke * 11) % Height) * VoxelSize, ((stroke * 53) % Depth) * VoxelSize);
+		ops.push_back(VoxelEditor::MakeSphere(centre, radius, (stroke & 1) ? 7 : 0));
+	}
+
+	BrickPool scratch(bricks);
+	std::vector<UINT> modifiedBricks;
+
+	auto start = std::chrono::high_resolution_clock::now();
+	Replay(scratch, ops, batchSize, modifiedBricks);
+	std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+	return opCount / elapsed.count();
+}
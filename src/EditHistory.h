@@ -0,0 +1,79 @@
+#pragma once
+
+#include <deque>
+#include "VoxelTypes.h"
+#include "BrickPool.h"
+#include "VoxelEdit.h"
+
+// Records edits as a stream of EditOps grouped into undoable steps. Ops are
+// queued as they are made and applied together by Apply(), as one batch and one
+// step, so overlapping ops touch each brick once and the work that follows an
+// edit (occupancy, faces, mips, enclosure and upload) runs once per step rather
+// than once per op.
+//
+// Each step keeps its ops and the encoded bricks it changed, as they were before
+// and after, so Undo() and Redo() restore bricks without re-running any edit.
+// Making a new step after an Undo() drops the steps that could have been redone.
+// Past maxSteps the oldest step can no longer be undone, but its ops stay in the
+// stream GetOps() returns.
+class EditHistory
+{
+public:
+	EditHistory(UINT maxSteps = 64) :
+		mMaxSteps(maxSteps),
+		mApplied(0)
+	{}
+
+	void Queue(const EditOp& op) { mQueued.push_back(op); }
+	bool HasQueued() const { return !mQueued.empty(); }
+
+	// Applies the queued ops to bricks as one step. Returns the number of voxel
+	// changes; the bricks they belong to are listed in mModifiedBricks. Ops that
+	// change nothing make no step.
+	UINT Apply(BrickPool& bricks);
+
+	// Take back, or make again, the last step undone or applied. Return false when
+	// there is no such step; otherwise the bricks restored are listed in
+	// mModifiedBricks.
+	bool Undo(BrickPool& bricks);
+	bool Redo(BrickPool& bricks);
+
+	bool CanUndo() const { return mApplied > 0; }
+	bool CanRedo() const { return mApplied < mSteps.size(); }
+
+	// Forgets every step and queued op, for when the volume is replaced.
+	void Clear();
+
+	// The ops of every step applied and not undone, oldest first: applied to the
+	// volume as it was before the first of them, they rebuild it as it is now.
+	void GetOps(std::vector<EditOp>& ops) const;
+
+	// Applies a stream of ops to bricks in batches of batchSize. Returns the
+	// number of voxel changes; modifiedBricks lists the bricks changed, in brick
+	// order.
+	static UINT Replay(BrickPool& bricks, const std::vector<EditOp>& ops, UINT batchSize, std::vector<UINT>& modifiedBricks);
+
+	// Ops per second for replaying strokes of overlapping spheres onto a copy of
+	// bricks in batches of batchSize.
+	static double Benchmark(const BrickPool& bricks, float radius, UINT opCount, UINT batchSize);
+
+	std::vector<UINT>	mModifiedBricks;
+
+private:
+	struct EditStep
+	{
+		std::vector<EditOp>	mOps;
+		std::vector<UINT>	mBricks;
+		std::vector<UINT>	mBeforeEntries;		// Offsets relative to mBeforeWords.
+		std::vector<UINT>	mBeforeWords;
+		std::vector<UINT>	mAfterEntries;		// Offsets relative to mAfterWords.
+		std::vector<UINT>	mAfterWords;
+	};
+
+	UINT					mMaxSteps;
+	std::vector<EditOp>		mQueued;
+	std::vector<EditOp>		mDroppedOps;	// Ops of steps that can no longer be undone.
+	std::deque<EditStep>	mSteps;
+	UINT					mApplied;		// Steps applied; those after were undone.
+	std::vector<UINT>		mTouched;
+};
@@ -0,0 +1,145 @@
+#include "stdafx.h"
+#include "Enclosure.h"
+#include <chrono>
+
+bool EnclosurePass::IsBrickSolid(const Voxel* voxels, UINT brick) const
+{
+	const Voxel* v = voxels + brick * VoxelsPerBrick;
+	for (UINT n = 0; n < VoxelsPerBrick; n++)
+	{
+		if (v[n].mMaterial == 0)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool EnclosurePass::IsBrickEmpty(const Voxel* voxels, UINT brick) const
+{
+	const Voxel* v = voxels + brick * VoxelsPerBrick;
+	for (UINT n = 0; n < VoxelsPerBrick; n++)
+	{
+		if (v[n].mMaterial != 0)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// Neighbour test shared by both paths; isSolid is queried by brick index.
+template<typename Solid>
+static bool IsEnclosureVisible(UINT brick, Solid isSolid)
+{
+	// Bricks on the edge of the volume are always drawn.
+	XMUINT3 b = GetBrickCoords(brick);
+	if (b.x == 0 || b.x == cWidthInBricks - 1 ||
+		b.y == 0 || b.y == cHeightInBricks - 1 ||
+		b.z == 0 || b.z == cDepthInBricks - 1)
+	{
+		return true;
+	}
+
+	return !isSolid(GetBrickIndex(b.x, b.y, b.z - 1)) ||
+		   !isSolid(GetBrickIndex(b.x, b.y, b.z + 1)) ||
+		   !isSolid(GetBrickIndex(b.x, b.y - 1, b.z)) ||
+		   !isSolid(GetBrickIndex(b.x, b.y + 1, b.z)) ||
+		   !isSolid(GetBrickIndex(b.x - 1, b.y, b.z)) ||
+		   !isSolid(GetBrickIndex(b.x + 1, b.y, b.z));
+}
+
+bool EnclosurePass::IsBrickVisible(const Voxel* voxels, UINT brick) const
+{
+	if (IsBrickEmpty(voxels, brick))
+	{
+		return false;
+	}
+
+	return IsEnclosureVisible(brick, [this, voxels](UINT neighbour) { return IsBrickSolid(voxels, neighbour); });
+}
+
+bool EnclosurePass::IsBrickVisible(const BrickOccupancy& occupancy, UINT brick) const
+{
+	if (occupancy.IsBrickEmpty(brick))
+	{
+		return false;
+	}
+
+	return IsEnclosureVisible(brick, [&occupancy](UINT neighbour) { return occupancy.IsBrickSolid(neighbour); });
+}
+
+template<typename Visible>
+void EnclosurePass::RunParallel(Visible isVisible, std::vector<DrawVoxelCommand>& commands, ThreadPool& pool)
+{
+	// Each job scans one z slab into its own list; the lists are joined in slab
+	// order so the output does not depend on timing.
+	const UINT slice = cWidthInBricks*cHeightInBricks;
+	pool.ParallelFor(cDepthInBricks, [this, &isVisible, slice](UINT z)
+	{
+		std::vector<DrawVoxelCommand>& slabCommands = mSlabCommands[z];
+		slabCommands.clear();
+		for (UINT brick = z * slice; brick < (z + 1) * slice; brick++)
+		{
+			if (isVisible(brick))
+			{
+				DrawVoxelCommand command;
+				command.Data = brick;
+				command.DrawArguments.VertexCountPerInstance = 4;
+				command.DrawArguments.InstanceCount = 6 * VoxelsPerBrick;
+				command.DrawArguments.StartVertexLocation = 0;
+				command.DrawArguments.StartInstanceLocation = 0;
+				slabCommands.push_back(command);
+			}
+		}
+	});
+
+	commands.clear();
+	for (const std::vector<DrawVoxelCommand>& slabCommands : mSlabCommands)
+	{
+		commands.insert(commands.end(), slabCommands.begin(), slabCommands.end());
+	}
+}
+
+void EnclosurePass::Run(const Voxel* voxels, std::vector<DrawVoxelCommand>& commands, ThreadPool& pool)
+{
+	RunParallel([this, voxels](UINT brick) { return IsBrickVisible(voxels, brick); }, commands, pool);
+}
+
+void EnclosurePass::Run(const BrickOccupancy& occupancy, std::vector<DrawVoxelCommand>& commands, ThreadPool& pool)
+{
+	RunParallel([this, &occupancy](UINT brick) { return IsBrickVisible(occupancy, brick); }, commands, pool);
+}
+
+double EnclosurePass::Benchmark(const Voxel* voxels, ThreadPool& pool, UINT iterations)
+{
+	std::vector<DrawVoxelCommand> commands;
+	commands.reserve(BrickCount);
+
+	auto start = std::chrono::high_resolution_clock::now();
+	for (UINT i = 0; i < iterations; i++)
+	{
+		Run(voxels, commands, pool);
+	}
+	std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+	return (double(BrickCount) * iterations) / elapsed.count();
+}
+
+double EnclosurePass::Benchmark(const Voxel* voxels, BrickOccupancy& occupancy, ThreadPool& pool, UINT iterations)
+{
+	std::vector<DrawVoxelCommand> commands;
+	commands.reserve(BrickCount);
+
+	auto start = std::chrono::high_resolution_clock::now();
+	for (UINT i = 0; i < iterations; i++)
+	{
+		occupancy.Build(voxels);
+		Run(occupancy, commands, pool);
+	}
+	std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+	return (double(BrickCount) * iterations) / elapsed.count();
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "VoxelTypes.h"
+#include "BrickOccupancy.h"
+#include "ThreadPool.h"
+
+// CPU implementation of the brick enclosure pass in compute.hlsl. A brick survives
+// if it holds at least one voxel and either lies on the edge of the volume or has
+// a neighbour that is not completely solid. Run() produces the same commands that
+// CSMain appends, ordered by brick index rather than in append order. The voxel
+// overloads scan every voxel like the original shader; the occupancy overloads
+// use the per-brick masks instead.
+class EnclosurePass
+{
+public:
+	EnclosurePass() :
+		mSlabCommands(cDepthInBricks)
+	{}
+
+	// Each z slab of bricks is a job on the pool.
+	void Run(const Voxel* voxels, std::vector<DrawVoxelCommand>& commands, ThreadPool& pool);
+	void Run(const BrickOccupancy& occupancy, std::vector<DrawVoxelCommand>& commands, ThreadPool& pool);
+
+	bool IsBrickSolid(const Voxel* voxels, UINT brick) const;
+	bool IsBrickEmpty(const Voxel* voxels, UINT brick) const;
+	bool IsBrickVisible(const Voxel* voxels, UINT brick) const;
+	bool IsBrickVisible(const BrickOccupancy& occupancy, UINT brick) const;
+
+	// Bricks processed per second over the given number of full passes. The
+	// occupancy variant rebuilds the masks from the voxels on every pass.
+	double Benchmark(const Voxel* voxels, ThreadPool& pool, UINT iterations);
+	double Benchmark(const Voxel* voxels, BrickOccupancy& occupancy, ThreadPool& pool, UINT iterations);
+
+private:
+	template<typename Visible>
+	void RunParallel(Visible isVisible, std::vector<DrawVoxelCommand>& commands, ThreadPool& pool);
+
+	std::vector<std::vector<DrawVoxelCommand>>	mSlabCommands;	// Per z slab, kept between runs.
+};
@@ -0,0 +1,128 @@
+#include "stdafx.h"
+#include "GreedyMesher.h"
+#include <algorithm>
+#include <chrono>
+
+static_assert(BrickWidth == 4 && BrickHeight == 4 && BrickDepth == 4, "Quad sizes are packed in 2 bits per axis.");
+
+// The axis each face points along, and the two axes of its plane, as voxel
+// index strides within a brick.
+static const UINT NormalStride[FaceCount] = { 16, 16, 4, 4, 1, 1 };
+static const UINT WidthStride[FaceCount] = { 1, 1, 1, 1, 4, 4 };
+static const UINT HeightStride[FaceCount] = { 4, 4, 16, 16, 16, 16 };
+
+UINT GreedyMesher::MeshBrick(const UINT64* planes, const Voxel* voxels, UINT16* quads)
+{
+	UINT count = 0;
+
+	for (UINT face = 0; face < FaceCount; face++)
+	{
+		const UINT64 plane = planes[face];
+		for (UINT slice = 0; slice < 4 && plane != 0; slice++)
+		{
+			// Materials of the slice's exposed faces, zero where there is none.
+			UINT materials[4][4];
+			bool any = false;
+			for (UINT v = 0; v < 4; v++)
+			{
+				for (UINT u = 0; u < 4; u++)
+				{
+					const UINT voxel = slice * NormalStride[face] + v * HeightStride[face] + u * WidthStride[face];
+					materials[v][u] = ((plane >> voxel) & 1) ? voxels[voxel].mMaterial : 0;
+					any |= materials[v][u] != 0;
+				}
+			}
+
+			for (UINT v = 0; v < 4 && any; v++)
+			{
+				for (UINT u = 0; u < 4; u++)
+				{
+					const UINT material = materials[v][u];
+					if (material == 0)
+					{
+						continue;
+					}
+
+					UINT width = 1;
+					while (u + width < 4 && materials[v][u + width] == material)
+					{
+						width++;
+					}
+
+					UINT height = 1;
+					for (bool grow = true; grow && v + height < 4; )
+					{
+						for (UINT n = u; n < u + width; n++)
+						{
+							grow &= materials[v + height][n] == material;
+						}
+						height += grow ? 1 : 0;
+					}
+
+					for (UINT y = v; y < v + height; y++)
+					{
+						for (UINT x = u; x < u + width; x++)
+						{
+							materials[y][x] = 0;
+						}
+					}
+
+					const UINT voxel = slice * NormalStride[face] + v * HeightStride[face] + u * WidthStride[face];
+					quads[count++] = static_cast<UINT16>(voxel | (face << 6) | ((width - 1) << 9) | ((height - 1) << 11));
+				}
+			}
+		}
+	}
+
+	return count;
+}
+
+void GreedyMesher::MeshBrick(const BrickFaces& faces, const BrickPool& bricks, UINT brick)
+{
+	if (faces.GetFaceCount(brick) == 0)
+	{
+		mQuads.Write(brick, nullptr, 0);
+		return;
+	}
+
+	Voxel voxels[VoxelsPerBrick];
+	UINT16 quads[FaceLists::MaxEntriesPerBrick];
+	bricks.ReadBrick(brick, voxels);
+	mQuads.Write(brick, quads, MeshBrick(&faces.mPlanes[brick * FaceCount], voxels, quads));
+}
+
+void GreedyMesher::Build(const BrickFaces& faces, const BrickPool& bricks)
+{
+	mQuads.Clear();
+	for (UINT brick = 0; brick < BrickCount; brick++)
+	{
+		if (faces.GetFaceCount(brick) != 0)
+		{
+			MeshBrick(faces, bricks, brick);
+		}
+	}
+}
+
+void GreedyMesher::UpdateBricks(const BrickFaces& faces, const BrickPool& bricks, const std::vector<UINT>& changed)
+{
+	mVisit.assign(changed.begin(), changed.end());
+	std::sort(mVisit.begin(), mVisit.end());
+	mVisit.erase(std::unique(mVisit.begin(), mVisit.end()), mVisit.end());
+
+	for (UINT brick : mVisit)
+	{
+		MeshBrick(faces, bricks, brick);
+	}
+}
+
+double GreedyMesher::Benchmark(const BrickFaces& faces, const BrickPool& bricks, UINT iterations)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+	for (UINT i = 0; i < iterations; i++)
+	{
+		Build(faces, bricks);
+	}
+	std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+	return (double(BrickCount) * iterations) / elapsed.count();
+}
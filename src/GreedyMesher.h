@@ -0,0 +1,41 @@
+#pragma once
+
+#include "VoxelTypes.h"
+#include "BrickPool.h"
+#include "BrickFaces.h"
+
+// Merges the exposed faces of each brick into larger quads. Within each slice of
+// a brick, faces pointing the same way that share a material are grown greedily
+// into rectangles, first along the row and then over the rows below, so a flat
+// stretch of one material becomes a single quad per brick instead of sixteen.
+//
+// Quads are kept in FaceLists in the face entry layout with the size added: the
+// first voxel in the low 6 bits, the face in the next 3, then the width and
+// height less one in 2 bits each. Width runs along the first axis of the face's
+// plane (x, or y for x facing quads) and height along the second (y, or z for y
+// and x facing quads). A 1x1 quad is the same entry as the face, so the vertex
+// shader draws either kind of list.
+class GreedyMesher
+{
+public:
+	// Meshes every brick from the exposed faces and the voxel materials.
+	void Build(const BrickFaces& faces, const BrickPool& bricks);
+
+	// Remeshes the listed bricks, which may repeat, after their faces or
+	// materials changed.
+	void UpdateBricks(const BrickFaces& faces, const BrickPool& bricks, const std::vector<UINT>& changed);
+
+	// Writes the quads for one brick's face planes and voxels and returns how many
+	// there are; quads must hold FaceLists::MaxEntriesPerBrick entries.
+	static UINT MeshBrick(const UINT64* planes, const Voxel* voxels, UINT16* quads);
+
+	// Bricks per second for a full rebuild.
+	double Benchmark(const BrickFaces& faces, const BrickPool& bricks, UINT iterations);
+
+	FaceLists	mQuads;
+
+private:
+	void MeshBrick(const BrickFaces& faces, const BrickPool& bricks, UINT brick);
+
+	std::vector<UINT>	mVisit;
+};
@@ -0,0 +1,256 @@
+#include "stdafx.h"
+#include "Scene.h"
+#include "Enclosure.h"
+#include "Culling.h"
+#include "Occlusion.h"
+#include "CommandBudget.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// Console counterpart of RunBenchmarks in D3D12ExecuteIndirect.cpp: times the CPU
+// passes on the sample's world without a window or device, and prints the same
+// lines the sample writes to the debugger.
+//
+//	VoxelBench [--world <name>] [--camera <x,y,z,yaw>] [--iterations <n>] [--quick] [pass...]
+//
+// With no passes named, every pass runs. The camera defaults to the sample's
+// starting camera. --quick runs one iteration of each, for ctest to check that
+// they complete.
+
+struct BenchOptions
+{
+	UINT		mIterations;
+	SceneCamera	mCamera;
+};
+
+// The commands the sample's frame would hand to occlusion culling: the enclosed
+// bricks that survive the frustum and LOD test from the camera.
+static void GetFrustumCulled(const Scene& scene, const XMFLOAT4X4& projection, std::vector<DrawVoxelCommand>& culled)
+{
+	FrustumCuller culler;
+	culler.SetProjection(projection);
+	culler.SetLod(&scene.mMips, GetLodDistance(projection));
+	culler.Run(scene.mEnclosed, culled);
+}
+
+static void BenchEnclosure(const Scene& scene, const BenchOptions& options)
+{
+	EnclosurePass enclosure;
+	std::vector<DrawVoxelCommand> commands;
+	enclosure.Run(&scene.mVoxels[0], commands, ThreadPool::Default());
+	double bricksPerSecond = enclosure.Benchmark(&scene.mVoxels[0], ThreadPool::Default(), options.mIterations);
+
+	BrickOccupancy occupancy;
+	double maskedBricksPerSecond = enclosure.Benchmark(&scene.mVoxels[0], occupancy, ThreadPool::Default(), options.mIterations);
+
+	printf("Enclosure: %u threads, %u of %u bricks visible, %.1f Mbricks/sec\n",
+		ThreadPool::Default().mThreadCount, static_cast<UINT>(commands.size()), BrickCount, bricksPerSecond / 1.0e6);
+	printf("Occupancy: build + enclosure %.1f Mbricks/sec, mask build", maskedBricksPerSecond / 1.0e6);
+	for (UINT level = SimdScalar; level <= static_cast<UINT>(GetCpuSimdLevel()); level++)
+	{
+		occupancy.mSimd = static_cast<SimdLevel>(level);
+		printf("%s %s %.1f Mbricks/sec", level == SimdScalar ? "" : ",", GetSimdLevelName(occupancy.mSimd),
+			occupancy.Benchmark(&scene.mVoxels[0], options.mIterations) / 1.0e6);
+	}
+	printf("\n");
+}
+
+static void BenchFrustum(const Scene& scene, const BenchOptions& options)
+{
+	const XMFLOAT4X4 projection = GetViewProjection(options.mCamera);
+	std::vector<DrawVoxelCommand> culled;
+	GetFrustumCulled(scene, projection, culled);
+	UINT farBricks = 0;
+	for (const DrawVoxelCommand& command : culled)
+	{
+		farBricks += (command.Data & FrustumCuller::FarBrickFlag) ? 1 : 0;
+	}
+
+	FrustumCuller culler;
+	culler.SetProjection(projection);
+	culler.SetLod(&scene.mMips, GetLodDistance(projection));
+	printf("Frustum: %u of %u bricks visible (%u far)", static_cast<UINT>(culled.size()), static_cast<UINT>(scene.mEnclosed.size()), farBricks);
+	for (UINT level = SimdScalar; level <= static_cast<UINT>(GetCpuSimdLevel()); level++)
+	{
+		culler.mSimd = static_cast<SimdLevel>(level);
+		printf(", %s %.1f Mbricks/sec", GetSimdLevelName(culler.mSimd), culler.Benchmark(scene.mEnclosed, options.mIterations * 4) / 1.0e6);
+	}
+	printf("\n");
+}
+
+static void BenchOcclusion(const Scene& scene, const BenchOptions& options)
+{
+	const XMFLOAT4X4 projection = GetViewProjection(options.mCamera);
+	std::vector<DrawVoxelCommand> culled;
+	GetFrustumCulled(scene, projection, culled);
+
+	OcclusionRasterizer rasterizer(OcclusionWidth, OcclusionHeight);
+	double rasterizedPerSecond = rasterizer.Benchmark(projection, scene.mOccupancy, culled, ThreadPool::Default(), options.mIterations);
+
+	printf("Occlusion rasterizer: %ux%u, %u occluders, %u of %u bricks occluded, %.1f Mbricks/sec, %.2f ms per frame\n",
+		rasterizer.GetPyramid().GetWidth(), rasterizer.GetPyramid().GetHeight(), rasterizer.mStats.mOccluders,
+		rasterizer.mStats.mOccluded, rasterizer.mStats.mTested, rasterizedPerSecond / 1.0e6,
+		culled.empty() ? 0.0 : 1000.0 * culled.size() / rasterizedPerSecond);
+}
+
+// The pyramid and brick test on their own. The pyramid's build rate is timed at
+// the sample's resolution; the brick test runs against the depth the occlusion
+// rasterizer draws, so that it has something to reject.
+static void BenchHiZ(const Scene& scene, const BenchOptions& options)
+{
+	const XMFLOAT4X4 projection = GetViewProjection(options.mCamera);
+	std::vector<DrawVoxelCommand> culled;
+	GetFrustumCulled(scene, projection, culled);
+
+	DepthPyramid pyramid;
+	pyramid.Resize(ViewportWidth, ViewportHeight);
+	double texelsPerSecond = pyramid.Benchmark(options.mIterations);
+
+	OcclusionRasterizer rasterizer(OcclusionWidth, OcclusionHeight);
+	std::vector<DrawVoxelCommand> unoccluded;
+	rasterizer.Run(projection, scene.mOccupancy, culled, unoccluded, ThreadPool::Default());
+	const DepthPyramid& depth = rasterizer.GetPyramid();
+
+	OcclusionCuller occlusion;
+	occlusion.SetProjection(projection, depth.GetWidth(), depth.GetHeight());
+	std::vector<DrawVoxelCommand> kept;
+	occlusion.Run(depth, culled, kept);
+	double occlusionTestsPerSecond = occlusion.Benchmark(depth, culled, options.mIterations * 4);
+
+	printf("Hi-Z: %ux%u pyramid with %u levels, build %.0f Mtexels/sec, brick test %.1f Mbricks/sec, %u of %u bricks occluded\n",
+		pyramid.GetWidth(), pyramid.GetHeight(), pyramid.GetLevelCount(), texelsPerSecond / 1.0e6, occlusionTestsPerSecond / 1.0e6,
+		static_cast<UINT>(culled.size() - kept.size()), static_cast<UINT>(culled.size()));
+}
+
+// Replays the visible counts of the camera turning on the spot through the
+// command budget, at a slow turn and at a full turn a second, with the sample's
+// readback latency of FrameCount frames.
+static void BenchBudget(const Scene& scene, const BenchOptions& options)
+{
+	CullHierarchy hierarchy;
+	hierarchy.Build(scene.mEnclosed);
+
+	FrustumCuller culler;
+	const UINT turnFrames[] = { 600, 60 };
+	for (UINT turn = 0; turn < sizeof(turnFrames) / sizeof(turnFrames[0]); turn++)
+	{
+		std::vector<UINT> counts(turnFrames[turn]);
+		std::vector<DrawVoxelCommand> turnCulled;
+		for (UINT frame = 0; frame < turnFrames[turn]; frame++)
+		{
+			SceneCamera camera = options.mCamera;
+			camera.mYaw += 2.0f * 3.14159265f * frame / turnFrames[turn];
+			const XMFLOAT4X4 projection = GetViewProjection(camera);
+			culler.SetProjection(projection);
+			culler.SetLod(&scene.mMips, GetLodDistance(projection));
+			culler.Run(hierarchy, turnCulled);
+			counts[frame] = static_cast<UINT>(turnCulled.size());
+		}
+
+		CommandBudget::BudgetStats stats = CommandBudget::Simulate(&counts[0], turnFrames[turn], FrameCount, hierarchy.GetCommandCount());
+		printf("Command budget, turn over %u frames: %.0f visible and %.0f max commands on average (of %u), peak %u, %u overflows\n",
+			turnFrames[turn], double(stats.mTotalCount) / (stats.mFrames ? stats.mFrames : 1), double(stats.mTotalBudget) / (stats.mFrames ? stats.mFrames : 1),
+			BrickCount, stats.mPeakCount, stats.mOverflows);
+	}
+}
+
+struct BenchPass
+{
+	const char*	mName;
+	void		(*mRun)(const Scene& scene, const BenchOptions& options);
+};
+
+static const BenchPass sPasses[] =
+{
+	{ "enclosure",	BenchEnclosure },
+	{ "frustum",	BenchFrustum },
+	{ "hiz",		BenchHiZ },
+	{ "occlusion",	BenchOcclusion },
+	{ "budget",		BenchBudget },
+};
+
+static const UINT PassCount = sizeof(sPasses) / sizeof(sPasses[0]);
+
+static int Usage()
+{
+	printf("Usage: VoxelBench [--world <name>] [--camera <x,y,z,yaw>] [--iterations <n>] [--quick] [pass...]\nWorlds:");
+	for (UINT type = 0; type < WorldTypeCount; type++)
+	{
+		printf(" %s", GetWorldTypeName(static_cast<WorldType>(type)));
+	}
+	printf("\nPasses:");
+	for (UINT pass = 0; pass < PassCount; pass++)
+	{
+		printf(" %s", sPasses[pass].mName);
+	}
+	printf("\n");
+	return 1;
+}
+
+int main(int argc, char** argv)
+{
+	WorldType world = WorldSample;
+	BenchOptions options = { 8, GetStartCamera() };
+	bool selected[PassCount] = {};
+	bool anySelected = false;
+
+	for (int arg = 1; arg < argc; arg++)
+	{
+		if (strcmp(argv[arg], "--world") == 0 && arg + 1 < argc)
+		{
+			if (!ParseWorldType(argv[++arg], world))
+			{
+				return Usage();
+			}
+		}
+		else if (strcmp(argv[arg], "--camera") == 0 && arg + 1 < argc)
+		{
+			if (!ParseCamera(argv[++arg], options.mCamera))
+			{
+				return Usage();
+			}
+		}
+		else if (strcmp(argv[arg], "--iterations") == 0 && arg + 1 < argc)
+		{
+			options.mIterations = static_cast<UINT>(atoi(argv[++arg]));
+			if (options.mIterations == 0)
+			{
+				return Usage();
+			}
+		}
+		else if (strcmp(argv[arg], "--quick") == 0)
+		{
+			options.mIterations = 1;
+		}
+		else
+		{
+			UINT pass = 0;
+			while (pass < PassCount && strcmp(argv[arg], sPasses[pass].mName) != 0)
+			{
+				pass++;
+			}
+			if (pass == PassCount)
+			{
+				return Usage();
+			}
+			selected[pass] = true;
+			anySelected = true;
+		}
+	}
+
+	Scene scene(world);
+	printf("World: %s, seed %u, %u of %u bricks mixed, %u enclosed\n", GetWorldTypeName(world), SceneSeed,
+		scene.mPool.MixedBrickCount(), BrickCount, static_cast<UINT>(scene.mEnclosed.size()));
+	printf("Camera: %.2f,%.2f,%.2f, yaw %.3f\n", options.mCamera.mPosition.x, options.mCamera.mPosition.y,
+		options.mCamera.mPosition.z, options.mCamera.mYaw);
+
+	for (UINT pass = 0; pass < PassCount; pass++)
+	{
+		if (selected[pass] || !anySelected)
+		{
+			sPasses[pass].mRun(scene, options);
+		}
+	}
+	return 0;
+}
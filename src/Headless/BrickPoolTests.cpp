@@ -0,0 +1,172 @@
+#include "stdafx.h"
+#include "Test.h"
+#include "Scene.h"
+#include "VoxelEdit.h"
+#include <algorithm>
+
+// A compacted table is accepted, and the pool loaded from it matches the one it
+// came from. Tables whose blocks run past the words, or whose blocks share
+// words with another brick's, whole or in part, are refused.
+TEST(BrickTableRejectsOverlaps)
+{
+	Scene scene(WorldCaves);
+	std::vector<UINT> table, words;
+	scene.mPool.Compact(table, words);
+	const UINT wordCount = static_cast<UINT>(words.size());
+	CHECK(BrickPool::IsValidTable(table.data(), words.data(), wordCount));
+
+	BrickPool loaded;
+	CHECK(loaded.Load(table.data(), words.data(), wordCount));
+	std::vector<UINT> loadedTable, loadedWords;
+	loaded.Compact(loadedTable, loadedWords);
+	CHECK(loadedTable == table && loadedWords == words);
+
+	// The first two mixed bricks; Compact() packs their blocks one after the other.
+	UINT first = BrickCount, second = BrickCount;
+	for (UINT brick = 0; brick < BrickCount && second == BrickCount; brick++)
+	{
+		if (table[brick] & UniformBrickFlag)
+		{
+			continue;
+		}
+		if (first == BrickCount)
+		{
+			first = brick;
+		}
+		else
+		{
+			second = brick;
+		}
+	}
+	CHECK(second < BrickCount);
+	if (second == BrickCount)
+	{
+		return;
+	}
+
+	std::vector<UINT> bad = table;
+	bad[second] = (table[second] & ~cBrickOffsetMask) | (table[first] & cBrickOffsetMask);
+	CHECK(!BrickPool::IsValidTable(bad.data(), words.data(), wordCount));
+	CHECK(!loaded.Load(bad.data(), words.data(), wordCount));
+
+	bad = table;
+	bad[second] = table[second] - 1;
+	CHECK(!BrickPool::IsValidTable(bad.data(), words.data(), wordCount));
+
+	bad = table;
+	bad[second] = (table[second] & ~cBrickOffsetMask) | wordCount;
+	CHECK(!BrickPool::IsValidTable(bad.data(), words.data(), wordCount));
+}
+
+// An 8 bit block whose index points past its 32 entry palette would be decoded
+// from words beyond the block, so a table holding one is refused.
+TEST(BrickTableRejectsPaletteOverrun)
+{
+	std::vector<Voxel> voxels(VoxelCount);
+	for (UINT n = 0; n < VoxelsPerBrick; n++)
+	{
+		voxels[n].mMaterial = 1 + n % 20;
+	}
+
+	BrickPool pool;
+	pool.Build(&voxels[0]);
+	CHECK(pool.mTable[0] >> cBrickFormatShift == BrickFormatPalette8);
+
+	std::vector<UINT> table, words;
+	pool.Compact(table, words);
+	const UINT wordCount = static_cast<UINT>(words.size());
+	CHECK(BrickPool::IsValidTable(table.data(), words.data(), wordCount));
+
+	// The last voxel's index, in the top byte of the block's last word.
+	const UINT offset = table[0] & cBrickOffsetMask;
+	std::vector<UINT> bad = words;
+	bad[offset + BrickPool::BlockWords(BrickFormatPalette8) - 1] |= 200u << 24;
+	CHECK(!BrickPool::IsValidTable(table.data(), bad.data(), wordCount));
+
+	BrickPool loaded;
+	CHECK(!loaded.Load(table.data(), bad.data(), wordCount));
+
+	bad = words;
+	bad[offset + BrickPool::BlockWords(BrickFormatPalette8) - 1] |= 32u << 24;
+	CHECK(!BrickPool::IsValidBlock(BrickFormatPalette8, &bad[offset]));
+	CHECK(BrickPool::IsValidBlock(BrickFormatPalette8, &words[offset]));
+}
+
+// Materials with the top bit set, which a uniform entry would mistake for its
+// flag, read back unchanged whether the brick is uniform or mixed.
+TEST(BrickPoolKeepsHighMaterials)
+{
+	const UINT materials[] = { 0x80000005u, 0xffffffffu, UniformBrickFlag, 5u };
+	for (UINT material : materials)
+	{
+		Voxel voxels[VoxelsPerBrick];
+		for (Voxel& voxel : voxels)
+		{
+			voxel.mMaterial = material;
+		}
+
+		BrickPool pool;
+		pool.WriteBrick(7, voxels);
+		CHECK(pool.IsUniform(7) == !(material & UniformBrickFlag));
+
+		Voxel read[VoxelsPerBrick];
+		pool.ReadBrick(7, read);
+		CHECK(memcmp(read, voxels, sizeof(voxels)) == 0);
+
+		voxels[VoxelsPerBrick - 1].mMaterial = 0;
+		pool.WriteBrick(7, voxels);
+		pool.ReadBrick(7, read);
+		CHECK(memcmp(read, voxels, sizeof(voxels)) == 0);
+	}
+}
+
+// A batch of overlapping edits of every shape, digging and placing, leaves the
+// pool as the same edits applied one at a time do: the same voxels in the same
+// formats, with the same number of changes and the same bricks modified.
+TEST(BatchedEditsMatchSequential)
+{
+	Scene scene(WorldCaves);
+	BrickPool& batched = scene.mPool;
+	BrickPool sequential(scene.mPool);
+
+	// Clustered in a corner of the volume so that most of the edits overlap.
+	TestRandom random(4);
+	const EditShape shapes[] = { EditSphere, EditBox, EditCylinder, EditCapsule, EditSdf };
+	const UINT materials[] = { 0, 7, 9 };
+	std::vector<EditOp> ops;
+	for (UINT n = 0; n < 60; n++)
+	{
+		const XMFLOAT3 centre(random.Next(2.0f, 6.0f), random.Next(1.0f, 5.0f), random.Next(2.0f, 6.0f));
+		ops.push_back(VoxelEditor::MakeBrush(shapes[n % 5], centre, random.Next(0.2f, 1.2f), materials[n % 3]));
+	}
+
+	VoxelEditor batchEditor(batched);
+	const UINT batchChanged = batchEditor.Apply(ops.data(), static_cast<UINT>(ops.size()));
+
+	VoxelEditor editor(sequential);
+	UINT changed = 0;
+	std::vector<UINT> modifiedBricks;
+	for (const EditOp& op : ops)
+	{
+		changed += editor.Apply(&op, 1);
+		modifiedBricks.insert(modifiedBricks.end(), editor.mModifiedBricks.begin(), editor.mModifiedBricks.end());
+	}
+	std::sort(modifiedBricks.begin(), modifiedBricks.end());
+	modifiedBricks.erase(std::unique(modifiedBricks.begin(), modifiedBricks.end()), modifiedBricks.end());
+
+	CHECK(batchChanged > 0);
+	CHECK(batchChanged == changed);
+	CHECK(batchEditor.mModifiedBricks == modifiedBricks);
+
+	for (UINT brick = 0; brick < BrickCount; brick++)
+	{
+		CHECK((batched.mTable[brick] & ~cBrickOffsetMask) == (sequential.mTable[brick] & ~cBrickOffsetMask));
+	}
+
+	std::vector<Voxel> batchedVoxels(VoxelCount);
+	std::vector<Voxel> sequentialVoxels(VoxelCount);
+	batched.Decode(&batchedVoxels[0]);
+	sequential.Decode(&sequentialVoxels[0]);
+	CHECK(memcmp(&batchedVoxels[0], &sequentialVoxels[0], VoxelCount * sizeof(Voxel)) == 0);
+	CHECK(memcmp(&batchedVoxels[0], &scene.mVoxels[0], VoxelCount * sizeof(Voxel)) != 0);
+}
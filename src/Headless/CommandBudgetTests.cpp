@@ -0,0 +1,83 @@
+#include "stdafx.h"
+#include "Test.h"
+#include "CommandBudget.h"
+
+// The budget is the bound until a count is known, then the peak count plus the
+// headroom rounded up to the granularity, never above the bound.
+TEST(CommandBudgetHeadroom)
+{
+	CommandBudget budget;
+	CHECK(budget.GetMaxCommandCount() == BrickCount);
+
+	budget.SetBound(10000);
+	CHECK(budget.GetMaxCommandCount() == 10000);
+
+	const UINT counts[] = { 1000, 3000, 2000, 7999 };
+	UINT peak = 0;
+	for (UINT count : counts)
+	{
+		// Drawn at the bound, so that none of them overflow.
+		budget.Record(count, 10000);
+		peak = count > peak ? count : peak;
+
+		const UINT max = budget.GetMaxCommandCount();
+		const UINT expected = static_cast<UINT>(ceil(peak * 1.25));
+		CHECK(max == 10000 || (max % CommandBudget::Granularity == 0 && max > expected && max <= expected + CommandBudget::Granularity));
+		CHECK(max <= 10000 && max >= peak);
+	}
+	CHECK(budget.GetMaxCommandCount() == 10000);
+	CHECK(budget.GetStats().mOverflows == 0);
+
+	budget.Reset();
+	CHECK(budget.GetMaxCommandCount() == 10000);
+}
+
+// A peak keeps the budget up for HistoryLength frames and no longer.
+TEST(CommandBudgetForgetsOldPeaks)
+{
+	CommandBudget budget;
+	budget.Record(5000, BrickCount);
+	for (UINT frame = 1; frame < CommandBudget::HistoryLength; frame++)
+	{
+		budget.Record(1000, budget.GetMaxCommandCount());
+		CHECK(budget.GetMaxCommandCount() >= 6250);
+	}
+	budget.Record(1000, budget.GetMaxCommandCount());
+	CHECK(budget.GetMaxCommandCount() == 1280);
+}
+
+// Replayed through the readback latency: a steady count never overflows; a
+// sudden rise overflows only the frames drawn before its count came back, after
+// which the budget falls back to the bound; and a rise too fast for the headroom
+// to follow overflows a few frames per fallback rather than every frame.
+TEST(CommandBudgetFollowsLatency)
+{
+	const UINT frames = 200;
+	std::vector<UINT> counts(frames, 1000);
+	CommandBudget::BudgetStats stats = CommandBudget::Simulate(&counts[0], frames, 2, BrickCount);
+	CHECK(stats.mOverflows == 0);
+	CHECK(stats.mFrames == frames - 2);
+	CHECK(stats.mTotalBudget < stats.mFrames * 1280ull + BrickCount * 2ull);
+
+	for (UINT latency = 1; latency <= 3; latency++)
+	{
+		for (UINT frame = 100; frame < frames; frame++)
+		{
+			counts[frame] = 4000;
+		}
+		stats = CommandBudget::Simulate(&counts[0], frames, latency, BrickCount);
+		CHECK(stats.mOverflows == latency);
+		CHECK(stats.mPeakCount == 4000);
+	}
+
+	// Each frame shows 15% more than the last, more than the headroom covers over
+	// two frames of latency.
+	std::vector<UINT> ramp(40);
+	for (UINT frame = 0; frame < ramp.size(); frame++)
+	{
+		ramp[frame] = static_cast<UINT>(200 * pow(1.15, frame));
+	}
+	stats = CommandBudget::Simulate(&ramp[0], static_cast<UINT>(ramp.size()), 2, BrickCount);
+	CHECK(stats.mOverflows > 0);
+	CHECK(stats.mOverflows <= 2 * (static_cast<UINT>(ramp.size()) / CommandBudget::FallbackLength + 1));
+}
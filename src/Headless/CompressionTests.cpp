@@ -0,0 +1,144 @@
+#include "stdafx.h"
+#include "Test.h"
+#include "Scene.h"
+#include "Compression.h"
+#include <algorithm>
+
+// Compresses data and checks that it fits the bound and decompresses to exactly
+// the same bytes. Returns the compressed block.
+static std::vector<UINT8> RoundTrip(const std::vector<UINT8>& data)
+{
+	const UINT size = static_cast<UINT>(data.size());
+	std::vector<UINT8> compressed(LzCompressBound(size));
+	const UINT compressedSize = LzCompress(data.data(), size, compressed.data());
+	CHECK(compressedSize <= LzCompressBound(size));
+	compressed.resize(compressedSize);
+
+	std::vector<UINT8> out(size + 1, 0xcd);
+	CHECK(LzDecompress(compressed.data(), compressedSize, out.data(), size));
+	CHECK(size == 0 || memcmp(out.data(), data.data(), size) == 0);
+	CHECK(out[size] == 0xcd);
+	return compressed;
+}
+
+// Empty and short inputs, incompressible bytes, long runs and repeats whose
+// matches overlap their own output at every short period, and voxel blocks,
+// all come back unchanged.
+TEST(LzRoundTrips)
+{
+	RoundTrip(std::vector<UINT8>());
+	for (UINT size = 1; size < 40; size++)
+	{
+		std::vector<UINT8> data(size);
+		for (UINT n = 0; n < size; n++)
+		{
+			data[n] = static_cast<UINT8>(n % 3);
+		}
+		RoundTrip(data);
+	}
+
+	TestRandom random(5);
+	std::vector<UINT8> noise(100000);
+	for (UINT8& byte : noise)
+	{
+		byte = static_cast<UINT8>(random.Next() * 256.0f);
+	}
+	RoundTrip(noise);
+
+	// Runs long enough to need several length bytes, and one longer than the
+	// largest offset.
+	std::vector<UINT8> run(200000, 7);
+	CHECK(RoundTrip(run).size() < run.size() / 100);
+
+	for (UINT period = 1; period <= 17; period++)
+	{
+		std::vector<UINT8> repeat(5000);
+		for (UINT n = 0; n < repeat.size(); n++)
+		{
+			repeat[n] = static_cast<UINT8>(n % period * 37 + period);
+		}
+		CHECK(RoundTrip(repeat).size() < repeat.size() / 10);
+	}
+
+	// Noise with copies of earlier stretches spliced in at a range of distances.
+	std::vector<UINT8> spliced = noise;
+	for (UINT n = 0; n < 200; n++)
+	{
+		const UINT length = 4 + static_cast<UINT>(random.Next() * 300.0f);
+		const UINT to = 70000 + static_cast<UINT>(random.Next() * 29000.0f);
+		const UINT from = to - 1 - static_cast<UINT>(random.Next() * 69000.0f);
+		memmove(&spliced[to], &spliced[from], std::min<UINT>(length, static_cast<UINT>(spliced.size()) - to));
+	}
+	RoundTrip(spliced);
+
+	Scene scene(WorldCaves);
+	std::vector<UINT8> words(scene.mPool.mWords.size() * sizeof(UINT));
+	memcpy(words.data(), scene.mPool.mWords.data(), words.size());
+	CHECK(RoundTrip(words).size() < words.size());
+}
+
+// A block written by hand in the LZ4 format: the literal "a", a match of eight
+// bytes one back, then the literal "b".
+TEST(LzReadsLz4Blocks)
+{
+	const UINT8 block[] = { 0x14, 'a', 0x01, 0x00, 0x10, 'b' };
+	char out[10];
+	CHECK(LzDecompress(block, sizeof(block), out, sizeof(out)));
+	CHECK(memcmp(out, "aaaaaaaaab", sizeof(out)) == 0);
+}
+
+// Truncated blocks, the wrong output size, and blocks whose offsets or lengths
+// reach outside either buffer are refused. Random damage never reads or writes
+// out of bounds, which the guard bytes and a sanitizer build would show.
+TEST(LzRejectsDamagedBlocks)
+{
+	std::vector<UINT8> data(4000);
+	for (UINT n = 0; n < data.size(); n++)
+	{
+		data[n] = static_cast<UINT8>((n * n) >> 6);
+	}
+	const std::vector<UINT8> compressed = RoundTrip(data);
+	const UINT size = static_cast<UINT>(data.size());
+	const UINT compressedSize = static_cast<UINT>(compressed.size());
+
+	std::vector<UINT8> out(size + 16);
+	for (UINT length = 0; length < compressedSize; length++)
+	{
+		std::vector<UINT8> truncated(compressed.begin(), compressed.begin() + length);
+		CHECK(!LzDecompress(truncated.data(), length, out.data(), size));
+	}
+	CHECK(!LzDecompress(compressed.data(), compressedSize, out.data(), size - 1));
+	CHECK(!LzDecompress(compressed.data(), compressedSize, out.data(), size + 1));
+
+	const UINT8 zeroOffset[] = { 0x14, 'a', 0x00, 0x00, 0x10, 'b' };
+	const UINT8 farOffset[] = { 0x14, 'a', 0x02, 0x00, 0x10, 'b' };
+	const UINT8 longLiterals[] = { 0x50, 'a', 'b' };
+	const UINT8 unendingLength[] = { 0xf0, 255, 255 };
+	char small[10];
+	CHECK(!LzDecompress(zeroOffset, sizeof(zeroOffset), small, sizeof(small)));
+	CHECK(!LzDecompress(farOffset, sizeof(farOffset), small, sizeof(small)));
+	CHECK(!LzDecompress(longLiterals, sizeof(longLiterals), small, 5));
+	CHECK(!LzDecompress(unendingLength, sizeof(unendingLength), small, sizeof(small)));
+
+	// A match longer than the output is refused rather than copied.
+	const UINT8 longMatch[] = { 0x1f, 'a', 0x01, 0x00, 200, 0x10, 'b' };
+	CHECK(!LzDecompress(longMatch, sizeof(longMatch), small, sizeof(small)));
+
+	TestRandom random(9);
+	for (UINT pass = 0; pass < 2000; pass++)
+	{
+		std::vector<UINT8> damaged = compressed;
+		const UINT flips = 1 + static_cast<UINT>(random.Next() * 4.0f);
+		for (UINT n = 0; n < flips; n++)
+		{
+			damaged[static_cast<UINT>(random.Next() * compressedSize)] ^= static_cast<UINT8>(1 + random.Next() * 255.0f);
+		}
+
+		memset(&out[size], 0xcd, 16);
+		LzDecompress(damaged.data(), compressedSize, out.data(), size);
+		for (UINT n = size; n < size + 16; n++)
+		{
+			CHECK(out[n] == 0xcd);
+		}
+	}
+}
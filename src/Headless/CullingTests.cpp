@@ -0,0 +1,222 @@
+#include "stdafx.h"
+#include "Test.h"
+#include "Scene.h"
+#include "Culling.h"
+#include <algorithm>
+
+// A camera anywhere in or a little around the volume, facing any way.
+static SceneCamera GetRandomCamera(TestRandom& random)
+{
+	const float margin = 4.0f;
+	SceneCamera camera;
+	camera.mPosition = XMFLOAT3(
+		-random.Next(-margin, Width * VoxelSize + margin),
+		-random.Next(-margin, Height * VoxelSize + margin),
+		-random.Next(-margin, Depth * VoxelSize + margin));
+	camera.mYaw = random.Next(0.0f, 2.0f * 3.14159265f);
+	return camera;
+}
+
+static bool SameCommands(std::vector<DrawVoxelCommand> a, std::vector<DrawVoxelCommand> b)
+{
+	if (a.size() != b.size())
+	{
+		return false;
+	}
+
+	auto byData = [](const DrawVoxelCommand& x, const DrawVoxelCommand& y) { return x.Data < y.Data; };
+	std::sort(a.begin(), a.end(), byData);
+	std::sort(b.begin(), b.end(), byData);
+	return memcmp(a.data(), b.data(), a.size() * sizeof(DrawVoxelCommand)) == 0;
+}
+
+// From 400 random cameras per world, the hierarchical pass emits exactly the
+// commands of the flat pass, LOD flags and instance counts included, in its own
+// group order.
+TEST(HierarchyMatchesFlat)
+{
+	const UINT cameraCount = 400;
+	for (UINT type = 0; type < WorldTypeCount; type++)
+	{
+		Scene scene(static_cast<WorldType>(type));
+		CullHierarchy hierarchy;
+		hierarchy.Build(scene.mEnclosed);
+
+		TestRandom random(type + 1);
+		FrustumCuller culler;
+		std::vector<DrawVoxelCommand> flat;
+		std::vector<DrawVoxelCommand> grouped;
+		UINT mismatches = 0;
+		UINT visible = 0;
+		for (UINT camera = 0; camera < cameraCount; camera++)
+		{
+			const XMFLOAT4X4 projection = GetViewProjection(GetRandomCamera(random));
+			culler.SetProjection(projection);
+			culler.SetLod(&scene.mMips, GetLodDistance(projection));
+			culler.Run(scene.mEnclosed, flat);
+			culler.Run(hierarchy, grouped);
+			mismatches += SameCommands(flat, grouped) ? 0 : 1;
+			visible += flat.empty() ? 0 : 1;
+		}
+
+		CHECK(mismatches == 0);
+		CHECK(visible > cameraCount / 4);
+	}
+}
+
+// Every SIMD path emits exactly the scalar path's commands, in the same order,
+// from random cameras and LOD distances. Some commands have their instances
+// zeroed, as the enclosure pass leaves slots, and the command count is varied so
+// that batches end with a partial tail.
+TEST(FrustumSimdMatchesScalar)
+{
+	const SimdLevel levels[] = { SimdSse2, SimdAvx2 };
+	for (SimdLevel level : levels)
+	{
+		if (GetSimdLevel(level) != level)
+		{
+			printf("FrustumSimdMatchesScalar: %s is not supported by this CPU, checked at %s instead\n",
+				GetSimdLevelName(level), GetSimdLevelName(GetSimdLevel(level)));
+		}
+	}
+
+	for (UINT type = 0; type < WorldTypeCount; type++)
+	{
+		Scene scene(static_cast<WorldType>(type));
+		TestRandom random(50 + type);
+		std::vector<DrawVoxelCommand> commands(scene.mEnclosed);
+		for (DrawVoxelCommand& command : commands)
+		{
+			if (random.Next() < 0.05f)
+			{
+				command.DrawArguments.InstanceCount = 0;
+			}
+		}
+
+		CullHierarchy hierarchy;
+		hierarchy.Build(commands);
+
+		FrustumCuller culler;
+		std::vector<DrawVoxelCommand> expected;
+		std::vector<DrawVoxelCommand> culled;
+		std::vector<DrawVoxelCommand> expectedGrouped;
+		std::vector<DrawVoxelCommand> grouped;
+		UINT mismatches = 0;
+		for (UINT camera = 0; camera < 100; camera++)
+		{
+			const XMFLOAT4X4 projection = GetViewProjection(GetRandomCamera(random));
+			culler.SetProjection(projection);
+			culler.SetLod(&scene.mMips, GetLodDistance(projection) * random.Next(0.25f, 1.0f));
+
+			std::vector<DrawVoxelCommand> input(commands.begin(), commands.end() - camera % 8);
+			culler.mSimd = SimdScalar;
+			culler.Run(input, expected);
+			culler.Run(hierarchy, expectedGrouped);
+			for (SimdLevel level : levels)
+			{
+				culler.mSimd = level;
+				culler.Run(input, culled);
+				culler.Run(hierarchy, grouped);
+				mismatches += culled.size() == expected.size() &&
+					memcmp(culled.data(), expected.data(), culled.size() * sizeof(DrawVoxelCommand)) == 0 ? 0 : 1;
+				mismatches += grouped.size() == expectedGrouped.size() &&
+					memcmp(grouped.data(), expectedGrouped.data(), grouped.size() * sizeof(DrawVoxelCommand)) == 0 ? 0 : 1;
+			}
+		}
+		CHECK(mismatches == 0);
+	}
+}
+
+// The distance bucket of a brick worked out directly from the projection: the
+// clip space w of its centre in units of cDistanceBucketDepth, as cull.hlsl's
+// DistanceBucket() takes it.
+static UINT GetReferenceBucket(const XMFLOAT4X4& projection, UINT brick)
+{
+	const float brickSize[3] = { cBrickWidth * cVoxelHalfWidth * 2.0f, cBrickHeight * cVoxelHalfWidth * 2.0f, cBrickDepth * cVoxelHalfWidth * 2.0f };
+	const XMUINT3 b = GetBrickCoords(brick);
+	const float c[3] =
+	{
+		static_cast<float>(b.x) * brickSize[0] + brickSize[0] / 2.0f,
+		static_cast<float>(b.y) * brickSize[1] + brickSize[1] / 2.0f,
+		static_cast<float>(b.z) * brickSize[2] + brickSize[2] / 2.0f
+	};
+	const float w = c[0] * projection.m[3][0] + c[1] * projection.m[3][1] + c[2] * projection.m[3][2] + projection.m[3][3];
+	if (w <= 0.0f)
+	{
+		return 0;
+	}
+	const UINT bucket = static_cast<UINT>(w / cDistanceBucketDepth);
+	return bucket < DistanceBucketCount ? bucket : DistanceBucketCount - 1;
+}
+
+// Sorts commands by distance with the culler and checks the result against a
+// stable sort by the reference buckets: nearest bucket first, and within a
+// bucket the input order. Returns the number of bucket boundaries crossed.
+static UINT CheckDistanceOrder(const FrustumCuller& culler, const XMFLOAT4X4& projection, const std::vector<DrawVoxelCommand>& commands)
+{
+	auto nearer = [&projection](const DrawVoxelCommand& a, const DrawVoxelCommand& b)
+	{
+		return GetReferenceBucket(projection, a.Data & FrustumCuller::BrickIndexMask) < GetReferenceBucket(projection, b.Data & FrustumCuller::BrickIndexMask);
+	};
+	std::vector<DrawVoxelCommand> expected(commands);
+	std::stable_sort(expected.begin(), expected.end(), nearer);
+
+	const UINT count = static_cast<UINT>(commands.size());
+	std::vector<DrawVoxelCommand> sorted(count);
+	UINT bucketCounts[DistanceBucketCount];
+	culler.SortByDistance(commands.data(), count, sorted.data(), bucketCounts);
+	CHECK(memcmp(sorted.data(), expected.data(), count * sizeof(DrawVoxelCommand)) == 0);
+
+	UINT expectedCounts[DistanceBucketCount] = {};
+	UINT boundaries = 0;
+	for (UINT n = 0; n < count; n++)
+	{
+		const UINT bucket = GetReferenceBucket(projection, commands[n].Data & FrustumCuller::BrickIndexMask);
+		CHECK(culler.GetDistanceBucket(commands[n].Data & FrustumCuller::BrickIndexMask) == bucket);
+		expectedCounts[bucket]++;
+		boundaries += n > 0 && nearer(expected[n - 1], expected[n]) ? 1 : 0;
+	}
+	CHECK(memcmp(bucketCounts, expectedCounts, sizeof(bucketCounts)) == 0);
+	return boundaries;
+}
+
+// The CPU reference for cull.hlsl's two pass bucket sort orders commands front
+// to back across every bucket boundary and keeps each bucket in input order.
+// A column of bricks fed in back to front, under a projection whose w runs along
+// z from behind the camera to past the last bucket, covers every bucket and the
+// clamping at both ends; the culled commands of random cameras cover the rest.
+TEST(DistanceSortFrontToBack)
+{
+	XMFLOAT4X4 alongZ(1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 2, -3);
+	FrustumCuller culler;
+	culler.SetProjection(alongZ);
+
+	std::vector<DrawVoxelCommand> column;
+	for (UINT bz = cDepthInBricks; bz-- > 0; )
+	{
+		for (UINT bx = 0; bx < 2; bx++)
+		{
+			DrawVoxelCommand command = {};
+			command.Data = GetBrickIndex(bx, 3, bz);
+			command.DrawArguments.InstanceCount = bz * 2 + bx;
+			column.push_back(command);
+		}
+	}
+	CHECK(CheckDistanceOrder(culler, alongZ, column) == DistanceBucketCount - 1);
+	CHECK(culler.GetDistanceBucket(GetBrickIndex(0, 0, 0)) == 0);
+	CHECK(culler.GetDistanceBucket(GetBrickIndex(0, 0, cDepthInBricks - 1)) == DistanceBucketCount - 1);
+
+	Scene scene(WorldSample);
+	TestRandom random(31);
+	std::vector<DrawVoxelCommand> culled;
+	UINT boundaries = 0;
+	for (UINT camera = 0; camera < 20; camera++)
+	{
+		const XMFLOAT4X4 projection = GetViewProjection(GetRandomCamera(random));
+		culler.SetProjection(projection);
+		culler.SetLod(&scene.mMips, GetLodDistance(projection));
+		culler.Run(scene.mEnclosed, culled);
+		boundaries += CheckDistanceOrder(culler, projection, culled);
+	}
+	CHECK(boundaries > 20);
+}
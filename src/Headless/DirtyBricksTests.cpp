@@ -0,0 +1,112 @@
+#include "stdafx.h"
+#include "Test.h"
+#include "DirtyBricks.h"
+
+// Takes every slot's queue, which a new tracker starts out with as a full refresh.
+static void TakeAll(DirtyBricks& dirty)
+{
+	std::vector<UINT> out(BrickCount);
+	for (UINT slot = 0; slot < FrameCount; slot++)
+	{
+		CHECK(dirty.IsFull(slot));
+		CHECK(dirty.Take(slot, &out[0]) == 0);
+		CHECK(!dirty.IsFull(slot));
+	}
+}
+
+// A brick marked more than once, directly or as a neighbour, is queued once per
+// slot.
+TEST(DirtyBricksDeduplicates)
+{
+	DirtyBricks dirty(false, 100);
+	TakeAll(dirty);
+	const UINT marks[] = { 5, 3, 5, 5, 3, 9 };
+	for (UINT brick : marks)
+	{
+		dirty.MarkBrick(brick);
+	}
+
+	std::vector<UINT> out(BrickCount);
+	for (UINT slot = 0; slot < FrameCount; slot++)
+	{
+		CHECK(dirty.Take(slot, &out[0]) == 3);
+		CHECK(out[0] == 5 && out[1] == 3 && out[2] == 9);
+	}
+
+	// Two neighbouring bricks inside the volume and their six neighbours each,
+	// of which each is the other's.
+	DirtyBricks neighbours(true, 100);
+	TakeAll(neighbours);
+	const UINT brick = GetBrickIndex(10, 5, 20);
+	neighbours.MarkBrick(brick);
+	neighbours.MarkBrick(brick + 1);
+	neighbours.MarkBrick(brick);
+	CHECK(neighbours.Take(0, &out[0]) == 12);
+}
+
+// Taking a slot's queue clears that slot only, and a brick taken can be queued
+// again. Ranges come out sorted, joined across gaps of up to mergeGap.
+TEST(DirtyBricksClearOnTake)
+{
+	DirtyBricks dirty(false, 100);
+	TakeAll(dirty);
+	const UINT marks[] = { 15, 11, 10, 12, 30, 31, 40 };
+	for (UINT brick : marks)
+	{
+		dirty.MarkBrick(brick);
+	}
+
+	std::vector<BrickRange> ranges;
+	dirty.TakeRanges(0, 2, ranges);
+	CHECK(ranges.size() == 3);
+	CHECK(ranges[0].mFirst == 10 && ranges[0].mCount == 6);
+	CHECK(ranges[1].mFirst == 30 && ranges[1].mCount == 2);
+	CHECK(ranges[2].mFirst == 40 && ranges[2].mCount == 1);
+	dirty.TakeRanges(0, 2, ranges);
+	CHECK(ranges.empty());
+
+	std::vector<UINT> out(BrickCount);
+	CHECK(dirty.Take(1, &out[0]) == 7);
+	CHECK(dirty.Take(1, &out[0]) == 0);
+
+	dirty.MarkBrick(11);
+	for (UINT slot = 0; slot < FrameCount; slot++)
+	{
+		CHECK(dirty.Take(slot, &out[0]) == 1 && out[0] == 11);
+	}
+}
+
+// With the sample's upload threshold, a slot lists up to UploadListLength
+// bricks, marking one of them again changes nothing, and one more brick flags
+// the slot for a full refresh as a single range over the volume. After that the
+// slot lists bricks again from empty.
+TEST(DirtyBricksFallBackToFull)
+{
+	DirtyBricks dirty(false, DirtyBricks::UploadListLength);
+	TakeAll(dirty);
+	for (UINT brick = 0; brick < DirtyBricks::UploadListLength; brick++)
+	{
+		dirty.MarkBrick(brick * 3);
+	}
+	dirty.MarkBrick(0);
+	CHECK(!dirty.IsFull(0));
+
+	std::vector<UINT> out(BrickCount);
+	CHECK(dirty.Take(1, &out[0]) == DirtyBricks::UploadListLength);
+
+	dirty.MarkBrick(1);
+	CHECK(dirty.IsFull(0));
+	CHECK(!dirty.IsFull(1));
+
+	std::vector<BrickRange> ranges;
+	dirty.TakeRanges(0, 2, ranges);
+	CHECK(ranges.size() == 1 && ranges[0].mFirst == 0 && ranges[0].mCount == BrickCount);
+	CHECK(!dirty.IsFull(0));
+
+	dirty.MarkBrick(3);
+	CHECK(dirty.Take(0, &out[0]) == 1 && out[0] == 3);
+	CHECK(dirty.Take(1, &out[0]) == 2 && out[0] == 1 && out[1] == 3);
+
+	dirty.MarkAll();
+	CHECK(dirty.IsFull(0) && dirty.IsFull(1));
+}
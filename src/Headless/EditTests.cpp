@@ -0,0 +1,144 @@
+#include "stdafx.h"
+#include "Test.h"
+#include "Scene.h"
+#include "VoxelEdit.h"
+#include "EditHistory.h"
+
+// A position on the voxel lattice, where voxel origins and brick edges lie.
+static float OnLattice(TestRandom& random, UINT limit)
+{
+	return static_cast<UINT>(random.Next() * limit) * VoxelSize;
+}
+
+// The SSE test of each analytic shape selects the same voxels as the scalar one,
+// brick by brick over everything the shape can reach. Half the shapes sit on the
+// voxel lattice with sizes a whole number of voxels, so voxel origins, brick
+// edges among them, fall exactly on their surfaces.
+TEST(EditSimdMatchesScalar)
+{
+	TestRandom random(17);
+	const EditShape shapes[] = { EditSphere, EditBox, EditCylinder, EditCapsule };
+	UINT masks = 0;
+	for (UINT n = 0; n < 400; n++)
+	{
+		const EditShape shape = shapes[n % 4];
+		const bool lattice = (n / 4) % 2 == 0;
+		const float size = lattice ? (1 + static_cast<UINT>(random.Next() * 12.0f)) * VoxelSize : random.Next(0.05f, 1.5f);
+		const XMFLOAT3 centre = lattice ?
+			XMFLOAT3(OnLattice(random, Width), OnLattice(random, Height), OnLattice(random, Depth)) :
+			XMFLOAT3(random.Next(0.0f, Width * VoxelSize), random.Next(0.0f, Height * VoxelSize), random.Next(0.0f, Depth * VoxelSize));
+
+		EditOp op;
+		switch (shape)
+		{
+			case EditBox:
+				op = VoxelEditor::MakeBox(centre, XMFLOAT3(size, size * 0.5f, size * 2.0f), 7);
+				break;
+			case EditCylinder:
+				op = VoxelEditor::MakeCylinder(centre, size, size * 0.5f, 7);
+				break;
+			case EditCapsule:
+			{
+				// Every eighth capsule is a single point, a sphere by another route.
+				const XMFLOAT3 end = (n % 32 == 3) ? centre : XMFLOAT3(centre.x + size, centre.y - size * 0.5f, centre.z + size * 2.0f);
+				op = VoxelEditor::MakeCapsule(centre, end, size * 0.5f, 7);
+				break;
+			}
+			default:
+				op = VoxelEditor::MakeSphere(centre, size, 7);
+				break;
+		}
+
+		std::vector<UINT> bricks;
+		VoxelEditor::GetBricks(&op, 1, bricks);
+		for (UINT brick : bricks)
+		{
+			const XMUINT3 coords = GetBrickCoords(brick);
+			const UINT64 expected = VoxelEditor::GetInsideMask(op, coords, false);
+			CHECK(VoxelEditor::GetInsideMask(op, coords, true) == expected);
+			masks += expected != 0 && expected != ~0ull;
+		}
+	}
+
+	// Enough bricks were cut by a surface for the comparison to mean something.
+	CHECK(masks > 1000);
+}
+
+// Whether two pools hold every brick in the same format with the same block,
+// wherever in the words the blocks lie.
+static bool SameBricks(const BrickPool& a, const BrickPool& b)
+{
+	for (UINT brick = 0; brick < BrickCount; brick++)
+	{
+		if ((a.mTable[brick] & ~cBrickOffsetMask) != (b.mTable[brick] & ~cBrickOffsetMask))
+		{
+			return false;
+		}
+
+		UINT wordCount, otherWordCount;
+		const UINT* block = a.GetBlock(brick, wordCount);
+		const UINT* otherBlock = b.GetBlock(brick, otherWordCount);
+		if (block && (wordCount != otherWordCount || memcmp(block, otherBlock, wordCount * sizeof(UINT)) != 0))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+// Undo puts back exactly the bricks a step changed, and Redo exactly the bricks
+// the step left; both list the bricks of the step. A new step made after an
+// Undo drops the step that could have been redone.
+TEST(EditHistoryUndoRedo)
+{
+	Scene scene(WorldCaves);
+	const BrickPool original(scene.mPool);
+	BrickPool& bricks = scene.mPool;
+	EditHistory history;
+	CHECK(!history.CanUndo() && !history.CanRedo());
+
+	// One step of overlapping ops that dig, place, and mix both.
+	const XMFLOAT3 centre(12.8f, 3.2f, 12.8f);
+	history.Queue(VoxelEditor::MakeSphere(centre, 1.5f, 0));
+	history.Queue(VoxelEditor::MakeBox(centre, XMFLOAT3(0.8f, 0.4f, 1.2f), 7));
+	history.Queue(VoxelEditor::MakeCapsule(XMFLOAT3(11.0f, 2.0f, 11.0f), XMFLOAT3(14.0f, 4.5f, 13.0f), 0.35f, 0));
+	CHECK(history.Apply(bricks) > 0);
+	const std::vector<UINT> stepBricks = history.mModifiedBricks;
+	CHECK(!stepBricks.empty());
+	CHECK(!SameBricks(bricks, original));
+	const BrickPool edited(bricks);
+
+	CHECK(history.Undo(bricks));
+	CHECK(history.mModifiedBricks == stepBricks);
+	CHECK(SameBricks(bricks, original));
+	CHECK(!history.Undo(bricks));
+
+	CHECK(history.Redo(bricks));
+	CHECK(history.mModifiedBricks == stepBricks);
+	CHECK(SameBricks(bricks, edited));
+	CHECK(!history.Redo(bricks));
+
+	// A second step, undone, then replaced by a third.
+	history.Queue(VoxelEditor::MakeSphere(XMFLOAT3(20.0f, 4.0f, 6.0f), 0.9f, 7));
+	CHECK(history.Apply(bricks) > 0);
+	CHECK(history.Undo(bricks));
+	CHECK(SameBricks(bricks, edited));
+	CHECK(history.CanRedo());
+
+	history.Queue(VoxelEditor::MakeCylinder(XMFLOAT3(6.0f, 2.5f, 20.0f), 0.7f, 0.5f, 0));
+	CHECK(history.Apply(bricks) > 0);
+	CHECK(!history.CanRedo());
+	CHECK(!history.Redo(bricks));
+	const BrickPool replaced(bricks);
+
+	// Undoing everything comes back to the original, and redoing it to the third
+	// step rather than the second.
+	CHECK(history.Undo(bricks) && history.Undo(bricks));
+	CHECK(SameBricks(bricks, original));
+	CHECK(history.Redo(bricks) && history.Redo(bricks));
+	CHECK(SameBricks(bricks, replaced));
+
+	std::vector<EditOp> ops;
+	history.GetOps(ops);
+	CHECK(ops.size() == 4 && ops[3].mShape == EditCylinder);
+}
@@ -0,0 +1,155 @@
+#include "stdafx.h"
+#include "Test.h"
+#include "Scene.h"
+#include "Enclosure.h"
+
+// The bricks compute.hlsl keeps, worked out directly from the dense voxels: any
+// brick holding a voxel that lies on the edge of the volume or next to a brick
+// with an empty voxel.
+static std::vector<UINT> GetEnclosedReference(const std::vector<Voxel>& voxels)
+{
+	std::vector<UINT> occupied(BrickCount, 0);
+	for (UINT index = 0; index < VoxelCount; index++)
+	{
+		occupied[index / VoxelsPerBrick] += voxels[index].mMaterial != 0 ? 1 : 0;
+	}
+
+	std::vector<UINT> bricks;
+	for (UINT z = 0; z < cDepthInBricks; z++)
+	{
+		for (UINT y = 0; y < cHeightInBricks; y++)
+		{
+			for (UINT x = 0; x < cWidthInBricks; x++)
+			{
+				const UINT brick = GetBrickIndex(x, y, z);
+				if (occupied[brick] == 0)
+				{
+					continue;
+				}
+
+				bool visible = x == 0 || y == 0 || z == 0 ||
+					x == cWidthInBricks - 1 || y == cHeightInBricks - 1 || z == cDepthInBricks - 1;
+				visible = visible || occupied[GetBrickIndex(x - 1, y, z)] < VoxelsPerBrick;
+				visible = visible || occupied[GetBrickIndex(x + 1, y, z)] < VoxelsPerBrick;
+				visible = visible || occupied[GetBrickIndex(x, y - 1, z)] < VoxelsPerBrick;
+				visible = visible || occupied[GetBrickIndex(x, y + 1, z)] < VoxelsPerBrick;
+				visible = visible || occupied[GetBrickIndex(x, y, z - 1)] < VoxelsPerBrick;
+				visible = visible || occupied[GetBrickIndex(x, y, z + 1)] < VoxelsPerBrick;
+				if (visible)
+				{
+					bricks.push_back(brick);
+				}
+			}
+		}
+	}
+	return bricks;
+}
+
+static bool MatchesReference(const std::vector<DrawVoxelCommand>& commands, const std::vector<UINT>& reference)
+{
+	if (commands.size() != reference.size())
+	{
+		return false;
+	}
+	for (size_t i = 0; i < commands.size(); i++)
+	{
+		const DrawVoxelArguments& arguments = commands[i].DrawArguments;
+		if (commands[i].Data != reference[i] || arguments.VertexCountPerInstance != 4 ||
+			arguments.InstanceCount != 6 * VoxelsPerBrick || arguments.StartVertexLocation != 0 || arguments.StartInstanceLocation != 0)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+// Both paths, at one thread and several, keep exactly the reference bricks of
+// every world type.
+TEST(EnclosureMatchesReference)
+{
+	for (UINT type = 0; type < WorldTypeCount; type++)
+	{
+		Scene scene(static_cast<WorldType>(type));
+		const std::vector<UINT> reference = GetEnclosedReference(scene.mVoxels);
+		CHECK(!reference.empty());
+		CHECK(MatchesReference(scene.mEnclosed, reference));
+
+		for (UINT threadCount = 1; threadCount <= 5; threadCount += 4)
+		{
+			ThreadPool pool(threadCount);
+			EnclosurePass enclosure;
+			std::vector<DrawVoxelCommand> commands;
+			enclosure.Run(&scene.mVoxels[0], commands, pool);
+			CHECK(MatchesReference(commands, reference));
+			enclosure.Run(scene.mOccupancy, commands, pool);
+			CHECK(MatchesReference(commands, reference));
+		}
+	}
+}
+
+// A solid volume with single voxels knocked out: each hole exposes its own brick
+// and that brick's six neighbours, and the occupancy masks built from the voxels
+// agree with the scan.
+TEST(EnclosureHoles)
+{
+	std::vector<Voxel> voxels(VoxelCount);
+	for (Voxel& voxel : voxels)
+	{
+		voxel.mMaterial = StoneMaterial;
+	}
+
+	UINT seed = 12345;
+	for (UINT hole = 0; hole < 256; hole++)
+	{
+		seed = seed * 1664525u + 1013904223u;
+		voxels[(seed >> 8) % VoxelCount].mMaterial = 0;
+	}
+
+	BrickOccupancy occupancy;
+	occupancy.Build(&voxels[0]);
+
+	const std::vector<UINT> reference = GetEnclosedReference(voxels);
+	EnclosurePass enclosure;
+	std::vector<DrawVoxelCommand> commands;
+	enclosure.Run(&voxels[0], commands, ThreadPool::Default());
+	CHECK(MatchesReference(commands, reference));
+	enclosure.Run(occupancy, commands, ThreadPool::Default());
+	CHECK(MatchesReference(commands, reference));
+}
+
+// The SSE2 and AVX2 mask builders agree with the scalar one, over a world and
+// over voxels with random holes and materials that only differ from zero in
+// their high bits.
+TEST(OccupancySimdMatchesScalar)
+{
+	Scene scene(WorldCaves);
+	std::vector<Voxel> random(VoxelCount);
+	TestRandom values(9);
+	for (Voxel& voxel : random)
+	{
+		const float r = values.Next();
+		voxel.mMaterial = r < 0.4f ? 0 : (r < 0.7f ? 0x80000000u : static_cast<UINT>(r * 65535.0f));
+	}
+
+	const std::vector<Voxel>* volumes[] = { &scene.mVoxels, &random };
+	const SimdLevel levels[] = { SimdSse2, SimdAvx2 };
+	for (const std::vector<Voxel>* voxels : volumes)
+	{
+		BrickOccupancy expected;
+		expected.BuildScalar(&(*voxels)[0]);
+		for (SimdLevel level : levels)
+		{
+			BrickOccupancy occupancy;
+			occupancy.mSimd = level;
+			occupancy.Build(&(*voxels)[0]);
+			CHECK(occupancy.mMasks == expected.mMasks);
+
+			occupancy.mMasks.assign(BrickCount, 0);
+			for (UINT brick = 0; brick < BrickCount; brick++)
+			{
+				occupancy.UpdateBrick(&(*voxels)[0], brick);
+			}
+			CHECK(occupancy.mMasks == expected.mMasks);
+		}
+	}
+}
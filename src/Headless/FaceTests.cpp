@@ -0,0 +1,129 @@
+#include "stdafx.h"
+#include "Test.h"
+#include "BrickFaces.h"
+#include "GreedyMesher.h"
+
+// Lists of the longest length written for every brick span more entries than a
+// table entry can address. Those that would start beyond MaxEntries are dropped
+// rather than wrapped into another brick's words, and Fits() reports it; the
+// lists written before then are intact.
+TEST(FaceListsRefuseOverflow)
+{
+	std::vector<UINT16> entries(FaceLists::MaxEntriesPerBrick);
+	for (UINT n = 0; n < entries.size(); n++)
+	{
+		entries[n] = static_cast<UINT16>(n);
+	}
+
+	FaceLists lists;
+	UINT written = 0;
+	for (UINT brick = 0; brick < BrickCount; brick++)
+	{
+		entries[0] = static_cast<UINT16>(brick);
+		lists.Write(brick, &entries[0], FaceLists::MaxEntriesPerBrick);
+		written += lists.GetCount(brick) != 0;
+	}
+	CHECK(!lists.Fits());
+	CHECK(written == FaceLists::MaxEntries / FaceLists::MaxEntriesPerBrick + (FaceLists::MaxEntries % FaceLists::MaxEntriesPerBrick != 0));
+	CHECK(lists.GetTotalCount() == UINT64(written) * FaceLists::MaxEntriesPerBrick);
+
+	for (UINT brick = 0; brick < BrickCount; brick++)
+	{
+		UINT wordCount;
+		const UINT* list = lists.GetList(brick, wordCount);
+		CHECK((list != nullptr) == (brick < written));
+		if (list)
+		{
+			CHECK(list + wordCount <= &lists.mWords[0] + lists.WordCount());
+			CHECK((list[0] & 0xffff) == (brick & 0xffff) && (list[0] >> 16) == 1);
+		}
+	}
+
+	lists.Clear();
+	CHECK(lists.Fits());
+}
+
+// Voxel index strides along the width and height of a quad, by face, as given
+// in GreedyMesher.h: width along x, or y for x facing quads; height along y, or
+// z for y and x facing quads.
+static const UINT QuadWidthStride[FaceCount] = { 1, 1, 1, 1, 4, 4 };
+static const UINT QuadHeightStride[FaceCount] = { 4, 4, 16, 16, 16, 16 };
+
+// The brick's quads cover each of its exposed faces exactly once and nothing
+// else, and a quad only spans faces of its first voxel's material. Returns the
+// number of quads.
+static UINT CheckQuadsCoverFaces(const GreedyMesher& mesher, const BrickFaces& faces, const BrickPool& bricks, UINT brick)
+{
+	Voxel voxels[VoxelsPerBrick];
+	bricks.ReadBrick(brick, voxels);
+
+	UINT covered[VoxelsPerBrick] = {};
+	UINT wordCount;
+	const UINT* list = mesher.mQuads.GetList(brick, wordCount);
+	const UINT count = mesher.mQuads.GetCount(brick);
+	for (UINT n = 0; n < count; n++)
+	{
+		const UINT quad = (list[n / 2] >> (16 * (n % 2))) & 0xffff;
+		const UINT first = quad & 63;
+		const UINT face = (quad >> 6) & 7;
+		const UINT width = ((quad >> 9) & 3) + 1;
+		const UINT height = ((quad >> 11) & 3) + 1;
+		CHECK(face < FaceCount);
+
+		for (UINT y = 0; y < height; y++)
+		{
+			for (UINT x = 0; x < width; x++)
+			{
+				const UINT voxel = first + x * QuadWidthStride[face] + y * QuadHeightStride[face];
+				CHECK(voxel < VoxelsPerBrick);
+				CHECK(!(covered[voxel] & (1u << face)));
+				CHECK(voxels[voxel].mMaterial == voxels[first].mMaterial);
+				covered[voxel] |= 1u << face;
+			}
+		}
+	}
+
+	for (UINT voxel = 0; voxel < VoxelsPerBrick; voxel++)
+	{
+		CHECK(covered[voxel] == faces.GetVoxelFaces(brick, voxel));
+	}
+	return count;
+}
+
+// A solid brick, a checkerboard and an L of two materials, each on its own in
+// the air: the solid brick merges into one quad per side, the checkerboard has
+// nothing to merge, and the L merges only within each material.
+TEST(GreedyQuadsCoverFaces)
+{
+	Voxel solid[VoxelsPerBrick], checkerboard[VoxelsPerBrick], shape[VoxelsPerBrick];
+	for (UINT voxel = 0; voxel < VoxelsPerBrick; voxel++)
+	{
+		const UINT vx = voxel & 3, vy = (voxel >> 2) & 3, vz = voxel >> 4;
+		solid[voxel].mMaterial = 3;
+		checkerboard[voxel].mMaterial = ((vx + vy + vz) & 1) ? 4 : 0;
+		shape[voxel].mMaterial = vx == 0 ? 5 : (vy == 0 ? 6 : 0);
+	}
+
+	const UINT bricks[] = { GetBrickIndex(4, 4, 4), GetBrickIndex(8, 4, 4), GetBrickIndex(12, 4, 4) };
+	BrickPool pool;
+	pool.WriteBrick(bricks[0], solid);
+	pool.WriteBrick(bricks[1], checkerboard);
+	pool.WriteBrick(bricks[2], shape);
+
+	BrickOccupancy occupancy;
+	occupancy.Build(pool);
+	BrickFaces faces;
+	faces.Build(occupancy);
+	GreedyMesher mesher;
+	mesher.Build(faces, pool);
+
+	CHECK(faces.GetFaceCount(bricks[0]) == 6 * 16);
+	CHECK(CheckQuadsCoverFaces(mesher, faces, pool, bricks[0]) == 6);
+
+	CHECK(faces.GetFaceCount(bricks[1]) == 32 * 6);
+	CHECK(CheckQuadsCoverFaces(mesher, faces, pool, bricks[1]) == 32 * 6);
+
+	const UINT shapeQuads = CheckQuadsCoverFaces(mesher, faces, pool, bricks[2]);
+	CHECK(shapeQuads < faces.GetFaceCount(bricks[2]));
+	CHECK(mesher.mQuads.GetTotalCount() == 6 + 32 * 6 + shapeQuads);
+}
@@ -0,0 +1,47 @@
+#include "stdafx.h"
+#include "Test.h"
+#include "Scene.h"
+
+static bool SameMips(const VoxelMips& a, const VoxelMips& b)
+{
+	for (UINT level = 1; level < VoxelMips::LevelCount; level++)
+	{
+		if (a.mMaterials[level] != b.mMaterials[level] || a.mMasks[level] != b.mMasks[level])
+		{
+			return false;
+		}
+	}
+	return a.mRecords == b.mRecords;
+}
+
+// The SSE2 and AVX2 majority reductions build the same levels and records as
+// the scalar one, over a world and over voxels drawn from a few materials so
+// that children often tie.
+TEST(MipsSimdMatchesScalar)
+{
+	std::vector<Voxel> voxels(VoxelCount);
+	TestRandom random(11);
+	for (Voxel& voxel : voxels)
+	{
+		voxel.mMaterial = static_cast<UINT>(random.Next() * 4.0f) * 0x5555u;
+	}
+
+	BrickPool mixed;
+	mixed.Build(&voxels[0]);
+	Scene scene(WorldCaves);
+	const BrickPool* pools[] = { &scene.mPool, &mixed };
+	const SimdLevel levels[] = { SimdSse2, SimdAvx2 };
+	for (const BrickPool* pool : pools)
+	{
+		VoxelMips expected;
+		expected.mSimd = SimdScalar;
+		expected.Build(*pool, ThreadPool::Default());
+		for (SimdLevel level : levels)
+		{
+			VoxelMips mips;
+			mips.mSimd = level;
+			mips.Build(*pool, ThreadPool::Default());
+			CHECK(SameMips(mips, expected));
+		}
+	}
+}
@@ -0,0 +1,204 @@
+#include "stdafx.h"
+#include "Test.h"
+#include "Scene.h"
+#include "Culling.h"
+#include "Occlusion.h"
+#include <algorithm>
+
+// For random rectangles over pyramids of random depths, of even, odd and
+// degenerate sizes, GetMaxDepth never reads below the farthest level 0 depth
+// under the rectangle, and reads it exactly for a single pixel.
+TEST(PyramidMaxDepthIsConservative)
+{
+	const UINT sizes[][2] = { { 1, 1 }, { 7, 3 }, { 64, 64 }, { OcclusionWidth, OcclusionHeight }, { 333, 97 }, { 1, 200 } };
+	TestRandom random(7);
+	for (const UINT* size : sizes)
+	{
+		const UINT width = size[0];
+		const UINT height = size[1];
+		std::vector<float> depth(width * height);
+		for (float& d : depth)
+		{
+			// Mostly far, with scattered near texels, as a depth buffer over terrain.
+			d = random.Next() < 0.7f ? random.Next(0.9f, 1.0f) : random.Next();
+		}
+
+		DepthPyramid pyramid;
+		pyramid.Resize(width, height);
+		pyramid.Build(&depth[0]);
+
+		UINT below = 0;
+		UINT inexact = 0;
+		for (UINT rectangle = 0; rectangle < 2000; rectangle++)
+		{
+			UINT x0 = static_cast<UINT>(random.Next() * width);
+			UINT x1 = static_cast<UINT>(random.Next() * width);
+			UINT y0 = static_cast<UINT>(random.Next() * height);
+			UINT y1 = static_cast<UINT>(random.Next() * height);
+			if (x0 > x1) std::swap(x0, x1);
+			if (y0 > y1) std::swap(y0, y1);
+
+			float expected = 0.0f;
+			for (UINT y = y0; y <= y1; y++)
+			{
+				for (UINT x = x0; x <= x1; x++)
+				{
+					expected = std::max(expected, depth[y * width + x]);
+				}
+			}
+
+			below += pyramid.GetMaxDepth(x0, y0, x1, y1) < expected ? 1 : 0;
+			inexact += pyramid.GetMaxDepth(x0, y0, x0, y0) != depth[y0 * width + x0] ? 1 : 0;
+		}
+
+		CHECK(below == 0);
+		CHECK(inexact == 0);
+	}
+}
+
+static UINT GetVoxelIndex(UINT x, UINT y, UINT z)
+{
+	return GetBrickIndex(x / BrickWidth, y / BrickHeight, z / BrickDepth) * VoxelsPerBrick +
+		((z % BrickDepth) * BrickHeight + (y % BrickHeight)) * BrickWidth + (x % BrickWidth);
+}
+
+// The brick of the first solid voxel a ray meets, stepping voxel by voxel, or
+// BrickCount when it leaves the volume without meeting one. Voxel (x, y, z)
+// fills the box from (x, y, z) to (x + 1, y + 1, z + 1) times VoxelSize, as the
+// occlusion tests bound it.
+static UINT CastRay(const std::vector<Voxel>& voxels, const float origin[3], const float direction[3])
+{
+	const int dims[3] = { static_cast<int>(Width), static_cast<int>(Height), static_cast<int>(Depth) };
+	float tEnter = 0.0f;
+	float tExit = FLT_MAX;
+	for (UINT a = 0; a < 3; a++)
+	{
+		const float extent = dims[a] * VoxelSize;
+		if (direction[a] == 0.0f)
+		{
+			if (origin[a] < 0.0f || origin[a] > extent)
+			{
+				return BrickCount;
+			}
+			continue;
+		}
+
+		float t0 = -origin[a] / direction[a];
+		float t1 = (extent - origin[a]) / direction[a];
+		tEnter = std::max(tEnter, std::min(t0, t1));
+		tExit = std::min(tExit, std::max(t0, t1));
+	}
+	if (tEnter > tExit)
+	{
+		return BrickCount;
+	}
+
+	int cell[3];
+	int step[3];
+	float tNext[3];
+	float tDelta[3];
+	for (UINT a = 0; a < 3; a++)
+	{
+		cell[a] = static_cast<int>(floorf((origin[a] + direction[a] * tEnter) / VoxelSize));
+		cell[a] = std::min(std::max(cell[a], 0), dims[a] - 1);
+		step[a] = direction[a] > 0.0f ? 1 : -1;
+		tNext[a] = direction[a] == 0.0f ? FLT_MAX : ((cell[a] + (step[a] > 0 ? 1 : 0)) * VoxelSize - origin[a]) / direction[a];
+		tDelta[a] = direction[a] == 0.0f ? FLT_MAX : VoxelSize / fabsf(direction[a]);
+	}
+
+	for (;;)
+	{
+		if (voxels[GetVoxelIndex(cell[0], cell[1], cell[2])].mMaterial != 0)
+		{
+			return GetBrickIndex(cell[0] / BrickWidth, cell[1] / BrickHeight, cell[2] / BrickDepth);
+		}
+
+		const UINT a = tNext[0] < tNext[1] ? (tNext[0] < tNext[2] ? 0 : 2) : (tNext[1] < tNext[2] ? 1 : 2);
+		if (tNext[a] > tExit)
+		{
+			return BrickCount;
+		}
+		cell[a] += step[a];
+		if (cell[a] < 0 || cell[a] >= dims[a])
+		{
+			return BrickCount;
+		}
+		tNext[a] += tDelta[a];
+	}
+}
+
+// Ray casts an image of each world from a range of cameras, at twice the
+// occlusion buffer's resolution with each sample jittered within its pixel, and
+// checks that the rasterizer keeps every brick that shows up in it.
+TEST(OcclusionKeepsVisibleBricks)
+{
+	const UINT samplesX = OcclusionWidth * 2;
+	const UINT samplesY = OcclusionHeight * 2;
+	const UINT cameraCount = 6;
+
+	// Scales from NDC to view space at unit depth, from the projection of a
+	// camera at the origin.
+	const XMFLOAT4X4 unrotated = GetViewProjection(SceneCamera{ XMFLOAT3(0, 0, 0), 0.0f });
+	const float scaleX = 1.0f / unrotated.m[0][0];
+	const float scaleY = 1.0f / unrotated.m[1][1];
+
+	UINT occluded = 0;
+	for (UINT type = 0; type < WorldTypeCount; type++)
+	{
+		Scene scene(static_cast<WorldType>(type));
+		TestRandom random(100 + type);
+		FrustumCuller culler;
+		OcclusionRasterizer rasterizer(OcclusionWidth, OcclusionHeight);
+
+		for (UINT camera = 0; camera < cameraCount; camera++)
+		{
+			// The sample's start, then cameras above the middle of the terrain looking
+			// across it.
+			SceneCamera view = GetStartCamera();
+			if (camera > 0)
+			{
+				view.mPosition = XMFLOAT3(-random.Next(0.0f, Width * VoxelSize), -random.Next(Height * VoxelSize * 0.5f, Height * VoxelSize + 2.0f),
+					-random.Next(0.0f, Depth * VoxelSize));
+				view.mYaw = random.Next(0.0f, 2.0f * 3.14159265f);
+			}
+
+			const XMFLOAT4X4 projection = GetViewProjection(view);
+			std::vector<DrawVoxelCommand> culled;
+			std::vector<DrawVoxelCommand> kept;
+			culler.SetProjection(projection);
+			culler.Run(scene.mEnclosed, culled);
+			rasterizer.Run(projection, scene.mOccupancy, culled, kept, ThreadPool::Default());
+			occluded += rasterizer.mStats.mOccluded;
+
+			std::vector<UINT8> state(BrickCount, 0);		// 1 when frustum culling kept the brick, 2 when occlusion did too.
+			for (const DrawVoxelCommand& command : culled)
+			{
+				state[command.Data & FrustumCuller::BrickIndexMask] = 1;
+			}
+			for (const DrawVoxelCommand& command : kept)
+			{
+				state[command.Data & FrustumCuller::BrickIndexMask] = 2;
+			}
+
+			const float origin[3] = { -view.mPosition.x, -view.mPosition.y, -view.mPosition.z };
+			const float c = cosf(view.mYaw);
+			const float s = sinf(view.mYaw);
+			UINT rejected = 0;
+			for (UINT y = 0; y < samplesY; y++)
+			{
+				for (UINT x = 0; x < samplesX; x++)
+				{
+					const float viewX = (2.0f * (x + random.Next()) / samplesX - 1.0f) * scaleX;
+					const float viewY = (1.0f - 2.0f * (y + random.Next()) / samplesY) * scaleY;
+					const float direction[3] = { viewX * c - s, viewY, viewX * s + c };
+					const UINT brick = CastRay(scene.mVoxels, origin, direction);
+					rejected += brick < BrickCount && state[brick] == 1 ? 1 : 0;
+				}
+			}
+			CHECK(rejected == 0);
+		}
+	}
+
+	// Otherwise the test proves nothing.
+	CHECK(occluded > 0);
+}
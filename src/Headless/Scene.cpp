@@ -0,0 +1,112 @@
+#include "stdafx.h"
+#include "Scene.h"
+#include "Enclosure.h"
+#include <cctype>
+#include <cstdio>
+
+Scene::Scene(WorldType type) :
+	mType(type),
+	mVoxels(VoxelCount)
+{
+	CreateWorldGenerator(type, SceneSeed)->Generate(mPool, ThreadPool::Default());
+	mPool.Decode(&mVoxels[0]);
+	mOccupancy.Build(mPool);
+	mMips.Build(mPool, ThreadPool::Default());
+
+	EnclosurePass enclosure;
+	enclosure.Run(mOccupancy, mEnclosed, ThreadPool::Default());
+}
+
+bool ParseWorldType(const char* name, WorldType& type)
+{
+	for (UINT candidate = 0; candidate < WorldTypeCount; candidate++)
+	{
+		const char* worldName = GetWorldTypeName(static_cast<WorldType>(candidate));
+		size_t i = 0;
+		while (name[i] && worldName[i] && tolower(name[i]) == tolower(worldName[i]))
+		{
+			i++;
+		}
+		if (name[i] == 0 && worldName[i] == 0)
+		{
+			type = static_cast<WorldType>(candidate);
+			return true;
+		}
+	}
+	return false;
+}
+
+SceneCamera GetStartCamera()
+{
+	SceneCamera camera = { XMFLOAT3(-0.1f * cWidth / 2, -0.1f * cHeight / 2, -0.1f * cDepth / 2), 0.0f };
+	return camera;
+}
+
+static XMFLOAT4X4 Multiply(const XMFLOAT4X4& a, const XMFLOAT4X4& b)
+{
+	XMFLOAT4X4 product;
+	for (UINT row = 0; row < 4; row++)
+	{
+		for (UINT column = 0; column < 4; column++)
+		{
+			product.m[row][column] = a.m[row][0] * b.m[0][column] + a.m[row][1] * b.m[1][column] +
+				a.m[row][2] * b.m[2][column] + a.m[row][3] * b.m[3][column];
+		}
+	}
+	return product;
+}
+
+// XMMatrixPerspectiveFovLH, XMMatrixRotationRollPitchYaw(0, yaw, 0) and
+// XMMatrixTranslation, in DirectXMath's row vector convention.
+XMFLOAT4X4 GetViewProjection(const SceneCamera& camera)
+{
+	const float fovY = 3.14159265f / 4.0f;
+	const float aspect = static_cast<float>(ViewportWidth) / static_cast<float>(ViewportHeight);
+	const float nearZ = 0.01f;
+	const float farZ = cDepth * 0.1f;
+	const float height = 1.0f / tanf(fovY / 2.0f);
+	const float range = farZ / (farZ - nearZ);
+	const XMFLOAT4X4 projection(
+		height / aspect, 0, 0, 0,
+		0, height, 0, 0,
+		0, 0, range, 1,
+		0, 0, -range * nearZ, 0);
+
+	const float c = cosf(camera.mYaw);
+	const float s = sinf(camera.mYaw);
+	const XMFLOAT4X4 rotation(
+		c, 0, -s, 0,
+		0, 1, 0, 0,
+		s, 0, c, 0,
+		0, 0, 0, 1);
+
+	const XMFLOAT4X4 translation(
+		1, 0, 0, 0,
+		0, 1, 0, 0,
+		0, 0, 1, 0,
+		camera.mPosition.x, camera.mPosition.y, camera.mPosition.z, 1);
+
+	const XMFLOAT4X4 viewProjection = Multiply(Multiply(translation, rotation), projection);
+	XMFLOAT4X4 transposed;
+	for (UINT row = 0; row < 4; row++)
+	{
+		for (UINT column = 0; column < 4; column++)
+		{
+			transposed.m[row][column] = viewProjection.m[column][row];
+		}
+	}
+	return transposed;
+}
+
+float GetLodDistance(const XMFLOAT4X4& projection)
+{
+	const float* row = projection.m[1];
+	float pixelsPerUnit = sqrtf(row[0] * row[0] + row[1] * row[1] + row[2] * row[2]) * ViewportHeight / 2.0f;
+	return VoxelSize * pixelsPerUnit / LodVoxelPixels;
+}
+
+bool ParseCamera(const char* text, SceneCamera& camera)
+{
+	char end = 0;
+	return sscanf(text, "%f,%f,%f,%f%c", &camera.mPosition.x, &camera.mPosition.y, &camera.mPosition.z, &camera.mYaw, &end) == 4;
+}
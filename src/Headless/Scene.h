@@ -0,0 +1,53 @@
+#pragma once
+
+#include "stdafx.h"
+#include "Worlds.h"
+#include "BrickPool.h"
+#include "BrickOccupancy.h"
+#include "VoxelMips.h"
+
+// The inputs RunBenchmarks in D3D12ExecuteIndirect.cpp times the CPU passes on,
+// rebuilt without the renderer: a world generated with the sample's seed, its
+// dense copy, occupancy masks and mip levels, and the commands the enclosure
+// pass keeps. The camera helpers follow the sample's window and projection.
+static const UINT SceneSeed = 1;			// D3D12ExecuteIndirect::WorldSeed.
+static const UINT ViewportWidth = 1280;		// The sample's window, from Main.cpp.
+static const UINT ViewportHeight = 720;
+static const UINT OcclusionWidth = 320;		// D3D12ExecuteIndirect::OcclusionWidth.
+static const UINT OcclusionHeight = (OcclusionWidth * ViewportHeight + ViewportWidth - 1) / ViewportWidth;
+static const float LodVoxelPixels = 4.0f;	// D3D12ExecuteIndirect::LodVoxelPixels.
+
+struct SceneCamera
+{
+	XMFLOAT3	mPosition;
+	float		mYaw;
+};
+
+class Scene
+{
+public:
+	Scene(WorldType type);
+
+	WorldType						mType;
+	BrickPool						mPool;
+	std::vector<Voxel>				mVoxels;
+	BrickOccupancy					mOccupancy;
+	VoxelMips						mMips;
+	std::vector<DrawVoxelCommand>	mEnclosed;
+};
+
+// Where the sample starts the camera.
+SceneCamera GetStartCamera();
+
+// The transposed view-projection, as D3D12ExecuteIndirect::GetViewProjection
+// builds it for the sample's window.
+XMFLOAT4X4 GetViewProjection(const SceneCamera& camera);
+
+// D3D12ExecuteIndirect::GetLodDistance with LOD enabled.
+float GetLodDistance(const XMFLOAT4X4& projection);
+
+// A camera written as x,y,z,yaw.
+bool ParseCamera(const char* text, SceneCamera& camera);
+
+// The world type named on the command line, matched without regard to case.
+bool ParseWorldType(const char* name, WorldType& type);
@@ -0,0 +1,69 @@
+#include "stdafx.h"
+#include "Test.h"
+#include "Terrain.h"
+
+static const SimdLevel SimdLevels[] = { SimdSse2, SimdAvx2 };
+
+static void ReportSkipped(const char* test, SimdLevel level)
+{
+	printf("%s: %s is not supported by this CPU, checked at %s instead\n", test, GetSimdLevelName(level),
+		GetSimdLevelName(GetSimdLevel(level)));
+}
+
+// The SSE2 and AVX2 sine kernels give exactly the scalar heightfield, so worlds
+// do not depend on the host CPU.
+TEST(TerrainHeightsMatchScalar)
+{
+	TerrainGenerator terrain;
+	terrain.mSimd = SimdScalar;
+	CHECK(terrain.MaxHeightError() == 0.0f);
+
+	for (SimdLevel level : SimdLevels)
+	{
+		if (GetSimdLevel(level) != level)
+		{
+			ReportSkipped("TerrainHeightsMatchScalar", level);
+		}
+		terrain.mSimd = level;
+		CHECK(terrain.MaxHeightError() == 0.0f);
+	}
+}
+
+// A heightfield whose surface sweeps from below the volume to above it, so that
+// brick rows are empty, solid and cut at every height.
+class RampGenerator : public HeightfieldGenerator
+{
+public:
+	RampGenerator() :
+		HeightfieldGenerator(3)
+	{}
+
+	void GenerateHeights(UINT z, float* heights) const override
+	{
+		for (UINT x = 0; x < Width; x++)
+		{
+			heights[x] = static_cast<float>((x * 7 + z * 13) % (Height + 8)) - 4.5f;
+		}
+	}
+};
+
+// The hashed materials of brick rows come out the same at every level.
+TEST(TerrainMaterialsMatchScalar)
+{
+	RampGenerator generator;
+	generator.mSimd = SimdScalar;
+	std::vector<Voxel> expected(VoxelCount);
+	generator.Generate(&expected[0], ThreadPool::Default());
+
+	for (SimdLevel level : SimdLevels)
+	{
+		if (GetSimdLevel(level) != level)
+		{
+			ReportSkipped("TerrainMaterialsMatchScalar", level);
+		}
+		generator.mSimd = level;
+		std::vector<Voxel> voxels(VoxelCount);
+		generator.Generate(&voxels[0], ThreadPool::Default());
+		CHECK(memcmp(&voxels[0], &expected[0], VoxelCount * sizeof(Voxel)) == 0);
+	}
+}
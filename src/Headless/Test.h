@@ -0,0 +1,60 @@
+#pragma once
+
+#include "stdafx.h"
+#include <cstdio>
+
+// A minimal harness for the headless tests. TEST registers a function under its
+// name; VoxelTests runs the tests named on its command line, or all of them, and
+// CMakeLists.txt registers each one with ctest. CHECK records a failure and
+// carries on, so one run reports every broken case.
+typedef void (*TestFunction)();
+
+struct TestCase
+{
+	const char*		mName;
+	TestFunction	mFunction;
+	TestCase*		mNext;
+};
+
+class TestRegistrar
+{
+public:
+	TestRegistrar(TestCase& test);
+};
+
+void ReportFailure(const char* file, int line, const char* condition);
+
+#define TEST(name) \
+	static void Test_##name(); \
+	static TestCase TestCase_##name = { #name, Test_##name, nullptr }; \
+	static TestRegistrar TestRegistrar_##name(TestCase_##name); \
+	static void Test_##name()
+
+#define CHECK(condition) \
+	do \
+	{ \
+		if (!(condition)) \
+		{ \
+			ReportFailure(__FILE__, __LINE__, #condition); \
+		} \
+	} while (0)
+
+// A repeatable stream of floats in [0, 1).
+class TestRandom
+{
+public:
+	TestRandom(UINT seed) :
+		mState(seed)
+	{}
+
+	float Next()
+	{
+		mState = mState * 1664525u + 1013904223u;
+		return static_cast<float>(mState >> 8) / 16777216.0f;
+	}
+
+	float Next(float low, float high) { return low + (high - low) * Next(); }
+
+private:
+	UINT	mState;
+};
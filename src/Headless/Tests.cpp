@@ -0,0 +1,68 @@
+#include "stdafx.h"
+#include "Test.h"
+#include <cstring>
+
+static TestCase* sTests = nullptr;
+static UINT sFailures = 0;
+
+TestRegistrar::TestRegistrar(TestCase& test)
+{
+	// Keep the tests in the order they were registered.
+	TestCase** tail = &sTests;
+	while (*tail)
+	{
+		tail = &(*tail)->mNext;
+	}
+	*tail = &test;
+}
+
+void ReportFailure(const char* file, int line, const char* condition)
+{
+	printf("%s(%d): failed: %s\n", file, line, condition);
+	sFailures++;
+}
+
+// VoxelTests [--list] [name...]
+int main(int argc, char** argv)
+{
+	if (argc > 1 && strcmp(argv[1], "--list") == 0)
+	{
+		for (TestCase* test = sTests; test; test = test->mNext)
+		{
+			printf("%s\n", test->mName);
+		}
+		return 0;
+	}
+
+	UINT run = 0;
+	UINT failed = 0;
+	for (TestCase* test = sTests; test; test = test->mNext)
+	{
+		bool selected = argc == 1;
+		for (int arg = 1; arg < argc; arg++)
+		{
+			selected = selected || strcmp(argv[arg], test->mName) == 0;
+		}
+		if (!selected)
+		{
+			continue;
+		}
+
+		const UINT failuresBefore = sFailures;
+		test->mFunction();
+		run++;
+
+		const bool passed = sFailures == failuresBefore;
+		failed += passed ? 0 : 1;
+		printf("%s: %s\n", test->mName, passed ? "passed" : "FAILED");
+	}
+
+	if (run == 0)
+	{
+		printf("No tests matched.\n");
+		return 1;
+	}
+
+	printf("%u of %u tests passed.\n", run - failed, run);
+	return failed ? 1 : 0;
+}
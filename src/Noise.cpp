@@ -0,0 +1,193 @@
+#include "stdafx.h"
+#include "Noise.h"
+
+// Gradient directions: the midpoints of a cube's edges. 2D noise uses the x and y
+// components of the first eight.
+static const float Gradients[12][3] =
+{
+	{ 1, 1, 0 }, { -1, 1, 0 }, { 1, -1, 0 }, { -1, -1, 0 },
+	{ 1, 0, 1 }, { -1, 0, 1 }, { 1, 0, -1 }, { -1, 0, -1 },
+	{ 0, 1, 1 }, { 0, -1, 1 }, { 0, 1, -1 }, { 0, -1, -1 }
+};
+
+static inline int FastFloor(float x)
+{
+	int i = static_cast<int>(x);
+	return x < i ? i - 1 : i;
+}
+
+SimplexNoise::SimplexNoise(UINT seed)
+{
+	for (UINT i = 0; i < 256; i++)
+	{
+		mPerm[i] = static_cast<UINT8>(i);
+	}
+
+	// Fisher-Yates shuffle driven by xorshift32; the state must not be zero.
+	UINT state = seed * 0x9e3779b9 + 1;
+	for (UINT i = 255; i > 0; i--)
+	{
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		UINT j = state % (i + 1);
+		UINT8 t = mPerm[i];
+		mPerm[i] = mPerm[j];
+		mPerm[j] = t;
+	}
+
+	for (UINT i = 0; i < 256; i++)
+	{
+		mPerm[i + 256] = mPerm[i];
+	}
+}
+
+float SimplexNoise::Noise(float x, float y) const
+{
+	const float F2 = 0.366025403f;	// (sqrt(3) - 1) / 2
+	const float G2 = 0.211324865f;	// (3 - sqrt(3)) / 6
+
+	// Skew into the simplex grid to find the containing cell.
+	float s = (x + y) * F2;
+	int i = FastFloor(x + s);
+	int j = FastFloor(y + s);
+	float t = (i + j) * G2;
+	float x0 = x - (i - t);
+	float y0 = y - (j - t);
+
+	// Which of the cell's two triangles the point lies in.
+	int i1 = x0 > y0 ? 1 : 0;
+	int j1 = x0 > y0 ? 0 : 1;
+
+	float x1 = x0 - i1 + G2;
+	float y1 = y0 - j1 + G2;
+	float x2 = x0 - 1.0f + 2.0f * G2;
+	float y2 = y0 - 1.0f + 2.0f * G2;
+
+	int ii = i & 255;
+	int jj = j & 255;
+	const float* g0 = Gradients[mPerm[ii + mPerm[jj]] & 7];
+	const float* g1 = Gradients[mPerm[ii + i1 + mPerm[jj + j1]] & 7];
+	const float* g2 = Gradients[mPerm[ii + 1 + mPerm[jj + 1]] & 7];
+
+	float n = 0.0f;
+	float t0 = 0.5f - x0 * x0 - y0 * y0;
+	if (t0 > 0.0f)
+	{
+		t0 *= t0;
+		n += t0 * t0 * (g0[0] * x0 + g0[1] * y0);
+	}
+	float t1 = 0.5f - x1 * x1 - y1 * y1;
+	if (t1 > 0.0f)
+	{
+		t1 *= t1;
+		n += t1 * t1 * (g1[0] * x1 + g1[1] * y1);
+	}
+	float t2 = 0.5f - x2 * x2 - y2 * y2;
+	if (t2 > 0.0f)
+	{
+		t2 *= t2;
+		n += t2 * t2 * (g2[0] * x2 + g2[1] * y2);
+	}
+
+	return 70.0f * n;
+}
+
+float SimplexNoise::Noise(float x, float y, float z) const
+{
+	const float F3 = 1.0f / 3.0f;
+	const float G3 = 1.0f / 6.0f;
+
+	float s = (x + y + z) * F3;
+	int i = FastFloor(x + s);
+	int j = FastFloor(y + s);
+	int k = FastFloor(z + s);
+	float t = (i + j + k) * G3;
+	float x0 = x - (i - t);
+	float y0 = y - (j - t);
+	float z0 = z - (k - t);
+
+	// Order the offsets to pick which of the cell's six tetrahedra holds the point.
+	int i1, j1, k1, i2, j2, k2;
+	if (x0 >= y0)
+	{
+		if (y0 >= z0)		{ i1 = 1; j1 = 0; k1 = 0; i2 = 1; j2 = 1; k2 = 0; }
+		else if (x0 >= z0)	{ i1 = 1; j1 = 0; k1 = 0; i2 = 1; j2 = 0; k2 = 1; }
+		else				{ i1 = 0; j1 = 0; k1 = 1; i2 = 1; j2 = 0; k2 = 1; }
+	}
+	else
+	{
+		if (y0 < z0)		{ i1 = 0; j1 = 0; k1 = 1; i2 = 0; j2 = 1; k2 = 1; }
+		else if (x0 < z0)	{ i1 = 0; j1 = 1; k1 = 0; i2 = 0; j2 = 1; k2 = 1; }
+		else				{ i1 = 0; j1 = 1; k1 = 0; i2 = 1; j2 = 1; k2 = 0; }
+	}
+
+	const float corners[4][3] =
+	{
+		{ x0, y0, z0 },
+		{ x0 - i1 + G3, y0 - j1 + G3, z0 - k1 + G3 },
+		{ x0 - i2 + 2.0f * G3, y0 - j2 + 2.0f * G3, z0 - k2 + 2.0f * G3 },
+		{ x0 - 1.0f + 3.0f * G3, y0 - 1.0f + 3.0f * G3, z0 - 1.0f + 3.0f * G3 }
+	};
+
+	int ii = i & 255;
+	int jj = j & 255;
+	int kk = k & 255;
+	const int gradients[4] =
+	{
+		mPerm[ii + mPerm[jj + mPerm[kk]]] % 12,
+		mPerm[ii + i1 + mPerm[jj + j1 + mPerm[kk + k1]]] % 12,
+		mPerm[ii + i2 + mPerm[jj + j2 + mPerm[kk + k2]]] % 12,
+		mPerm[ii + 1 + mPerm[jj + 1 + mPerm[kk + 1]]] % 12
+	};
+
+	float n = 0.0f;
+	for (UINT c = 0; c < 4; c++)
+	{
+		const float* p = corners[c];
+		float tc = 0.6f - p[0] * p[0] - p[1] * p[1] - p[2] * p[2];
+		if (tc > 0.0f)
+		{
+			const float* g = Gradients[gradients[c]];
+			tc *= tc;
+			n += tc * tc * (g[0] * p[0] + g[1] * p[1] + g[2] * p[2]);
+		}
+	}
+
+	return 32.0f * n;
+}
+
+float SimplexNoise::Fbm(float x, float y, UINT octaves, float lacunarity, float gain) const
+{
+	float sum = 0.0f;
+	float amplitude = 1.0f;
+	float total = 0.0f;
+	for (UINT o = 0; o < octaves; o++)
+	{
+		sum += amplitude * Noise(x, y);
+		total += amplitude;
+		x *= lacunarity;
+		y *= lacunarity;
+		amplitude *= gain;
+	}
+
+	return total > 0.0f ? sum / total : 0.0f;
+}
+
+float SimplexNoise::Fbm(float x, float y, float z, UINT octaves, float lacunarity, float gain) const
+{
+	float sum = 0.0f;
+	float amplitude = 1.0f;
+	float total = 0.0f;
+	for (UINT o = 0; o < octaves; o++)
+	{
+		sum += amplitude * Noise(x, y, z);
+		total += amplitude;
+		x *= lacunarity;
+		y *= lacunarity;
+		z *= lacunarity;
+		amplitude *= gain;
+	}
+
+	return total > 0.0f ? sum / total : 0.0f;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "VoxelTypes.h"
+
+// Seeded 2D and 3D simplex noise (after Gustavson's reference implementation),
+// returning values in roughly [-1, 1], plus fractal sums of several octaves.
+// The permutation table is built once from the seed; evaluation only reads it,
+// so one instance can be shared by every generation thread.
+class SimplexNoise
+{
+public:
+	SimplexNoise(UINT seed);
+
+	float Noise(float x, float y) const;
+	float Noise(float x, float y, float z) const;
+
+	// Sums octaves of noise, each at lacunarity times the frequency and gain
+	// times the amplitude of the last, normalised back to roughly [-1, 1].
+	float Fbm(float x, float y, UINT octaves, float lacunarity = 2.0f, float gain = 0.5f) const;
+	float Fbm(float x, float y, float z, UINT octaves, float lacunarity = 2.0f, float gain = 0.5f) const;
+
+private:
+	UINT8	mPerm[512];
+};
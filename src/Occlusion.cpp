@@ -0,0 +1,578 @@
+#include "stdafx.h"
+#include "Occlusion.h"
+#include "Culling.h"
+#include <immintrin.h>
+#include <chrono>
+#include <cfloat>
+#include <algorithm>
+
+void DepthPyramid::Resize(UINT width, UINT height)
+{
+	mLevelCount = 0;
+	for (;;)
+	{
+		mWidths[mLevelCount] = width;
+		mHeights[mLevelCount] = height;
+		mLevels[mLevelCount].assign(width * height, 1.0f);
+		mLevelCount++;
+
+		if ((width == 1 && height == 1) || mLevelCount == MaxLevels)
+		{
+			break;
+		}
+		width = (width + 1) / 2;
+		height = (height + 1) / 2;
+	}
+}
+
+void DepthPyramid::Build(const float* depth)
+{
+	memcpy(GetDepth(), depth, mWidths[0] * mHeights[0] * sizeof(float));
+	Update();
+}
+
+void DepthPyramid::Update()
+{
+	for (UINT level = 1; level < mLevelCount; level++)
+	{
+		const float* src = &mLevels[level - 1][0];
+		float* dst = &mLevels[level][0];
+		const UINT srcWidth = mWidths[level - 1];
+		const UINT srcHeight = mHeights[level - 1];
+		const UINT width = mWidths[level];
+		const UINT height = mHeights[level];
+
+		for (UINT y = 0; y < height; y++)
+		{
+			// An odd row or column at the edge is folded into the last texel.
+			const float* row0 = src + (2 * y) * srcWidth;
+			const float* row1 = src + (2 * y + 1 < srcHeight ? 2 * y + 1 : 2 * y) * srcWidth;
+			float* out = dst + y * width;
+			UINT x = 0;
+
+			// Four output texels from eight input columns at a time.
+			for (; 2 * x + 8 <= srcWidth; x += 4)
+			{
+				__m128 a = _mm_max_ps(_mm_loadu_ps(row0 + 2 * x), _mm_loadu_ps(row1 + 2 * x));
+				__m128 b = _mm_max_ps(_mm_loadu_ps(row0 + 2 * x + 4), _mm_loadu_ps(row1 + 2 * x + 4));
+				__m128 even = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+				__m128 odd = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+				_mm_storeu_ps(out + x, _mm_max_ps(even, odd));
+			}
+
+			for (; x < width; x++)
+			{
+				const UINT x0 = 2 * x;
+				const UINT x1 = x0 + 1 < srcWidth ? x0 + 1 : x0;
+				float a = row0[x0] > row0[x1] ? row0[x0] : row0[x1];
+				float b = row1[x0] > row1[x1] ? row1[x0] : row1[x1];
+				out[x] = a > b ? a : b;
+			}
+		}
+	}
+}
+
+float DepthPyramid::GetMaxDepth(UINT x0, UINT y0, UINT x1, UINT y1) const
+{
+	// Texel x of level n covers level 0 pixels [x << n, (x + 1) << n).
+	UINT level = 0;
+	while (level + 1 < mLevelCount && (((x1 >> level) - (x0 >> level)) > 1 || ((y1 >> level) - (y0 >> level)) > 1))
+	{
+		level++;
+	}
+
+	const float* texels = &mLevels[level][0];
+	const UINT width = mWidths[level];
+	const UINT height = mHeights[level];
+	UINT tx0 = x0 >> level, tx1 = x1 >> level;
+	UINT ty0 = y0 >> level, ty1 = y1 >> level;
+	tx1 = tx1 < width ? tx1 : width - 1;
+	ty1 = ty1 < height ? ty1 : height - 1;
+
+	float depth = 0.0f;
+	for (UINT y = ty0; y <= ty1; y++)
+	{
+		for (UINT x = tx0; x <= tx1; x++)
+		{
+			float d = texels[y * width + x];
+			depth = d > depth ? d : depth;
+		}
+	}
+
+	return depth;
+}
+
+double DepthPyramid::Benchmark(UINT iterations)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+	for (UINT i = 0; i < iterations; i++)
+	{
+		Update();
+	}
+	std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+	return (double(mWidths[0]) * mHeights[0] * iterations) / elapsed.count();
+}
+
+void OcclusionCuller::SetProjection(const XMFLOAT4X4& projection, UINT width, UINT height)
+{
+	memcpy(mRows, projection.m, sizeof(mRows));
+	mWidth = static_cast<float>(width);
+	mHeight = static_cast<float>(height);
+}
+
+bool OcclusionCuller::ProjectBrick(UINT brick, BrickScreenBounds& bounds, XMFLOAT3* corners) const
+{
+	XMUINT3 b = GetBrickCoords(brick);
+	const float size[3] = { BrickWidth * VoxelSize, BrickHeight * VoxelSize, BrickDepth * VoxelSize };
+	const float lo[3] = { b.x * size[0], b.y * size[1], b.z * size[2] };
+
+	// Clip space position of the low corner, and the step along each edge.
+	float base[4], step[3][4];
+	for (UINT n = 0; n < 4; n++)
+	{
+		base[n] = lo[0] * mRows[n][0] + lo[1] * mRows[n][1] + lo[2] * mRows[n][2] + mRows[n][3];
+		for (UINT a = 0; a < 3; a++)
+		{
+			step[a][n] = size[a] * mRows[n][a];
+		}
+	}
+
+	bounds.mMinX = bounds.mMinY = bounds.mMinDepth = FLT_MAX;
+	bounds.mMaxX = bounds.mMaxY = bounds.mMaxDepth = -FLT_MAX;
+
+	for (UINT corner = 0; corner < 8; corner++)
+	{
+		float p[4];
+		for (UINT n = 0; n < 4; n++)
+		{
+			p[n] = base[n];
+			for (UINT a = 0; a < 3; a++)
+			{
+				if (corner & (1 << a))
+				{
+					p[n] += step[a][n];
+				}
+			}
+		}
+
+		if (p[3] <= 0.0f || p[2] < 0.0f)
+		{
+			return false;
+		}
+
+		const float invW = 1.0f / p[3];
+		const float x = (p[0] * invW * 0.5f + 0.5f) * mWidth;
+		const float y = (0.5f - p[1] * invW * 0.5f) * mHeight;
+		const float z = p[2] * invW;
+
+		bounds.mMinX = x < bounds.mMinX ? x : bounds.mMinX;
+		bounds.mMaxX = x > bounds.mMaxX ? x : bounds.mMaxX;
+		bounds.mMinY = y < bounds.mMinY ? y : bounds.mMinY;
+		bounds.mMaxY = y > bounds.mMaxY ? y : bounds.mMaxY;
+		bounds.mMinDepth = z < bounds.mMinDepth ? z : bounds.mMinDepth;
+		bounds.mMaxDepth = z > bounds.mMaxDepth ? z : bounds.mMaxDepth;
+
+		if (corners)
+		{
+			corners[corner] = XMFLOAT3(x, y, z);
+		}
+	}
+
+	return true;
+}
+
+bool OcclusionCuller::IsBrickOccluded(const DepthPyramid& pyramid, UINT brick) const
+{
+	BrickScreenBounds bounds;
+	return ProjectBrick(brick, bounds) && IsOccluded(pyramid, bounds);
+}
+
+bool OcclusionCuller::IsOccluded(const DepthPyramid& pyramid, const BrickScreenBounds& bounds) const
+{
+	// Off screen bricks are the frustum test's business.
+	if (bounds.mMaxX < 0.0f || bounds.mMaxY < 0.0f || bounds.mMinX >= mWidth || bounds.mMinY >= mHeight)
+	{
+		return false;
+	}
+
+	// Every pixel the bounds touch, clamped to the screen.
+	const float maxX = mWidth - 1.0f;
+	const float maxY = mHeight - 1.0f;
+	UINT x0 = static_cast<UINT>(bounds.mMinX > 0.0f ? bounds.mMinX : 0.0f);
+	UINT y0 = static_cast<UINT>(bounds.mMinY > 0.0f ? bounds.mMinY : 0.0f);
+	UINT x1 = static_cast<UINT>(bounds.mMaxX < maxX ? bounds.mMaxX : maxX);
+	UINT y1 = static_cast<UINT>(bounds.mMaxY < maxY ? bounds.mMaxY : maxY);
+
+	return bounds.mMinDepth > pyramid.GetMaxDepth(x0, y0, x1, y1);
+}
+
+UINT OcclusionCuller::Run(const DepthPyramid& pyramid, const DrawVoxelCommand* commands, UINT count, DrawVoxelCommand* out) const
+{
+	UINT visible = 0;
+	for (UINT n = 0; n < count; n++)
+	{
+		if (!IsBrickOccluded(pyramid, commands[n].Data & FrustumCuller::BrickIndexMask))
+		{
+			out[visible++] = commands[n];
+		}
+	}
+
+	return visible;
+}
+
+void OcclusionCuller::Run(const DepthPyramid& pyramid, const std::vector<DrawVoxelCommand>& commands, std::vector<DrawVoxelCommand>& out) const
+{
+	out.resize(commands.size());
+	if (!commands.empty())
+	{
+		out.resize(Run(pyramid, &commands[0], static_cast<UINT>(commands.size()), &out[0]));
+	}
+}
+
+double OcclusionCuller::Benchmark(const DepthPyramid& pyramid, const std::vector<DrawVoxelCommand>& commands, UINT iterations) const
+{
+	std::vector<DrawVoxelCommand> out;
+	out.reserve(commands.size());
+
+	auto start = std::chrono::high_resolution_clock::now();
+	for (UINT i = 0; i < iterations; i++)
+	{
+		Run(pyramid, commands, out);
+	}
+	std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+	return (double(commands.size()) * iterations) / elapsed.count();
+}
+
+double OcclusionCuller::EstimateOverdraw(const DrawVoxelCommand* commands, UINT count) const
+{
+	const UINT width = static_cast<UINT>(mWidth);
+	const UINT height = static_cast<UINT>(mHeight);
+	std::vector<float> depth(width * height, 1.0f);
+
+	UINT64 shaded = 0;
+	for (UINT n = 0; n < count; n++)
+	{
+		BrickScreenBounds bounds;
+		if (!ProjectBrick(commands[n].Data & FrustumCuller::BrickIndexMask, bounds) ||
+			bounds.mMaxX < 0.0f || bounds.mMaxY < 0.0f || bounds.mMinX >= mWidth || bounds.mMinY >= mHeight)
+		{
+			continue;
+		}
+
+		const float maxX = mWidth - 1.0f;
+		const float maxY = mHeight - 1.0f;
+		UINT x0 = static_cast<UINT>(bounds.mMinX > 0.0f ? bounds.mMinX : 0.0f);
+		UINT y0 = static_cast<UINT>(bounds.mMinY > 0.0f ? bounds.mMinY : 0.0f);
+		UINT x1 = static_cast<UINT>(bounds.mMaxX < maxX ? bounds.mMaxX : maxX);
+		UINT y1 = static_cast<UINT>(bounds.mMaxY < maxY ? bounds.mMaxY : maxY);
+
+		for (UINT y = y0; y <= y1; y++)
+		{
+			float* row = &depth[y * width];
+			for (UINT x = x0; x <= x1; x++)
+			{
+				if (bounds.mMinDepth < row[x])
+				{
+					row[x] = bounds.mMinDepth;
+					shaded++;
+				}
+			}
+		}
+	}
+
+	UINT64 covered = 0;
+	for (float d : depth)
+	{
+		covered += d < 1.0f ? 1 : 0;
+	}
+
+	return covered ? double(shaded) / double(covered) : 1.0;
+}
+
+enum OcclusionFlags
+{
+	ProjectedFlag	= 1,	// mBounds holds the brick's screen bounds.
+	SolidFlag		= 2,	// The brick is completely solid, so its box hides what is behind it.
+	OccludedFlag	= 4
+};
+
+static const UINT OcclusionChunkSize = 1024;	// Commands per job when projecting and testing.
+
+OcclusionRasterizer::OcclusionRasterizer(UINT width, UINT height, UINT maxOccluders) :
+	mMaxOccluders(maxOccluders),
+	mStats(),
+	mTilesX((width + TileWidth - 1) / TileWidth),
+	mTilesY((height + TileHeight - 1) / TileHeight),
+	mBins(mTilesX * mTilesY)
+{
+	mPyramid.Resize(width, height);
+}
+
+bool OcclusionRasterizer::SetupOccluder(const XMFLOAT3* corners, Occluder& occluder) const
+{
+	// Convex hull of the corners by Andrew's monotone chain, counter-clockwise
+	// with y taken as up.
+	XMFLOAT3 points[8];
+	memcpy(points, corners, sizeof(points));
+	std::sort(points, points + 8, [](const XMFLOAT3& a, const XMFLOAT3& b) { return a.x < b.x || (a.x == b.x && a.y < b.y); });
+
+	auto cross = [](const XMFLOAT3& o, const XMFLOAT3& a, const XMFLOAT3& b) { return (a.x - o.x) * (b.y - o.y) - (a.y - o.y) * (b.x - o.x); };
+
+	XMFLOAT3 hull[16];
+	int k = 0;
+	for (int i = 0; i < 8; i++)
+	{
+		while (k >= 2 && cross(hull[k - 2], hull[k - 1], points[i]) <= 0.0f) k--;
+		hull[k++] = points[i];
+	}
+	for (int i = 6, lower = k + 1; i >= 0; i--)
+	{
+		while (k >= lower && cross(hull[k - 2], hull[k - 1], points[i]) <= 0.0f) k--;
+		hull[k++] = points[i];
+	}
+	k--;	// The last point repeats the first.
+
+	if (k < 3)
+	{
+		return false;
+	}
+
+	float minX = hull[0].x, maxX = hull[0].x, minY = hull[0].y, maxY = hull[0].y;
+	occluder.mEdgeCount = k;
+	for (int i = 0; i < k; i++)
+	{
+		const XMFLOAT3& p = hull[i];
+		const XMFLOAT3& q = hull[(i + 1) % k];
+		occluder.mEdges[i][0] = p.y - q.y;
+		occluder.mEdges[i][1] = q.x - p.x;
+		occluder.mEdges[i][2] = -(occluder.mEdges[i][0] * p.x + occluder.mEdges[i][1] * p.y);
+
+		minX = p.x < minX ? p.x : minX;
+		maxX = p.x > maxX ? p.x : maxX;
+		minY = p.y < minY ? p.y : minY;
+		maxY = p.y > maxY ? p.y : maxY;
+	}
+
+	// Only pixels wholly inside the outline are covered; clamp to the screen
+	// before converting so huge outlines stay in range.
+	const float width = static_cast<float>(mPyramid.GetWidth());
+	const float height = static_cast<float>(mPyramid.GetHeight());
+	minX = ceilf(minX < 0.0f ? 0.0f : minX);
+	minY = ceilf(minY < 0.0f ? 0.0f : minY);
+	maxX = floorf(maxX > width ? width : maxX) - 1.0f;
+	maxY = floorf(maxY > height ? height : maxY) - 1.0f;
+	if (minX > maxX || minY > maxY)
+	{
+		return false;
+	}
+
+	occluder.mMinX = static_cast<int>(minX);
+	occluder.mMinY = static_cast<int>(minY);
+	occluder.mMaxX = static_cast<int>(maxX);
+	occluder.mMaxY = static_cast<int>(maxY);
+
+	occluder.mDepth = 0.0f;
+	for (int i = 0; i < 8; i++)
+	{
+		occluder.mDepth = corners[i].z > occluder.mDepth ? corners[i].z : occluder.mDepth;
+	}
+
+	return true;
+}
+
+void OcclusionRasterizer::RasterizeTile(UINT tile)
+{
+	const int width = static_cast<int>(mPyramid.GetWidth());
+	const int height = static_cast<int>(mPyramid.GetHeight());
+	const int tileX0 = (tile % mTilesX) * TileWidth;
+	const int tileY0 = (tile / mTilesX) * TileHeight;
+	const int tileX1 = (tileX0 + static_cast<int>(TileWidth) < width ? tileX0 + static_cast<int>(TileWidth) : width) - 1;
+	const int tileY1 = (tileY0 + static_cast<int>(TileHeight) < height ? tileY0 + static_cast<int>(TileHeight) : height) - 1;
+	float* depth = mPyramid.GetDepth();
+
+	for (int y = tileY0; y <= tileY1; y++)
+	{
+		std::fill(depth + y * width + tileX0, depth + y * width + tileX1 + 1, 1.0f);
+	}
+
+	for (UINT index : mBins[tile])
+	{
+		const Occluder& occluder = mOccluders[index];
+		const int y0 = occluder.mMinY > tileY0 ? occluder.mMinY : tileY0;
+		const int y1 = occluder.mMaxY < tileY1 ? occluder.mMaxY : tileY1;
+
+		for (int y = y0; y <= y1; y++)
+		{
+			// Narrow the row to the pixels whose every corner passes every edge.
+			float spanX0 = static_cast<float>(occluder.mMinX > tileX0 ? occluder.mMinX : tileX0);
+			float spanX1 = static_cast<float>(occluder.mMaxX < tileX1 ? occluder.mMaxX : tileX1);
+			for (UINT e = 0; e < occluder.mEdgeCount && spanX0 <= spanX1; e++)
+			{
+				const float a = occluder.mEdges[e][0];
+				const float b = occluder.mEdges[e][1];
+				const float rhs = -occluder.mEdges[e][2] - b * static_cast<float>(b > 0.0f ? y : y + 1);
+
+				if (a > 0.0f)
+				{
+					float x = ceilf(rhs / a);
+					spanX0 = x > spanX0 ? x : spanX0;
+				}
+				else if (a < 0.0f)
+				{
+					float x = floorf(rhs / a) - 1.0f;
+					spanX1 = x < spanX1 ? x : spanX1;
+				}
+				else if (rhs > 0.0f)
+				{
+					spanX1 = spanX0 - 1.0f;
+				}
+			}
+
+			if (spanX0 > spanX1)
+			{
+				continue;
+			}
+
+			float* row = depth + y * width;
+			for (int x = static_cast<int>(spanX0); x <= static_cast<int>(spanX1); x++)
+			{
+				row[x] = occluder.mDepth < row[x] ? occluder.mDepth : row[x];
+			}
+		}
+	}
+}
+
+UINT OcclusionRasterizer::Run(const XMFLOAT4X4& projection, const BrickOccupancy& occupancy, const DrawVoxelCommand* commands, UINT count,
+	DrawVoxelCommand* out, ThreadPool& pool)
+{
+	mCuller.SetProjection(projection, mPyramid.GetWidth(), mPyramid.GetHeight());
+	mBounds.resize(count);
+	mFlags.assign(count, 0);
+
+	const UINT chunks = (count + OcclusionChunkSize - 1) / OcclusionChunkSize;
+	pool.ParallelFor(chunks, [&](UINT chunk)
+	{
+		const UINT end = (chunk + 1) * OcclusionChunkSize < count ? (chunk + 1) * OcclusionChunkSize : count;
+		for (UINT n = chunk * OcclusionChunkSize; n < end; n++)
+		{
+			const UINT brick = commands[n].Data & FrustumCuller::BrickIndexMask;
+			if (mCuller.ProjectBrick(brick, mBounds[n]))
+			{
+				mFlags[n] = ProjectedFlag | (occupancy.IsBrickSolid(brick) ? SolidFlag : 0);
+			}
+		}
+	});
+
+	// The nearest solid bricks make the occluders.
+	mCandidates.clear();
+	for (UINT n = 0; n < count; n++)
+	{
+		if (mFlags[n] == (ProjectedFlag | SolidFlag))
+		{
+			mCandidates.push_back(n);
+		}
+	}
+	if (mCandidates.size() > mMaxOccluders)
+	{
+		std::nth_element(mCandidates.begin(), mCandidates.begin() + mMaxOccluders, mCandidates.end(),
+			[this](UINT a, UINT b) { return mBounds[a].mMinDepth < mBounds[b].mMinDepth; });
+		mCandidates.resize(mMaxOccluders);
+	}
+
+	mOccluders.resize(mCandidates.size());
+	const UINT occluderChunks = static_cast<UINT>((mCandidates.size() + OcclusionChunkSize - 1) / OcclusionChunkSize);
+	pool.ParallelFor(occluderChunks, [&](UINT chunk)
+	{
+		const UINT end = (chunk + 1) * OcclusionChunkSize < mCandidates.size() ? (chunk + 1) * OcclusionChunkSize : static_cast<UINT>(mCandidates.size());
+		for (UINT n = chunk * OcclusionChunkSize; n < end; n++)
+		{
+			BrickScreenBounds bounds;
+			XMFLOAT3 corners[8];
+			mCuller.ProjectBrick(commands[mCandidates[n]].Data & FrustumCuller::BrickIndexMask, bounds, corners);
+			if (!SetupOccluder(corners, mOccluders[n]))
+			{
+				mOccluders[n].mEdgeCount = 0;
+			}
+		}
+	});
+
+	for (std::vector<UINT>& bin : mBins)
+	{
+		bin.clear();
+	}
+
+	mStats.mOccluders = 0;
+	for (UINT n = 0; n < mOccluders.size(); n++)
+	{
+		const Occluder& occluder = mOccluders[n];
+		if (occluder.mEdgeCount == 0)
+		{
+			continue;
+		}
+
+		mStats.mOccluders++;
+		for (UINT ty = occluder.mMinY / TileHeight; ty <= occluder.mMaxY / TileHeight; ty++)
+		{
+			for (UINT tx = occluder.mMinX / TileWidth; tx <= occluder.mMaxX / TileWidth; tx++)
+			{
+				mBins[ty * mTilesX + tx].push_back(n);
+			}
+		}
+	}
+
+	pool.ParallelFor(mTilesX * mTilesY, [this](UINT tile) { RasterizeTile(tile); });
+	mPyramid.Update();
+
+	pool.ParallelFor(chunks, [&](UINT chunk)
+	{
+		const UINT end = (chunk + 1) * OcclusionChunkSize < count ? (chunk + 1) * OcclusionChunkSize : count;
+		for (UINT n = chunk * OcclusionChunkSize; n < end; n++)
+		{
+			if ((mFlags[n] & ProjectedFlag) && mCuller.IsOccluded(mPyramid, mBounds[n]))
+			{
+				mFlags[n] |= OccludedFlag;
+			}
+		}
+	});
+
+	UINT visible = 0;
+	for (UINT n = 0; n < count; n++)
+	{
+		if (!(mFlags[n] & OccludedFlag))
+		{
+			out[visible++] = commands[n];
+		}
+	}
+
+	mStats.mTested = count;
+	mStats.mOccluded = count - visible;
+	return visible;
+}
+
+void OcclusionRasterizer::Run(const XMFLOAT4X4& projection, const BrickOccupancy& occupancy, const std::vector<DrawVoxelCommand>& commands,
+	std::vector<DrawVoxelCommand>& out, ThreadPool& pool)
+{
+	out.resize(commands.size());
+	if (!commands.empty())
+	{
+		out.resize(Run(projection, occupancy, &commands[0], static_cast<UINT>(commands.size()), &out[0], pool));
+	}
+}
+
+double OcclusionRasterizer::Benchmark(const XMFLOAT4X4& projection, const BrickOccupancy& occupancy, const std::vector<DrawVoxelCommand>& commands,
+	ThreadPool& pool, UINT iterations)
+{
+	std::vector<DrawVoxelCommand> out;
+	out.reserve(commands.size());
+
+	auto start = std::chrono::high_resolution_clock::now();
+	for (UINT i = 0; i < iterations; i++)
+	{
+		Run(projection, occupancy, commands, out, pool);
+	}
+	std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+	return (double(commands.size()) * iterations) / elapsed.count();
+}
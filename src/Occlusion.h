@@ -0,0 +1,178 @@
+#pragma once
+
+#include "VoxelTypes.h"
+#include "BrickOccupancy.h"
+#include "ThreadPool.h"
+
+// A conservative depth pyramid for occlusion tests. Level 0 holds a depth buffer
+// (0 near, 1 far, as the sample's depth test uses); each further level halves
+// the resolution, rounding up, and keeps the farthest depth of the texels it
+// covers. A box whose nearest depth lies beyond the farthest depth under its
+// screen bounds is hidden.
+class DepthPyramid
+{
+public:
+	static const UINT MaxLevels = 16;
+
+	DepthPyramid() :
+		mLevelCount(0)
+	{}
+
+	// Allocates every level for a width x height level 0.
+	void Resize(UINT width, UINT height);
+
+	// Copies depth (width x height as passed to Resize, row by row) into level 0
+	// and rebuilds the other levels.
+	void Build(const float* depth);
+
+	// Rebuilds levels 1 and up after level 0 has been written through GetDepth().
+	void Update();
+
+	float* GetDepth() { return &mLevels[0][0]; }
+	const float* GetLevel(UINT level) const { return &mLevels[level][0]; }
+	UINT GetLevelCount() const { return mLevelCount; }
+	UINT GetWidth(UINT level = 0) const { return mWidths[level]; }
+	UINT GetHeight(UINT level = 0) const { return mHeights[level]; }
+
+	// The farthest depth over the level 0 pixels [x0, x1] x [y0, y1], read from
+	// the finest level where the rectangle spans at most 2x2 texels.
+	float GetMaxDepth(UINT x0, UINT y0, UINT x1, UINT y1) const;
+
+	// Level 0 texels reduced per second over the given number of rebuilds.
+	double Benchmark(UINT iterations);
+
+private:
+	std::vector<float>	mLevels[MaxLevels];
+	UINT				mWidths[MaxLevels];
+	UINT				mHeights[MaxLevels];
+	UINT				mLevelCount;
+};
+
+// Screen space bounds of a brick: pixels of the viewport the projection maps to,
+// with y running down the screen, and the depth range of its corners.
+struct BrickScreenBounds
+{
+	float mMinX;
+	float mMinY;
+	float mMaxX;
+	float mMaxY;
+	float mMinDepth;
+	float mMaxDepth;
+};
+
+// Tests brick bounds against a DepthPyramid. The pyramid is usually built from
+// the previous frame's depth, so a brick that has only just come into view may
+// be judged against slightly stale depths; everything that cannot be bounded
+// safely (bricks crossing the near plane or off the screen) is kept.
+class OcclusionCuller
+{
+public:
+	OcclusionCuller() :
+		mRows(),
+		mWidth(1),
+		mHeight(1)
+	{}
+
+	// Takes the projection as it is passed to cull.hlsl and the size of the
+	// pyramid's level 0.
+	void SetProjection(const XMFLOAT4X4& projection, UINT width, UINT height);
+
+	// Bounds the brick's box on the screen, and optionally writes the screen
+	// position and depth of its eight corners. Returns false when part of it is
+	// at or behind the near plane.
+	bool ProjectBrick(UINT brick, BrickScreenBounds& bounds, XMFLOAT3* corners = nullptr) const;
+
+	bool IsBrickOccluded(const DepthPyramid& pyramid, UINT brick) const;
+	bool IsOccluded(const DepthPyramid& pyramid, const BrickScreenBounds& bounds) const;
+
+	// Writes the commands whose bricks are not occluded to out (which must hold
+	// count entries) and returns how many there are. LOD flags in Data are
+	// ignored when finding the brick.
+	UINT Run(const DepthPyramid& pyramid, const DrawVoxelCommand* commands, UINT count, DrawVoxelCommand* out) const;
+	void Run(const DepthPyramid& pyramid, const std::vector<DrawVoxelCommand>& commands, std::vector<DrawVoxelCommand>& out) const;
+
+	// Commands tested per second over the given number of passes.
+	double Benchmark(const DepthPyramid& pyramid, const std::vector<DrawVoxelCommand>& commands, UINT iterations) const;
+
+	// Estimates the overdraw of drawing the commands in order with a software depth
+	// test: each brick fills its screen bounds at its nearest depth, and every
+	// pixel that passes the test counts as shaded. Returns the shaded pixels per
+	// pixel covered at least once, so 1 means nothing was shaded twice. Bricks that
+	// cannot be bounded are left out.
+	double EstimateOverdraw(const DrawVoxelCommand* commands, UINT count) const;
+
+private:
+	float	mRows[4][4];	// Clip space rows, as in FrustumCuller.
+	float	mWidth;
+	float	mHeight;
+};
+
+// A small tiled software rasterizer that supplies the depth for occlusion culling
+// on the CPU. The solid bricks among the commands, nearest first, are drawn as
+// occluders: each covers the pixels that lie wholly inside the convex outline of
+// its box, at the depth of its farthest corner, so the depth buffer never claims
+// more than the bricks hide. The remaining commands are then tested against a
+// DepthPyramid built from it.
+//
+// Occluders are binned into screen tiles and the tiles are rasterized in
+// parallel; projection and testing are split across the pool as well.
+class OcclusionRasterizer
+{
+public:
+	static const UINT TileWidth = 32;
+	static const UINT TileHeight = 32;
+
+	// Counts from the last Run().
+	struct OcclusionStats
+	{
+		UINT mOccluders;
+		UINT mTested;
+		UINT mOccluded;
+	};
+
+	OcclusionRasterizer(UINT width, UINT height, UINT maxOccluders = 2048);
+
+	// Draws the occluders among commands and writes the commands they do not hide
+	// to out (which must hold count entries), keeping their order. Returns the
+	// number written.
+	UINT Run(const XMFLOAT4X4& projection, const BrickOccupancy& occupancy, const DrawVoxelCommand* commands, UINT count,
+		DrawVoxelCommand* out, ThreadPool& pool);
+	void Run(const XMFLOAT4X4& projection, const BrickOccupancy& occupancy, const std::vector<DrawVoxelCommand>& commands,
+		std::vector<DrawVoxelCommand>& out, ThreadPool& pool);
+
+	const DepthPyramid& GetPyramid() const { return mPyramid; }
+
+	// Commands processed per second over the given number of runs.
+	double Benchmark(const XMFLOAT4X4& projection, const BrickOccupancy& occupancy, const std::vector<DrawVoxelCommand>& commands,
+		ThreadPool& pool, UINT iterations);
+
+	UINT			mMaxOccluders;
+	OcclusionStats	mStats;
+
+private:
+	// The convex outline of a brick as edge functions a * x + b * y + c, which
+	// are non-negative inside, and the pixels it could cover.
+	struct Occluder
+	{
+		float	mEdges[8][3];
+		UINT	mEdgeCount;
+		float	mDepth;
+		int		mMinX;
+		int		mMinY;
+		int		mMaxX;
+		int		mMaxY;
+	};
+
+	bool SetupOccluder(const XMFLOAT3* corners, Occluder& occluder) const;
+	void RasterizeTile(UINT tile);
+
+	OcclusionCuller					mCuller;
+	DepthPyramid					mPyramid;
+	UINT							mTilesX;
+	UINT							mTilesY;
+	std::vector<BrickScreenBounds>	mBounds;		// Per command.
+	std::vector<UINT8>				mFlags;			// Per command: projected, solid, occluded.
+	std::vector<UINT>				mCandidates;	// Commands that could occlude, nearest first.
+	std::vector<Occluder>			mOccluders;
+	std::vector<std::vector<UINT>>	mBins;			// Occluders overlapping each tile.
+};
@@ -0,0 +1,249 @@
+#include "stdafx.h"
+#include "RegionFile.h"
+#include "Compression.h"
+#include <chrono>
+
+static_assert(sizeof(RegionFileHeader) % sizeof(UINT64) == 0, "The group table after the header stays aligned.");
+
+// A group's table entries followed by the largest blocks its bricks can have.
+static const UINT MaxGroupWords = BricksPerCullGroup * (1 + VoxelsPerBrick);
+
+// The n-th brick of a cull group, counting x-fastest within the group.
+static inline UINT GetGroupBrick(UINT group, UINT n)
+{
+	const UINT groupX = group % cCullGroupsX;
+	const UINT groupY = (group / cCullGroupsX) % cCullGroupsY;
+	const UINT groupZ = group / (cCullGroupsX * cCullGroupsY);
+
+	const UINT x = n % CullGroupWidth;
+	const UINT y = (n / CullGroupWidth) % CullGroupWidth;
+	const UINT z = n / (CullGroupWidth * CullGroupWidth);
+	return GetBrickIndex(groupX * CullGroupWidth + x, groupY * CullGroupWidth + y, groupZ * CullGroupWidth + z);
+}
+
+bool RegionFileView::Open(const void* data, UINT64 size)
+{
+	mHeader = nullptr;
+	mGroups = nullptr;
+	mData = nullptr;
+
+	if (size < sizeof(RegionFileHeader))
+	{
+		return false;
+	}
+
+	const RegionFileHeader& header = *static_cast<const RegionFileHeader*>(data);
+	if (header.mMagic != RegionFileMagic || header.mVersion != RegionFileVersion || header.mHeaderSize != sizeof(RegionFileHeader) ||
+		header.mGroupCount != CullGroupCount || header.mGroupWidth != CullGroupWidth || header.mWidthInBricks != cWidthInBricks ||
+		header.mHeightInBricks != cHeightInBricks || header.mDepthInBricks != cDepthInBricks ||
+		header.mFileSize != size || header.mHeaderChecksum != HeaderChecksum(header))
+	{
+		return false;
+	}
+
+	const UINT64 groupsBytes = CullGroupCount * sizeof(RegionGroup);
+	if (header.mGroupsOffset % sizeof(UINT64) || header.mGroupsOffset < sizeof(RegionFileHeader) || header.mGroupsOffset + groupsBytes > size)
+	{
+		return false;
+	}
+
+	const UINT8* bytes = static_cast<const UINT8*>(data);
+	const RegionGroup* groups = reinterpret_cast<const RegionGroup*>(bytes + header.mGroupsOffset);
+	if (TileChecksum(groups, groupsBytes) != header.mGroupsChecksum)
+	{
+		return false;
+	}
+
+	// Groups are only decompressed when read, but their sizes are checked now so
+	// a read cannot run outside the file or the scratch space it decompresses to.
+	for (UINT group = 0; group < CullGroupCount; group++)
+	{
+		const RegionGroup& g = groups[group];
+		if (g.mOffset > size || g.mCompressedBytes > size - g.mOffset || g.mBytes % sizeof(UINT) ||
+			g.mBytes < BricksPerCullGroup * sizeof(UINT) || g.mBytes > MaxGroupWords * sizeof(UINT))
+		{
+			return false;
+		}
+	}
+
+	mHeader = &header;
+	mGroups = groups;
+	mData = bytes;
+	return true;
+}
+
+TileCoord RegionFileView::GetCoord() const
+{
+	TileCoord coord = { mHeader->mTileX, mHeader->mTileZ };
+	return coord;
+}
+
+bool RegionFileView::DecompressGroup(UINT group, UINT* words) const
+{
+	const RegionGroup& g = mGroups[group];
+	return LzDecompress(mData + g.mOffset, g.mCompressedBytes, words, g.mBytes) && TileChecksum(words, g.mBytes) == g.mChecksum;
+}
+
+bool RegionFileView::LoadGroup(UINT group, BrickPool& bricks) const
+{
+	UINT words[MaxGroupWords];
+	if (!IsOpen() || group >= CullGroupCount || !DecompressGroup(group, words))
+	{
+		return false;
+	}
+
+	// As with tile files, the entries are checked against the blocks even though
+	// the checksum matched.
+	const UINT* blocks = words + BricksPerCullGroup;
+	const UINT blockWords = mGroups[group].mBytes / sizeof(UINT) - BricksPerCullGroup;
+	for (UINT n = 0; n < BricksPerCullGroup; n++)
+	{
+		const UINT entry = words[n];
+		if (entry & UniformBrickFlag)
+		{
+			continue;
+		}
+
+		const UINT format = entry >> cBrickFormatShift;
+		if (format >= BrickFormatCount || (entry & cBrickOffsetMask) + BrickPool::BlockWords(static_cast<BrickFormat>(format)) > blockWords ||
+			!BrickPool::IsValidBlock(static_cast<BrickFormat>(format), blocks + (entry & cBrickOffsetMask)))
+		{
+			return false;
+		}
+	}
+
+	for (UINT n = 0; n < BricksPerCullGroup; n++)
+	{
+		const UINT entry = words[n];
+		bricks.WriteBlock(GetGroupBrick(group, n), entry, (entry & UniformBrickFlag) ? nullptr : blocks + (entry & cBrickOffsetMask));
+	}
+	return true;
+}
+
+bool RegionFileView::Load(BrickPool& bricks) const
+{
+	bricks.Clear();
+	for (UINT group = 0; group < CullGroupCount; group++)
+	{
+		if (!LoadGroup(group, bricks))
+		{
+			bricks.Clear();
+			return false;
+		}
+	}
+	return true;
+}
+
+double RegionFileView::Benchmark(const std::vector<UINT8>& image, UINT iterations)
+{
+	RegionFileView view;
+	if (!view.Open(image.data(), image.size()))
+	{
+		return 0.0;
+	}
+
+	std::vector<UINT> words(MaxGroupWords);
+	UINT64 bytes = 0;
+
+	auto start = std::chrono::high_resolution_clock::now();
+	for (UINT i = 0; i < iterations; i++)
+	{
+		for (UINT group = 0; group < CullGroupCount; group++)
+		{
+			const RegionGroup& g = view.mGroups[group];
+			LzDecompress(view.mData + g.mOffset, g.mCompressedBytes, words.data(), g.mBytes);
+			bytes += g.mBytes;
+		}
+	}
+	std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+	return bytes / elapsed.count();
+}
+
+void SerializeRegion(const TileCoord& coord, const BrickPool& bricks, std::vector<UINT8>& image)
+{
+	RegionFileHeader header = {};
+	header.mMagic = RegionFileMagic;
+	header.mVersion = RegionFileVersion;
+	header.mHeaderSize = sizeof(RegionFileHeader);
+	header.mGroupCount = CullGroupCount;
+	header.mGroupWidth = CullGroupWidth;
+	header.mWidthInBricks = cWidthInBricks;
+	header.mHeightInBricks = cHeightInBricks;
+	header.mDepthInBricks = cDepthInBricks;
+	header.mTileX = coord.mX;
+	header.mTileZ = coord.mZ;
+	header.mGroupsOffset = sizeof(RegionFileHeader);
+
+	const UINT64 groupsBytes = CullGroupCount * sizeof(RegionGroup);
+	std::vector<RegionGroup> groups(CullGroupCount);
+	image.assign(static_cast<size_t>(header.mGroupsOffset + groupsBytes), 0);
+
+	std::vector<UINT> words;
+	std::vector<UINT8> compressed(LzCompressBound(MaxGroupWords * sizeof(UINT)));
+	for (UINT group = 0; group < CullGroupCount; group++)
+	{
+		// The group's entries, then its blocks packed in the same order.
+		words.assign(BricksPerCullGroup, 0);
+		for (UINT n = 0; n < BricksPerCullGroup; n++)
+		{
+			const UINT brick = GetGroupBrick(group, n);
+			const UINT entry = bricks.mTable[brick];
+			if (entry & UniformBrickFlag)
+			{
+				words[n] = entry;
+				continue;
+			}
+
+			UINT wordCount;
+			const UINT* block = bricks.GetBlock(brick, wordCount);
+			words[n] = (entry & ~cBrickOffsetMask) | static_cast<UINT>(words.size() - BricksPerCullGroup);
+			words.insert(words.end(), block, block + wordCount);
+		}
+
+		RegionGroup& g = groups[group];
+		g.mOffset = image.size();
+		g.mBytes = static_cast<UINT>(words.size() * sizeof(UINT));
+		g.mCompressedBytes = LzCompress(words.data(), g.mBytes, compressed.data());
+		g.mChecksum = TileChecksum(words.data(), g.mBytes);
+		image.insert(image.end(), compressed.begin(), compressed.begin() + g.mCompressedBytes);
+	}
+
+	header.mFileSize = image.size();
+	header.mGroupsChecksum = TileChecksum(groups.data(), groupsBytes);
+	header.mHeaderChecksum = HeaderChecksum(header);
+
+	memcpy(&image[0], &header, sizeof(header));
+	memcpy(&image[static_cast<size_t>(header.mGroupsOffset)], groups.data(), static_cast<size_t>(groupsBytes));
+}
+
+std::wstring GetRegionFilePath(const std::wstring& directory, const TileCoord& coord)
+{
+	WCHAR name[64];
+	swprintf_s(name, L"tile_%d_%d.vxr", coord.mX, coord.mZ);
+	return directory + name;
+}
+
+bool WriteRegionFile(const std::wstring& path, const TileCoord& coord, const BrickPool& bricks)
+{
+	std::vector<UINT8> image;
+	SerializeRegion(coord, bricks, image);
+	return WriteFileImage(path, image);
+}
+
+bool MappedRegionFile::Open(const std::wstring& path)
+{
+	Close();
+	if (!mFile.Open(path) || !mView.Open(mFile.GetData(), mFile.GetSize()))
+	{
+		Close();
+		return false;
+	}
+	return true;
+}
+
+void MappedRegionFile::Close()
+{
+	mView = RegionFileView();
+	mFile.Close();
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <string>
+#include "Definitions.h"
+#include "BrickPool.h"
+#include "TileFile.h"
+
+// A tile archived with each cull group of CullGroupWidth^3 bricks compressed on
+// its own, so any group can be read back without touching the rest:
+//
+//	RegionFileHeader
+//	groups	CullGroupCount RegionGroups, in cull group order
+//	data	each group's compressed bytes, back to back
+//
+// A group decompresses, with LzDecompress, to the table entries of its bricks in
+// brick order within the group, their offsets relative to the group's blocks,
+// followed by those blocks. The header checksums itself and the group table;
+// each group records a checksum of its decompressed bytes, checked when the
+// group is read. Like tile files, regions of another version or volume size are
+// refused.
+static const UINT RegionFileMagic = 0x47525856;		// "VXRG"
+static const UINT RegionFileVersion = 1;
+
+struct RegionFileHeader
+{
+	UINT	mMagic;
+	UINT	mVersion;
+	UINT	mHeaderSize;		// sizeof(RegionFileHeader) when written.
+	UINT	mGroupCount;
+	UINT	mGroupWidth;		// In bricks.
+	UINT	mWidthInBricks;
+	UINT	mHeightInBricks;
+	UINT	mDepthInBricks;
+	int		mTileX;
+	int		mTileZ;
+	UINT64	mGroupsOffset;		// In bytes from the start of the file.
+	UINT64	mFileSize;
+	UINT64	mGroupsChecksum;
+	UINT64	mHeaderChecksum;	// Of the header with this field zero.
+};
+
+struct RegionGroup
+{
+	UINT64	mOffset;			// Of the compressed bytes, from the start of the file.
+	UINT	mCompressedBytes;
+	UINT	mBytes;				// Decompressed.
+	UINT64	mChecksum;			// TileChecksum of the decompressed bytes.
+};
+
+// The groups of a region file image in memory.
+class RegionFileView
+{
+public:
+	RegionFileView() :
+		mHeader(nullptr),
+		mGroups(nullptr),
+		mData(nullptr)
+	{}
+
+	// Checks the header and the group table, but not the groups themselves.
+	// Returns false when data does not hold a region of this version and volume
+	// size.
+	bool Open(const void* data, UINT64 size);
+
+	bool IsOpen() const { return mHeader != nullptr; }
+
+	TileCoord GetCoord() const;
+	const RegionGroup& GetGroup(UINT group) const { return mGroups[group]; }
+
+	// Decompresses one cull group into its bricks, leaving the others untouched.
+	// Returns false, leaving the group's bricks untouched, when it is damaged.
+	bool LoadGroup(UINT group, BrickPool& bricks) const;
+
+	// Replaces bricks with the whole region. Returns false, leaving bricks
+	// cleared, when any group is damaged.
+	bool Load(BrickPool& bricks) const;
+
+	// Bytes of groups decompressed per second, over the given number of passes
+	// over every group, without storing the bricks.
+	static double Benchmark(const std::vector<UINT8>& image, UINT iterations);
+
+private:
+	bool DecompressGroup(UINT group, UINT* words) const;
+
+	const RegionFileHeader*	mHeader;
+	const RegionGroup*		mGroups;
+	const UINT8*			mData;
+};
+
+// Writes the image of a region file.
+void SerializeRegion(const TileCoord& coord, const BrickPool& bricks, std::vector<UINT8>& image);
+
+// The name a region is saved under in directory, e.g. "tile_-1_2.vxr".
+std::wstring GetRegionFilePath(const std::wstring& directory, const TileCoord& coord);
+
+// Saves a region with WriteFileImage().
+bool WriteRegionFile(const std::wstring& path, const TileCoord& coord, const BrickPool& bricks);
+
+// A region file mapped read-only. The view stays valid until Close().
+class MappedRegionFile
+{
+public:
+	// Returns false when the file is missing or its header or group table are
+	// not valid.
+	bool Open(const std::wstring& path);
+	void Close();
+
+	const RegionFileView& GetView() const { return mView; }
+
+private:
+	MappedFile		mFile;
+	RegionFileView	mView;
+};
@@ -0,0 +1,447 @@
+#include "stdafx.h"
+#include "SaveJournal.h"
+#include "BrickOccupancy.h"
+#include "TileFile.h"
+#include <chrono>
+
+static_assert(sizeof(SaveJournalHeader) % sizeof(UINT) == 0 && sizeof(SaveJournalRecord) % sizeof(UINT) == 0,
+	"Records and their payloads stay uint aligned.");
+
+static SaveJournalHeader MakeHeader()
+{
+	SaveJournalHeader header = {};
+	header.mMagic = SaveJournalMagic;
+	header.mVersion = SaveJournalVersion;
+	header.mHeaderSize = sizeof(SaveJournalHeader);
+	header.mBrickCount = BrickCount;
+	header.mWidthInBricks = cWidthInBricks;
+	header.mHeightInBricks = cHeightInBricks;
+	header.mDepthInBricks = cDepthInBricks;
+	header.mHeaderChecksum = HeaderChecksum(header);
+	return header;
+}
+
+SaveJournal::SaveJournal() :
+	mMarked(BrickCount, 0),
+	mFile(INVALID_HANDLE_VALUE),
+	mLogBytes(0),
+	mSequence(0),
+	mWriting(false),
+	mFailed(false),
+	mQuit(false),
+	mStats()
+{
+}
+
+SaveJournal::~SaveJournal()
+{
+	Close();
+}
+
+bool SaveJournal::Open(const std::wstring& path, BrickPool& bricks, UINT& replayedBricks)
+{
+	Close();
+	replayedBricks = 0;
+
+	mFile = CreateFileW(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (mFile == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+
+	LARGE_INTEGER size;
+	bool opened = GetFileSizeEx(mFile, &size) != 0;
+	UINT64 validBytes = 0;
+	UINT recordCount = 0;
+
+	if (opened && size.QuadPart > 0)
+	{
+		// A log that is not ours is left alone rather than replaced.
+		std::vector<UINT8> image(static_cast<size_t>(size.QuadPart));
+		DWORD read = 0;
+		opened = ReadFile(mFile, image.data(), static_cast<DWORD>(image.size()), &read, nullptr) && read == image.size() &&
+			Replay(image.data(), image.size(), bricks, validBytes, recordCount, replayedBricks);
+	}
+	else if (opened)
+	{
+		const SaveJournalHeader header = MakeHeader();
+		DWORD written = 0;
+		opened = WriteFile(mFile, &header, sizeof(header), &written, nullptr) && written == sizeof(header) && FlushFileBuffers(mFile);
+		validBytes = sizeof(header);
+	}
+
+	// Cut any torn record, so new records follow the last valid one.
+	LARGE_INTEGER end;
+	end.QuadPart = static_cast<LONGLONG>(validBytes);
+	opened = opened && SetFilePointerEx(mFile, end, nullptr, FILE_BEGIN) && SetEndOfFile(mFile);
+	if (!opened)
+	{
+		CloseHandle(mFile);
+		mFile = INVALID_HANDLE_VALUE;
+		return false;
+	}
+
+	mLogBytes = validBytes;
+	mSequence = recordCount;
+	mWriting = false;
+	mFailed = false;
+	mQuit = false;
+	mStats = JournalStats();
+	mWriter = std::thread([this]() { WriterLoop(); });
+	return true;
+}
+
+void SaveJournal::Close()
+{
+	if (mWriter.joinable())
+	{
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			mQuit = true;
+		}
+		mWake.notify_all();
+		mWriter.join();
+	}
+
+	if (mFile != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(mFile);
+		mFile = INVALID_HANDLE_VALUE;
+	}
+}
+
+void SaveJournal::MarkBrick(UINT brick)
+{
+	if (!mMarked[brick])
+	{
+		mMarked[brick] = 1;
+		mMarkedBricks.push_back(brick);
+	}
+}
+
+void SaveJournal::Commit(const BrickPool& bricks)
+{
+	if (mMarkedBricks.empty())
+	{
+		return;
+	}
+
+	JournalBatch batch;
+	batch.mBricks.swap(mMarkedBricks);
+	for (UINT brick : batch.mBricks)
+	{
+		mMarked[brick] = 0;
+	}
+	bricks.CopyBricks(batch.mBricks.data(), static_cast<UINT>(batch.mBricks.size()), batch.mEntries, batch.mWords);
+
+	if (IsOpen())
+	{
+		Queue(std::move(batch));
+	}
+}
+
+void SaveJournal::Checkpoint(const BrickPool& bricks, const std::wstring& basePath)
+{
+	for (UINT brick : mMarkedBricks)
+	{
+		mMarked[brick] = 0;
+	}
+	mMarkedBricks.clear();
+
+	if (IsOpen())
+	{
+		JournalBatch batch;
+		batch.mCheckpoint.reset(new BrickPool(bricks));
+		batch.mBasePath = basePath;
+		Queue(std::move(batch));
+	}
+}
+
+void SaveJournal::Queue(JournalBatch&& batch)
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mStats.mCommittedBricks += batch.mBricks.size();
+		mQueue.push_back(std::move(batch));
+	}
+	mWake.notify_all();
+}
+
+void SaveJournal::Flush()
+{
+	std::unique_lock<std::mutex> lock(mMutex);
+	mDone.wait(lock, [this]() { return mQueue.empty() && !mWriting; });
+}
+
+bool SaveJournal::HasFailed() const
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mFailed;
+}
+
+SaveJournal::JournalStats SaveJournal::GetStats() const
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	return mStats;
+}
+
+void SaveJournal::WriterLoop()
+{
+	std::unique_lock<std::mutex> lock(mMutex);
+	for (;;)
+	{
+		mWake.wait(lock, [this]() { return mQuit || !mQueue.empty(); });
+		if (mQueue.empty())
+		{
+			return;
+		}
+
+		std::deque<JournalBatch> batches;
+		batches.swap(mQueue);
+		mWriting = true;
+		bool failed = mFailed;
+		lock.unlock();
+
+		// Batches are written together, with a checkpoint splitting them so the
+		// records before it reach the log first.
+		JournalStats pass = {};
+		std::vector<UINT8> out;
+		UINT records = 0;
+		UINT64 bricks = 0;
+		auto writeRecords = [&]()
+		{
+			if (records == 0)
+			{
+				return;
+			}
+			if (WriteAndFlush(out, records))
+			{
+				pass.mRecords += records;
+				pass.mWrittenBricks += bricks;
+				pass.mBytes += out.size();
+				pass.mWrites++;
+			}
+			else
+			{
+				pass.mFailures++;
+			}
+			out.clear();
+			records = 0;
+			bricks = 0;
+		};
+
+		for (const JournalBatch& batch : batches)
+		{
+			// Records appended after a failed checkpoint would be replayed onto
+			// a tile file they were never made against.
+			if (failed)
+			{
+				break;
+			}
+
+			if (batch.mCheckpoint)
+			{
+				writeRecords();
+				if (RunCheckpoint(batch))
+				{
+					pass.mCheckpoints++;
+				}
+				else
+				{
+					pass.mFailures++;
+					failed = true;
+				}
+				continue;
+			}
+
+			AppendRecord(batch, out);
+			records++;
+			bricks += batch.mBricks.size();
+		}
+		writeRecords();
+
+		lock.lock();
+		mStats.mWrittenBricks += pass.mWrittenBricks;
+		mStats.mRecords += pass.mRecords;
+		mStats.mWrites += pass.mWrites;
+		mStats.mBytes += pass.mBytes;
+		mStats.mCheckpoints += pass.mCheckpoints;
+		mStats.mFailures += pass.mFailures;
+		mFailed = failed;
+		mWriting = false;
+		mDone.notify_all();
+	}
+}
+
+void SaveJournal::AppendRecord(const JournalBatch& batch, std::vector<UINT8>& out)
+{
+	const UINT brickCount = static_cast<UINT>(batch.mBricks.size());
+	const UINT wordCount = static_cast<UINT>(batch.mWords.size());
+	const size_t payloadBytes = (2 * static_cast<size_t>(brickCount) + wordCount) * sizeof(UINT);
+
+	const size_t start = out.size();
+	out.resize(start + sizeof(SaveJournalRecord) + payloadBytes);
+
+	UINT8* payload = &out[start + sizeof(SaveJournalRecord)];
+	memcpy(payload, batch.mBricks.data(), brickCount * sizeof(UINT));
+	memcpy(payload + brickCount * sizeof(UINT), batch.mEntries.data(), brickCount * sizeof(UINT));
+	if (wordCount > 0)
+	{
+		memcpy(payload + 2 * brickCount * sizeof(UINT), batch.mWords.data(), wordCount * sizeof(UINT));
+	}
+
+	SaveJournalRecord record = {};
+	record.mMagic = SaveJournalRecordMagic;
+	record.mSequence = mSequence++;
+	record.mBrickCount = brickCount;
+	record.mWordCount = wordCount;
+	record.mPayloadChecksum = TileChecksum(payload, payloadBytes);
+	record.mHeaderChecksum = HeaderChecksum(record);
+	memcpy(&out[start], &record, sizeof(record));
+}
+
+bool SaveJournal::WriteAndFlush(const std::vector<UINT8>& out, UINT recordCount)
+{
+	DWORD written = 0;
+	if (WriteFile(mFile, out.data(), static_cast<DWORD>(out.size()), &written, nullptr) && written == out.size() && FlushFileBuffers(mFile))
+	{
+		mLogBytes += out.size();
+		return true;
+	}
+
+	// Cut whatever part reached the file, so later records still follow the last
+	// one written whole and replay does not stop short of them.
+	LARGE_INTEGER end;
+	end.QuadPart = static_cast<LONGLONG>(mLogBytes);
+	SetFilePointerEx(mFile, end, nullptr, FILE_BEGIN);
+	SetEndOfFile(mFile);
+	mSequence -= recordCount;
+	return false;
+}
+
+bool SaveJournal::RunCheckpoint(const JournalBatch& batch)
+{
+	BrickOccupancy occupancy;
+	occupancy.Build(*batch.mCheckpoint);
+
+	TileCoord origin = { 0, 0 };
+	if (!WriteTileFile(batch.mBasePath, origin, *batch.mCheckpoint, occupancy))
+	{
+		return false;
+	}
+
+	// Everything in the log is in the tile file now.
+	LARGE_INTEGER end;
+	end.QuadPart = sizeof(SaveJournalHeader);
+	if (!SetFilePointerEx(mFile, end, nullptr, FILE_BEGIN) || !SetEndOfFile(mFile) || !FlushFileBuffers(mFile))
+	{
+		return false;
+	}
+
+	mLogBytes = sizeof(SaveJournalHeader);
+	mSequence = 0;
+	return true;
+}
+
+bool SaveJournal::Replay(const UINT8* data, UINT64 size, BrickPool& bricks, UINT64& validBytes, UINT& recordCount, UINT& replayedBricks)
+{
+	validBytes = 0;
+	recordCount = 0;
+	replayedBricks = 0;
+
+	const SaveJournalHeader expected = MakeHeader();
+	if (size < sizeof(SaveJournalHeader) || memcmp(data, &expected, sizeof(expected)) != 0)
+	{
+		return false;
+	}
+
+	UINT64 offset = sizeof(SaveJournalHeader);
+	validBytes = offset;
+	while (size - offset >= sizeof(SaveJournalRecord))
+	{
+		SaveJournalRecord record;
+		memcpy(&record, data + offset, sizeof(record));
+		if (record.mMagic != SaveJournalRecordMagic || record.mHeaderChecksum != HeaderChecksum(record) || record.mSequence != recordCount ||
+			record.mBrickCount > BrickCount || record.mWordCount > record.mBrickCount * VoxelsPerBrick)
+		{
+			break;
+		}
+
+		const UINT64 payloadBytes = (2 * static_cast<UINT64>(record.mBrickCount) + record.mWordCount) * sizeof(UINT);
+		if (payloadBytes > size - offset - sizeof(record))
+		{
+			break;
+		}
+
+		const UINT* payload = reinterpret_cast<const UINT*>(data + offset + sizeof(record));
+		if (TileChecksum(payload, payloadBytes) != record.mPayloadChecksum)
+		{
+			break;
+		}
+
+		const UINT* brickIndices = payload;
+		const UINT* entries = payload + record.mBrickCount;
+		const UINT* words = entries + record.mBrickCount;
+
+		bool valid = true;
+		for (UINT n = 0; n < record.mBrickCount && valid; n++)
+		{
+			const UINT entry = entries[n];
+			const UINT format = entry >> cBrickFormatShift;
+			valid = brickIndices[n] < BrickCount && ((entry & UniformBrickFlag) ||
+				(format < BrickFormatCount && (entry & cBrickOffsetMask) + BrickPool::BlockWords(static_cast<BrickFormat>(format)) <= record.mWordCount &&
+				BrickPool::IsValidBlock(static_cast<BrickFormat>(format), words + (entry & cBrickOffsetMask))));
+		}
+		if (!valid)
+		{
+			break;
+		}
+
+		bricks.RestoreBricks(brickIndices, record.mBrickCount, entries, words);
+
+		replayedBricks += record.mBrickCount;
+		recordCount++;
+		offset += sizeof(record) + payloadBytes;
+		validBytes = offset;
+	}
+
+	return true;
+}
+
+SaveJournal::BenchmarkResult SaveJournal::Benchmark(const BrickPool& bricks, const std::wstring& path, UINT brickCount)
+{
+	BenchmarkResult result = {};
+	DeleteFileW(path.c_str());
+
+	SaveJournal journal;
+	BrickPool replayed;
+	UINT replayedBricks;
+	if (!journal.Open(path, replayed, replayedBricks))
+	{
+		return result;
+	}
+
+	auto start = std::chrono::high_resolution_clock::now();
+	UINT marked = 0;
+	for (UINT brick = 0; brick < BrickCount && marked < brickCount; brick++)
+	{
+		if (!bricks.IsUniform(brick))
+		{
+			journal.MarkBrick(brick);
+			marked++;
+		}
+	}
+	journal.Commit(bricks);
+	auto committed = std::chrono::high_resolution_clock::now();
+	journal.Flush();
+	auto flushed = std::chrono::high_resolution_clock::now();
+
+	result.mCommitSeconds = std::chrono::duration<double>(committed - start).count();
+	result.mWriteSeconds = std::chrono::duration<double>(flushed - start).count();
+	result.mBricks = marked;
+	result.mBytes = journal.GetStats().mBytes;
+
+	journal.Close();
+	DeleteFileW(path.c_str());
+	return result;
+}
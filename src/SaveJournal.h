@@ -0,0 +1,164 @@
+#pragma once
+
+#include <string>
+#include <memory>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "Definitions.h"
+#include "BrickPool.h"
+
+// An append-only log of edited bricks, written on a background thread so saving
+// never waits on the disk in OnUpdate() or OnRender():
+//
+//	SaveJournalHeader
+//	records	a SaveJournalRecord each, followed by mBrickCount brick indices, their
+//			mBrickCount table entries, offsets relative to the record's blocks,
+//			and mWordCount words of blocks
+//
+// Edited bricks are marked as they change. Commit() then copies the encoded
+// bricks, a few hundred bytes each at most, into a batch for the writer, which
+// is all the frame pays for. The writer appends every batch queued since its
+// last pass with one write and one flush. A record carries a sequence number and
+// checksums of itself and its payload, so a record torn by a crash is found and
+// dropped, with anything after it, when the log is next opened.
+//
+// The log holds the edits made since the last checkpoint. Checkpoint() queues a
+// full save of a copy of the volume as a tile file, after which the log starts
+// empty again; edits committed after the checkpoint follow it in the queue, so
+// none are lost. Replaying a log that a crash left behind a newer checkpoint
+// only repeats edits the tile file already holds. A checkpoint that fails leaves
+// a log that no longer matches the tile file, so the writer stops there and
+// drops everything queued after it until the journal is opened again.
+static const UINT SaveJournalMagic = 0x4e4a5856;		// "VXJN"
+static const UINT SaveJournalVersion = 1;
+static const UINT SaveJournalRecordMagic = 0x43524a56;	// "VJRC"
+
+struct SaveJournalHeader
+{
+	UINT	mMagic;
+	UINT	mVersion;
+	UINT	mHeaderSize;		// sizeof(SaveJournalHeader) when written.
+	UINT	mBrickCount;
+	UINT	mWidthInBricks;
+	UINT	mHeightInBricks;
+	UINT	mDepthInBricks;
+	UINT	mReserved;
+	UINT64	mHeaderChecksum;	// Of the header with this field zero.
+};
+
+struct SaveJournalRecord
+{
+	UINT	mMagic;
+	UINT	mSequence;			// 0 for the first record after the header.
+	UINT	mBrickCount;
+	UINT	mWordCount;
+	UINT64	mPayloadChecksum;
+	UINT64	mHeaderChecksum;	// Of the record with this field zero.
+};
+
+class SaveJournal
+{
+public:
+	struct JournalStats
+	{
+		UINT64	mCommittedBricks;	// Bricks handed to the writer.
+		UINT64	mWrittenBricks;		// Bricks on disk.
+		UINT64	mRecords;
+		UINT64	mWrites;			// Write and flush pairs; each covers one or more records.
+		UINT64	mBytes;
+		UINT64	mCheckpoints;
+		UINT64	mFailures;			// Writes, flushes or checkpoints that failed.
+	};
+
+	struct BenchmarkResult
+	{
+		double	mCommitSeconds;		// Spent in Commit(), on the calling thread.
+		double	mWriteSeconds;		// From Commit() until the writer had flushed.
+		UINT	mBricks;			// Fewer than asked for when bricks has fewer mixed bricks.
+		UINT64	mBytes;
+	};
+
+	SaveJournal();
+	~SaveJournal();
+
+	// Opens the log at path, creating it when missing, replays its records onto
+	// bricks and starts the writer. A damaged record, and everything after it, is
+	// cut from the log. replayedBricks counts the bricks written by the replay.
+	// Returns false, with the journal closed, when the log cannot be opened or
+	// belongs to a volume of another size.
+	bool Open(const std::wstring& path, BrickPool& bricks, UINT& replayedBricks);
+
+	// Writes anything queued, then stops the writer and closes the log.
+	void Close();
+
+	bool IsOpen() const { return mFile != INVALID_HANDLE_VALUE; }
+
+	// Records that a brick has changed since the last Commit().
+	void MarkBrick(UINT brick);
+
+	// Copies the marked bricks from bricks and queues them for the writer.
+	void Commit(const BrickPool& bricks);
+
+	// Queues a full save of a copy of bricks to basePath as a tile file, after
+	// which the log restarts. Marked bricks are covered by the copy.
+	void Checkpoint(const BrickPool& bricks, const std::wstring& basePath);
+
+	// Blocks until the writer has finished everything queued so far.
+	void Flush();
+
+	// True once a checkpoint has failed and the writer has stopped. The volume
+	// then has to be saved some other way and the log started over.
+	bool HasFailed() const;
+
+	JournalStats GetStats() const;
+
+	// Applies the records in a log image to bricks, stopping at the first record
+	// that is damaged, torn or out of sequence. Returns false when the image does
+	// not start with a valid header. validBytes is the length of the valid prefix
+	// and recordCount the number of records in it.
+	static bool Replay(const UINT8* data, UINT64 size, BrickPool& bricks, UINT64& validBytes, UINT& recordCount, UINT& replayedBricks);
+
+	// Commits brickCount of the mixed bricks of bricks to a scratch log at path,
+	// one brick per MarkBrick(), and waits for the writer. The log is deleted.
+	static BenchmarkResult Benchmark(const BrickPool& bricks, const std::wstring& path, UINT brickCount);
+
+private:
+	struct JournalBatch
+	{
+		std::vector<UINT>			mBricks;
+		std::vector<UINT>			mEntries;	// Offsets relative to mWords.
+		std::vector<UINT>			mWords;
+		std::unique_ptr<BrickPool>	mCheckpoint;
+		std::wstring				mBasePath;
+	};
+
+	SaveJournal(const SaveJournal&) = delete;
+	SaveJournal& operator=(const SaveJournal&) = delete;
+
+	void WriterLoop();
+	void AppendRecord(const JournalBatch& batch, std::vector<UINT8>& out);
+	bool WriteAndFlush(const std::vector<UINT8>& out, UINT recordCount);
+	bool RunCheckpoint(const JournalBatch& batch);
+	void Queue(JournalBatch&& batch);
+
+	// Used by the calling thread alone.
+	std::vector<UINT8>		mMarked;		// Per brick, set once listed in mMarkedBricks.
+	std::vector<UINT>		mMarkedBricks;
+
+	// Used by the writer alone while it runs.
+	HANDLE					mFile;
+	UINT64					mLogBytes;		// Up to the end of the last record written.
+	UINT					mSequence;		// Of the next record.
+
+	std::thread				mWriter;
+	mutable std::mutex		mMutex;
+	std::condition_variable	mWake;
+	std::condition_variable	mDone;
+	std::deque<JournalBatch>	mQueue;
+	bool					mWriting;		// The writer holds batches taken from mQueue.
+	bool					mFailed;		// A checkpoint failed; later batches are dropped.
+	bool					mQuit;
+	JournalStats			mStats;
+};
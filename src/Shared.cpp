@@ -1,5 +1,6 @@
 #include "stdafx.h"
 #include "Shared.h"
+#include "Terrain.h"
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
@@ -8,7 +9,7 @@ void SharedResources::CreateCounterReset()
 	ThrowIfFailed(mDevice->CreateCommittedResource(
 		&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD),
 		D3D12_HEAP_FLAG_NONE,
-		&CD3DX12_RESOURCE_DESC::Buffer(sizeof(UINT)),
+		&CD3DX12_RESOURCE_DESC::Buffer(DistanceBucketCount * 2 * sizeof(UINT)),
 		D3D12_RESOURCE_STATE_GENERIC_READ,
 		nullptr,
 		IID_PPV_ARGS(&mCounterReset)));
@@ -16,7 +17,7 @@ void SharedResources::CreateCounterReset()
 	UINT8* pMappedCounterReset = nullptr;
 	CD3DX12_RANGE readRange(0, 0);
 	ThrowIfFailed(mCounterReset->Map(0, &readRange, reinterpret_cast<void**>(&pMappedCounterReset)));
-	ZeroMemory(pMappedCounterReset, sizeof(UINT));
+	ZeroMemory(pMappedCounterReset, DistanceBucketCount * 2 * sizeof(UINT));
 	mCounterReset->Unmap(0, nullptr);
 }
 
@@ -64,11 +65,17 @@ void SharedResources::CreateCommands(ID3D12GraphicsCommandList* commandList)
 	commandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition( mCommands.Get(), D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE));
 }
 
-ComPtr<ID3D12Resource>  SharedResources::CreateVoxels()
+ComPtr<ID3D12Resource>  SharedResources::CreateVoxels(VoxelGenerator& generator)
 {
 	ComPtr<ID3D12Resource> Buffer;
 
-	const UINT constantBufferDataSize = VoxelCount * FrameCount * sizeof(Voxel);
+	generator.Generate(mVoxelPool, ThreadPool::Default());
+
+	// Each slot holds the brick table followed by the brick blocks, with room for
+	// edits to add mixed bricks.
+	const UINT wordCapacity = mVoxelPool.WordCount() + mVoxelPool.WordCount() / 4 + 256 * VoxelsPerBrick;
+	mVoxelSlotSize = BrickCount + wordCapacity;
+	const UINT constantBufferDataSize = mVoxelSlotSize * FrameCount * sizeof(UINT);
 
 	ThrowIfFailed(mDevice->CreateCommittedResource(
 		&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD),
@@ -80,61 +87,101 @@ ComPtr<ID3D12Resource>  SharedResources::CreateVoxels()
 
 		NAME_D3D12_OBJECT(Buffer);
 
-	for (int bz = 0; bz < cDepthInBricks; bz++)
 	{
-		for (int by = 0; by < cHeightInBricks; by++)
+		CD3DX12_RANGE readRange(0, 0);
+		ThrowIfFailed(Buffer->Map(0, &readRange, reinterpret_cast<void**>(&mMappedVoxels)));
+		memcpy(mMappedVoxels, &mVoxelPool.mTable[0], BrickCount * sizeof(UINT));
+		if (!mVoxelPool.mWords.empty())
 		{
-			for (int bx = 0; bx < cWidthInBricks; bx++)
-			{
-				for (int vz = 0; vz < cBrickDepth; vz++)
-				{
-					for (int vy = 0; vy < cBrickHeight; vy++)
-					{
-						for (int vx = 0; vx < cBrickWidth; vx++)
-						{
-							UINT brick = bz * (cWidthInBricks*cHeightInBricks) + by * cWidthInBricks + bx;
-							UINT voxel = vz * (cBrickWidth*cBrickHeight) + vy * cBrickWidth + vx;
-							UINT n = brick * VoxelsPerBrick + voxel;
-
-							UINT x = bx * cBrickWidth + vx;
-							UINT y = by * cBrickHeight + vy;
-							UINT z = bz * cBrickDepth + vz;
-
-							auto v0 = (cos((float)x / Width * 3.141f * 4.0f + 1.0f));
-							auto v1 = (sin((float)z / Depth * 3.141f * 4.0f + 1.0f));
-
-							auto v3 = (v0*v1) / 2.0f + 0.5f;
-							auto surface = v3*(Height / 1 - 1);
-							if (y < surface  && y >(surface - 6))
-							{
-								int tx = 13;  //rand() % 16;
-								int ty = 4 * 16; // rand() % 16;
-								tx += 6 * 256;
-								ty += 3 * (256 * 16);
-								mVoxelData[n].mMaterial = rand() % 65536; // tx + ty; //XMFLOAT2((float)tx / 16.0f, (float)ty / 16.0f);// , GetRandomFloat(0.0f, 1.0f), 1.0f);
-							}
-							else if (y < (surface - 2))
-							{
-								int tx = 2;  //rand() % 16;
-								int ty = 0; // rand() % 16;
-								mVoxelData[n].mMaterial = rand() % 65536; // tx + ty * 16; // XMFLOAT2((float)tx / 16.0f, (float)ty / 16.0f); // , GetRandomFloat(0.0f, 1.0f), 1.0f);
-							}
-							else
-							{
-								mVoxelData[n].mMaterial = 0; // XMFLOAT2(0, 0);
-							}
-						}
-					}
-				}
-			}
+			memcpy(mMappedVoxels + BrickCount, &mVoxelPool.mWords[0], mVoxelPool.mWords.size() * sizeof(UINT));
 		}
 	}
 
+	return Buffer;
+}
+
+ComPtr<ID3D12Resource> SharedResources::CreateBrickMasks()
+{
+	ComPtr<ID3D12Resource> Buffer;
+
+	const UINT brickMaskDataSize = BrickCount * FrameCount * sizeof(UINT64);
+
+	ThrowIfFailed(mDevice->CreateCommittedResource(
+		&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD),
+		D3D12_HEAP_FLAG_NONE,
+		&CD3DX12_RESOURCE_DESC::Buffer(brickMaskDataSize),
+		D3D12_RESOURCE_STATE_GENERIC_READ,
+		nullptr,
+		IID_PPV_ARGS(&Buffer)));
+
+	NAME_D3D12_OBJECT(Buffer);
+
+	mOccupancy.Build(mVoxelPool);
+
 	{
 		CD3DX12_RANGE readRange(0, 0);
-		ThrowIfFailed(Buffer->Map(0, &readRange, reinterpret_cast<void**>(&mMappedVoxels)));
-		const size_t size = VoxelCount * sizeof(Voxel);
-		memcpy(mMappedVoxels, &mVoxelData[0], size);
+		ThrowIfFailed(Buffer->Map(0, &readRange, reinterpret_cast<void**>(&mMappedBrickMasks)));
+		memcpy(mMappedBrickMasks, &mOccupancy.mMasks[0], BrickCount * sizeof(UINT64));
+	}
+
+	return Buffer;
+}
+
+ComPtr<ID3D12Resource> SharedResources::CreateFaces()
+{
+	ComPtr<ID3D12Resource> Buffer;
+
+	mBrickFaces.Build(mOccupancy);
+
+	// Each slot holds the face table followed by the face lists.
+	mFaceSlotSize = BrickCount + mBrickFaces.mLists.WordCount();
+	const UINT faceDataSize = mFaceSlotSize * FrameCount * sizeof(UINT);
+
+	ThrowIfFailed(mDevice->CreateCommittedResource(
+		&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD),
+		D3D12_HEAP_FLAG_NONE,
+		&CD3DX12_RESOURCE_DESC::Buffer(faceDataSize),
+		D3D12_RESOURCE_STATE_GENERIC_READ,
+		nullptr,
+		IID_PPV_ARGS(&Buffer)));
+
+	NAME_D3D12_OBJECT(Buffer);
+
+	{
+		CD3DX12_RANGE readRange(0, 0);
+		ThrowIfFailed(Buffer->Map(0, &readRange, reinterpret_cast<void**>(&mMappedFaces)));
+		memcpy(mMappedFaces, &mBrickFaces.mLists.mTable[0], BrickCount * sizeof(UINT));
+		if (!mBrickFaces.mLists.mWords.empty())
+		{
+			memcpy(mMappedFaces + BrickCount, &mBrickFaces.mLists.mWords[0], mBrickFaces.mLists.mWords.size() * sizeof(UINT));
+		}
+	}
+
+	return Buffer;
+}
+
+ComPtr<ID3D12Resource> SharedResources::CreateLods()
+{
+	ComPtr<ID3D12Resource> Buffer;
+
+	mMips.Build(mVoxelPool, ThreadPool::Default());
+
+	const UINT lodDataSize = BrickCount * VoxelMips::LodRecordWords * FrameCount * sizeof(UINT);
+
+	ThrowIfFailed(mDevice->CreateCommittedResource(
+		&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD),
+		D3D12_HEAP_FLAG_NONE,
+		&CD3DX12_RESOURCE_DESC::Buffer(lodDataSize),
+		D3D12_RESOURCE_STATE_GENERIC_READ,
+		nullptr,
+		IID_PPV_ARGS(&Buffer)));
+
+	NAME_D3D12_OBJECT(Buffer);
+
+	{
+		CD3DX12_RANGE readRange(0, 0);
+		ThrowIfFailed(Buffer->Map(0, &readRange, reinterpret_cast<void**>(&mMappedLods)));
+		memcpy(mMappedLods, &mMips.mRecords[0], mMips.mRecords.size() * sizeof(UINT));
 	}
 
 	return Buffer;
@@ -191,9 +238,12 @@ void SharedResources::CreateTexture(ID3D12GraphicsCommandList* commandList, std:
 }
 
 
-void SharedResources::Init(ID3D12GraphicsCommandList* commandList, std::string& filename )
+void SharedResources::Init(ID3D12GraphicsCommandList* commandList, std::string& filename, VoxelGenerator& generator )
 {
-	mVoxels = CreateVoxels();
+	mVoxels = CreateVoxels(generator);
+	mBrickMasks = CreateBrickMasks();
+	mFaces = CreateFaces();
+	mLods = CreateLods();
 	CreateTexture( commandList, filename );
 	CreateCommands( commandList );
 	CreateCounterReset();
@@ -4,33 +4,54 @@
 #include <memory>
 #include <functional>
 #include "Definitions.h"
+#include "BrickPool.h"
+#include "BrickOccupancy.h"
+#include "BrickFaces.h"
+#include "VoxelMips.h"
 #include "stb_image.h"
 
 using namespace DirectX;
 using Microsoft::WRL::ComPtr;
 
+class VoxelGenerator;
+
 class SharedResources
 {
 public:
 	SharedResources(ID3D12Device* device) :
 		mVoxels(),
+		mBrickMasks(),
+		mFaces(),
+		mLods(),
 		mTexture(),
 		mCommands(),
 		mCounterReset(),
+		mVoxelSlotSize(0),
+		mFaceSlotSize(0),
 		mDevice(device),
 		mTextureData(),
 		mTextureUpload(),
 		mCommandsUpload(),
-		mMappedVoxels(nullptr)
+		mMappedVoxels(nullptr),
+		mMappedBrickMasks(nullptr),
+		mMappedFaces(nullptr),
+		mMappedLods(nullptr)
 	{}
 
-	void Init(ID3D12GraphicsCommandList* commandList, std::string& filename);
+	// The voxels are filled by generator, which selects the world type.
+	void Init(ID3D12GraphicsCommandList* commandList, std::string& filename, VoxelGenerator& generator);
 
 	ComPtr<ID3D12Resource> mVoxels;
+	ComPtr<ID3D12Resource> mBrickMasks;
+	ComPtr<ID3D12Resource> mFaces;
+	ComPtr<ID3D12Resource> mLods;
 	ComPtr<ID3D12Resource> mTexture;
 	ComPtr<ID3D12Resource> mCommands;
 	ComPtr<ID3D12Resource> mCounterReset;
 
+	UINT mVoxelSlotSize;	// Elements per frame slot of mVoxels: the brick table, then blocks.
+	UINT mFaceSlotSize;		// Elements per frame slot of mFaces: the face table, then lists.
+
 private:
 
 	template<typename T>
@@ -38,17 +59,26 @@ private:
 
 	ID3D12Device*					mDevice;
 
-	std::vector<Voxel>				mVoxelData;
+	BrickPool						mVoxelPool;
+	BrickOccupancy					mOccupancy;
+	BrickFaces						mBrickFaces;
+	VoxelMips						mMips;
 	std::vector<DrawVoxelCommand>	mCommandsData;
 	deleted_unique_ptr<stbi_uc>		mTextureData;
 
 	ComPtr<ID3D12Resource>			mTextureUpload;
 	ComPtr<ID3D12Resource>			mCommandsUpload;
 
-	Voxel*							mMappedVoxels;
+	UINT*							mMappedVoxels;
+	UINT64*							mMappedBrickMasks;
+	UINT*							mMappedFaces;
+	UINT*							mMappedLods;
 
 	void							CreateCounterReset();
 	void							CreateCommands(ID3D12GraphicsCommandList* commandList);
 	void							CreateTexture(ID3D12GraphicsCommandList* commandList, std::string& filename);
-	ComPtr<ID3D12Resource>			CreateVoxels();
+	ComPtr<ID3D12Resource>			CreateVoxels(VoxelGenerator& generator);
+	ComPtr<ID3D12Resource>			CreateBrickMasks();
+	ComPtr<ID3D12Resource>			CreateFaces();
+	ComPtr<ID3D12Resource>			CreateLods();
 };
\ No newline at end of file
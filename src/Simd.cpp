@@ -0,0 +1,68 @@
+#include "stdafx.h"
+#include "Simd.h"
+#if !defined(_MSC_VER)
+#include <cpuid.h>
+#endif
+
+static void Cpuid(UINT leaf, UINT subleaf, UINT registers[4])
+{
+#if defined(_MSC_VER)
+	int values[4];
+	__cpuidex(values, static_cast<int>(leaf), static_cast<int>(subleaf));
+	memcpy(registers, values, sizeof(values));
+#else
+	if (!__get_cpuid_count(leaf, subleaf, &registers[0], &registers[1], &registers[2], &registers[3]))
+	{
+		registers[0] = registers[1] = registers[2] = registers[3] = 0;
+	}
+#endif
+}
+
+// The register state the OS saves on a context switch, from XCR0.
+static UINT64 GetEnabledXState()
+{
+#if defined(_MSC_VER)
+	return _xgetbv(0);
+#else
+	UINT low, high;
+	__asm__("xgetbv" : "=a"(low), "=d"(high) : "c"(0));
+	return (static_cast<UINT64>(high) << 32) | low;
+#endif
+}
+
+static SimdLevel DetectSimdLevel()
+{
+	UINT registers[4];
+	Cpuid(0, 0, registers);
+	const UINT maxLeaf = registers[0];
+
+	// SSE2 is part of x64; AVX2 needs the CPU flag, and the OS saving the YMM
+	// registers as well as the XMM ones.
+	Cpuid(1, 0, registers);
+	const bool osxsave = (registers[2] & (1u << 27)) != 0;
+	const bool avx = (registers[2] & (1u << 28)) != 0;
+	if (maxLeaf < 7 || !osxsave || !avx || (GetEnabledXState() & 6) != 6)
+	{
+		return SimdSse2;
+	}
+
+	Cpuid(7, 0, registers);
+	return (registers[1] & (1u << 5)) ? SimdAvx2 : SimdSse2;
+}
+
+SimdLevel GetCpuSimdLevel()
+{
+	static const SimdLevel level = DetectSimdLevel();
+	return level;
+}
+
+const char* GetSimdLevelName(SimdLevel level)
+{
+	switch (level)
+	{
+		case SimdScalar:	return "scalar";
+		case SimdSse2:		return "SSE2";
+		case SimdAvx2:		return "AVX2";
+		default:			return "unknown";
+	}
+}
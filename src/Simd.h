@@ -0,0 +1,34 @@
+#pragma once
+
+#include "VoxelTypes.h"
+
+// Instruction sets the CPU passes choose between at run time. The sample is
+// built for the x64 baseline, SSE2, so __AVX2__ is never defined; kernels that
+// need AVX2 are compiled for it one function at a time with AVX2_FUNCTION and
+// only called once the CPU and OS are known to support it.
+enum SimdLevel
+{
+	SimdScalar,		// Plain C++, the reference the other paths are checked against.
+	SimdSse2,
+	SimdAvx2
+};
+
+// The highest level the CPU and OS support, detected on the first call.
+SimdLevel GetCpuSimdLevel();
+
+// The requested level, lowered to what the CPU supports.
+static inline SimdLevel GetSimdLevel(SimdLevel requested)
+{
+	const SimdLevel supported = GetCpuSimdLevel();
+	return requested < supported ? requested : supported;
+}
+
+const char* GetSimdLevelName(SimdLevel level);
+
+// MSVC compiles AVX2 intrinsics in any function; GCC and Clang need the target
+// named on each function that uses them, including inline helpers.
+#if defined(_MSC_VER) && !defined(__clang__)
+#define AVX2_FUNCTION
+#else
+#define AVX2_FUNCTION __attribute__((target("avx2")))
+#endif
@@ -0,0 +1,385 @@
+#include "stdafx.h"
+#include "Terrain.h"
+#include <immintrin.h>
+#include <chrono>
+
+// Counter based hash (lowbias32) so every voxel's value depends only on its index.
+static inline UINT Hash(UINT x)
+{
+	x ^= x >> 16;
+	x *= 0x7feb352d;
+	x ^= x >> 15;
+	x *= 0x846ca68b;
+	x ^= x >> 16;
+	return x;
+}
+
+// Terms of the sine series used at every SIMD level, which fold their argument
+// into [-pi/2, pi/2] first; the x^11 term keeps the error near 1e-7 there.
+static const float SinC3 = -1.0f / 6.0f;
+static const float SinC5 = 1.0f / 120.0f;
+static const float SinC7 = -1.0f / 5040.0f;
+static const float SinC9 = 1.0f / 362880.0f;
+static const float SinC11 = -1.0f / 39916800.0f;
+
+static const float TwoPi = 6.28318530718f;
+static const float HalfPi = 1.57079632679f;
+
+static const float Pi = 3.14159265359f;
+
+// The scalar form of SinPs. Every level evaluates the same operations in the same
+// order (and contraction into FMA is off), so the heights come out bit-exact
+// whichever path the host CPU takes; cosf/sinf would round differently.
+static inline float SinSeries(float x)
+{
+	// nearbyintf rounds to nearest even, as _mm_cvtps_epi32 and _mm256_round_ps do.
+	float turns = nearbyintf(x * (1.0f / TwoPi));
+	x = x - turns * TwoPi;
+	if (fabsf(x) > HalfPi)
+	{
+		x = copysignf(Pi, x) - x;
+	}
+
+	float x2 = x * x;
+	float p = SinC11;
+	p = p * x2 + SinC9;
+	p = p * x2 + SinC7;
+	p = p * x2 + SinC5;
+	p = p * x2 + SinC3;
+	p = p * x2 + 1.0f;
+	return p * x;
+}
+
+static inline AVX2_FUNCTION __m256 SinPs(__m256 x)
+{
+	const __m256 signMask = _mm256_set1_ps(-0.0f);
+	const __m256 pi = _mm256_set1_ps(Pi);
+
+	// Reduce to [-pi, pi], then reflect through +-pi/2 using sin(x) = sin(+-pi - x).
+	__m256 turns = _mm256_round_ps(_mm256_mul_ps(x, _mm256_set1_ps(1.0f / TwoPi)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+	x = _mm256_sub_ps(x, _mm256_mul_ps(turns, _mm256_set1_ps(TwoPi)));
+	__m256 reflected = _mm256_sub_ps(_mm256_or_ps(pi, _mm256_and_ps(x, signMask)), x);
+	__m256 outside = _mm256_cmp_ps(_mm256_andnot_ps(signMask, x), _mm256_set1_ps(HalfPi), _CMP_GT_OQ);
+	x = _mm256_blendv_ps(x, reflected, outside);
+
+	__m256 x2 = _mm256_mul_ps(x, x);
+	__m256 p = _mm256_set1_ps(SinC11);
+	p = _mm256_add_ps(_mm256_mul_ps(p, x2), _mm256_set1_ps(SinC9));
+	p = _mm256_add_ps(_mm256_mul_ps(p, x2), _mm256_set1_ps(SinC7));
+	p = _mm256_add_ps(_mm256_mul_ps(p, x2), _mm256_set1_ps(SinC5));
+	p = _mm256_add_ps(_mm256_mul_ps(p, x2), _mm256_set1_ps(SinC3));
+	p = _mm256_add_ps(_mm256_mul_ps(p, x2), _mm256_set1_ps(1.0f));
+	return _mm256_mul_ps(p, x);
+}
+
+static inline AVX2_FUNCTION __m256i HashEpi32(__m256i x)
+{
+	x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 16));
+	x = _mm256_mullo_epi32(x, _mm256_set1_epi32(0x7feb352d));
+	x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 15));
+	x = _mm256_mullo_epi32(x, _mm256_set1_epi32(static_cast<int>(0x846ca68b)));
+	x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 16));
+	return x;
+}
+
+static inline __m128 SinPs(__m128 x)
+{
+	const __m128 signMask = _mm_set1_ps(-0.0f);
+	const __m128 pi = _mm_set1_ps(Pi);
+
+	// SSE2 has no round or blend; convert with the default round-to-nearest mode
+	// and select with masks instead.
+	__m128 turns = _mm_cvtepi32_ps(_mm_cvtps_epi32(_mm_mul_ps(x, _mm_set1_ps(1.0f / TwoPi))));
+	x = _mm_sub_ps(x, _mm_mul_ps(turns, _mm_set1_ps(TwoPi)));
+	__m128 reflected = _mm_sub_ps(_mm_or_ps(pi, _mm_and_ps(x, signMask)), x);
+	__m128 outside = _mm_cmpgt_ps(_mm_andnot_ps(signMask, x), _mm_set1_ps(HalfPi));
+	x = _mm_or_ps(_mm_and_ps(outside, reflected), _mm_andnot_ps(outside, x));
+
+	__m128 x2 = _mm_mul_ps(x, x);
+	__m128 p = _mm_set1_ps(SinC11);
+	p = _mm_add_ps(_mm_mul_ps(p, x2), _mm_set1_ps(SinC9));
+	p = _mm_add_ps(_mm_mul_ps(p, x2), _mm_set1_ps(SinC7));
+	p = _mm_add_ps(_mm_mul_ps(p, x2), _mm_set1_ps(SinC5));
+	p = _mm_add_ps(_mm_mul_ps(p, x2), _mm_set1_ps(SinC3));
+	p = _mm_add_ps(_mm_mul_ps(p, x2), _mm_set1_ps(1.0f));
+	return _mm_mul_ps(p, x);
+}
+
+// Number of voxels in a column that lie below the surface, i.e. with y < surface.
+static inline UINT SolidCount(float surface)
+{
+	if (surface <= 0.0f)
+	{
+		return 0;
+	}
+	UINT count = static_cast<UINT>(ceilf(surface));
+	return count > Height ? Height : count;
+}
+
+UINT VoxelGenerator::Material(UINT voxelIndex) const
+{
+	// Scale the top 16 bits of the hash onto [1, 65535]; zero would punch a hole
+	// in the ground.
+	return 1 + (((Hash(voxelIndex ^ Hash(mSeed)) >> 16) * 65535) >> 16);
+}
+
+void VoxelGenerator::Generate(Voxel* voxels, ThreadPool& pool)
+{
+	Prepare(pool);
+
+	// One job per row of bricks along x.
+	pool.ParallelFor(cHeightInBricks * cDepthInBricks, [this, voxels](UINT row)
+	{
+		const UINT first = row * cWidthInBricks;
+		for (UINT brick = first; brick < first + cWidthInBricks; brick++)
+		{
+			GenerateBrick(brick, voxels + brick * VoxelsPerBrick);
+		}
+	});
+}
+
+void VoxelGenerator::Generate(BrickPool& bricks, ThreadPool& pool)
+{
+	Prepare(pool);
+	bricks.Clear();
+
+	// Uniform bricks go straight into the table, which rows share without
+	// overlapping. Mixed bricks are held per row and added to the pool in order.
+	const UINT rowCount = cHeightInBricks * cDepthInBricks;
+	std::vector<std::vector<Voxel>> mixedVoxels(rowCount);
+	std::vector<std::vector<UINT>> mixedBricks(rowCount);
+
+	pool.ParallelFor(rowCount, [this, &bricks, &mixedVoxels, &mixedBricks](UINT row)
+	{
+		Voxel voxels[VoxelsPerBrick];
+		const UINT first = row * cWidthInBricks;
+		for (UINT brick = first; brick < first + cWidthInBricks; brick++)
+		{
+			GenerateBrick(brick, voxels);
+
+			UINT material;
+			if (BrickPool::IsUniform(voxels, material))
+			{
+				bricks.mTable[brick] = UniformBrickFlag | material;
+			}
+			else
+			{
+				mixedBricks[row].push_back(brick);
+				mixedVoxels[row].insert(mixedVoxels[row].end(), voxels, voxels + VoxelsPerBrick);
+			}
+		}
+	});
+
+	for (UINT row = 0; row < rowCount; row++)
+	{
+		for (size_t i = 0; i < mixedBricks[row].size(); i++)
+		{
+			bricks.WriteBrick(mixedBricks[row][i], &mixedVoxels[row][i * VoxelsPerBrick]);
+		}
+		std::vector<Voxel>().swap(mixedVoxels[row]);
+	}
+}
+
+double VoxelGenerator::Benchmark(ThreadPool& pool, UINT iterations)
+{
+	std::vector<Voxel> voxels(VoxelCount);
+
+	auto start = std::chrono::high_resolution_clock::now();
+	for (UINT i = 0; i < iterations; i++)
+	{
+		Generate(&voxels[0], pool);
+	}
+	std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+	return (double(VoxelCount) * iterations) / elapsed.count();
+}
+
+void HeightfieldGenerator::Prepare(ThreadPool& pool)
+{
+	pool.ParallelFor(Depth, [this](UINT z) { GenerateHeights(z, &mHeights[z * Width]); });
+}
+
+void HeightfieldGenerator::GenerateBrick(UINT brick, Voxel* out) const
+{
+	const XMUINT3 b = GetBrickCoords(brick);
+	UINT solidCounts[cBrickWidth];
+
+	for (UINT vz = 0; vz < cBrickDepth; vz++)
+	{
+		const float* heights = &mHeights[(b.z * cBrickDepth + vz) * Width + b.x * cBrickWidth];
+		for (UINT vx = 0; vx < cBrickWidth; vx++)
+		{
+			solidCounts[vx] = SolidCount(heights[vx]);
+		}
+
+		const UINT offset = vz * (cBrickWidth*cBrickHeight);
+		FillBrickRows(out + offset, brick * VoxelsPerBrick + offset, b.y * cBrickHeight, solidCounts);
+	}
+}
+
+// The terms shared by every column of row z: the height is v0 * scale + offset.
+static inline float RowScale(UINT z)
+{
+	const float v1 = SinSeries(static_cast<float>(z) / Depth * 3.141f * 4.0f + 1.0f);
+	return v1 * 0.5f * (Height - 1);
+}
+
+static const float RowOffset = 0.5f * (Height - 1);
+
+float TerrainGenerator::ColumnHeight(UINT x, UINT z) const
+{
+	// cos(a) as sin(a + pi/2), as the SIMD kernels compute it.
+	const float angle = static_cast<float>(x) / Width * 3.141f * 4.0f + 1.0f;
+	const float v0 = SinSeries(angle + HalfPi);
+	return v0 * RowScale(z) + RowOffset;
+}
+
+void TerrainGenerator::GenerateHeightsScalar(UINT z, float* heights) const
+{
+	for (UINT x = 0; x < Width; x++)
+	{
+		heights[x] = ColumnHeight(x, z);
+	}
+}
+
+// The z term is the same for the whole row, so only the x term is vectorised.
+void TerrainGenerator::GenerateHeightsSse2(UINT z, float* heights) const
+{
+	static_assert(Width % 4 == 0, "Rows are generated four columns at a time.");
+	const __m128 scale = _mm_set1_ps(RowScale(z));
+	const __m128 offset = _mm_set1_ps(RowOffset);
+	for (UINT x = 0; x < Width; x += 4)
+	{
+		__m128 fx = _mm_cvtepi32_ps(_mm_add_epi32(_mm_set1_epi32(x), _mm_setr_epi32(0, 1, 2, 3)));
+		__m128 angle = _mm_div_ps(fx, _mm_set1_ps(static_cast<float>(Width)));
+		angle = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(angle, _mm_set1_ps(3.141f)), _mm_set1_ps(4.0f)), _mm_set1_ps(1.0f));
+		__m128 v0 = SinPs(_mm_add_ps(angle, _mm_set1_ps(HalfPi)));
+		_mm_storeu_ps(heights + x, _mm_add_ps(_mm_mul_ps(v0, scale), offset));
+	}
+}
+
+AVX2_FUNCTION void TerrainGenerator::GenerateHeightsAvx2(UINT z, float* heights) const
+{
+	static_assert(Width % 8 == 0, "Rows are generated eight columns at a time.");
+	const __m256 scale = _mm256_set1_ps(RowScale(z));
+	const __m256 offset = _mm256_set1_ps(RowOffset);
+	for (UINT x = 0; x < Width; x += 8)
+	{
+		__m256 fx = _mm256_cvtepi32_ps(_mm256_add_epi32(_mm256_set1_epi32(x), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7)));
+		__m256 angle = _mm256_div_ps(fx, _mm256_set1_ps(static_cast<float>(Width)));
+		angle = _mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(angle, _mm256_set1_ps(3.141f)), _mm256_set1_ps(4.0f)), _mm256_set1_ps(1.0f));
+		__m256 v0 = SinPs(_mm256_add_ps(angle, _mm256_set1_ps(HalfPi)));
+		_mm256_storeu_ps(heights + x, _mm256_add_ps(_mm256_mul_ps(v0, scale), offset));
+	}
+}
+
+void TerrainGenerator::GenerateHeights(UINT z, float* heights) const
+{
+	switch (GetSimdLevel(mSimd))
+	{
+		case SimdAvx2:	GenerateHeightsAvx2(z, heights); break;
+		case SimdSse2:	GenerateHeightsSse2(z, heights); break;
+		default:		GenerateHeightsScalar(z, heights); break;
+	}
+}
+
+// Fills one z row of a brick (cBrickHeight rows of cBrickWidth voxels, stored
+// contiguously) given the solid count of each of its columns.
+void HeightfieldGenerator::FillBrickRows(Voxel* out, UINT firstIndex, UINT y0, const UINT* solidCounts) const
+{
+	static_assert(cBrickWidth == 4 && cBrickHeight == 4, "Brick rows are filled as four columns of four voxels.");
+
+	UINT lowest = solidCounts[0];
+	UINT highest = solidCounts[0];
+	for (UINT vx = 1; vx < cBrickWidth; vx++)
+	{
+		lowest = solidCounts[vx] < lowest ? solidCounts[vx] : lowest;
+		highest = solidCounts[vx] > highest ? solidCounts[vx] : highest;
+	}
+
+	// Above the surface in every column: a run of air.
+	if (highest <= y0)
+	{
+		memset(out, 0, cBrickWidth * cBrickHeight * sizeof(Voxel));
+		return;
+	}
+
+	if (mLayered)
+	{
+		for (UINT vy = 0; vy < cBrickHeight; vy++)
+		{
+			for (UINT vx = 0; vx < cBrickWidth; vx++)
+			{
+				const UINT y = y0 + vy;
+				UINT material = 0;
+				if (y < solidCounts[vx])
+				{
+					const UINT depth = solidCounts[vx] - 1 - y;
+					material = depth == 0 ? GrassMaterial : (depth < 4 ? DirtMaterial : StoneMaterial);
+				}
+				out[vy * cBrickWidth + vx].mMaterial = material;
+			}
+		}
+		return;
+	}
+
+	if (GetSimdLevel(mSimd) >= SimdAvx2)
+	{
+		FillHashedRowsAvx2(out, firstIndex, y0, solidCounts, lowest >= y0 + cBrickHeight);
+		return;
+	}
+
+	for (UINT vy = 0; vy < cBrickHeight; vy++)
+	{
+		for (UINT vx = 0; vx < cBrickWidth; vx++)
+		{
+			const UINT n = vy * cBrickWidth + vx;
+			out[n].mMaterial = (y0 + vy) < solidCounts[vx] ? Material(firstIndex + n) : 0;
+		}
+	}
+}
+
+// The hashed rows of FillBrickRows, eight voxels at a time. solid is set when
+// every voxel of the rows lies below the surface.
+AVX2_FUNCTION void HeightfieldGenerator::FillHashedRowsAvx2(Voxel* out, UINT firstIndex, UINT y0, const UINT* solidCounts, bool solid) const
+{
+	static_assert(sizeof(Voxel) == sizeof(UINT), "Materials are stored as packed 32 bit values.");
+	const __m128i counts = _mm_loadu_si128(reinterpret_cast<const __m128i*>(solidCounts));
+	const __m256i columnCounts = _mm256_broadcastsi128_si256(counts);
+	const __m256i seed = _mm256_set1_epi32(Hash(mSeed));
+	const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+	// Two rows of four voxels per step.
+	for (UINT vy = 0; vy < cBrickHeight; vy += 2)
+	{
+		__m256i index = _mm256_add_epi32(_mm256_set1_epi32(firstIndex + vy * cBrickWidth), lanes);
+		__m256i h = _mm256_srli_epi32(HashEpi32(_mm256_xor_si256(index, seed)), 16);
+		__m256i material = _mm256_add_epi32(_mm256_srli_epi32(_mm256_mullo_epi32(h, _mm256_set1_epi32(65535)), 16), _mm256_set1_epi32(1));
+		if (!solid)
+		{
+			__m256i y = _mm256_setr_epi32(y0 + vy, y0 + vy, y0 + vy, y0 + vy, y0 + vy + 1, y0 + vy + 1, y0 + vy + 1, y0 + vy + 1);
+			material = _mm256_and_si256(material, _mm256_cmpgt_epi32(columnCounts, y));
+		}
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + vy * cBrickWidth), material);
+	}
+}
+
+float TerrainGenerator::MaxHeightError() const
+{
+	std::vector<float> scalar(Width);
+	std::vector<float> simd(Width);
+	float maxError = 0.0f;
+
+	for (UINT z = 0; z < Depth; z++)
+	{
+		GenerateHeightsScalar(z, &scalar[0]);
+		GenerateHeights(z, &simd[0]);
+		for (UINT x = 0; x < Width; x++)
+		{
+			float error = fabsf(scalar[x] - simd[x]);
+			maxError = error > maxError ? error : maxError;
+		}
+	}
+
+	return maxError;
+}
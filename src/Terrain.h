@@ -0,0 +1,119 @@
+#pragma once
+
+#include "VoxelTypes.h"
+#include "ThreadPool.h"
+#include "BrickPool.h"
+#include "Simd.h"
+
+// Materials for layered worlds. The low byte picks the tile in the sample's
+// texture atlas; these are the values its original generation loop had commented
+// out in favour of random materials.
+static const UINT GrassMaterial = 13901;
+static const UINT DirtMaterial = 2;
+static const UINT StoneMaterial = 1;
+
+// Interface for anything that can fill the dense voxel volume. Work is chunked by
+// brick: GenerateBrick depends only on the brick index (and whatever Prepare
+// computed), so bricks can be produced in any order, on any thread, or one at a
+// time as they are streamed in. Materials come from a hash of the seed and voxel
+// index rather than rand(), so the same seed produces the same volume whatever
+// the thread count.
+class VoxelGenerator
+{
+public:
+	VoxelGenerator(UINT seed) :
+		mSeed(seed),
+		mOriginX(0),
+		mOriginZ(0)
+	{}
+	virtual ~VoxelGenerator() {}
+
+	// Computes data shared between bricks. Must be called before GenerateBrick.
+	virtual void Prepare(ThreadPool& pool) {}
+
+	// Fills the VoxelsPerBrick voxels of one brick, starting at out.
+	virtual void GenerateBrick(UINT brick, Voxel* out) const = 0;
+
+	// Prepares, then generates rows of bricks across the pool.
+	void Generate(Voxel* voxels, ThreadPool& pool);
+
+	// As above, but straight into sparse storage without a dense copy of the
+	// volume. Blocks are allocated in brick order, so the layout is the same
+	// whatever the thread count.
+	void Generate(BrickPool& bricks, ThreadPool& pool);
+
+	UINT Material(UINT voxelIndex) const;
+
+	// Voxels generated per second over the given number of full volumes.
+	double Benchmark(ThreadPool& pool, UINT iterations);
+
+	UINT				mSeed;
+
+	// World position of the volume's first voxel along x and z, so that one
+	// generator can fill any tile of a world larger than the volume. Set it
+	// before Prepare.
+	int					mOriginX;
+	int					mOriginZ;
+};
+
+// Base for worlds defined by a surface height per (x, z) column, with everything
+// below the surface solid. Prepare evaluates the height of every column once;
+// bricks are then filled from per-column solid counts.
+class HeightfieldGenerator : public VoxelGenerator
+{
+public:
+	HeightfieldGenerator(UINT seed) :
+		VoxelGenerator(seed),
+		mSimd(GetCpuSimdLevel()),
+		mLayered(false),
+		mHeights(Width * Depth)
+	{}
+
+	void Prepare(ThreadPool& pool) override;
+	void GenerateBrick(UINT brick, Voxel* out) const override;
+
+	// Surface heights for one row of columns, in voxels.
+	virtual void GenerateHeights(UINT z, float* heights) const = 0;
+
+	// The widest kernels to use. With AVX2 the material hash for brick rows is
+	// vectorised; SSE2 has no 32 bit multiply, so below that it stays scalar.
+	SimdLevel			mSimd;
+
+	// When set, columns get a grass surface over dirt over stone instead of
+	// hashed materials, so most bricks underground are uniform.
+	bool				mLayered;
+
+protected:
+	void FillBrickRows(Voxel* out, UINT firstIndex, UINT y0, const UINT* solidCounts) const;
+	void FillHashedRowsAvx2(Voxel* out, UINT firstIndex, UINT y0, const UINT* solidCounts, bool solid) const;
+
+	std::vector<float>	mHeights;	// Surface height per column, indexed z * Width + x.
+};
+
+// The sample's rolling terrain: a cos/sin heightfield. Its periods divide the
+// volume, so every tile of a larger world is the same and the origin is ignored.
+//
+// Heights come from a polynomial sine kernel, one column at a time at SimdScalar,
+// four with SSE2 and eight with AVX2. Every level runs the same operations in the
+// same order, so the heights, and the worlds generated and saved from them, do
+// not depend on the host CPU.
+class TerrainGenerator : public HeightfieldGenerator
+{
+public:
+	TerrainGenerator(UINT seed = 1) :
+		HeightfieldGenerator(seed)
+	{}
+
+	void GenerateHeights(UINT z, float* heights) const override;
+
+	float ColumnHeight(UINT x, UINT z) const;
+
+	// Largest difference between the heightfields at mSimd and the scalar ones;
+	// zero unless the kernels have drifted apart.
+	float MaxHeightError() const;
+
+private:
+	void GenerateHeightsScalar(UINT z, float* heights) const;
+	void GenerateHeightsSse2(UINT z, float* heights) const;
+	void GenerateHeightsAvx2(UINT z, float* heights) const;
+};
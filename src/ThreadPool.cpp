@@ -0,0 +1,111 @@
+#include "stdafx.h"
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(UINT threadCount) :
+	mThreadCount(threadCount),
+	mJob(nullptr),
+	mJobCount(0),
+	mNextJob(0),
+	mBusyWorkers(0),
+	mGeneration(0),
+	mQuit(false)
+{
+	if (mThreadCount == 0)
+	{
+		mThreadCount = std::thread::hardware_concurrency();
+	}
+	if (mThreadCount == 0)
+	{
+		mThreadCount = 1;
+	}
+
+	for (UINT t = 1; t < mThreadCount; t++)
+	{
+		mWorkers.emplace_back([this]() { WorkerLoop(); });
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mQuit = true;
+	}
+	mWake.notify_all();
+
+	for (std::thread& worker : mWorkers)
+	{
+		worker.join();
+	}
+}
+
+ThreadPool& ThreadPool::Default()
+{
+	static ThreadPool pool;
+	return pool;
+}
+
+void ThreadPool::RunJobs()
+{
+	for (UINT i = mNextJob++; i < mJobCount; i = mNextJob++)
+	{
+		(*mJob)(i);
+	}
+}
+
+void ThreadPool::WorkerLoop()
+{
+	UINT64 generation = 0;
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mMutex);
+			mWake.wait(lock, [this, generation]() { return mQuit || mGeneration != generation; });
+			if (mQuit)
+			{
+				return;
+			}
+			generation = mGeneration;
+		}
+
+		RunJobs();
+
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			if (--mBusyWorkers == 0)
+			{
+				mDone.notify_one();
+			}
+		}
+	}
+}
+
+void ThreadPool::ParallelFor(UINT count, const std::function<void(UINT)>& job)
+{
+	if (mWorkers.empty() || count <= 1)
+	{
+		for (UINT i = 0; i < count; i++)
+		{
+			job(i);
+		}
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mJob = &job;
+		mJobCount = count;
+		mNextJob = 0;
+		mBusyWorkers = static_cast<UINT>(mWorkers.size());
+		mGeneration++;
+	}
+	mWake.notify_all();
+
+	RunJobs();
+
+	// Workers still have to check in even if the caller ran every job, so the
+	// next batch cannot start while one is reading this batch's state.
+	std::unique_lock<std::mutex> lock(mMutex);
+	mDone.wait(lock, [this]() { return mBusyWorkers == 0; });
+	mJob = nullptr;
+}
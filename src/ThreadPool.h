@@ -0,0 +1,43 @@
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+// A fixed set of worker threads for splitting CPU passes into independent jobs.
+// ParallelFor hands out job indices from a shared counter, so the order jobs run
+// in varies; callers that need deterministic output must write each job's
+// results to a location chosen by its index.
+class ThreadPool
+{
+public:
+	// threadCount includes the calling thread; 0 uses one per hardware thread.
+	ThreadPool(UINT threadCount = 0);
+	~ThreadPool();
+
+	// Calls job(i) for every i in [0, count) and returns once all calls have
+	// finished. The calling thread runs jobs too. Not reentrant.
+	void ParallelFor(UINT count, const std::function<void(UINT)>& job);
+
+	// Pool shared by passes that run at startup or on demand.
+	static ThreadPool& Default();
+
+	UINT	mThreadCount;
+
+private:
+	void WorkerLoop();
+	void RunJobs();
+
+	std::vector<std::thread>			mWorkers;
+	std::mutex							mMutex;
+	std::condition_variable				mWake;
+	std::condition_variable				mDone;
+	const std::function<void(UINT)>*	mJob;
+	UINT								mJobCount;
+	std::atomic<UINT>					mNextJob;
+	UINT								mBusyWorkers;
+	UINT64								mGeneration;
+	bool								mQuit;
+};
@@ -0,0 +1,255 @@
+#include "stdafx.h"
+#include "TileFile.h"
+#include <chrono>
+
+static_assert(sizeof(TileFileHeader) % sizeof(UINT64) == 0, "Sections after the header stay aligned.");
+
+static inline UINT64 AlignSection(UINT64 offset)
+{
+	return (offset + (TileFileAlignment - 1)) & ~static_cast<UINT64>(TileFileAlignment - 1);
+}
+
+UINT64 TileChecksum(const void* data, UINT64 bytes)
+{
+	// The sums wrap at 2^64 rather than being reduced modulo 2^32 - 1 as in
+	// Fletcher-64, which cannot tell a word of zeroes from one of ones.
+	const UINT* words = static_cast<const UINT*>(data);
+	const UINT64 count = bytes / sizeof(UINT);
+	UINT64 sum1 = 0;
+	UINT64 sum2 = 0;
+
+	for (UINT64 i = 0; i < count; i++)
+	{
+		sum1 += words[i];
+		sum2 += sum1;
+	}
+
+	return (sum2 << 32) ^ sum1;
+}
+
+bool TileFileView::Open(const void* data, UINT64 size)
+{
+	mHeader = nullptr;
+	mData = nullptr;
+
+	if (size < sizeof(TileFileHeader))
+	{
+		return false;
+	}
+
+	const TileFileHeader& header = *static_cast<const TileFileHeader*>(data);
+	if (header.mMagic != TileFileMagic || header.mVersion != TileFileVersion || header.mHeaderSize != sizeof(TileFileHeader) ||
+		header.mBrickCount != BrickCount || header.mWidthInBricks != cWidthInBricks ||
+		header.mHeightInBricks != cHeightInBricks || header.mDepthInBricks != cDepthInBricks ||
+		header.mFileSize != size || header.mHeaderChecksum != HeaderChecksum(header))
+	{
+		return false;
+	}
+
+	const UINT64 tableBytes = BrickCount * sizeof(UINT);
+	const UINT64 wordBytes = static_cast<UINT64>(header.mWordCount) * sizeof(UINT);
+	const UINT64 maskBytes = BrickCount * sizeof(UINT64);
+	if (header.mTableOffset % TileFileAlignment || header.mWordsOffset % TileFileAlignment || header.mMasksOffset % TileFileAlignment ||
+		header.mTableOffset < sizeof(TileFileHeader) || header.mTableOffset + tableBytes > size ||
+		header.mWordsOffset + wordBytes > size || header.mMasksOffset + maskBytes > size)
+	{
+		return false;
+	}
+
+	const UINT8* bytes = static_cast<const UINT8*>(data);
+	if (TileChecksum(bytes + header.mTableOffset, tableBytes) != header.mTableChecksum ||
+		TileChecksum(bytes + header.mWordsOffset, wordBytes) != header.mWordsChecksum ||
+		TileChecksum(bytes + header.mMasksOffset, maskBytes) != header.mMasksChecksum)
+	{
+		return false;
+	}
+
+	// The checksums catch damage, but the table is still checked so a file that
+	// was written wrongly cannot send LoadVoxel outside the blocks.
+	const UINT* table = reinterpret_cast<const UINT*>(bytes + header.mTableOffset);
+	const UINT* words = reinterpret_cast<const UINT*>(bytes + header.mWordsOffset);
+	if (!BrickPool::IsValidTable(table, words, header.mWordCount))
+	{
+		return false;
+	}
+
+	mHeader = &header;
+	mData = bytes;
+	return true;
+}
+
+TileCoord TileFileView::GetCoord() const
+{
+	TileCoord coord = { mHeader->mTileX, mHeader->mTileZ };
+	return coord;
+}
+
+bool TileFileView::Load(BrickPool& bricks, BrickOccupancy& occupancy) const
+{
+	if (!IsOpen() || !bricks.Load(GetTable(), GetWords(), GetWordCount()))
+	{
+		return false;
+	}
+
+	occupancy.mMasks.assign(GetMasks(), GetMasks() + BrickCount);
+	return true;
+}
+
+double TileFileView::Benchmark(const std::vector<UINT8>& image, UINT iterations)
+{
+	BrickPool bricks;
+	BrickOccupancy occupancy;
+	TileFileView view;
+
+	auto start = std::chrono::high_resolution_clock::now();
+	for (UINT i = 0; i < iterations; i++)
+	{
+		view.Open(image.data(), image.size());
+		view.Load(bricks, occupancy);
+	}
+	std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+	return (double(image.size()) * iterations) / elapsed.count();
+}
+
+void SerializeTile(const TileCoord& coord, const BrickPool& bricks, const BrickOccupancy& occupancy, std::vector<UINT8>& image)
+{
+	std::vector<UINT> table;
+	std::vector<UINT> words;
+	bricks.Compact(table, words);
+
+	TileFileHeader header = {};
+	header.mMagic = TileFileMagic;
+	header.mVersion = TileFileVersion;
+	header.mHeaderSize = sizeof(TileFileHeader);
+	header.mBrickCount = BrickCount;
+	header.mWidthInBricks = cWidthInBricks;
+	header.mHeightInBricks = cHeightInBricks;
+	header.mDepthInBricks = cDepthInBricks;
+	header.mTileX = coord.mX;
+	header.mTileZ = coord.mZ;
+	header.mWordCount = static_cast<UINT>(words.size());
+
+	const UINT64 tableBytes = BrickCount * sizeof(UINT);
+	const UINT64 wordBytes = words.size() * sizeof(UINT);
+	const UINT64 maskBytes = BrickCount * sizeof(UINT64);
+	header.mTableOffset = AlignSection(sizeof(TileFileHeader));
+	header.mWordsOffset = AlignSection(header.mTableOffset + tableBytes);
+	header.mMasksOffset = AlignSection(header.mWordsOffset + wordBytes);
+	header.mFileSize = header.mMasksOffset + maskBytes;
+
+	header.mTableChecksum = TileChecksum(table.data(), tableBytes);
+	header.mWordsChecksum = TileChecksum(words.data(), wordBytes);
+	header.mMasksChecksum = TileChecksum(occupancy.mMasks.data(), maskBytes);
+	header.mHeaderChecksum = HeaderChecksum(header);
+
+	image.assign(static_cast<size_t>(header.mFileSize), 0);
+	memcpy(&image[0], &header, sizeof(header));
+	memcpy(&image[static_cast<size_t>(header.mTableOffset)], table.data(), static_cast<size_t>(tableBytes));
+	if (wordBytes > 0)
+	{
+		memcpy(&image[static_cast<size_t>(header.mWordsOffset)], words.data(), static_cast<size_t>(wordBytes));
+	}
+	memcpy(&image[static_cast<size_t>(header.mMasksOffset)], occupancy.mMasks.data(), static_cast<size_t>(maskBytes));
+}
+
+std::wstring GetTileFilePath(const std::wstring& directory, const TileCoord& coord)
+{
+	WCHAR name[64];
+	swprintf_s(name, L"tile_%d_%d.vxt", coord.mX, coord.mZ);
+	return directory + name;
+}
+
+bool WriteFileImage(const std::wstring& path, const std::vector<UINT8>& image)
+{
+	const std::wstring temporary = path + L".tmp";
+	HANDLE file = CreateFileW(temporary.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+
+	DWORD written = 0;
+	bool saved = WriteFile(file, image.data(), static_cast<DWORD>(image.size()), &written, nullptr) && written == image.size() &&
+		FlushFileBuffers(file);
+	CloseHandle(file);
+
+	saved = saved && MoveFileExW(temporary.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+	if (!saved)
+	{
+		DeleteFileW(temporary.c_str());
+	}
+	return saved;
+}
+
+bool WriteTileFile(const std::wstring& path, const TileCoord& coord, const BrickPool& bricks, const BrickOccupancy& occupancy)
+{
+	std::vector<UINT8> image;
+	SerializeTile(coord, bricks, occupancy, image);
+	return WriteFileImage(path, image);
+}
+
+bool MappedFile::Open(const std::wstring& path)
+{
+	Close();
+
+	mFile = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (mFile == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(mFile, &size) || size.QuadPart == 0)
+	{
+		Close();
+		return false;
+	}
+
+	mMapping = CreateFileMappingW(mFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	mData = mMapping ? MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+	if (!mData)
+	{
+		Close();
+		return false;
+	}
+	mSize = static_cast<UINT64>(size.QuadPart);
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (mData)
+	{
+		UnmapViewOfFile(mData);
+		mData = nullptr;
+	}
+	if (mMapping)
+	{
+		CloseHandle(mMapping);
+		mMapping = nullptr;
+	}
+	if (mFile != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(mFile);
+		mFile = INVALID_HANDLE_VALUE;
+	}
+	mSize = 0;
+}
+
+bool MappedTileFile::Open(const std::wstring& path)
+{
+	Close();
+	if (!mFile.Open(path) || !mView.Open(mFile.GetData(), mFile.GetSize()))
+	{
+		Close();
+		return false;
+	}
+	return true;
+}
+
+void MappedTileFile::Close()
+{
+	mView = TileFileView();
+	mFile.Close();
+}
@@ -0,0 +1,154 @@
+#pragma once
+
+#include <string>
+#include "Definitions.h"
+#include "BrickPool.h"
+#include "BrickOccupancy.h"
+#include "TileResidency.h"
+
+// A saved tile, laid out so that a mapped file can be validated as it is and
+// its sections copied out without decoding; see TileFileView::Load():
+//
+//	TileFileHeader
+//	table	BrickCount uints, the BrickPool table with its blocks packed in brick order
+//	words	mWordCount uints, the blocks
+//	masks	BrickCount uint64s, the occupancy masks
+//
+// Every section starts on a TileFileAlignment boundary. The header records a
+// TileChecksum of each section, and of itself, so a truncated or
+// damaged file is refused rather than drawn. Files from another version, or for
+// a volume of another size, are refused too.
+static const UINT TileFileMagic = 0x4c545856;		// "VXTL"
+static const UINT TileFileVersion = 2;
+static const UINT TileFileAlignment = 64;
+
+struct TileFileHeader
+{
+	UINT	mMagic;
+	UINT	mVersion;
+	UINT	mHeaderSize;		// sizeof(TileFileHeader) when written.
+	UINT	mBrickCount;
+	UINT	mWidthInBricks;
+	UINT	mHeightInBricks;
+	UINT	mDepthInBricks;
+	int		mTileX;
+	int		mTileZ;
+	UINT	mWordCount;
+	UINT64	mTableOffset;		// In bytes from the start of the file.
+	UINT64	mWordsOffset;
+	UINT64	mMasksOffset;
+	UINT64	mFileSize;
+	UINT64	mTableChecksum;
+	UINT64	mWordsChecksum;
+	UINT64	mMasksChecksum;
+	UINT64	mHeaderChecksum;	// Of the header with this field zero.
+};
+
+// A Fletcher style checksum over the uints of data: the low half is their sum
+// and the high half the sum of the running sums, so any change to one word
+// changes it, as does almost any reordering. bytes must be a multiple of four.
+UINT64 TileChecksum(const void* data, UINT64 bytes);
+
+// TileChecksum of a file header with its mHeaderChecksum field taken as zero.
+// The header is copied out as uints, rather than summed through a copy of the
+// struct, so the cleared field is seen by the checksum's reads.
+template<typename Header>
+UINT64 HeaderChecksum(const Header& header)
+{
+	static_assert(sizeof(Header) % sizeof(UINT) == 0, "Headers are summed as uints.");
+	UINT words[sizeof(Header) / sizeof(UINT)];
+	memcpy(words, &header, sizeof(header));
+	memset(reinterpret_cast<UINT8*>(words) + offsetof(Header, mHeaderChecksum), 0, sizeof(header.mHeaderChecksum));
+	return TileChecksum(words, sizeof(words));
+}
+
+// The sections of a tile file image in memory, once checked.
+class TileFileView
+{
+public:
+	TileFileView() :
+		mHeader(nullptr),
+		mData(nullptr)
+	{}
+
+	// Checks the header and every checksum. Returns false when data does not hold
+	// a valid tile file of this version and volume size.
+	bool Open(const void* data, UINT64 size);
+
+	bool IsOpen() const { return mHeader != nullptr; }
+
+	TileCoord GetCoord() const;
+	const UINT* GetTable() const { return reinterpret_cast<const UINT*>(mData + mHeader->mTableOffset); }
+	const UINT* GetWords() const { return reinterpret_cast<const UINT*>(mData + mHeader->mWordsOffset); }
+	UINT GetWordCount() const { return mHeader->mWordCount; }
+	const UINT64* GetMasks() const { return reinterpret_cast<const UINT64*>(mData + mHeader->mMasksOffset); }
+
+	// Copies the table, blocks and masks into CPU structures that can be edited.
+	// This is a copy, not a view of the file: edits allocate and free blocks in
+	// the pool, which a read-only mapping cannot hold.
+	bool Load(BrickPool& bricks, BrickOccupancy& occupancy) const;
+
+	// Bytes of file image opened and loaded per second over the given number of passes.
+	static double Benchmark(const std::vector<UINT8>& image, UINT iterations);
+
+private:
+	const TileFileHeader*	mHeader;
+	const UINT8*			mData;
+};
+
+// Writes the image of a tile file.
+void SerializeTile(const TileCoord& coord, const BrickPool& bricks, const BrickOccupancy& occupancy, std::vector<UINT8>& image);
+
+// The name a tile is saved under in directory, e.g. "tile_-1_2.vxt".
+std::wstring GetTileFilePath(const std::wstring& directory, const TileCoord& coord);
+
+// Writes a file image beside path and renames it over path once it is on disk,
+// so a failed save leaves any earlier file intact.
+bool WriteFileImage(const std::wstring& path, const std::vector<UINT8>& image);
+
+// Saves a tile with WriteFileImage().
+bool WriteTileFile(const std::wstring& path, const TileCoord& coord, const BrickPool& bricks, const BrickOccupancy& occupancy);
+
+// A file mapped read-only. The data stays valid until Close().
+class MappedFile
+{
+public:
+	MappedFile() :
+		mFile(INVALID_HANDLE_VALUE),
+		mMapping(nullptr),
+		mData(nullptr),
+		mSize(0)
+	{}
+	~MappedFile() { Close(); }
+
+	// Returns false when the file is missing or empty.
+	bool Open(const std::wstring& path);
+	void Close();
+
+	const void* GetData() const { return mData; }
+	UINT64 GetSize() const { return mSize; }
+
+private:
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	HANDLE		mFile;
+	HANDLE		mMapping;
+	const void*	mData;
+	UINT64		mSize;
+};
+
+// A tile file mapped read-only. The view stays valid until Close().
+class MappedTileFile
+{
+public:
+	// Returns false when the file is missing or is not a valid tile file.
+	bool Open(const std::wstring& path);
+	void Close();
+
+	const TileFileView& GetView() const { return mView; }
+
+private:
+	MappedFile		mFile;
+	TileFileView	mView;
+};
@@ -0,0 +1,376 @@
+#include "stdafx.h"
+#include "TileResidency.h"
+#include "TileFile.h"
+#include "RegionFile.h"
+#include <algorithm>
+#include <chrono>
+
+static inline UINT RingDistance(const TileCoord& a, const TileCoord& b)
+{
+	const int dx = a.mX > b.mX ? a.mX - b.mX : b.mX - a.mX;
+	const int dz = a.mZ > b.mZ ? a.mZ - b.mZ : b.mZ - a.mZ;
+	return static_cast<UINT>(dx > dz ? dx : dz);
+}
+
+// Orders tiles by ring, then by straight line distance within a ring, so the
+// tiles nearest the camera load first.
+static inline UINT64 LoadPriority(const TileCoord& coord, const TileCoord& camera)
+{
+	const INT64 dx = coord.mX - camera.mX;
+	const INT64 dz = coord.mZ - camera.mZ;
+	return (static_cast<UINT64>(RingDistance(coord, camera)) << 32) | static_cast<UINT64>(dx * dx + dz * dz);
+}
+
+static inline bool SameTile(const TileCoord& a, const TileCoord& b)
+{
+	return a.mX == b.mX && a.mZ == b.mZ;
+}
+
+TileResidency::TileResidency(UINT radius, UINT slotCount, const TileLoader& loader, UINT loaderCount) :
+	mRadius(radius),
+	mLoader(loader),
+	mSlots(slotCount),
+	mCamera(),
+	mLoads(0),
+	mEvictionCount(0),
+	mDiscarded(0),
+	mInFlight(0),
+	mQuit(false)
+{
+	for (TileSlot& slot : mSlots)
+	{
+		slot.mCoord = TileCoord();
+		slot.mState = SlotFree;
+		slot.mRequest = 0;
+	}
+
+	for (UINT t = 0; t < (loaderCount > 0 ? loaderCount : 1); t++)
+	{
+		mLoaders.emplace_back([this]() { LoaderLoop(); });
+	}
+}
+
+TileResidency::~TileResidency()
+{
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mQuit = true;
+		mQueue.clear();
+	}
+	mWake.notify_all();
+
+	for (std::thread& loader : mLoaders)
+	{
+		loader.join();
+	}
+}
+
+TileLoader TileResidency::CreateGeneratorLoader(WorldType type, UINT seed)
+{
+	return [type, seed](const TileCoord& coord, BrickPool& bricks, ThreadPool& pool)
+	{
+		// Generators keep per-volume state from Prepare, so each tile gets its own.
+		std::unique_ptr<VoxelGenerator> generator = CreateWorldGenerator(type, seed);
+		generator->mOriginX = coord.mX * static_cast<int>(Width);
+		generator->mOriginZ = coord.mZ * static_cast<int>(Depth);
+		generator->Generate(bricks, pool);
+	};
+}
+
+TileLoader TileResidency::CreateFileLoader(const std::wstring& directory, const TileLoader& fallback)
+{
+	return [directory, fallback](const TileCoord& coord, BrickPool& bricks, ThreadPool& pool)
+	{
+		MappedTileFile file;
+		if (file.Open(GetTileFilePath(directory, coord)))
+		{
+			const TileFileView& view = file.GetView();
+			const TileCoord saved = view.GetCoord();
+			if (saved.mX == coord.mX && saved.mZ == coord.mZ && bricks.Load(view.GetTable(), view.GetWords(), view.GetWordCount()))
+			{
+				return;
+			}
+		}
+		fallback(coord, bricks, pool);
+	};
+}
+
+TileLoader TileResidency::CreateRegionLoader(const std::wstring& directory, const TileLoader& fallback)
+{
+	return [directory, fallback](const TileCoord& coord, BrickPool& bricks, ThreadPool& pool)
+	{
+		MappedRegionFile file;
+		if (file.Open(GetRegionFilePath(directory, coord)))
+		{
+			const RegionFileView& view = file.GetView();
+			const TileCoord saved = view.GetCoord();
+			if (saved.mX == coord.mX && saved.mZ == coord.mZ && view.Load(bricks))
+			{
+				return;
+			}
+		}
+		fallback(coord, bricks, pool);
+	};
+}
+
+TileCoord TileResidency::GetTileAt(const XMFLOAT3& position)
+{
+	TileCoord coord;
+	coord.mX = static_cast<int>(floorf(position.x / (Width * VoxelSize)));
+	coord.mZ = static_cast<int>(floorf(position.z / (Depth * VoxelSize)));
+	return coord;
+}
+
+void TileResidency::LoaderLoop()
+{
+	// Loads run one to a thread; the pool only runs jobs on the caller.
+	ThreadPool pool(1);
+
+	std::unique_lock<std::mutex> lock(mMutex);
+	for (;;)
+	{
+		mWake.wait(lock, [this]() { return mQuit || !mQueue.empty(); });
+		if (mQuit)
+		{
+			return;
+		}
+
+		LoadRequest request = mQueue.front();
+		mQueue.pop_front();
+		mInFlight++;
+		lock.unlock();
+
+		std::unique_ptr<TileContents> contents(new TileContents());
+		mLoader(request.mCoord, contents->mBricks, pool);
+		contents->mOccupancy.Build(contents->mBricks);
+		contents->mFaces.Build(contents->mOccupancy);
+		contents->mMips.Build(contents->mBricks, pool);
+
+		lock.lock();
+		LoadResult result;
+		result.mSlot = request.mSlot;
+		result.mRequest = request.mRequest;
+		result.mContents = std::move(contents);
+		mResults.push_back(std::move(result));
+		mInFlight--;
+		mDone.notify_all();
+	}
+}
+
+// Makes the tiles whose loads have finished resident, unless their slot has
+// since been given to another tile.
+void TileResidency::Collect()
+{
+	std::vector<LoadResult> results;
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		results.swap(mResults);
+	}
+
+	for (LoadResult& result : results)
+	{
+		TileSlot& slot = mSlots[result.mSlot];
+		if (slot.mState != SlotLoading || slot.mRequest != result.mRequest)
+		{
+			continue;
+		}
+
+		slot.mState = SlotResident;
+		slot.mContents = std::move(result.mContents);
+		mArrivals.push_back(result.mSlot);
+		mLoads++;
+	}
+}
+
+void TileResidency::ReleaseSlot(UINT slot)
+{
+	TileSlot& s = mSlots[slot];
+	s.mState = SlotFree;
+	s.mRequest++;
+	s.mContents.reset();
+
+	mArrivals.erase(std::remove(mArrivals.begin(), mArrivals.end(), slot), mArrivals.end());
+	mEvictions.push_back(slot);
+}
+
+// A free slot, or else the slot of the resident tile farthest from the camera
+// outside the ring. Returns -1 when every slot holds a tile within the ring.
+int TileResidency::AcquireSlot(const TileCoord& camera)
+{
+	int victim = -1;
+	UINT64 victimPriority = 0;
+	for (UINT s = 0; s < mSlots.size(); s++)
+	{
+		const TileSlot& slot = mSlots[s];
+		if (slot.mState == SlotFree)
+		{
+			return static_cast<int>(s);
+		}
+
+		if (slot.mState == SlotResident && RingDistance(slot.mCoord, camera) > mRadius)
+		{
+			UINT64 priority = LoadPriority(slot.mCoord, camera);
+			if (victim < 0 || priority > victimPriority)
+			{
+				victim = static_cast<int>(s);
+				victimPriority = priority;
+			}
+		}
+	}
+
+	if (victim >= 0)
+	{
+		ReleaseSlot(static_cast<UINT>(victim));
+		mEvictionCount++;
+	}
+	return victim;
+}
+
+void TileResidency::Update(const TileCoord& camera)
+{
+	Collect();
+	mCamera = camera;
+
+	// Abandon loads for tiles that have left the ring. A load already running
+	// finishes, but its result no longer matches the slot's request.
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		for (UINT s = 0; s < mSlots.size(); s++)
+		{
+			if (mSlots[s].mState == SlotLoading && RingDistance(mSlots[s].mCoord, camera) > mRadius)
+			{
+				mQueue.erase(std::remove_if(mQueue.begin(), mQueue.end(), [s](const LoadRequest& request) { return request.mSlot == s; }), mQueue.end());
+				ReleaseSlot(s);
+				mDiscarded++;
+			}
+		}
+	}
+
+	// Request the ring, nearest first.
+	std::vector<TileCoord> ring;
+	const int radius = static_cast<int>(mRadius);
+	for (int dz = -radius; dz <= radius; dz++)
+	{
+		for (int dx = -radius; dx <= radius; dx++)
+		{
+			TileCoord coord = { camera.mX + dx, camera.mZ + dz };
+			ring.push_back(coord);
+		}
+	}
+	std::sort(ring.begin(), ring.end(), [&camera](const TileCoord& a, const TileCoord& b)
+	{
+		return LoadPriority(a, camera) < LoadPriority(b, camera);
+	});
+
+	std::vector<LoadRequest> requests;
+	for (const TileCoord& coord : ring)
+	{
+		bool present = false;
+		for (const TileSlot& slot : mSlots)
+		{
+			if (slot.mState != SlotFree && SameTile(slot.mCoord, coord))
+			{
+				present = true;
+				break;
+			}
+		}
+		if (present)
+		{
+			continue;
+		}
+
+		int s = AcquireSlot(camera);
+		if (s < 0)
+		{
+			break;
+		}
+
+		TileSlot& slot = mSlots[s];
+		slot.mCoord = coord;
+		slot.mState = SlotLoading;
+		slot.mRequest++;
+
+		LoadRequest request = { static_cast<UINT>(s), slot.mRequest, coord };
+		requests.push_back(request);
+	}
+
+	if (requests.empty())
+	{
+		return;
+	}
+
+	// Requests queued for an earlier camera position are reordered with the new ones.
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mQueue.insert(mQueue.end(), requests.begin(), requests.end());
+		std::stable_sort(mQueue.begin(), mQueue.end(), [&camera](const LoadRequest& a, const LoadRequest& b)
+		{
+			return LoadPriority(a.mCoord, camera) < LoadPriority(b.mCoord, camera);
+		});
+	}
+	mWake.notify_all();
+}
+
+void TileResidency::Flush()
+{
+	{
+		std::unique_lock<std::mutex> lock(mMutex);
+		mDone.wait(lock, [this]() { return mQueue.empty() && mInFlight == 0; });
+	}
+	Collect();
+}
+
+void TileResidency::TakeArrivals(std::vector<UINT>& slots)
+{
+	slots.swap(mArrivals);
+	mArrivals.clear();
+}
+
+void TileResidency::TakeEvictions(std::vector<UINT>& slots)
+{
+	slots.swap(mEvictions);
+	mEvictions.clear();
+}
+
+int TileResidency::FindResident(const TileCoord& coord) const
+{
+	for (UINT s = 0; s < mSlots.size(); s++)
+	{
+		if (mSlots[s].mState == SlotResident && SameTile(mSlots[s].mCoord, coord))
+		{
+			return static_cast<int>(s);
+		}
+	}
+	return -1;
+}
+
+TileResidency::ResidencyStats TileResidency::GetStats() const
+{
+	ResidencyStats stats = {};
+	for (const TileSlot& slot : mSlots)
+	{
+		stats.mResident += slot.mState == SlotResident ? 1 : 0;
+		stats.mLoading += slot.mState == SlotLoading ? 1 : 0;
+	}
+	stats.mLoads = mLoads;
+	stats.mEvictions = mEvictionCount;
+	stats.mDiscarded = mDiscarded;
+	return stats;
+}
+
+double TileResidency::Benchmark(const TileLoader& loader, UINT radius, UINT loaderCount, UINT steps)
+{
+	const UINT ringWidth = 2 * radius + 1;
+	TileResidency residency(radius, ringWidth * ringWidth + ringWidth, loader, loaderCount);
+
+	auto start = std::chrono::high_resolution_clock::now();
+	for (UINT step = 0; step <= steps; step++)
+	{
+		TileCoord camera = { static_cast<int>(step), 0 };
+		residency.Update(camera);
+		residency.Flush();
+	}
+	std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+	return residency.GetStats().mLoads / elapsed.count();
+}
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <memory>
+#include <functional>
+#include <deque>
+#include <string>
+#include "Definitions.h"
+#include "BrickPool.h"
+#include "BrickOccupancy.h"
+#include "BrickFaces.h"
+#include "VoxelMips.h"
+#include "ThreadPool.h"
+#include "Worlds.h"
+
+// Position of a tile in the world's grid of volumes, in tiles along x and z. Tile
+// (x, z) holds the voxels from (x * Width, z * Depth) on.
+struct TileCoord
+{
+	int mX;
+	int mZ;
+};
+
+// A tile's voxels and everything the GPU copy derives from them. Faces and mips
+// treat the voxels outside the tile as air, so the faces along tile seams are
+// drawn even where a neighbouring tile covers them.
+struct TileContents
+{
+	BrickPool		mBricks;
+	BrickOccupancy	mOccupancy;
+	BrickFaces		mFaces;
+	VoxelMips		mMips;
+};
+
+// Fills the voxels of a tile. Called on a loader thread, with a pool that runs
+// jobs on that thread alone.
+typedef std::function<void(const TileCoord& coord, BrickPool& bricks, ThreadPool& pool)> TileLoader;
+
+// Keeps the tiles within a ring around the camera resident in a fixed set of
+// slots, so a world larger than the volume can be drawn with a bounded amount of
+// memory. Slots are CPU-side only: each holds a tile's TileContents. The sample
+// still draws its one volume from its own buffers and only runs this in the
+// "Streaming:" benchmark.
+//
+// Update() requests every tile within mRadius tiles (Chebyshev distance) of the
+// camera's tile, nearest first, and hands each one to a free slot. Loader threads
+// fill the tile and derive its faces and mips in the background; Update() then
+// makes it resident and reports its slot through TakeArrivals(). Tiles that leave
+// the ring stay resident as a cache until their slot is needed, when the one
+// farthest from the camera is evicted; a tile still loading is abandoned instead,
+// and its result discarded when it arrives.
+class TileResidency
+{
+public:
+	enum SlotState
+	{
+		SlotFree,
+		SlotLoading,
+		SlotResident
+	};
+
+	struct TileSlot
+	{
+		TileCoord						mCoord;
+		SlotState						mState;
+		UINT							mRequest;	// Bumped whenever the slot is given a tile, so late loads for an older one are recognised.
+		std::unique_ptr<TileContents>	mContents;	// Set once resident.
+	};
+
+	struct ResidencyStats
+	{
+		UINT	mResident;
+		UINT	mLoading;
+		UINT64	mLoads;			// Tiles made resident.
+		UINT64	mEvictions;		// Resident tiles whose slot was reused.
+		UINT64	mDiscarded;		// Loads abandoned because their tile left the ring.
+	};
+
+	// slotCount must be at least (2 * radius + 1)^2, the size of the ring; any
+	// more slots cache tiles behind the camera. loaderCount threads load tiles.
+	TileResidency(UINT radius, UINT slotCount, const TileLoader& loader, UINT loaderCount = 2);
+	~TileResidency();
+
+	// A loader that generates tiles of the given world type, with the generator's
+	// origin at the tile.
+	static TileLoader CreateGeneratorLoader(WorldType type, UINT seed);
+
+	// A loader that maps the tile's file in directory, as WriteTileFile saves it,
+	// and falls back to the given loader when there is no valid file for the tile.
+	static TileLoader CreateFileLoader(const std::wstring& directory, const TileLoader& fallback);
+
+	// As CreateFileLoader, for region files saved by WriteRegionFile.
+	static TileLoader CreateRegionLoader(const std::wstring& directory, const TileLoader& fallback);
+
+	// The tile holding a world space position, given in the sample's units.
+	static TileCoord GetTileAt(const XMFLOAT3& position);
+
+	// Collects finished loads, then requests the ring around the camera's tile.
+	void Update(const TileCoord& camera);
+
+	// Blocks until every requested tile has loaded, then collects them.
+	void Flush();
+
+	// The slots made resident since the last call, in the order they arrived.
+	// Their tiles must be uploaded before they are drawn.
+	void TakeArrivals(std::vector<UINT>& slots);
+
+	// The slots evicted or abandoned since the last call. Their tiles must no
+	// longer be drawn; the slot may already hold another request.
+	void TakeEvictions(std::vector<UINT>& slots);
+
+	// The slot holding a tile, or -1 when it is not resident.
+	int FindResident(const TileCoord& coord) const;
+
+	UINT GetSlotCount() const { return static_cast<UINT>(mSlots.size()); }
+	const TileSlot& GetSlot(UINT slot) const { return mSlots[slot]; }
+	ResidencyStats GetStats() const;
+
+	// Tiles loaded per second while the camera moves steps tiles along x, one
+	// tile per Update(), with every load waited for at each step.
+	static double Benchmark(const TileLoader& loader, UINT radius, UINT loaderCount, UINT steps);
+
+	UINT	mRadius;
+
+private:
+	struct LoadRequest
+	{
+		UINT		mSlot;
+		UINT		mRequest;
+		TileCoord	mCoord;
+	};
+
+	struct LoadResult
+	{
+		UINT							mSlot;
+		UINT							mRequest;
+		std::unique_ptr<TileContents>	mContents;
+	};
+
+	void LoaderLoop();
+	void Collect();
+	int AcquireSlot(const TileCoord& camera);
+	void ReleaseSlot(UINT slot);
+
+	TileLoader						mLoader;
+	std::vector<TileSlot>			mSlots;
+	std::vector<UINT>				mArrivals;
+	std::vector<UINT>				mEvictions;
+	TileCoord						mCamera;
+	UINT64							mLoads;
+	UINT64							mEvictionCount;
+	UINT64							mDiscarded;
+
+	// Shared with the loader threads.
+	std::vector<std::thread>		mLoaders;
+	std::mutex						mMutex;
+	std::condition_variable			mWake;
+	std::condition_variable			mDone;
+	std::deque<LoadRequest>			mQueue;			// Nearest first.
+	std::vector<LoadResult>			mResults;
+	UINT							mInFlight;		// Requests taken by loaders and not yet in mResults.
+	bool							mQuit;
+};
@@ -0,0 +1,430 @@
+#include "stdafx.h"
+#include "VoxelEdit.h"
+#include <immintrin.h>
+#include <algorithm>
+#include <chrono>
+
+// Clamps a voxel space bound to [0, limit).
+static inline int ClampVoxel(float v, int limit)
+{
+	int i = static_cast<int>(floorf(v));
+	return i < 0 ? 0 : (i >= limit ? limit - 1 : i);
+}
+
+// Voxel space bounds of the box from lo to hi, clamped to the volume.
+static void SetBounds(EditOp& op, const XMFLOAT3& lo, const XMFLOAT3& hi)
+{
+	const float invSize = 1.0f / VoxelSize;
+	op.mMin = XMINT3(ClampVoxel(lo.x * invSize, Width),
+		ClampVoxel(lo.y * invSize, Height),
+		ClampVoxel(lo.z * invSize, Depth));
+	op.mMax = XMINT3(ClampVoxel(hi.x * invSize + 1.0f, Width),
+		ClampVoxel(hi.y * invSize + 1.0f, Height),
+		ClampVoxel(hi.z * invSize + 1.0f, Depth));
+}
+
+// Bounds of the box of half size extent around the op's centre.
+static void SetBounds(EditOp& op, const XMFLOAT3& extent)
+{
+	SetBounds(op, XMFLOAT3(op.mCentre.x - extent.x, op.mCentre.y - extent.y, op.mCentre.z - extent.z),
+		XMFLOAT3(op.mCentre.x + extent.x, op.mCentre.y + extent.y, op.mCentre.z + extent.z));
+}
+
+static inline bool OverlapsBrick(const EditOp& op, int bx, int by, int bz)
+{
+	return op.mMin.x / cBrickWidth <= bx && bx <= op.mMax.x / cBrickWidth &&
+		op.mMin.y / cBrickHeight <= by && by <= op.mMax.y / cBrickHeight &&
+		op.mMin.z / cBrickDepth <= bz && bz <= op.mMax.z / cBrickDepth;
+}
+
+const char* GetEditShapeName(EditShape shape)
+{
+	switch (shape)
+	{
+		case EditSphere:		return "Sphere";
+		case EditBox:			return "Box";
+		case EditCylinder:		return "Cylinder";
+		case EditCapsule:		return "Capsule";
+		case EditSdf:			return "SDF";
+		default:				return "Unknown";
+	}
+}
+
+EditOp VoxelEditor::MakeSphere(const XMFLOAT3& centre, float radius, UINT material)
+{
+	EditOp op = {};
+	op.mShape = EditSphere;
+	op.mMaterial = material;
+	op.mCentre = centre;
+	op.mRadius = radius;
+	SetBounds(op, XMFLOAT3(radius, radius, radius));
+	return op;
+}
+
+EditOp VoxelEditor::MakeBox(const XMFLOAT3& centre, const XMFLOAT3& halfExtent, UINT material)
+{
+	EditOp op = {};
+	op.mShape = EditBox;
+	op.mMaterial = material;
+	op.mCentre = centre;
+	op.mExtent = halfExtent;
+	SetBounds(op, halfExtent);
+	return op;
+}
+
+EditOp VoxelEditor::MakeCylinder(const XMFLOAT3& centre, float radius, float halfHeight, UINT material)
+{
+	EditOp op = {};
+	op.mShape = EditCylinder;
+	op.mMaterial = material;
+	op.mCentre = centre;
+	op.mRadius = radius;
+	op.mExtent = XMFLOAT3(radius, halfHeight, radius);
+	SetBounds(op, op.mExtent);
+	return op;
+}
+
+EditOp VoxelEditor::MakeCapsule(const XMFLOAT3& start, const XMFLOAT3& end, float radius, UINT material)
+{
+	EditOp op = {};
+	op.mShape = EditCapsule;
+	op.mMaterial = material;
+	op.mCentre = start;
+	op.mEnd = end;
+	op.mRadius = radius;
+	SetBounds(op, XMFLOAT3((start.x < end.x ? start.x : end.x) - radius, (start.y < end.y ? start.y : end.y) - radius, (start.z < end.z ? start.z : end.z) - radius),
+		XMFLOAT3((start.x > end.x ? start.x : end.x) + radius, (start.y > end.y ? start.y : end.y) + radius, (start.z > end.z ? start.z : end.z) + radius));
+	return op;
+}
+
+EditOp VoxelEditor::MakeSdf(EditSdfFunction sdf, const XMFLOAT3& centre, const XMFLOAT3& extent, UINT material)
+{
+	EditOp op = {};
+	op.mShape = EditSdf;
+	op.mMaterial = material;
+	op.mCentre = centre;
+	op.mExtent = extent;
+	op.mSdf = sdf;
+	SetBounds(op, extent);
+	return op;
+}
+
+EditOp VoxelEditor::MakeBrush(EditShape shape, const XMFLOAT3& centre, float size, UINT material)
+{
+	switch (shape)
+	{
+		case EditBox:
+			return MakeBox(centre, XMFLOAT3(size, size, size), material);
+		case EditCylinder:
+			return MakeCylinder(centre, size, size, material);
+		case EditCapsule:
+			return MakeCapsule(XMFLOAT3(centre.x - size, centre.y, centre.z), XMFLOAT3(centre.x + size, centre.y, centre.z), size * 0.5f, material);
+		case EditSdf:
+		{
+			const float tube = size * 0.3f;
+			EditOp op = MakeSdf(TorusSdf, centre, XMFLOAT3(size + tube, tube, size + tube), material);
+			op.mRadius = size;
+			return op;
+		}
+		default:
+			return MakeSphere(centre, size, material);
+	}
+}
+
+void VoxelEditor::TorusSdf(const EditOp& op, const float* x, const float* y, const float* z, float* distances, UINT count)
+{
+	for (UINT i = 0; i < count; i++)
+	{
+		float dx = x[i] - op.mCentre.x;
+		float dy = y[i] - op.mCentre.y;
+		float dz = z[i] - op.mCentre.z;
+		float ring = sqrtf(dx*dx + dz*dz) - op.mRadius;
+		distances[i] = sqrtf(ring*ring + dy*dy) - op.mExtent.y;
+	}
+}
+
+void VoxelEditor::GetBricks(const EditOp* ops, UINT count, std::vector<UINT>& bricks)
+{
+	bricks.clear();
+	for (UINT n = 0; n < count; n++)
+	{
+		const EditOp& op = ops[n];
+		for (int bz = op.mMin.z / cBrickDepth; bz <= op.mMax.z / cBrickDepth; bz++)
+		{
+			for (int by = op.mMin.y / cBrickHeight; by <= op.mMax.y / cBrickHeight; by++)
+			{
+				for (int bx = op.mMin.x / cBrickWidth; bx <= op.mMax.x / cBrickWidth; bx++)
+				{
+					bricks.push_back(GetBrickIndex(bx, by, bz));
+				}
+			}
+		}
+	}
+
+	// A single edit's bricks are already in order and distinct.
+	if (count > 1)
+	{
+		std::sort(bricks.begin(), bricks.end());
+		bricks.erase(std::unique(bricks.begin(), bricks.end()), bricks.end());
+	}
+}
+
+// Whether a voxel origin, relative to the op's centre, lies inside an analytic
+// shape.
+static inline bool IsInside(const EditOp& op, float dx, float dy, float dz)
+{
+	switch (op.mShape)
+	{
+		case EditSphere:
+			return (dx*dx + dy*dy + dz*dz) < op.mRadius * op.mRadius;
+		case EditBox:
+			return fabsf(dx) < op.mExtent.x && fabsf(dy) < op.mExtent.y && fabsf(dz) < op.mExtent.z;
+		case EditCylinder:
+			return (dx*dx + dz*dz) < op.mRadius * op.mRadius && fabsf(dy) < op.mExtent.y;
+		case EditCapsule:
+		{
+			// The nearest point of the segment, as a fraction of the way along it.
+			const float ax = op.mEnd.x - op.mCentre.x;
+			const float ay = op.mEnd.y - op.mCentre.y;
+			const float az = op.mEnd.z - op.mCentre.z;
+			const float lengthSquared = ax*ax + ay*ay + az*az;
+			const float invLengthSquared = lengthSquared > 0.0f ? 1.0f / lengthSquared : 0.0f;
+			float t = (dx*ax + dy*ay + dz*az) * invLengthSquared;
+			t = t < 0.0f ? 0.0f : (t > 1.0f ? 1.0f : t);
+			float px = dx - ax * t;
+			float py = dy - ay * t;
+			float pz = dz - az * t;
+			return (px*px + py*py + pz*pz) < op.mRadius * op.mRadius;
+		}
+		default:
+			return false;
+	}
+}
+
+static UINT64 GetInsideMaskScalar(const EditOp& op, const XMUINT3& brickCoords)
+{
+	UINT64 mask = 0;
+	for (UINT vz = 0; vz < cBrickDepth; vz++)
+	{
+		float dz = (brickCoords.z * cBrickDepth + vz) * VoxelSize - op.mCentre.z;
+		for (UINT vy = 0; vy < cBrickHeight; vy++)
+		{
+			float dy = (brickCoords.y * cBrickHeight + vy) * VoxelSize - op.mCentre.y;
+			for (UINT vx = 0; vx < cBrickWidth; vx++)
+			{
+				float dx = (brickCoords.x * cBrickWidth + vx) * VoxelSize - op.mCentre.x;
+				if (IsInside(op, dx, dy, dz))
+				{
+					mask |= 1ull << (vz * (cBrickWidth*cBrickHeight) + vy * cBrickWidth + vx);
+				}
+			}
+		}
+	}
+	return mask;
+}
+
+// As GetInsideMaskScalar(), a brick row at a time: x varies across the four lanes
+// while y and z are shared by the row.
+static UINT64 GetInsideMaskSimd(const EditOp& op, const XMUINT3& brickCoords)
+{
+	static_assert(cBrickWidth == 4, "A brick row fills one SSE register");
+
+	const __m128 dx = _mm_sub_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_add_epi32(_mm_set1_epi32(brickCoords.x * cBrickWidth), _mm_setr_epi32(0, 1, 2, 3))),
+		_mm_set1_ps(VoxelSize)), _mm_set1_ps(op.mCentre.x));
+	const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+	const __m128 radiusSquared = _mm_set1_ps(op.mRadius * op.mRadius);
+	const __m128 dxSquared = _mm_mul_ps(dx, dx);
+
+	// Capsule terms; t is clamped to the segment below.
+	const float ax = op.mEnd.x - op.mCentre.x;
+	const float ay = op.mEnd.y - op.mCentre.y;
+	const float az = op.mEnd.z - op.mCentre.z;
+	const float lengthSquared = ax*ax + ay*ay + az*az;
+	const float invLengthSquared = lengthSquared > 0.0f ? 1.0f / lengthSquared : 0.0f;
+	const __m128 dxAlong = _mm_mul_ps(dx, _mm_set1_ps(ax));
+
+	UINT64 mask = 0;
+	for (UINT vz = 0; vz < cBrickDepth; vz++)
+	{
+		float dzScalar = (brickCoords.z * cBrickDepth + vz) * VoxelSize - op.mCentre.z;
+		const __m128 dz = _mm_set1_ps(dzScalar);
+		for (UINT vy = 0; vy < cBrickHeight; vy++)
+		{
+			float dyScalar = (brickCoords.y * cBrickHeight + vy) * VoxelSize - op.mCentre.y;
+			const __m128 dy = _mm_set1_ps(dyScalar);
+
+			__m128 inside;
+			switch (op.mShape)
+			{
+				case EditSphere:
+					inside = _mm_cmplt_ps(_mm_add_ps(_mm_add_ps(dxSquared, _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz)), radiusSquared);
+					break;
+				case EditBox:
+					inside = _mm_cmplt_ps(_mm_and_ps(dx, absMask), _mm_set1_ps(op.mExtent.x));
+					inside = _mm_and_ps(inside, _mm_cmplt_ps(_mm_and_ps(dy, absMask), _mm_set1_ps(op.mExtent.y)));
+					inside = _mm_and_ps(inside, _mm_cmplt_ps(_mm_and_ps(dz, absMask), _mm_set1_ps(op.mExtent.z)));
+					break;
+				case EditCylinder:
+					inside = _mm_cmplt_ps(_mm_add_ps(dxSquared, _mm_mul_ps(dz, dz)), radiusSquared);
+					inside = _mm_and_ps(inside, _mm_cmplt_ps(_mm_and_ps(dy, absMask), _mm_set1_ps(op.mExtent.y)));
+					break;
+				case EditCapsule:
+				{
+					__m128 t = _mm_add_ps(_mm_add_ps(dxAlong, _mm_mul_ps(dy, _mm_set1_ps(ay))), _mm_mul_ps(dz, _mm_set1_ps(az)));
+					t = _mm_mul_ps(t, _mm_set1_ps(invLengthSquared));
+					t = _mm_min_ps(_mm_max_ps(t, _mm_setzero_ps()), _mm_set1_ps(1.0f));
+					__m128 px = _mm_sub_ps(dx, _mm_mul_ps(_mm_set1_ps(ax), t));
+					__m128 py = _mm_sub_ps(dy, _mm_mul_ps(_mm_set1_ps(ay), t));
+					__m128 pz = _mm_sub_ps(dz, _mm_mul_ps(_mm_set1_ps(az), t));
+					inside = _mm_cmplt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(px, px), _mm_mul_ps(py, py)), _mm_mul_ps(pz, pz)), radiusSquared);
+					break;
+				}
+				default:
+					inside = _mm_setzero_ps();
+					break;
+			}
+
+			mask |= static_cast<UINT64>(_mm_movemask_ps(inside)) << (vz * (cBrickWidth*cBrickHeight) + vy * cBrickWidth);
+		}
+	}
+	return mask;
+}
+
+// Evaluates an SDF brush over every voxel origin of a brick.
+static UINT64 GetSdfMask(const EditOp& op, const XMUINT3& brickCoords)
+{
+	float x[VoxelsPerBrick], y[VoxelsPerBrick], z[VoxelsPerBrick], distances[VoxelsPerBrick];
+	UINT v = 0;
+	for (UINT vz = 0; vz < cBrickDepth; vz++)
+	{
+		for (UINT vy = 0; vy < cBrickHeight; vy++)
+		{
+			for (UINT vx = 0; vx < cBrickWidth; vx++, v++)
+			{
+				x[v] = (brickCoords.x * cBrickWidth + vx) * VoxelSize;
+				y[v] = (brickCoords.y * cBrickHeight + vy) * VoxelSize;
+				z[v] = (brickCoords.z * cBrickDepth + vz) * VoxelSize;
+			}
+		}
+	}
+
+	op.mSdf(op, x, y, z, distances, VoxelsPerBrick);
+
+	UINT64 mask = 0;
+	for (v = 0; v < VoxelsPerBrick; v++)
+	{
+		mask |= static_cast<UINT64>(distances[v] < 0.0f) << v;
+	}
+	return mask;
+}
+
+UINT64 VoxelEditor::GetInsideMask(const EditOp& op, const XMUINT3& brickCoords, bool useSimd)
+{
+	if (op.mShape == EditSdf)
+	{
+		return op.mSdf ? GetSdfMask(op, brickCoords) : 0;
+	}
+	return useSimd ? GetInsideMaskSimd(op, brickCoords) : GetInsideMaskScalar(op, brickCoords);
+}
+
+// Sets the voxels of a brick selected by mask to material. Returns the number
+// that changed.
+static UINT SetMaterial(UINT64 mask, UINT material, Voxel* brickVoxels)
+{
+	UINT changed = 0;
+	for (UINT v = 0; v < VoxelsPerBrick; v++)
+	{
+		if (((mask >> v) & 1) && brickVoxels[v].mMaterial != material)
+		{
+			brickVoxels[v].mMaterial = material;
+			changed++;
+		}
+	}
+	return changed;
+}
+
+UINT VoxelEditor::Apply(const EditOp* ops, UINT count)
+{
+	mModifiedBricks.clear();
+	GetBricks(ops, count, mBrickList);
+
+	UINT changed = 0;
+	Voxel brickVoxels[VoxelsPerBrick];
+
+	for (UINT brick : mBrickList)
+	{
+		const XMUINT3 coords = GetBrickCoords(brick);
+
+		// The edits that cover any of this brick, in order, and the voxels they cover.
+		mBrickOps.clear();
+		mBrickMasks.clear();
+		for (UINT n = 0; n < count; n++)
+		{
+			if (OverlapsBrick(ops[n], coords.x, coords.y, coords.z))
+			{
+				UINT64 mask = GetInsideMask(ops[n], coords, mUseSimd);
+				if (mask != 0)
+				{
+					mBrickOps.push_back(n);
+					mBrickMasks.push_back(mask);
+				}
+			}
+		}
+		if (mBrickOps.empty())
+		{
+			continue;
+		}
+
+		// A brick made entirely of the material every edit sets cannot change.
+		if (mBricks.IsUniform(brick))
+		{
+			const UINT material = mBricks.mTable[brick] & ~UniformBrickFlag;
+			bool unchanged = true;
+			for (UINT n : mBrickOps)
+			{
+				unchanged = unchanged && ops[n].mMaterial == material;
+			}
+			if (unchanged)
+			{
+				continue;
+			}
+		}
+
+		mBricks.ReadBrick(brick, brickVoxels);
+		UINT brickChanged = 0;
+		for (size_t i = 0; i < mBrickOps.size(); i++)
+		{
+			brickChanged += SetMaterial(mBrickMasks[i], ops[mBrickOps[i]].mMaterial, brickVoxels);
+		}
+
+		if (brickChanged > 0)
+		{
+			mBricks.WriteBrick(brick, brickVoxels);
+			mModifiedBricks.push_back(brick);
+			changed += brickChanged;
+		}
+	}
+
+	return changed;
+}
+
+UINT VoxelEditor::ApplySphere(const XMFLOAT3& centre, float radius, UINT material)
+{
+	EditOp op = MakeSphere(centre, radius, material);
+	return Apply(&op, 1);
+}
+
+double VoxelEditor::Benchmark(EditShape shape, float size, UINT edits)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+	for (UINT i = 0; i < edits; i++)
+	{
+		// Step through the volume on a coarse lattice so successive edits land apart.
+		XMFLOAT3 centre(((i * 37) % Width) * VoxelSize, ((i * 11) % Height) * VoxelSize, ((i * 53) % Depth) * VoxelSize);
+		EditOp op = MakeBrush(shape, centre, size, (i & 1) ? 7 : 0);
+		Apply(&op, 1);
+	}
+	std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+	return edits / elapsed.count();
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include "VoxelTypes.h"
+#include "BrickPool.h"
+
+enum EditShape
+{
+	EditSphere,		// mCentre and mRadius.
+	EditBox,		// mCentre and mExtent, the half size on each axis.
+	EditCylinder,	// Upright, around mCentre: mRadius across x and z, mExtent.y half the height.
+	EditCapsule,	// The segment from mCentre to mEnd, grown by mRadius.
+	EditSdf,		// Where mSdf is negative, within mExtent of mCentre.
+	EditShapeCount
+};
+
+const char* GetEditShapeName(EditShape shape);
+
+struct EditOp;
+
+// A signed distance brush. Writes the distances of count voxel origins, given as
+// separate x, y and z arrays, negative inside. A brush is called once per brick
+// with all of the brick's voxels, so it can vectorise its own loop, and takes its
+// parameters from the op's fields other than mSdf and the bounds.
+typedef void (*EditSdfFunction)(const EditOp& op, const float* x, const float* y, const float* z, float* distances, UINT count);
+
+// One edit: every voxel whose origin lies strictly inside the shape is set to
+// mMaterial (0 digs). mMin and mMax bound the voxels the shape can reach,
+// inclusive and clamped to the volume; they are filled in by the Make functions.
+struct EditOp
+{
+	EditShape		mShape;
+	UINT			mMaterial;
+	XMFLOAT3		mCentre;
+	float			mRadius;
+	XMFLOAT3		mExtent;
+	XMFLOAT3		mEnd;
+	EditSdfFunction	mSdf;
+	XMINT3			mMin;
+	XMINT3			mMax;
+};
+
+// Applies edits to the sparse voxel volume, visiting only the bricks and voxels
+// that the edit's bounds overlap. Each brick is expanded, edited and written
+// back, so it collapses to a table entry if the edit leaves it uniform. Positions
+// are in the same space as the voxel origins the sample renders, where voxel
+// (x, y, z) sits at (x, y, z) * VoxelSize.
+//
+// An edit first tests which of a brick's voxels lie inside it, as a mask with a
+// bit per voxel, and bricks no edit covers any of are not expanded at all. With
+// mUseSimd set the analytic shapes test a brick row of four voxels at a time,
+// using the same operations in the same order as the scalar test, so both paths
+// select exactly the same voxels.
+class VoxelEditor
+{
+public:
+	VoxelEditor(BrickPool& bricks) :
+		mUseSimd(true),
+		mBricks(bricks)
+	{}
+
+	static EditOp MakeSphere(const XMFLOAT3& centre, float radius, UINT material);
+	static EditOp MakeBox(const XMFLOAT3& centre, const XMFLOAT3& halfExtent, UINT material);
+	static EditOp MakeCylinder(const XMFLOAT3& centre, float radius, float halfHeight, UINT material);
+	static EditOp MakeCapsule(const XMFLOAT3& start, const XMFLOAT3& end, float radius, UINT material);
+
+	// An SDF brush bounded by the box of half size extent around centre. The
+	// brush's own parameters go in mRadius and mEnd (and mExtent, which it must
+	// stay within) afterwards.
+	static EditOp MakeSdf(EditSdfFunction sdf, const XMFLOAT3& centre, const XMFLOAT3& extent, UINT material);
+
+	// A brush of each shape roughly size across its half width, for the sample's
+	// controls and benchmarks. EditSdf makes a flat ring, from TorusSdf.
+	static EditOp MakeBrush(EditShape shape, const XMFLOAT3& centre, float size, UINT material);
+
+	// A torus around the y axis through mCentre, with mRadius from the centre to
+	// the middle of the tube and mExtent.y the tube's radius.
+	static void TorusSdf(const EditOp& op, const float* x, const float* y, const float* z, float* distances, UINT count);
+
+	// Applies a batch of edits in order. Edits that overlap are merged per brick,
+	// so each brick any of them reaches is expanded and written back once, with
+	// the same result as applying them one at a time. Returns the number of voxel
+	// changes; the bricks they belong to are listed in mModifiedBricks, in brick
+	// order.
+	UINT Apply(const EditOp* ops, UINT count);
+
+	UINT ApplySphere(const XMFLOAT3& centre, float radius, UINT material);
+
+	// The bricks a batch of edits can reach, in brick order.
+	static void GetBricks(const EditOp* ops, UINT count, std::vector<UINT>& bricks);
+
+	// The voxels of a brick that lie inside an edit, bit vz * 16 + vy * 4 + vx for
+	// voxel (vx, vy, vz) of the brick.
+	static UINT64 GetInsideMask(const EditOp& op, const XMUINT3& brickCoords, bool useSimd);
+
+	// Edits per second for alternating dig and place brushes spread over the volume.
+	double Benchmark(EditShape shape, float size, UINT edits);
+
+	bool				mUseSimd;
+	std::vector<UINT>	mModifiedBricks;
+
+private:
+	BrickPool&			mBricks;
+	std::vector<UINT>	mBrickList;
+	std::vector<UINT>	mBrickOps;
+	std::vector<UINT64>	mBrickMasks;
+};
@@ -0,0 +1,390 @@
+#include "stdafx.h"
+#include "VoxelMips.h"
+#include <immintrin.h>
+#include <algorithm>
+#include <chrono>
+
+static_assert(BrickWidth == 4 && BrickHeight == 4 && BrickDepth == 4, "Mip bricks are gathered assuming 4x4x4 bricks.");
+static_assert(VoxelMips::LevelCount == 3, "Records describe the cells of level 1 and the voxel of level 2.");
+static_assert((cHeightInBricks >> (VoxelMips::LevelCount - 1)) != 0, "Every level must hold at least one brick.");
+static_assert(VoxelMips::MaxCellFaces <= 5 * (VoxelMips::LodRecordWords - 5), "Records must hold every exposed cell face.");
+
+// Neighbour offsets, in the order of VoxelFace.
+static const int FaceOffsets[FaceCount][3] = { { 0, 0, -1 }, { 0, 0, 1 }, { 0, 1, 0 }, { 0, -1, 0 }, { -1, 0, 0 }, { 1, 0, 0 } };
+
+VoxelMips::VoxelMips() :
+	mSimd(GetCpuSimdLevel()),
+	mRecords(BrickCount * LodRecordWords, 0)
+{
+	for (UINT level = 0; level < LevelCount; level++)
+	{
+		mBricksX[level] = cWidthInBricks >> level;
+		mBricksY[level] = cHeightInBricks >> level;
+		mBricksZ[level] = cDepthInBricks >> level;
+		if (level > 0)
+		{
+			const UINT brickCount = mBricksX[level] * mBricksY[level] * mBricksZ[level];
+			mMaterials[level].assign(brickCount * VoxelsPerBrick, 0);
+			mMasks[level].assign(brickCount, 0);
+		}
+	}
+}
+
+UINT16 VoxelMips::Majority(const UINT16 children[8])
+{
+	UINT solid = 0;
+	UINT16 best = 0;
+	UINT bestCount = 0;
+	for (UINT k = 0; k < 8; k++)
+	{
+		if (children[k] == 0)
+		{
+			continue;
+		}
+
+		solid++;
+		UINT count = 0;
+		for (UINT j = 0; j < 8; j++)
+		{
+			count += children[j] == children[k] ? 1 : 0;
+		}
+
+		// Ties go to the first child.
+		if (count > bestCount)
+		{
+			best = children[k];
+			bestCount = count;
+		}
+	}
+
+	return solid >= 4 ? best : 0;
+}
+
+// Majority() for the 64 voxels of a brick at once, children[j][v] being child j
+// of voxel v. Each candidate child is compared against all eight in every lane.
+static void MajoritySse2(const UINT16 children[8][VoxelsPerBrick], UINT16* out)
+{
+	const __m128i zero = _mm_setzero_si128();
+	for (UINT v = 0; v < VoxelsPerBrick; v += 8)
+	{
+		__m128i c[8];
+		__m128i air = zero;
+		for (UINT j = 0; j < 8; j++)
+		{
+			c[j] = _mm_load_si128(reinterpret_cast<const __m128i*>(&children[j][v]));
+			air = _mm_add_epi16(air, _mm_cmpeq_epi16(c[j], zero));
+		}
+
+		__m128i best = zero;
+		__m128i bestCount = zero;
+		for (UINT k = 0; k < 8; k++)
+		{
+			__m128i count = zero;
+			for (UINT j = 0; j < 8; j++)
+			{
+				count = _mm_sub_epi16(count, _mm_cmpeq_epi16(c[j], c[k]));
+			}
+			count = _mm_andnot_si128(_mm_cmpeq_epi16(c[k], zero), count);
+
+			__m128i take = _mm_cmpgt_epi16(count, bestCount);
+			best = _mm_or_si128(_mm_and_si128(take, c[k]), _mm_andnot_si128(take, best));
+			bestCount = _mm_max_epi16(count, bestCount);
+		}
+
+		__m128i solid = _mm_cmpgt_epi16(air, _mm_set1_epi16(-5));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + v), _mm_and_si128(solid, best));
+	}
+}
+
+static AVX2_FUNCTION void MajorityAvx2(const UINT16 children[8][VoxelsPerBrick], UINT16* out)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	for (UINT v = 0; v < VoxelsPerBrick; v += 16)
+	{
+		__m256i c[8];
+		__m256i air = zero;		// Minus the number of air children.
+		for (UINT j = 0; j < 8; j++)
+		{
+			c[j] = _mm256_load_si256(reinterpret_cast<const __m256i*>(&children[j][v]));
+			air = _mm256_add_epi16(air, _mm256_cmpeq_epi16(c[j], zero));
+		}
+
+		__m256i best = zero;
+		__m256i bestCount = zero;
+		for (UINT k = 0; k < 8; k++)
+		{
+			__m256i count = zero;
+			for (UINT j = 0; j < 8; j++)
+			{
+				count = _mm256_sub_epi16(count, _mm256_cmpeq_epi16(c[j], c[k]));
+			}
+			count = _mm256_andnot_si256(_mm256_cmpeq_epi16(c[k], zero), count);
+
+			__m256i take = _mm256_cmpgt_epi16(count, bestCount);
+			best = _mm256_or_si256(_mm256_and_si256(take, c[k]), _mm256_andnot_si256(take, best));
+			bestCount = _mm256_max_epi16(count, bestCount);
+		}
+
+		__m256i solid = _mm256_cmpgt_epi16(air, _mm256_set1_epi16(-5));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + v), _mm256_and_si256(solid, best));
+	}
+}
+
+void VoxelMips::BuildBrick(const BrickPool& bricks, UINT level, UINT brick)
+{
+	const UINT bx = brick % mBricksX[level];
+	const UINT by = (brick / mBricksX[level]) % mBricksY[level];
+	const UINT bz = brick / (mBricksX[level] * mBricksY[level]);
+
+	// Each of the eight bricks below covers a 2x2x2 corner of this one's voxels.
+	alignas(32) UINT16 children[8][VoxelsPerBrick];
+	for (UINT n = 0; n < 8; n++)
+	{
+		const UINT cx = bx * 2 + (n & 1);
+		const UINT cy = by * 2 + ((n >> 1) & 1);
+		const UINT cz = bz * 2 + (n >> 2);
+
+		UINT16 materials[VoxelsPerBrick];
+		const UINT16* source = materials;
+		if (level == 1)
+		{
+			Voxel voxels[VoxelsPerBrick];
+			bricks.ReadBrick(GetBrickIndex(cx, cy, cz), voxels);
+			for (UINT v = 0; v < VoxelsPerBrick; v++)
+			{
+				materials[v] = static_cast<UINT16>(voxels[v].mMaterial);
+			}
+		}
+		else
+		{
+			source = &mMaterials[level - 1][((cz * mBricksY[level - 1] + cy) * mBricksX[level - 1] + cx) * VoxelsPerBrick];
+		}
+
+		for (UINT v = 0; v < VoxelsPerBrick; v++)
+		{
+			const UINT x = v & 3;
+			const UINT y = (v >> 2) & 3;
+			const UINT z = v >> 4;
+			const UINT parent = ((n >> 2) * 2 + (z >> 1)) * 16 + (((n >> 1) & 1) * 2 + (y >> 1)) * 4 + (n & 1) * 2 + (x >> 1);
+			children[(z & 1) * 4 + (y & 1) * 2 + (x & 1)][parent] = source[v];
+		}
+	}
+
+	UINT16* out = &mMaterials[level][brick * VoxelsPerBrick];
+	switch (GetSimdLevel(mSimd))
+	{
+		case SimdAvx2:
+			MajorityAvx2(children, out);
+			break;
+		case SimdSse2:
+			MajoritySse2(children, out);
+			break;
+		default:
+			for (UINT v = 0; v < VoxelsPerBrick; v++)
+			{
+				const UINT16 voxelChildren[8] = { children[0][v], children[1][v], children[2][v], children[3][v],
+					children[4][v], children[5][v], children[6][v], children[7][v] };
+				out[v] = Majority(voxelChildren);
+			}
+			break;
+	}
+
+	UINT64 mask = 0;
+	for (UINT v = 0; v < VoxelsPerBrick; v++)
+	{
+		mask |= out[v] != 0 ? 1ull << v : 0;
+	}
+	mMasks[level][brick] = mask;
+}
+
+UINT VoxelMips::GetMaterial(UINT level, UINT x, UINT y, UINT z) const
+{
+	const UINT brick = ((z >> 2) * mBricksY[level] + (y >> 2)) * mBricksX[level] + (x >> 2);
+	return mMaterials[level][brick * VoxelsPerBrick + (z & 3) * 16 + (y & 3) * 4 + (x & 3)];
+}
+
+bool VoxelMips::IsSolid(UINT level, int x, int y, int z) const
+{
+	if (x < 0 || y < 0 || z < 0 || x >= int(mBricksX[level] * 4) || y >= int(mBricksY[level] * 4) || z >= int(mBricksZ[level] * 4))
+	{
+		return false;
+	}
+
+	const UINT brick = ((z >> 2) * mBricksY[level] + (y >> 2)) * mBricksX[level] + (x >> 2);
+	return (mMasks[level][brick] >> ((z & 3) * 16 + (y & 3) * 4 + (x & 3)) & 1) != 0;
+}
+
+UINT VoxelMips::GetOccupiedBrickCount(UINT level) const
+{
+	UINT count = 0;
+	for (UINT64 mask : mMasks[level])
+	{
+		count += mask != 0 ? 1 : 0;
+	}
+	return count;
+}
+
+UINT VoxelMips::GetInstanceCount(UINT brick, UINT level) const
+{
+	const UINT word = mRecords[brick * LodRecordWords + 4];
+	if (level == 1)
+	{
+		return word >> 24;
+	}
+
+	UINT count = 0;
+	for (UINT faces = (word >> 16) & 63; faces != 0; faces &= faces - 1)
+	{
+		count++;
+	}
+	return count;
+}
+
+void VoxelMips::BuildRecord(UINT brick, UINT* record) const
+{
+	const XMUINT3 b = GetBrickCoords(brick);
+	memset(record, 0, LodRecordWords * sizeof(UINT));
+
+	UINT cellFaces = 0;
+	for (UINT cell = 0; cell < 8; cell++)
+	{
+		const int x = b.x * 2 + (cell & 1);
+		const int y = b.y * 2 + ((cell >> 1) & 1);
+		const int z = b.z * 2 + (cell >> 2);
+		const UINT material = GetMaterial(1, x, y, z);
+		record[cell / 2] |= material << ((cell & 1) * 16);
+		if (material == 0)
+		{
+			continue;
+		}
+
+		for (UINT face = 0; face < FaceCount; face++)
+		{
+			if (!IsSolid(1, x + FaceOffsets[face][0], y + FaceOffsets[face][1], z + FaceOffsets[face][2]))
+			{
+				record[5 + cellFaces / 5] |= (cell | (face << 3)) << ((cellFaces % 5) * 6);
+				cellFaces++;
+			}
+		}
+	}
+
+	const UINT material = GetMaterial(2, b.x, b.y, b.z);
+	UINT faces = 0;
+	for (UINT face = 0; material != 0 && face < FaceCount; face++)
+	{
+		if (!IsSolid(2, b.x + FaceOffsets[face][0], b.y + FaceOffsets[face][1], b.z + FaceOffsets[face][2]))
+		{
+			faces |= 1u << face;
+		}
+	}
+	record[4] = material | (faces << 16) | (cellFaces << 24);
+}
+
+void VoxelMips::BuildLevels(const BrickPool& bricks, ThreadPool& pool)
+{
+	// Each level reads the finished level below, so only the rows of one level
+	// run in parallel.
+	for (UINT level = 1; level < LevelCount; level++)
+	{
+		const UINT width = mBricksX[level];
+		pool.ParallelFor(mBricksY[level] * mBricksZ[level], [this, &bricks, level, width](UINT row)
+		{
+			for (UINT x = 0; x < width; x++)
+			{
+				BuildBrick(bricks, level, row * width + x);
+			}
+		});
+	}
+}
+
+void VoxelMips::Build(const BrickPool& bricks, ThreadPool& pool)
+{
+	BuildLevels(bricks, pool);
+
+	pool.ParallelFor(cHeightInBricks * cDepthInBricks, [this](UINT row)
+	{
+		for (UINT x = 0; x < cWidthInBricks; x++)
+		{
+			const UINT brick = row * cWidthInBricks + x;
+			BuildRecord(brick, &mRecords[brick * LodRecordWords]);
+		}
+	});
+}
+
+void VoxelMips::UpdateBricks(const BrickPool& bricks, const std::vector<UINT>& modified, std::vector<UINT>& changed)
+{
+	// Rebuild the parent of every modified brick, then the parents of those.
+	std::vector<UINT> parents;
+	std::vector<UINT> levelBricks;
+	for (UINT brick : modified)
+	{
+		XMUINT3 b = GetBrickCoords(brick);
+		parents.push_back(((b.z / 2) * mBricksY[1] + b.y / 2) * mBricksX[1] + b.x / 2);
+	}
+
+	for (UINT level = 1; level < LevelCount; level++)
+	{
+		std::sort(parents.begin(), parents.end());
+		parents.erase(std::unique(parents.begin(), parents.end()), parents.end());
+		for (UINT brick : parents)
+		{
+			BuildBrick(bricks, level, brick);
+		}
+
+		levelBricks.swap(parents);
+		parents.clear();
+		for (UINT brick : levelBricks)
+		{
+			if (level + 1 < LevelCount)
+			{
+				const UINT x = brick % mBricksX[level];
+				const UINT y = (brick / mBricksX[level]) % mBricksY[level];
+				const UINT z = brick / (mBricksX[level] * mBricksY[level]);
+				parents.push_back(((z / 2) * mBricksY[level + 1] + y / 2) * mBricksX[level + 1] + x / 2);
+			}
+		}
+	}
+
+	// A record also reads the cells and level 2 voxels of the neighbouring bricks.
+	std::vector<UINT> records;
+	for (UINT brick : modified)
+	{
+		XMUINT3 b = GetBrickCoords(brick);
+		records.push_back(brick);
+		for (UINT face = 0; face < FaceCount; face++)
+		{
+			const int x = int(b.x) + FaceOffsets[face][0];
+			const int y = int(b.y) + FaceOffsets[face][1];
+			const int z = int(b.z) + FaceOffsets[face][2];
+			if (x >= 0 && y >= 0 && z >= 0 && x < cWidthInBricks && y < cHeightInBricks && z < cDepthInBricks)
+			{
+				records.push_back(GetBrickIndex(x, y, z));
+			}
+		}
+	}
+	std::sort(records.begin(), records.end());
+	records.erase(std::unique(records.begin(), records.end()), records.end());
+
+	UINT record[LodRecordWords];
+	for (UINT brick : records)
+	{
+		BuildRecord(brick, record);
+		if (memcmp(record, GetRecord(brick), sizeof(record)) != 0)
+		{
+			memcpy(&mRecords[brick * LodRecordWords], record, sizeof(record));
+			changed.push_back(brick);
+		}
+	}
+}
+
+double VoxelMips::Benchmark(const BrickPool& bricks, ThreadPool& pool, UINT iterations)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+	for (UINT i = 0; i < iterations; i++)
+	{
+		BuildLevels(bricks, pool);
+	}
+	std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+	return (double(VoxelCount) * iterations) / elapsed.count();
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "VoxelTypes.h"
+#include "BrickPool.h"
+#include "BrickFaces.h"
+#include "ThreadPool.h"
+#include "Simd.h"
+
+// Coarser copies of the volume for drawing distant bricks. Each level halves the
+// resolution of the one below: a voxel holds the material most of its 2x2x2
+// children share, or air when fewer than half of them are solid, so thin
+// features fade out with distance rather than thicken. Every level is stored in
+// 4x4x4 bricks like level 0, brick-major, with an occupancy mask per brick; the
+// bricks whose mask is non-zero are the level's brick set.
+//
+// A level 0 brick covers 2x2x2 voxels (cells) of level 1 and one voxel of level
+// 2. For each level 0 brick a record of LodRecordWords uints describes both:
+//
+//	words 0-3	The materials of the eight level 1 cells, 16 bits each; cell
+//				c = z * 4 + y * 2 + x is in the low half of word c / 2 when even.
+//	word 4		The level 2 material in the low 16 bits, its exposed faces from
+//				bit 16 and the number of exposed cell faces from bit 24.
+//	words 5-9	The exposed cell faces, 6 bits each (cell | face << 3), five to
+//				a word from the low bits up.
+//
+// Faces are numbered as in BrickFaces and exposed where the neighbour on the same
+// level is air, across brick boundaries, with everything outside the volume air.
+// cull.hlsl and FrustumCuller draw a brick's cells past the LOD distance, and its
+// level 2 voxel past twice that, instead of its own faces.
+class VoxelMips
+{
+public:
+	static const UINT LevelCount = 3;				// Including level 0, which the BrickPool holds.
+	static const UINT LodRecordWords = cLodRecordWords;
+	static const UINT MaxCellFaces = 24;			// Eight cells in a 2x2x2 block expose at most 24 faces.
+
+	VoxelMips();
+
+	// Rebuilds every level and record from the volume.
+	void Build(const BrickPool& bricks, ThreadPool& pool);
+
+	// Recomputes the parents of the given level 0 bricks on every level, and the
+	// records of those bricks and their neighbours. Every brick whose record
+	// changed is appended to changed.
+	void UpdateBricks(const BrickPool& bricks, const std::vector<UINT>& modified, std::vector<UINT>& changed);
+
+	UINT GetMaterial(UINT level, UINT x, UINT y, UINT z) const;
+	bool IsSolid(UINT level, int x, int y, int z) const;
+
+	UINT GetBrickCount(UINT level) const { return static_cast<UINT>(mMasks[level].size()); }
+	UINT GetOccupiedBrickCount(UINT level) const;
+
+	// The instances a brick draws at level 1 or 2.
+	UINT GetInstanceCount(UINT brick, UINT level) const;
+
+	const UINT* GetRecord(UINT brick) const { return &mRecords[brick * LodRecordWords]; }
+
+	// The material most of the eight children share, as the SIMD path chooses it.
+	static UINT16 Majority(const UINT16 children[8]);
+
+	// Level 0 voxels reduced per second by full rebuilds of the levels.
+	double Benchmark(const BrickPool& bricks, ThreadPool& pool, UINT iterations);
+
+	SimdLevel					mSimd;						// The widest reduction to use; clamped to what the CPU supports.
+	std::vector<UINT16>			mMaterials[LevelCount];		// Levels 1 and up.
+	std::vector<UINT64>			mMasks[LevelCount];
+	std::vector<UINT>			mRecords;					// LodRecordWords per level 0 brick.
+
+private:
+	void BuildBrick(const BrickPool& bricks, UINT level, UINT brick);
+	void BuildRecord(UINT brick, UINT* record) const;
+	void BuildLevels(const BrickPool& bricks, ThreadPool& pool);
+
+	UINT	mBricksX[LevelCount];
+	UINT	mBricksY[LevelCount];
+	UINT	mBricksZ[LevelCount];
+};
@@ -27,12 +27,10 @@ void VoxelTile::AppendEnclosingWork(ID3D12GraphicsCommandList* CommandList, Shar
 
 	ComputeRootConstants rootConstants;
 	rootConstants.CommandCount = BrickCount;
+	rootConstants.BrickListCount = 0;
 
 	CommandList->SetComputeRoot32BitConstants(RootConstants, ComputeRootConstantsInU32s, reinterpret_cast<void*>(&rootConstants), 0);
 
-	// Reset the UAV counter for this frame.
-	CommandList->CopyBufferRegion(m_processedCommandBuffers[mBufferIndex].Get(), CounterOffset, Shared->mCounterReset.Get(), 0, sizeof(UINT));
-
 	{
 		D3D12_RESOURCE_BARRIER barrier = CD3DX12_RESOURCE_BARRIER::Transition(m_processedCommandBuffers[mBufferIndex].Get(), D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
 		CommandList->ResourceBarrier(1, &barrier);
@@ -70,23 +68,45 @@ void VoxelTile::AppendCullingWork(ID3D12GraphicsCommandList* CommandList, Shared
 
 	CSCullConstants rootConstants;
 	rootConstants.projection = View.mProjection;
+	rootConstants.bucketPass = 0;
+	rootConstants.lodDistance = View.mLodDistance;
 
 	CommandList->SetComputeRoot32BitConstants(CullRootConstants, CullConstantsInU32, reinterpret_cast<void*>(&rootConstants), 0);
 
-	// Reset the UAV counter for this frame.
-	CommandList->CopyBufferRegion(m_cullCommandBuffers[View.mFrame].Get(), CounterOffset, Shared->mCounterReset.Get(), 0, sizeof(UINT));
+	// Reset the UAV counter and the distance buckets for this frame.
+	ID3D12Resource* distanceBuckets = m_distanceBucketBuffers[View.mFrame].Get();
+	CommandList->CopyBufferRegion(m_cullCommandBuffers[View.mFrame].Get(), CounterBufferOffset, Shared->mCounterReset.Get(), 0, sizeof(UINT));
+	CommandList->CopyBufferRegion(distanceBuckets, 0, Shared->mCounterReset.Get(), 0, DistanceBucketCount * 2 * sizeof(UINT));
 
 	{
-		D3D12_RESOURCE_BARRIER barrier = CD3DX12_RESOURCE_BARRIER::Transition(m_cullCommandBuffers[View.mFrame].Get(), D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_UNORDERED_ACCESS);
-		CommandList->ResourceBarrier(1, &barrier);
+		D3D12_RESOURCE_BARRIER barriers[2] =
+		{
+			CD3DX12_RESOURCE_BARRIER::Transition(m_cullCommandBuffers[View.mFrame].Get(), D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_UNORDERED_ACCESS),
+			CD3DX12_RESOURCE_BARRIER::Transition(distanceBuckets, D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_UNORDERED_ACCESS)
+		};
+		CommandList->ResourceBarrier(_countof(barriers), barriers);
 	}
 
-	CommandList->Dispatch(static_cast<UINT>(ceil(BrickCount / float(ComputeThreadBlockSize))), 1, 1);
+	// Size the distance buckets, then write the commands into them.
+	CommandList->Dispatch(CullGroupCount, 1, 1);
 
 	{
-		D3D12_RESOURCE_BARRIER barrier = CD3DX12_RESOURCE_BARRIER::Transition(m_cullCommandBuffers[View.mFrame].Get(), D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_INDIRECT_ARGUMENT);
+		D3D12_RESOURCE_BARRIER barrier = CD3DX12_RESOURCE_BARRIER::UAV(distanceBuckets);
 		CommandList->ResourceBarrier(1, &barrier);
 	}
+
+	rootConstants.bucketPass = 1;
+	CommandList->SetComputeRoot32BitConstant(CullRootConstants, rootConstants.bucketPass, offsetof(CSCullConstants, bucketPass) / sizeof(UINT));
+	CommandList->Dispatch(CullGroupCount, 1, 1);
+
+	{
+		D3D12_RESOURCE_BARRIER barriers[2] =
+		{
+			CD3DX12_RESOURCE_BARRIER::Transition(m_cullCommandBuffers[View.mFrame].Get(), D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_INDIRECT_ARGUMENT),
+			CD3DX12_RESOURCE_BARRIER::Transition(distanceBuckets, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COPY_DEST)
+		};
+		CommandList->ResourceBarrier(_countof(barriers), barriers);
+	}
 }
 
 void VoxelTile::AppendRenderingWork(ID3D12GraphicsCommandList* CommandList)
@@ -102,20 +122,73 @@ void VoxelTile::CreateVoxelView( SharedResources* Shared)
 	srvDesc.Format = DXGI_FORMAT_UNKNOWN;
 	srvDesc.ViewDimension = D3D12_SRV_DIMENSION_BUFFER;
 	srvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
-	srvDesc.Buffer.NumElements = VoxelCount;
-	srvDesc.Buffer.StructureByteStride = sizeof(Voxel);
+	srvDesc.Buffer.NumElements = Shared->mVoxelSlotSize;
+	srvDesc.Buffer.StructureByteStride = sizeof(UINT);
 	srvDesc.Buffer.Flags = D3D12_BUFFER_SRV_FLAG_NONE;
 	srvDesc.Buffer.FirstElement = 0;
 
-	UINT tileOffset = this->mIndex * VoxelCount;
+	UINT tileOffset = this->mIndex * Shared->mVoxelSlotSize;
 
 	CD3DX12_CPU_DESCRIPTOR_HANDLE cbvSrvHandle( mDescriptorHeap->GetCPUDescriptorHandleForHeapStart(), VoxelBufferOffset + mDescriptorOffset, increment );
 	for (int i = 0; i < FrameCount; i++)
 	{
-		srvDesc.Buffer.FirstElement = tileOffset + i * VoxelCount;
+		srvDesc.Buffer.FirstElement = tileOffset + i * Shared->mVoxelSlotSize;
 		mDevice->CreateShaderResourceView( Shared->mVoxels.Get(), &srvDesc, cbvSrvHandle);
 		cbvSrvHandle.Offset( DescriptorCountPerFrame, increment);
 	}
+
+	// Occupancy masks for the enclosure pass, one slot per frame alongside the voxels.
+	srvDesc.Buffer.NumElements = BrickCount;
+	srvDesc.Buffer.StructureByteStride = sizeof(UINT64);
+
+	UINT tileBrickOffset = this->mIndex * BrickCount;
+
+	CD3DX12_CPU_DESCRIPTOR_HANDLE brickMaskHandle( mDescriptorHeap->GetCPUDescriptorHandleForHeapStart(), BrickMaskBufferOffset + mDescriptorOffset, increment );
+	for (int i = 0; i < FrameCount; i++)
+	{
+		srvDesc.Buffer.FirstElement = tileBrickOffset + i * BrickCount;
+		mDevice->CreateShaderResourceView( Shared->mBrickMasks.Get(), &srvDesc, brickMaskHandle);
+		brickMaskHandle.Offset( DescriptorCountPerFrame, increment);
+	}
+
+	// Face counts for the enclosure pass, one slot per frame like the voxels.
+	srvDesc.Buffer.NumElements = Shared->mFaceSlotSize;
+	srvDesc.Buffer.StructureByteStride = sizeof(UINT);
+
+	UINT tileFaceOffset = this->mIndex * Shared->mFaceSlotSize;
+
+	CD3DX12_CPU_DESCRIPTOR_HANDLE faceHandle( mDescriptorHeap->GetCPUDescriptorHandleForHeapStart(), FaceBufferOffset + mDescriptorOffset, increment );
+	for (int i = 0; i < FrameCount; i++)
+	{
+		srvDesc.Buffer.FirstElement = tileFaceOffset + i * Shared->mFaceSlotSize;
+		mDevice->CreateShaderResourceView( Shared->mFaces.Get(), &srvDesc, faceHandle);
+		faceHandle.Offset( DescriptorCountPerFrame, increment);
+	}
+
+	// LOD records for the cull shader, one slot per frame like the voxels.
+	srvDesc.Buffer.NumElements = BrickCount * VoxelMips::LodRecordWords;
+
+	UINT tileLodOffset = this->mIndex * BrickCount * VoxelMips::LodRecordWords;
+
+	CD3DX12_CPU_DESCRIPTOR_HANDLE lodHandle( mDescriptorHeap->GetCPUDescriptorHandleForHeapStart(), LodBufferOffset + mDescriptorOffset, increment );
+	for (int i = 0; i < FrameCount; i++)
+	{
+		srvDesc.Buffer.FirstElement = tileLodOffset + i * BrickCount * VoxelMips::LodRecordWords;
+		mDevice->CreateShaderResourceView( Shared->mLods.Get(), &srvDesc, lodHandle);
+		lodHandle.Offset( DescriptorCountPerFrame, increment);
+	}
+
+	// Tiles always run the full enclosure pass, so the dirty brick list is left unbound.
+	srvDesc.Buffer.FirstElement = 0;
+	srvDesc.Buffer.NumElements = 1;
+	srvDesc.Buffer.StructureByteStride = sizeof(UINT);
+
+	CD3DX12_CPU_DESCRIPTOR_HANDLE dirtyBrickListHandle( mDescriptorHeap->GetCPUDescriptorHandleForHeapStart(), DirtyBrickListOffset + mDescriptorOffset, increment );
+	for (int i = 0; i < FrameCount; i++)
+	{
+		mDevice->CreateShaderResourceView( nullptr, &srvDesc, dirtyBrickListHandle);
+		dirtyBrickListHandle.Offset( DescriptorCountPerFrame, increment);
+	}
 }
 
 void VoxelTile::CreateBuffers()
@@ -145,7 +218,7 @@ void VoxelTile::CreateBuffers()
 		uavDesc.Buffer.FirstElement = 0;
 		uavDesc.Buffer.NumElements = BrickCount;
 		uavDesc.Buffer.StructureByteStride = sizeof(DrawVoxelCommand);
-		uavDesc.Buffer.CounterOffsetInBytes =CounterOffset;
+		uavDesc.Buffer.CounterOffsetInBytes = CounterBufferOffset;
 		uavDesc.Buffer.Flags = D3D12_BUFFER_UAV_FLAG_NONE;
 
 		mDevice->CreateUnorderedAccessView(
@@ -210,4 +283,34 @@ void VoxelTile::CreateBuffers()
 			processedCommandsHandle.Offset( DescriptorCountPerFrame, increment );
 		}
 	}
+
+	{
+		// Create the buffers the cull shader counts the commands of each distance
+		// bucket in, followed by a cursor per bucket.
+		CD3DX12_CPU_DESCRIPTOR_HANDLE distanceBucketsHandle(mDescriptorHeap->GetCPUDescriptorHandleForHeapStart(), DistanceBucketsOffset + mDescriptorOffset, increment);
+		for (UINT frame = 0; frame < FrameCount; frame++)
+		{
+			ThrowIfFailed(mDevice->CreateCommittedResource(
+				&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT),
+				D3D12_HEAP_FLAG_NONE,
+				&CD3DX12_RESOURCE_DESC::Buffer(DistanceBucketCount * 2 * sizeof(UINT), D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS),
+				D3D12_RESOURCE_STATE_COPY_DEST,
+				nullptr,
+				IID_PPV_ARGS(&m_distanceBucketBuffers[frame])));
+
+			NAME_D3D12_OBJECT_INDEXED(m_distanceBucketBuffers, frame);
+
+			D3D12_UNORDERED_ACCESS_VIEW_DESC uavDesc = {};
+			uavDesc.Format = DXGI_FORMAT_UNKNOWN;
+			uavDesc.ViewDimension = D3D12_UAV_DIMENSION_BUFFER;
+			uavDesc.Buffer.FirstElement = 0;
+			uavDesc.Buffer.NumElements = DistanceBucketCount * 2;
+			uavDesc.Buffer.StructureByteStride = sizeof(UINT);
+			uavDesc.Buffer.CounterOffsetInBytes = 0;
+			uavDesc.Buffer.Flags = D3D12_BUFFER_UAV_FLAG_NONE;
+
+			mDevice->CreateUnorderedAccessView(m_distanceBucketBuffers[frame].Get(), nullptr, &uavDesc, distanceBucketsHandle);
+			distanceBucketsHandle.Offset(DescriptorCountPerFrame, increment);
+		}
+	}
 }
\ No newline at end of file
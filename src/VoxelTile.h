@@ -30,6 +30,7 @@ public:
 	UINT							  mDescriptorOffset;
 	ComPtr<ID3D12Resource>			  m_processedCommandBuffers[FrameCount];
 	ComPtr<ID3D12Resource>			  m_cullCommandBuffers[FrameCount];
+	ComPtr<ID3D12Resource>			  m_distanceBucketBuffers[FrameCount];
 	bool							  mDirty;
 	UINT							  mBufferIndex;
 private:
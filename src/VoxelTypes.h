@@ -0,0 +1,173 @@
+#pragma once
+
+// The voxel types and volume constants shared by the renderer and the CPU passes.
+// Nothing here depends on Windows or Direct3D, so the CPU passes also build on
+// their own for the headless target (see CMakeLists.txt). Definitions.h adds the
+// renderer's descriptor layouts and root constants on top.
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <cmath>
+#include <cfloat>
+#include <vector>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#include "defines.h"
+
+// The Windows integer names the sources use, as the same types <windows.h>
+// declares them, so that both can be included together.
+typedef unsigned char		UINT8;
+typedef unsigned short		UINT16;
+typedef unsigned int		UINT32;
+typedef unsigned int		UINT;
+typedef unsigned long long	UINT64;
+typedef long long			INT64;
+typedef int					INT;
+typedef unsigned char		BYTE;
+
+#if defined(_WIN32)
+#include <DirectXMath.h>
+#else
+// The DirectXMath storage types the CPU passes use, laid out as DirectXMath lays
+// them out. None of its vector maths is needed outside the renderer.
+namespace DirectX
+{
+	struct XMFLOAT2
+	{
+		float x, y;
+		XMFLOAT2() = default;
+		constexpr XMFLOAT2(float _x, float _y) : x(_x), y(_y) {}
+	};
+
+	struct XMFLOAT3
+	{
+		float x, y, z;
+		XMFLOAT3() = default;
+		constexpr XMFLOAT3(float _x, float _y, float _z) : x(_x), y(_y), z(_z) {}
+	};
+
+	struct XMFLOAT4
+	{
+		float x, y, z, w;
+		XMFLOAT4() = default;
+		constexpr XMFLOAT4(float _x, float _y, float _z, float _w) : x(_x), y(_y), z(_z), w(_w) {}
+	};
+
+	struct XMINT3
+	{
+		int32_t x, y, z;
+		XMINT3() = default;
+		constexpr XMINT3(int32_t _x, int32_t _y, int32_t _z) : x(_x), y(_y), z(_z) {}
+	};
+
+	struct XMUINT3
+	{
+		uint32_t x, y, z;
+		XMUINT3() = default;
+		constexpr XMUINT3(uint32_t _x, uint32_t _y, uint32_t _z) : x(_x), y(_y), z(_z) {}
+	};
+
+	struct XMFLOAT4X4
+	{
+		union
+		{
+			struct
+			{
+				float _11, _12, _13, _14;
+				float _21, _22, _23, _24;
+				float _31, _32, _33, _34;
+				float _41, _42, _43, _44;
+			};
+			float m[4][4];
+		};
+
+		XMFLOAT4X4() = default;
+		XMFLOAT4X4(float m00, float m01, float m02, float m03,
+			float m10, float m11, float m12, float m13,
+			float m20, float m21, float m22, float m23,
+			float m30, float m31, float m32, float m33) :
+			_11(m00), _12(m01), _13(m02), _14(m03),
+			_21(m10), _22(m11), _23(m12), _24(m13),
+			_31(m20), _32(m21), _33(m22), _34(m23),
+			_41(m30), _42(m31), _43(m32), _44(m33)
+		{}
+	};
+}
+#endif
+
+using namespace DirectX;
+
+// Laid out as D3D12_DRAW_ARGUMENTS, which Definitions.h checks.
+struct DrawVoxelArguments
+{
+	UINT VertexCountPerInstance;
+	UINT InstanceCount;
+	UINT StartVertexLocation;
+	UINT StartInstanceLocation;
+};
+
+#pragma pack(push, 4)
+struct DrawVoxelCommand
+{
+	UINT					  Data;
+	DrawVoxelArguments		  DrawArguments;
+};
+#pragma pack(pop)
+
+#pragma pack(push,4)
+struct Voxel
+{
+	UINT mMaterial;
+};
+#pragma pack(pop)
+
+static const UINT FrameCount = 2;
+static const UINT Depth = cDepth;
+static const UINT Height = cHeight;
+static const UINT Width = cWidth;
+static const UINT BrickWidth = cBrickWidth;
+static const UINT BrickHeight = cBrickHeight;
+static const UINT BrickDepth = cBrickDepth;
+static const UINT VoxelsPerBrick = BrickWidth*BrickDepth *BrickHeight;
+static const float VoxelSize = cVoxelHalfWidth * 2.0f;
+static const UINT TileX = 1;
+static const UINT TileY = 1;
+static const UINT TileZ = 1;
+static const UINT TileRingRadius = 1;		// Tiles kept resident on each side of the camera's tile.
+static const UINT TileSlotCount = (2*TileRingRadius+1)*(2*TileRingRadius+1) + (2*TileRingRadius+1);	// The ring, plus a row left behind as the camera crosses a seam.
+static const UINT BrickCount = cDepthInBricks*cHeightInBricks*cWidthInBricks;
+static const UINT VoxelCount = BrickCount * VoxelsPerBrick;
+static const UINT UniformBrickFlag = cUniformBrickFlag;		// Set in a brick table entry that holds its material inline.
+static const UINT BrickResourceCount = BrickCount * FrameCount;
+static const UINT CullGroupWidth = cCullGroupWidth;	// Bricks along each side of the groups cull.hlsl tests as a whole.
+static const UINT BricksPerCullGroup = CullGroupWidth*CullGroupWidth*CullGroupWidth;	// One cull.hlsl thread per brick.
+static const UINT CullGroupCount = cCullGroupsX*cCullGroupsY*cCullGroupsZ;
+static const UINT DistanceBucketCount = cDistanceBuckets;	// View distance bands cull.hlsl orders commands by, nearest first.
+
+// Brick indices are laid out x-fastest, then y, then z; this matches the
+// decode in compute.hlsl, cull.hlsl and shaders.hlsl.
+static inline UINT GetBrickIndex(UINT x, UINT y, UINT z)
+{
+	return z * (cWidthInBricks*cHeightInBricks) + y * cWidthInBricks + x;
+}
+
+static inline XMUINT3 GetBrickCoords(UINT index)
+{
+	const UINT slice = cWidthInBricks*cHeightInBricks;
+	return XMUINT3((index % slice) % cWidthInBricks, (index % slice) / cWidthInBricks, index / slice);
+}
+
+// Index of the lowest set bit of a non-zero mask.
+static inline UINT GetLowestBit(UINT64 mask)
+{
+#if defined(_MSC_VER)
+	unsigned long index;
+	_BitScanForward64(&index, mask);
+	return index;
+#else
+	return static_cast<UINT>(__builtin_ctzll(mask));
+#endif
+}
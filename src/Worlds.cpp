@@ -0,0 +1,84 @@
+#include "stdafx.h"
+#include "Worlds.h"
+
+const char* GetWorldTypeName(WorldType type)
+{
+	switch (type)
+	{
+		case WorldSample:		return "Sample";
+		case WorldHills:		return "Hills";
+		case WorldCaves:		return "Caves";
+		case WorldOverhangs:	return "Overhangs";
+		default:				return "Unknown";
+	}
+}
+
+std::unique_ptr<VoxelGenerator> CreateWorldGenerator(WorldType type, UINT seed)
+{
+	switch (type)
+	{
+		case WorldHills:		return std::unique_ptr<VoxelGenerator>(new HillsGenerator(seed));
+		case WorldCaves:		return std::unique_ptr<VoxelGenerator>(new CaveGenerator(seed));
+		case WorldOverhangs:	return std::unique_ptr<VoxelGenerator>(new DensityGenerator(seed));
+		default:				return std::unique_ptr<VoxelGenerator>(new TerrainGenerator(seed));
+	}
+}
+
+void HillsGenerator::GenerateHeights(UINT z, float* heights) const
+{
+	for (UINT x = 0; x < Width; x++)
+	{
+		heights[x] = mBaseHeight + mAmplitude * mNoise.Fbm(static_cast<float>(mOriginX + static_cast<int>(x)) * mFrequency,
+			static_cast<float>(mOriginZ + static_cast<int>(z)) * mFrequency, mOctaves);
+	}
+}
+
+void CaveGenerator::GenerateBrick(UINT brick, Voxel* out) const
+{
+	HillsGenerator::GenerateBrick(brick, out);
+
+	const XMUINT3 b = GetBrickCoords(brick);
+	for (UINT n = 0; n < VoxelsPerBrick; n++)
+	{
+		if (out[n].mMaterial == 0)
+		{
+			continue;
+		}
+
+		const float x = static_cast<float>(mOriginX + static_cast<int>(b.x * cBrickWidth + n % cBrickWidth));
+		const float y = static_cast<float>(b.y * cBrickHeight + (n / cBrickWidth) % cBrickHeight);
+		const float z = static_cast<float>(mOriginZ + static_cast<int>(b.z * cBrickDepth + n / (cBrickWidth*cBrickHeight)));
+
+		// Keep the bottom layer so the caves have a floor.
+		if (y > 0.0f && fabsf(mCaveNoise.Fbm(x * mCaveFrequency, y * mCaveFrequency, z * mCaveFrequency, 2)) < mCaveWidth)
+		{
+			out[n].mMaterial = 0;
+		}
+	}
+}
+
+void DensityGenerator::GenerateBrick(UINT brick, Voxel* out) const
+{
+	const XMUINT3 b = GetBrickCoords(brick);
+	const float y0 = static_cast<float>(b.y * cBrickHeight);
+	const float y1 = y0 + (cBrickHeight - 1);
+
+	// The noise lies in [-1, 1], so bricks far enough from the base height are
+	// entirely solid or entirely air whatever it returns.
+	if (y0 - mBaseHeight > mAmplitude)
+	{
+		memset(out, 0, VoxelsPerBrick * sizeof(Voxel));
+		return;
+	}
+
+	const bool solid = mBaseHeight - y1 > mAmplitude;
+	for (UINT n = 0; n < VoxelsPerBrick; n++)
+	{
+		const float x = static_cast<float>(mOriginX + static_cast<int>(b.x * cBrickWidth + n % cBrickWidth));
+		const float y = y0 + (n / cBrickWidth) % cBrickHeight;
+		const float z = static_cast<float>(mOriginZ + static_cast<int>(b.z * cBrickDepth + n / (cBrickWidth*cBrickHeight)));
+
+		bool filled = solid || (mBaseHeight - y + mAmplitude * mNoise.Fbm(x * mFrequency, y * mFrequency, z * mFrequency, mOctaves)) > 0.0f;
+		out[n].mMaterial = filled ? StoneMaterial : 0;
+	}
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <memory>
+#include "Terrain.h"
+#include "Noise.h"
+
+// The world types the volume can be initialised from.
+enum WorldType
+{
+	WorldSample,		// The sample's cos/sin rolling terrain.
+	WorldHills,			// Fractal noise heightfield.
+	WorldCaves,			// Hills with tunnels carved by 3D noise.
+	WorldOverhangs,		// 3D noise density, giving arches and overhangs.
+	WorldTypeCount
+};
+
+const char* GetWorldTypeName(WorldType type);
+std::unique_ptr<VoxelGenerator> CreateWorldGenerator(WorldType type, UINT seed);
+
+// Rolling hills from a few octaves of 2D simplex noise, in layers of grass, dirt
+// and stone.
+class HillsGenerator : public HeightfieldGenerator
+{
+public:
+	HillsGenerator(UINT seed) :
+		HeightfieldGenerator(seed),
+		mNoise(seed),
+		mFrequency(1.0f / 96.0f),
+		mOctaves(5),
+		mBaseHeight(Height * 0.45f),
+		mAmplitude(Height * 0.35f)
+	{
+		mLayered = true;
+	}
+
+	void GenerateHeights(UINT z, float* heights) const override;
+
+	SimplexNoise	mNoise;
+	float			mFrequency;		// Of the first octave, in cycles per voxel.
+	UINT			mOctaves;
+	float			mBaseHeight;
+	float			mAmplitude;
+};
+
+// Hills with winding tunnels: voxels below the surface are cleared where a 3D
+// noise field lies close to zero, which traces out connected sheets and tubes.
+class CaveGenerator : public HillsGenerator
+{
+public:
+	CaveGenerator(UINT seed) :
+		HillsGenerator(seed),
+		mCaveNoise(seed ^ 0x5bd1e995),
+		mCaveFrequency(1.0f / 24.0f),
+		mCaveWidth(0.08f)
+	{}
+
+	void GenerateBrick(UINT brick, Voxel* out) const override;
+
+	SimplexNoise	mCaveNoise;
+	float			mCaveFrequency;
+	float			mCaveWidth;		// Noise magnitude below which a voxel is hollowed out.
+};
+
+// Solid stone wherever a 3D noise density, biased to fall off with height, is
+// positive. Unlike a heightfield this can produce overhangs and floating rock.
+class DensityGenerator : public VoxelGenerator
+{
+public:
+	DensityGenerator(UINT seed) :
+		VoxelGenerator(seed),
+		mNoise(seed),
+		mFrequency(1.0f / 48.0f),
+		mOctaves(4),
+		mBaseHeight(Height * 0.4f),
+		mAmplitude(Height * 0.3f)
+	{}
+
+	void GenerateBrick(UINT brick, Voxel* out) const override;
+
+	SimplexNoise	mNoise;
+	float			mFrequency;
+	UINT			mOctaves;
+	float			mBaseHeight;	// Height at which the density bias crosses zero.
+	float			mAmplitude;		// Noise amplitude, in voxels of height.
+};
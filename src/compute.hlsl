@@ -13,11 +13,6 @@
 
 #include "defines.h"
 
-struct SceneConstantBuffer
-{
-	uint color;
-};
-
 struct IndirectCommand
 {
 	uint  index;
@@ -26,60 +21,68 @@ struct IndirectCommand
 
 cbuffer RootConstants : register(b0)
 {
-	float commandCount;	// The number of commands to be processed.
+	float commandCount;		// The number of commands to be processed.
+	uint  brickListCount;	// When non-zero, only the bricks in brickList are processed.
 };
 
-StructuredBuffer<SceneConstantBuffer> cbv				: register(t0);	// SRV: Wrapped constant buffers
+StructuredBuffer<uint> voxelPool						: register(t0);	// SRV: Brick table and payloads; unused, the masks stand in for them
 StructuredBuffer<IndirectCommand> inputCommands			: register(t1);	// SRV: Indirect commands
-AppendStructuredBuffer<IndirectCommand> outputCommands	: register(u0);	// UAV: Processed indirect commands
+StructuredBuffer<uint2> brickMasks						: register(t2);	// SRV: One occupancy bit per voxel for each brick
+StructuredBuffer<uint> brickList						: register(t3);	// SRV: Bricks touched by edits since this buffer was last processed
+StructuredBuffer<uint> brickFaces						: register(t4);	// SRV: Face table; the low bits of each entry count the brick's exposed faces
+RWStructuredBuffer<IndirectCommand> outputCommands		: register(u0);	// UAV: One command per brick, with an instance per exposed face; hidden bricks draw none
 
+uint BrickIndex(uint3 InOffset)
+{
+	return InOffset.z * (cWidthInBricks*cHeightInBricks) + InOffset.y * cWidthInBricks + InOffset.x;
+}
 
 bool IsBrickSolid(uint3  InOffset)
 {
-	uint voxelsPerBrick = cBrickWidth*cBrickHeight*cBrickDepth;
-	uint index = InOffset.z * (cWidthInBricks*cHeightInBricks) + InOffset.y * cWidthInBricks + InOffset.x;
-	index *= voxelsPerBrick;
-	for (uint v = 0; v < voxelsPerBrick; v++ )
-	{
-		if (cbv[index+v].color == 0)
-		{
-			return false;
-		}
-	}
-
-	return true;
+	return all(brickMasks[BrickIndex(InOffset)] == uint2(0xffffffff, 0xffffffff));
 }
 
 bool IsBrickEmpty(uint3  InOffset)
 {
-	uint voxelsPerBrick = cBrickWidth*cBrickHeight*cBrickDepth;
-	uint index = InOffset.z * (cWidthInBricks*cHeightInBricks) + InOffset.y * cWidthInBricks + InOffset.x;
-	index *= voxelsPerBrick;
-	for (uint v = 0; v < voxelsPerBrick; v++)
+	return all(brickMasks[BrickIndex(InOffset)] == uint2(0, 0));
+}
+
+bool IsBrickVisible(uint3 brick)
+{
+	if (IsBrickEmpty(brick))
+	{
+		return false;
+	}
+
+	// Bricks on the edge of the volume are always drawn.
+	if (brick.z == 0 || brick.z == (cDepthInBricks-1) ||
+		brick.y == 0 || brick.y == (cHeightInBricks-1) ||
+		brick.x == 0 || brick.x == (cWidthInBricks-1))
 	{
-		if (cbv[index + v].color != 0)
-		{
-			return false;
-		}
+		return true;
 	}
 
-	return true;
+	return !IsBrickSolid( brick - uint3(0, 0, 1)) ||
+		   !IsBrickSolid( brick + uint3(0, 0, 1)) ||
+		   !IsBrickSolid( brick - uint3(0, 1, 0)) ||
+		   !IsBrickSolid( brick + uint3(0, 1, 0)) ||
+		   !IsBrickSolid( brick - uint3(1, 0, 0)) ||
+		   !IsBrickSolid( brick + uint3(1, 0, 0));
 }
 
 [numthreads(threadBlockSize, 1, 1)]
 void CSMain(uint3 groupId : SV_GroupID, uint groupIndex : SV_GroupIndex)
 {
 	// Each thread of the CS operates on one of the indirect commands.
-	uint index = (groupId.x * threadBlockSize) + groupIndex;
+	uint thread = (groupId.x * threadBlockSize) + groupIndex;
 
 	// Don't attempt to access commands that don't exist if more threads are allocated
 	// than commands
-
-
-	if (index < commandCount)
+	if (thread < commandCount)
 	{
-//		outputCommands.Append(inputCommands[index]);
-	//	return;
+		// Every brick owns a fixed slot in the output so that an edit only needs to
+		// rewrite the slots of the bricks it touched.
+		uint index = brickListCount > 0 ? brickList[thread] : thread;
 
 		uint3 brick;
 
@@ -87,52 +90,9 @@ void CSMain(uint3 groupId : SV_GroupID, uint groupIndex : SV_GroupIndex)
 		brick.y = (index % (cWidthInBricks*cHeightInBricks)) / cWidthInBricks;
 		brick.x = (index % (cWidthInBricks*cHeightInBricks)) % cWidthInBricks;
 
-		if (IsBrickEmpty(brick))
-		{
-			return;
-		} 
-
-		if (brick.z > 0 && brick.z < (cDepthInBricks-1))
-		{
-			if ( !IsBrickSolid( brick - uint3(0, 0,1 )) ||
-				 !IsBrickSolid( brick + uint3(0, 0,1)) )
-			{
-				outputCommands.Append(inputCommands[index]);
-				return;
-			}
-		}
-		else
-		{
-			outputCommands.Append(inputCommands[index]);
-			return;
-		}
-
-		if ( brick.y > 0 && brick.y < (cHeightInBricks-1))
-		{
-			if ( !IsBrickSolid( brick - uint3(0, 1, 0)) ||
-				 !IsBrickSolid( brick + uint3(0, 1, 0)))
-			{
-			  outputCommands.Append(inputCommands[index]);
-			  return;
-			}
-		}
-		else
-		{
-			outputCommands.Append(inputCommands[index]);
-			return;
-		}
-
-		if ( brick.x > 0 && brick.x < (cWidthInBricks-1))
-		{
-			if ( !IsBrickSolid( brick - uint3(1, 0, 0)) ||
-				 !IsBrickSolid( brick + uint3(1, 0, 0)))
-			{
-		     	outputCommands.Append(inputCommands[index]);
-			}
-		}
-		else
-		{
-			outputCommands.Append(inputCommands[index]);
-		}
+		IndirectCommand cmd = inputCommands[index];
+		cmd.drawArguments.y = IsBrickVisible(brick) ? (brickFaces[index] & ((1u << cFaceCountBits) - 1)) : 0;
+
+		outputCommands[index] = cmd;
 	}
 }
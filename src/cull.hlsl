@@ -9,10 +9,24 @@
 //
 //*********************************************************
 
-#define threadBlockSize 128
-
 #include "defines.h"
 
+// Bricks are culled against the frustum alone. The Hi-Z pyramid and occlusion
+// rasterizer in Occlusion.h run on the CPU culling path only; nothing on the GPU
+// builds a depth pyramid, so there is no occlusion stage here.
+
+// One thread group per cull group, one thread per brick.
+#define threadBlockSize (cCullGroupWidth*cCullGroupWidth*cCullGroupWidth)
+
+#define GroupCulled		0	// Every brick is outside the frustum.
+#define GroupPartial	1	// Needs the brick test.
+#define GroupVisible	2	// Every brick is inside and none is past the LOD distance.
+#define GroupVisibleFar	3	// Every brick is inside and past the LOD distance.
+
+static const float wEpsilon = 0.000001f;
+static const float nearClip = 0.9999f;
+static const float groupMargin = 0.0001f;	// Fraction of the clip space magnitudes a group must clear a plane by.
+
 struct IndirectCommand
 {
 	uint  index;
@@ -27,17 +41,157 @@ struct CommandCount
 cbuffer RootConstants : register(b0)
 {
 	float4x4 projection;
+	uint bucketPass;		// 0 counts the commands in each distance bucket, 1 writes them out.
+	float lodDistance;		// w past which bricks draw their level 1 cells, and their level 2 voxel past twice that.
 };
 
 StructuredBuffer<IndirectCommand> inputCommands			: register(t0);	// SRV: Indirect commands
 StructuredBuffer<CommandCount> commandCounts			: register(t1);
-AppendStructuredBuffer<IndirectCommand> outputCommands	: register(u0);	// UAV: Processed indirect commands
+StructuredBuffer<uint> brickLods						: register(t2);	// SRV: LOD records, cLodRecordWords per brick (see VoxelMips.h)
+RWStructuredBuffer<IndirectCommand> outputCommands		: register(u0);	// UAV: Processed indirect commands, nearest bucket first; the counter holds their number
+RWStructuredBuffer<uint> distanceBuckets				: register(u1);	// UAV: Commands per bucket, then the commands written to each bucket so far
+
+groupshared uint groupVisibility;
+
+// The view distance band of a brick centre at clip space w. FrustumCuller::GetDistanceBucket()
+// is the CPU reference.
+uint DistanceBucket(float w)
+{
+	return w <= 0.0 ? 0 : min(uint(w / cDistanceBucketDepth), cDistanceBuckets - 1);
+}
+
+float3 BrickDims()
+{
+	return float3(cBrickWidth*cVoxelHalfWidth*2.0, 
+		          cBrickHeight*cVoxelHalfWidth*2.0, 
+		          cBrickDepth*cVoxelHalfWidth*2.0f );
+}
+
+float BrickRadius()
+{
+	float3 bounds = BrickDims() * 2.4f / 2.0f;
+	return sqrt(dot(bounds.xyz, bounds.xyz));
+}
+
+// Range of dot(plane, float4(c, 1)) over the box of centres c in [lo, hi].
+float2 PlaneRange(float4 plane, float3 lo, float3 hi)
+{
+	float3 a = plane.xyz * lo;
+	float3 b = plane.xyz * hi;
+	float3 l = min(a, b);
+	float3 h = max(a, b);
+	return float2(l.x + l.y + l.z + plane.w, h.x + h.y + h.z + plane.w);
+}
+
+// The brick test below, multiplied through by w and evaluated at the extremes of
+// the box spanned by the group's brick centres. Groups within a small margin of
+// a plane are left to the brick test, so both accept the same bricks.
+// FrustumCuller::ClassifyGroup() is the CPU reference.
+uint ClassifyGroup(uint3 group)
+{
+	float3 brickdims = BrickDims();
+	float3 lo = float3(group * cCullGroupWidth) * brickdims + brickdims / 2.0;
+	float3 hi = lo + (cCullGroupWidth - 1) * brickdims;
+	float r = BrickRadius();
+
+	// mul(c, projection) takes clip space from the columns.
+	float4 cx = projection._m00_m10_m20_m30;
+	float4 cy = projection._m01_m11_m21_m31;
+	float4 cz = projection._m02_m12_m22_m32;
+	float4 cw = projection._m03_m13_m23_m33;
+
+	float2 rx = PlaneRange(cx, lo, hi);
+	float2 ry = PlaneRange(cy, lo, hi);
+	float2 rz = PlaneRange(cz, lo, hi);
+	float2 rw = PlaneRange(cw, lo, hi);
+	float scale = max(r, max(max(max(abs(rx.x), abs(rx.y)), max(abs(ry.x), abs(ry.y))),
+		                     max(max(abs(rz.x), abs(rz.y)), max(abs(rw.x), abs(rw.y)))));
+	float margin = groupMargin * scale;
+
+	// Multiplying through by w flips the test where w is negative, so the group
+	// must lie wholly on one side of w = 0.
+	float4 w = cw + float4(0, 0, 0, wEpsilon);
+	float2 wr = PlaneRange(w, lo, hi);
+	float s;
+	if (wr.x > margin)
+	{
+		s = 1.0;
+	}
+	else if (wr.y < -margin)
+	{
+		s = -1.0;
+	}
+	else
+	{
+		return GroupPartial;
+	}
+
+	// A brick is rejected when s * dot(plane, float4(c, 1)) > 0 for any of these.
+	float4 planes[6] =
+	{
+		cx - w - float4(0, 0, 0, r),
+		-cx - w - float4(0, 0, 0, r),
+		cy - w - float4(0, 0, 0, r),
+		-cy - w - float4(0, 0, 0, r),
+		-cz - float4(0, 0, 0, r),
+		cz - nearClip * w
+	};
+
+	bool partial = false;
+	[unroll]
+	for (uint n = 0; n < 6; n++)
+	{
+		float2 range = PlaneRange(planes[n], lo, hi);
+		if (s < 0.0)
+		{
+			range = -range.yx;
+		}
+
+		if (range.x > margin)
+		{
+			return GroupCulled;
+		}
+		partial = partial || range.y >= -margin;
+	}
+
+	if (partial)
+	{
+		return GroupPartial;
+	}
+
+	// Bricks past the LOD distance have w > lodDistance, which never holds behind the camera.
+	float2 farRange = PlaneRange(cw - float4(0, 0, 0, lodDistance), lo, hi);
+	if (farRange.x > margin)
+	{
+		return GroupVisibleFar;
+	}
+	return farRange.y < -margin ? GroupVisible : GroupPartial;
+}
 
 [numthreads(threadBlockSize, 1, 1)]
 void CSMain(uint3 groupId : SV_GroupID, uint groupIndex : SV_GroupIndex)
 {
-	// Each thread of the CS operates on one of the indirect commands.
-	uint index = (groupId.x * threadBlockSize) + groupIndex;
+	// Each thread of the CS operates on one brick of its group.
+	uint3 group = uint3(groupId.x % cCullGroupsX, (groupId.x / cCullGroupsX) % cCullGroupsY, groupId.x / (cCullGroupsX*cCullGroupsY));
+	uint3 local = uint3(groupIndex % cCullGroupWidth, (groupIndex / cCullGroupWidth) % cCullGroupWidth, groupIndex / (cCullGroupWidth*cCullGroupWidth));
+	uint3 brickCoords = group * cCullGroupWidth + local;
+	uint index = (brickCoords.z * cHeightInBricks + brickCoords.y) * cWidthInBricks + brickCoords.x;
+
+	// The first thread settles the whole group where it can.
+	if (groupIndex == 0)
+	{
+		groupVisibility = ClassifyGroup(group);
+	}
+	GroupMemoryBarrierWithGroupSync();
+
+	uint visibility = groupVisibility;
+
+	// The enclosure pass leaves a slot for every brick and zeroes the instance
+	// count of the ones that are empty or enclosed.
+	if (visibility == GroupCulled || inputCommands[index].drawArguments.y == 0)
+	{
+		return;
+	}
 
 	uint4 cmdidx =  inputCommands[index].index;
 
@@ -47,36 +201,72 @@ void CSMain(uint3 groupId : SV_GroupID, uint groupIndex : SV_GroupIndex)
 	brick.y = (cmdidx % (cWidthInBricks*cHeightInBricks)) / cWidthInBricks;
 	brick.x = (cmdidx % (cWidthInBricks*cHeightInBricks)) % cWidthInBricks;
 	brick.w = 1.0f;
-	
-	float3 brickdims = float3(cBrickWidth*cVoxelHalfWidth*2.0, 
-		                      cBrickHeight*cVoxelHalfWidth*2.0, 
-		                      cBrickDepth*cVoxelHalfWidth*2.0f );
+
+	float3 brickdims = BrickDims();
 
 	brick.xyz *= brickdims;
 	brick.xyz += brickdims / 2.0;
- 
+
 	float4 p = mul(brick, projection);
-	float3 clp = p.xyz / (p.w + 0.000001f);
-	float3 bounds = brickdims * 2.4f / 2.0f;
-	float r = sqrt(dot(bounds.xyz, bounds.xyz));
 
-    r /= (p.w + 0.000001f);
+	bool isFar = visibility == GroupVisibleFar;
+	if (visibility == GroupPartial)
+	{
+		float3 clp = p.xyz / (p.w + wEpsilon);
+		float r = BrickRadius();
+
+		r /= (p.w + wEpsilon);
+
+		if (clp.x > (1.0+r) || clp.x < (-1.0-r) || clp.y > (1.0+r) || clp.y < (-1.0f-r) || clp.z < -r || clp.z > nearClip )
+		{
+			return;
+		}
 
-	if (clp.x > (1.0+r) || clp.x < (-1.0-r) || clp.y > (1.0+r) || clp.y < (-1.0f-r) || clp.z < -r || clp.z > 0.9999f )
+		isFar = p.w > lodDistance;
+	}
+
+	// Distant bricks draw the exposed faces of their level 1 cells, or past twice
+	// the LOD distance those of their level 2 voxel, and are dropped when that
+	// leaves nothing to draw. FrustumCuller::Emit() is the CPU reference.
+	uint lodFlags = 0;
+	uint lodInstances = 0;
+	if (isFar)
 	{
+		uint lodWord = brickLods[index * cLodRecordWords + 4];
+		lodFlags = p.w > 2.0 * lodDistance ? cFarBrickFlag | cCoarseBrickFlag : cFarBrickFlag;
+		lodInstances = (lodFlags & cCoarseBrickFlag) ? countbits((lodWord >> 16) & 63) : lodWord >> 24;
+		if (lodInstances == 0)
+		{
+			return;
+		}
+	}
+
+	// The first pass only sizes the buckets. The second places each command after
+	// every command of the nearer buckets, so near bricks are drawn first and fill
+	// the depth buffer before the bricks they hide.
+	uint bucket = DistanceBucket(p.w);
+	if (bucketPass == 0)
+	{
+		InterlockedAdd(distanceBuckets[bucket], 1);
 		return;
 	}
 
 	IndirectCommand cmd = inputCommands[index];
 
-	if (clp.z > 0.999 )
+	if (isFar)
 	{
-		cmd.drawArguments.y = 6;
-		cmd.index |= 0x80000000;
+		cmd.drawArguments.y = lodInstances;
+		cmd.index |= lodFlags;
 	}
 
-	if (index < commandCounts[0].count )
+	uint slot = 0;
+	for (uint n = 0; n < bucket; n++)
 	{
-		outputCommands.Append(cmd);
-	}	
+		slot += distanceBuckets[n];
+	}
+
+	uint rank;
+	InterlockedAdd(distanceBuckets[cDistanceBuckets + bucket], 1, rank);
+	outputCommands[slot + rank] = cmd;
+	outputCommands.IncrementCounter();
 }
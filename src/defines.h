@@ -10,5 +10,21 @@
 #define cWidthInBricks (cWidth/cBrickWidth)
 #define cHeightInBricks (cHeight/cBrickHeight)
 #define cDepthInBricks (cDepth/cBrickDepth)
+#define cBrickCount (cWidthInBricks*cHeightInBricks*cDepthInBricks)
 
-#define cVoxelHalfWidth 0.05f
\ No newline at end of file
+#define cCullGroupWidth 4
+#define cCullGroupsX (cWidthInBricks/cCullGroupWidth)
+#define cCullGroupsY (cHeightInBricks/cCullGroupWidth)
+#define cCullGroupsZ (cDepthInBricks/cCullGroupWidth)
+
+#define cDistanceBuckets 16
+#define cDistanceBucketDepth (cDepth*cVoxelHalfWidth*2.0f/cDistanceBuckets)
+
+#define cVoxelHalfWidth 0.05f
+#define cUniformBrickFlag 0x80000000
+#define cBrickOffsetMask 0x0fffffff
+#define cBrickFormatShift 28
+#define cFaceCountBits 9
+#define cFarBrickFlag 0x80000000
+#define cCoarseBrickFlag 0x40000000
+#define cLodRecordWords 10
@@ -11,11 +11,6 @@
 
 #include "defines.h"
 
-struct SceneConstantBuffer
-{
-	uint color;
-};
-
 cbuffer ViewConstantBuffer : register(b1)
 {
 	float4x4 projection;
@@ -27,40 +22,122 @@ Texture2D g_texture : register(t0);
 SamplerState g_sampler : register(s0);
 
 
-StructuredBuffer<SceneConstantBuffer> cbv				: register(t0);	// SRV: Wrapped constant buffers
+StructuredBuffer<uint> voxelPool				: register(t0);	// SRV: Brick table followed by mixed brick payloads
+StructuredBuffer<uint> brickFaces				: register(t1);	// SRV: Face table followed by the packed face lists
+StructuredBuffer<uint> brickLods				: register(t2);	// SRV: LOD records, cLodRecordWords per brick (see VoxelMips.h)
+
+// Material of a voxel, read through the brick table. Uniform bricks hold their
+// material in the table entry; others point at a block, either raw materials or
+// a palette followed by packed 1, 2, 4 or 8 bit indices (see BrickPool.h).
+uint LoadVoxel(uint brick, uint voxel)
+{
+	uint entry = voxelPool[brick];
+	if (entry & cUniformBrickFlag)
+	{
+		return entry & ~cUniformBrickFlag;
+	}
+
+	uint block = cBrickCount + (entry & cBrickOffsetMask);
+	uint format = entry >> cBrickFormatShift;
+	if (format == 0)
+	{
+		return voxelPool[block + voxel];
+	}
+
+	uint bits = 1u << (format - 1);
+	uint paletteCapacity = bits == 8 ? 32 : (1u << bits);
+	uint bit = voxel * bits;
+	uint index = (voxelPool[block + paletteCapacity + (bit >> 5)] >> (bit & 31)) & ((1u << bits) - 1);
+	return voxelPool[block + index];
+}
+
+// The instance'th exposed face of a brick, read through the face table: the voxel
+// in the low 6 bits and the face above (see BrickFaces.h).
+uint LoadFace(uint brick, uint instance)
+{
+	uint face = (brickFaces[brick] >> cFaceCountBits) + instance;
+	return (brickFaces[cBrickCount + (face >> 1)] >> ((face & 1) * 16)) & 0xffff;
+}
 
 struct PSInput
 {
 	float4 position : SV_POSITION;
 	float4 color : COLOR;
-	float2 uv : TEXCOORD0;
+	float2 uv : TEXCOORD0;		// Within the face, in voxels; repeats the texture across merged quads.
+	float2 tile : TEXCOORD1;	// Corner of the material's texture in the atlas.
 };
 
 PSInput VSMain(uint pid : SV_InstanceID, uint vid : SV_VertexID )
 {
 	PSInput result;
 
-	uint index = indexAndFlag & 0x7fffffff;
-	uint flag =  indexAndFlag & 0x80000000;
+	uint index = indexAndFlag & ~(cFarBrickFlag | cCoarseBrickFlag);
 
 	float scale = cVoxelHalfWidth;
 
-	uint voxid = pid / 6;
-	uint voxmatidx = index*cBrickWidth*cBrickHeight*cBrickDepth + voxid;
+	// Axes a quad's width and height run along, by face.
+	float3 widthAxis[6] = { { 1,0,0 },{ 1,0,0 },{ 1,0,0 },{ 1,0,0 },{ 0,1,0 },{ 0,1,0 } };
+	float3 heightAxis[6] = { { 0,1,0 },{ 0,1,0 },{ 0,0,1 },{ 0,0,1 },{ 0,0,1 },{ 0,0,1 } };
+
+	// Bricks past the LOD distance draw from their LOD record, one instance per
+	// exposed face of a level 1 cell, 2x2x2 voxels, or of the level 2 voxel that
+	// fills the brick. Others draw one per entry of the brick's list, either an
+	// exposed voxel face or a quad merged from several (see GreedyMesher.h).
+	// voxid is the first voxel of the face, and extent the size of the box it
+	// bounds in voxels.
+	uint voxid;
+	uint id;
+	uint material;
+	float3 extent;
+	if (indexAndFlag & cCoarseBrickFlag)
+	{
+		uint lodWord = brickLods[index * cLodRecordWords + 4];
+		uint faces = (lodWord >> 16) & 63;
+		for (uint n = 0; n < pid; n++)
+		{
+			faces &= faces - 1;
+		}
+
+		voxid = 0;
+		id = firstbitlow(faces);
+		material = lodWord & 0xffff;
+		extent = float3(cBrickWidth, cBrickHeight, cBrickDepth);
+	}
+	else if (indexAndFlag & cFarBrickFlag)
+	{
+		uint record = index * cLodRecordWords;
+		uint face = (brickLods[record + 5 + pid / 5] >> ((pid % 5) * 6)) & 63;
+		uint cell = face & 7;
+
+		voxid = (cell >> 2) * 2 * (cBrickWidth*cBrickHeight) + ((cell >> 1) & 1) * 2 * cBrickWidth + (cell & 1) * 2;
+		id = face >> 3;
+		material = (brickLods[record + cell / 2] >> ((cell & 1) * 16)) & 0xffff;
+		extent = float3(2, 2, 2);
+	}
+	else
+	{
+		uint face = LoadFace(index, pid);
+		uint2 size = uint2(((face >> 9) & 3) + 1, ((face >> 11) & 3) + 1);
+
+		voxid = face & 63;
+		id = (face >> 6) & 7;
+		material = LoadVoxel(index, voxid);
+		extent = 1.0 + widthAxis[id] * (size.x - 1) + heightAxis[id] * (size.y - 1);
+	}
 
-	if (cbv[voxmatidx].color == 0)
+	if (material == 0)
 	{
 		result.position = float4(0, 0, 0, 0);
 		return result;
 	}
 
-	float2 uvs[4] = { { 0,0 },{ 0.98,0 },{ 0,0.98 },{ 0.98,0.98 } };
+	float2 uvs[4] = { { 0,0 },{ 1,0 },{ 0,1 },{ 1,1 } };
 
-	uint texid = (cbv[voxmatidx].color % 256);
+	uint texid = (material % 256);
 
 	float2 tex = float2(texid % 16, float(uint(texid / 16))) / 16.0f;
 
-	result.uv.xy = uvs[vid] / 16.0f + tex;
+	result.tile = tex;
 
 	float3 norms[6] = {
 		{ 0,0,-1},
@@ -105,6 +182,11 @@ PSInput VSMain(uint pid : SV_InstanceID, uint vid : SV_VertexID )
 
 };
 
+	// The axes the quad's texture coordinates run along.
+	float3 uAxis = abs(verts[id * 4 + 1].xyz - verts[id * 4].xyz) / (scale*2.0);
+	float3 vAxis = abs(verts[id * 4 + 2].xyz - verts[id * 4].xyz) / (scale*2.0);
+	result.uv = uvs[vid] * float2(dot(uAxis, extent), dot(vAxis, extent));
+
 	float4 brick; 
 
 	brick.z = uint( index /  (cWidthInBricks*cHeightInBricks) );
@@ -115,8 +197,6 @@ PSInput VSMain(uint pid : SV_InstanceID, uint vid : SV_VertexID )
 	brick *= uint4(cBrickWidth, cBrickHeight, cBrickDepth, 0.0);
 	brick *= (scale*2.0f);
 
-	uint id = pid % 6;
-
 	float4 voxel;
 
 	voxel.z = voxid / (cBrickWidth*cBrickHeight);
@@ -130,18 +210,10 @@ PSInput VSMain(uint pid : SV_InstanceID, uint vid : SV_VertexID )
 
 	voxel.xyz += float3(scale, scale, scale);
 
-	float4 vertex;
-
-	if (flag)
-	{
-		vertex = verts[vid + id * 4] * float4(cBrickWidth, cBrickHeight, cBrickDepth, 1) +
-			float4(cBrickWidth, cBrickHeight, cBrickDepth, 0)  * scale
-									   + brick + tileoffset;
-	}
-	else
-	{
-		vertex = verts[vid + id * 4] + brick + voxel + tileoffset;
-	}
+	// Corners on the positive side of the first voxel move out to the end of the
+	// quad, or the far side of the cell.
+	float4 vertex = verts[vid + id * 4] + brick + voxel + tileoffset;
+	vertex.xyz += step(0, verts[vid + id * 4].xyz) * (extent - 1.0) * (scale*2.0);
 
 	result.position = mul( vertex, projection);
 
@@ -155,11 +227,11 @@ PSInput VSMain(uint pid : SV_InstanceID, uint vid : SV_VertexID )
 
 	/*if (id == 2 || id == 3)
 	{
-		texid = (cbv[voxmatidx].color / 256) % 256;
+		texid = (material / 256) % 256;
 	}
 	else
 	{
-		texid = (cbv[voxmatidx].color % 256 );
+		texid = (material % 256 );
 	}
 
 	float2 tex = float2(texid % 16, float(uint( texid / 16)) ) / 16.0f;
@@ -172,5 +244,6 @@ PSInput VSMain(uint pid : SV_InstanceID, uint vid : SV_VertexID )
 
 float4 PSMain(PSInput input) : SV_TARGET
 {
-	return g_texture.Sample( g_sampler, input.uv.xy ) *  input.color;
+	// Inset slightly so point sampling stays inside the material's tile.
+	return g_texture.Sample( g_sampler, input.tile + frac(input.uv) * (0.98 / 16.0f) ) *  input.color;
 }
@@ -15,6 +15,14 @@
 
 #pragma once
 
+#if defined(VOXEL_HEADLESS)
+
+// The CPU passes built on their own, without Windows or Direct3D (see
+// CMakeLists.txt).
+#include "VoxelTypes.h"
+
+#else
+
 #ifndef WIN32_LEAN_AND_MEAN
 #define WIN32_LEAN_AND_MEAN             // Exclude rarely-used stuff from Windows headers.
 #endif
@@ -31,3 +39,5 @@
 #include <wrl.h>
 #include <vector>
 #include <shellapi.h>
+
+#endif